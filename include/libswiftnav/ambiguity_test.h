@@ -13,9 +13,12 @@
 #ifndef LIBSWIFTNAV_AMBIGUITY_TEST_H
 #define LIBSWIFTNAV_AMBIGUITY_TEST_H
 
+#include "hypothesis_store.h"
 #include "memory_pool.h"
 #include "sats_management.h"
 
+/** Number of hypotheses an ambiguity test can carry by default, without
+ * allocating memory. See ambiguity_test_set_max_hypotheses(). */
 #define MAX_HYPOTHESES 1000
 
 typedef struct {
@@ -28,8 +31,29 @@ typedef struct {
   u8 null_space_dim;
   double null_projector[(MAX_CHANNELS-4) * (MAX_CHANNELS-1)];
   double half_res_cov_inv[(2*MAX_CHANNELS - 5) * (2*MAX_CHANNELS - 5)];
+  /* half_res_cov_inv projected onto the ambiguities, M^T half_res_cov_inv M
+   * where r_mean = M N. num_dds x num_dds. */
+  double amb_quad[(MAX_CHANNELS-1) * (MAX_CHANNELS-1)];
+  /* Inputs the matrices were built from by init_residual_matrices_dd(), used
+   * by update_residual_matrices() to skip rebuilding them. dd_num_dds is 0 if
+   * they weren't built that way. */
+  u8 dd_num_dds;
+  double dd_phase_var;
+  double dd_code_var;
+  double dd_DE_mtx[(MAX_CHANNELS-1) * 3];
 } residual_mtxs_t;
 
+/* Quadratic term of the hypothesis log likelihood for one epoch, expanded
+ * about a reference hypothesis N0 so that with d = N - N0 it is
+ * q = c + g^T d - d^T H d. See expand_quadratic_term(). */
+typedef struct {
+  u8 num_dds;
+  s32 N0[MAX_CHANNELS-1];
+  float c;
+  float g[MAX_CHANNELS-1];
+  float H[(MAX_CHANNELS-1) * (MAX_CHANNELS-1)];
+} quadratic_expansion_t;
+
 typedef struct {
   u8 initialized;
   u8 num_matching_ndxs;
@@ -39,6 +63,9 @@ typedef struct {
 
 typedef struct {
   u8 num_dds;
+  /* The hypotheses being tested. */
+  hypothesis_store_t hyps;
+  /* Working area for the satellite projection and inclusion steps. */
   memory_pool_t *pool;
   residual_mtxs_t res_mtxs;
   sats_management_t sats;
@@ -50,7 +77,7 @@ typedef s32 z_t;
 /* See doc string above inclusion_loop_body in ambiguity_test.c for info on
  * matrices and lower/upper bounds fields: */
 typedef struct {
-  u16 intersection_size;
+  u32 intersection_size;
   z_t *Z;
   z_t *Z1;
   z_t *Z1_inv;
@@ -79,9 +106,15 @@ void create_empty_ambiguity_test(ambiguity_test_t *amb_test);
 void create_ambiguity_test(ambiguity_test_t *amb_test);
 void reset_ambiguity_test(ambiguity_test_t *amb_test);
 void destroy_ambiguity_test(ambiguity_test_t *amb_test);
+s8 ambiguity_test_set_max_hypotheses(ambiguity_test_t *amb_test, u32 max_hyps);
+size_t ambiguity_test_memory_required(u32 max_hyps);
+s8 ambiguity_test_set_memory_budget(ambiguity_test_t *amb_test, size_t bytes);
+void ambiguity_test_set_time_budget(double seconds);
+u32 ambiguity_test_max_hypotheses(void);
 s8 sats_match(const ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff_t *sdiffs);
 u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, const sdiff_t *sdiffs, sdiff_t *sdiffs_with_ref_first);
-void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var,
+void update_ambiguity_test(double ref_ecef[3], const double b[3],
+                           double phase_var, double code_var,
                            ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
                            u8 changed_sats);
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test);
@@ -120,6 +153,8 @@ u32 float_to_decor(const double *addible_float_cov,
                    u8 num_dds_to_add,
                    s32 *lower_bounds, s32 *upper_bounds,
                    z_t *Z, z_t *Z_inv);
+u8 count_intersection(intersection_count_t *x, const hypothesis_store_t *hyps,
+                      u32 max_count, u32 max_iterations);
 // TODO(dsk) delete
 s8 determine_sats_addition(ambiguity_test_t *amb_test,
                            double *float_N_cov, u8 num_float_dds, double *float_N_mean,
@@ -132,9 +167,21 @@ void add_sats_old(ambiguity_test_t *amb_test,
                   s32 *lower_bounds, s32 *upper_bounds,
                   s32 *Z_inv);
 void init_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds, double *DE_mtx, double *obs_cov);
+void init_residual_matrices_dd(residual_mtxs_t *res_mtxs, u8 num_dds,
+                               double *DE_mtx, double phase_var, double code_var);
+u8 update_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds,
+                            double *DE_mtx, const double b[3],
+                            double phase_var, double code_var, u8 force);
 void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q, double *r_cov_inv);
+void assign_dd_residual_covariance_inverse(u8 num_dds, double phase_var,
+                                           double code_var, double *q,
+                                           double *r_cov_inv);
 void assign_r_vec(residual_mtxs_t *res_mtxs, u8 num_dds, double *dd_measurements, double *r_vec);
 void assign_r_mean(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_mean);
 double get_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothesis, double *r_vec);
+void expand_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, const s32 *N0,
+                           double *r_vec, quadratic_expansion_t *qe);
+void get_quadratic_terms(const quadratic_expansion_t *qe, u32 n,
+                         const s32 *N, u32 stride, float *q);
 
 #endif /* LIBSWIFTNAV_AMBIGUITY_TEST_H */
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_BASELINE_QR_H
+#define LIBSWIFTNAV_BASELINE_QR_H
+
+#include "common.h"
+#include "constants.h"
+#include "single_diff.h"
+
+/** Largest change in a stored geometry row before it is replaced in the R
+ * factor. Smaller changes are absorbed by iterative refinement. */
+#define BASELINE_QR_REFRESH_TOL 1e-3
+
+/** Maximum number of iterative refinement steps per solve. */
+#define BASELINE_QR_MAX_REFINE 5
+
+/** Incremental square root information baseline solver.
+ * Holds the upper triangular factor \f$ R \f$ of the double difference
+ * geometry matrix, \f$ R^T R = DE^T DE \f$, between epochs. When a satellite
+ * is added or dropped only its row is folded into or out of \f$ R \f$.
+ * A zero initialised struct is ready to use. */
+typedef struct {
+  u8 initialized;                 /**< Non-zero once R has been formed. */
+  u8 ref_prn;                     /**< PRN of the reference satellite. */
+  u8 num_dds;                     /**< Number of rows folded into R. */
+  u8 prns[MAX_CHANNELS-1];        /**< PRN of the satellite of each row. */
+  double rows[MAX_CHANNELS-1][3]; /**< Geometry rows folded into R. */
+  double R[3][3];                 /**< Upper triangular factor. */
+  u32 n_factorizations;           /**< Number of times R was rebuilt. */
+} baseline_qr_t;
+
+void baseline_qr_init(baseline_qr_t *qr);
+s8 baseline_qr_solve_de(baseline_qr_t *qr, u8 num_dds, u8 ref_prn,
+                        const u8 *prns, const double *DE, const double *y,
+                        double b[3]);
+s8 baseline_qr_solve(baseline_qr_t *qr, u8 num_sats,
+                     const sdiff_t *sdiffs_with_ref_first,
+                     const double ref_ecef[3], const double *y, double b[3]);
+
+#endif /* LIBSWIFTNAV_BASELINE_QR_H */
@@ -0,0 +1,19 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_BLAS_CHECK_H
+#define LIBSWIFTNAV_BLAS_CHECK_H
+
+#include "common.h"
+
+s8 blas_self_check(void);
+
+#endif /* LIBSWIFTNAV_BLAS_CHECK_H */
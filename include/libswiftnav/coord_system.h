@@ -13,6 +13,8 @@
 #ifndef LIBSWIFTNAV_COORD_SYSTEM_H
 #define LIBSWIFTNAV_COORD_SYSTEM_H
 
+#include "common.h"
+
 /** \addtogroup coord_system
  * \{ */
 
@@ -38,6 +40,20 @@
 
 /* \} */
 
+/** A local tangent plane (North, East, Down) frame about a reference point.
+ * Holds the quantities that the wgsecef2ned() family of functions would
+ * otherwise recompute from the reference point on every call, for use when
+ * many vectors are transformed relative to the same point. Initialise with
+ * ltp_frame_init(). */
+typedef struct {
+  /** Reference point in ECEF [m]. */
+  double ref_ecef[3];
+  /** Reference point as [lat, lon, height] in [radians, radians, meters]. */
+  double ref_llh[3];
+  /** Rotation from ECEF to NED. */
+  double M[3][3];
+} ltp_frame_t;
+
 void llhrad2deg(const double llh_rad[3], double llh_deg[3]);
 
 void llhdeg2rad(const double llh_deg[3], double llh_rad[3]);
@@ -59,5 +75,42 @@ void wgsned2ecef_d(const double ned[3], const double ref_ecef[3],
 void wgsecef2azel(const double ecef[3], const double ref_ecef[3],
                   double* azimuth, double* elevation);
 
+void wgsecef2llh_vermeille(const double ecef[3], double llh[3]);
+
+void wgsllh2ecef_array(u32 n, const double llh[n][3], double ecef[n][3]);
+void wgsecef2llh_array(u32 n, const double ecef[n][3], double llh[n][3]);
+void wgsllh2ecef_soa(u32 n, const double *restrict lat,
+                     const double *restrict lon, const double *restrict hgt,
+                     double *restrict x, double *restrict y,
+                     double *restrict z);
+void wgsecef2llh_soa(u32 n, const double *restrict x,
+                     const double *restrict y, const double *restrict z,
+                     double *restrict lat, double *restrict lon,
+                     double *restrict hgt);
+void wgsecef2ned_d_array(u32 n, const double ecef[n][3],
+                         const double ref_ecef[3], double ned[n][3]);
+void wgsecef2azel_array(u32 n, const double ecef[n][3],
+                        const double ref_ecef[3],
+                        double azimuth[n], double elevation[n]);
+
+void ltp_frame_init(ltp_frame_t *frame, const double ref_ecef[3]);
+void ltp_ecef2ned(const ltp_frame_t *frame, const double ecef[3],
+                  double ned[3]);
+void ltp_ecef2ned_d(const ltp_frame_t *frame, const double ecef[3],
+                    double ned[3]);
+void ltp_ned2ecef(const ltp_frame_t *frame, const double ned[3],
+                  double ecef[3]);
+void ltp_ned2ecef_d(const ltp_frame_t *frame, const double ned[3],
+                    double ecef[3]);
+void ltp_ecef2azel(const ltp_frame_t *frame, const double ecef[3],
+                   double *azimuth, double *elevation);
+void ltp_ecef2ned_d_array(const ltp_frame_t *frame, u32 n,
+                          const double ecef[n][3], double ned[n][3]);
+void ltp_ned2ecef_d_array(const ltp_frame_t *frame, u32 n,
+                          const double ned[n][3], double ecef[n][3]);
+void ltp_ecef2azel_array(const ltp_frame_t *frame, u32 n,
+                         const double ecef[n][3],
+                         double azimuth[n], double elevation[n]);
+
 #endif /* LIBSWIFTNAV_COORD_SYSTEM_H */
 
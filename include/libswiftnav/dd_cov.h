@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_DD_COV_H
+#define LIBSWIFTNAV_DD_COV_H
+
+#include "common.h"
+
+void dd_cov_assign(u8 n, double var, double *C);
+void dd_cov_multiply(u8 n, double var, u32 cols, const double *B, double *C);
+void dd_cov_inverse(u8 n, double var, double *C_inv);
+void dd_cov_solve(u8 n, double var, const double *b, double *x);
+void dd_cov_cholesky(u8 n, double var, double *L);
+void dd_cov_udu(u8 n, double var, double *U, double *D);
+void dd_cov_udu_inverse(u8 n, double var, double *U_inv, double *D);
+void dd_cov_rank_one_udu_inverse(u8 n, double var, const double *u,
+                                 double *U_inv, double *D);
+double dd_cov_log_det(u8 n, double var);
+
+#endif /* LIBSWIFTNAV_DD_COV_H */
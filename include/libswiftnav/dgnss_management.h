@@ -45,6 +45,7 @@ void dgnss_set_settings(double phase_var_test, double code_var_test,
                         double phase_var_kf, double code_var_kf,
                         double amb_drift_var, double amb_init_var,
                         double new_int_var);
+s8 dgnss_set_iar_budget(u32 max_hyps, double time_budget);
 void make_measurements(u8 num_diffs, const sdiff_t *sdiffs, double *raw_measurements);
 void dgnss_init(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3]);
 void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3]);
@@ -23,10 +23,15 @@
 #define GPS_WEEK_CYCLE 1
 
 /** Offset between GPS and UTC times in seconds.
- * Update when a new leap second is inserted and be careful about times in the
- * past when this offset was different. */
+ * \deprecated Only correct between July 2012 and July 2015, use
+ * gps_utc_offset() which looks the offset up in a leap second table. */
 #define GPS_MINUS_UTC_SECS 16
 
+/** Nanoseconds in one second. */
+#define GPS_NS_PER_S 1000000000LL
+/** Nanoseconds in one GPS week. */
+#define GPS_NS_PER_WEEK (7LL*24*3600*GPS_NS_PER_S)
+
 /** Unix timestamp of the GPS epoch 1980-01-06 00:00:00 UTC */
 #define GPS_EPOCH 315964800
 
@@ -36,12 +41,35 @@ typedef struct __attribute__((packed)) {
   u16 wn;     /**< GPS week number. */
 } gps_time_t;
 
+/** GPS time with integer nanosecond resolution.
+ * Counts nanoseconds since the GPS epoch so that arithmetic, comparisons and
+ * differences are exact and take constant time. A signed 64 bit count covers
+ * almost 300 years either side of the epoch. */
+typedef struct {
+  s64 ns; /**< Nanoseconds since the GPS epoch. */
+} gps_time_ns_t;
+
 gps_time_t normalize_gps_time(gps_time_t);
 
 time_t gps2time(gps_time_t t);
 
 double gpsdifftime(gps_time_t end, gps_time_t beginning);
 
+double gps_day_of_year(gps_time_t t);
+
+gps_time_ns_t gps_time_to_ns(gps_time_t t);
+gps_time_t gps_time_from_ns(gps_time_ns_t t);
+gps_time_ns_t gps_ns_from_wn_tow(u16 wn, s64 tow_ns);
+u16 gps_ns_wn(gps_time_ns_t t);
+s64 gps_ns_tow(gps_time_ns_t t);
+gps_time_ns_t gps_ns_add(gps_time_ns_t t, s64 dt_ns);
+s64 gps_ns_diff(gps_time_ns_t end, gps_time_ns_t beginning);
+double gps_ns_diff_s(gps_time_ns_t end, gps_time_ns_t beginning);
+
+s8 gps_utc_offset(gps_time_ns_t t);
+s64 gps_ns_to_unix_ns(gps_time_ns_t t);
+gps_time_ns_t unix_ns_to_gps_ns(s64 unix_ns);
+
 #endif /* LIBSWIFTNAV_TIME_H */
 
 
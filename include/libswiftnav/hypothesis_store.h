@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_HYPOTHESIS_STORE_H
+#define LIBSWIFTNAV_HYPOTHESIS_STORE_H
+
+#include "common.h"
+#include "constants.h"
+
+/** Maximum number of ambiguities in a stored hypothesis. */
+#define HYPOTHESIS_STORE_MAX_DDS (MAX_CHANNELS-1)
+
+/** Columns are padded to a multiple of this many hypotheses, so they are
+ * a multiple of 32 bytes apart and all start on a 32 byte boundary if the
+ * buffer passed to hypothesis_store_init() does. */
+#define HYPOTHESIS_STORE_ALIGN 8
+
+/** Column stride used for a store of a given capacity. */
+#define HYPOTHESIS_STORE_STRIDE(capacity) \
+  (((capacity) + HYPOTHESIS_STORE_ALIGN - 1) & ~(HYPOTHESIS_STORE_ALIGN - 1))
+
+/** Hash index slots per hypothesis, keeps the index at most half full. */
+#define HYPOTHESIS_STORE_INDEX_SLOTS 2
+
+/** Size in bytes of the buffer needed by hypothesis_store_init(). */
+#define HYPOTHESIS_STORE_BUFF_SIZE(capacity) \
+  (HYPOTHESIS_STORE_STRIDE(capacity) * \
+   ((HYPOTHESIS_STORE_MAX_DDS + 1) * sizeof(s32) + \
+    HYPOTHESIS_STORE_INDEX_SLOTS * sizeof(u32) + sizeof(u8)))
+
+/** Integer ambiguity hypotheses stored as structure of arrays.
+ *
+ * Hypothesis `i` has log likelihood `ll[i]` and ambiguities
+ * `N[k*stride + i]` for `k < num_dds`. Keeping each ambiguity in its own
+ * contiguous column means a pass over the store is a handful of linear
+ * streams, and lets per-hypothesis kernels run across many hypotheses at
+ * once.
+ *
+ * The store also keeps a hash index over the first `index_dds` ambiguities
+ * of each hypothesis and the index of the hypothesis with the greatest log
+ * likelihood, so that hypothesis_store_find() and hypothesis_store_mle() don't
+ * have to scan the store. These are valid while `indexed` is set. */
+typedef struct {
+  u32 capacity;   /**< Maximum number of hypotheses. */
+  u32 stride;     /**< Distance between the columns of N. */
+  u32 n;          /**< Number of hypotheses in the store. */
+  float *ll;      /**< Log likelihood of each hypothesis, length capacity. */
+  s32 *N;         /**< Ambiguity columns, HYPOTHESIS_STORE_MAX_DDS x stride. */
+  u32 *index;     /**< Hash index, hypothesis index plus one or 0 if empty. */
+  u32 index_size; /**< Number of slots in the hash index. */
+  u8 index_dds;   /**< Number of ambiguities the hash index is keyed on. */
+  u8 indexed;     /**< Whether the hash index and `mle` are up to date. */
+  u32 mle;        /**< Index of the hypothesis with the greatest `ll`. */
+  u8 *keep;       /**< Scratch flags for hypothesis_store_compact(). */
+} hypothesis_store_t;
+
+s8 hypothesis_store_init(hypothesis_store_t *store, u32 capacity, void *buff);
+void hypothesis_store_clear(hypothesis_store_t *store);
+s32 hypothesis_store_add(hypothesis_store_t *store, u8 num_dds,
+                         const s32 *N, float ll);
+void hypothesis_store_get(const hypothesis_store_t *store, u32 i, u8 num_dds,
+                          s32 *N);
+void hypothesis_store_set(hypothesis_store_t *store, u32 i, u8 num_dds,
+                          const s32 *N);
+u32 hypothesis_store_compact_range(hypothesis_store_t *store, u8 num_dds,
+                                   u32 start, u32 end);
+void hypothesis_store_move(hypothesis_store_t *store, u8 num_dds,
+                           u32 dst, u32 src, u32 count);
+u32 hypothesis_store_compact(hypothesis_store_t *store, u8 num_dds);
+void hypothesis_store_reindex(hypothesis_store_t *store, u8 num_dds);
+s32 hypothesis_store_find(const hypothesis_store_t *store, u8 num_dds,
+                          const s32 *N);
+s32 hypothesis_store_mle(const hypothesis_store_t *store);
+
+#endif /* LIBSWIFTNAV_HYPOTHESIS_STORE_H */
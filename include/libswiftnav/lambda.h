@@ -16,8 +16,48 @@
 
 #include "common.h"
 
+/** Default limit on the number of nodes visited by lambda_search(). */
+#define LAMBDA_MAX_ITERATIONS 10000
+
+/** Size in bytes of the buffer needed by lambda_init() for `n` parameters. */
+#define LAMBDA_WORKSPACE_SIZE(n) \
+  ((4 * (n) * (n) + 6 * (n)) * sizeof(double) + (n) * sizeof(u8))
+
+/** Reduced problem and search state for the LAMBDA method.
+ * Set up by lambda_init() for one float covariance, after which
+ * lambda_search() can be called any number of times with different float
+ * parameters. All matrices are column major. */
+typedef struct {
+  u8 n;               /**< Number of float parameters. */
+  u32 max_iterations; /**< Node limit for lambda_search(). */
+  double *L;          /**< Unit lower triangular, Z^T Q Z = L^T diag(D) L. */
+  double *D;          /**< Conditional variances of the reduced parameters. */
+  double *Z;          /**< Integer decorrelating transformation. */
+  double *Z_inv;      /**< Inverse of Z, also integer. */
+  double *S;          /**< Partial sums of the search. */
+  double *z_float;    /**< Reduced float parameters, Z^T a. */
+  double *z_cond;     /**< Conditional float parameters of the search. */
+  double *z;          /**< Current integer candidate of the search. */
+  double *step;       /**< Zig-zag steps of the search. */
+  double *dist;       /**< Partial distances of the search. */
+  u8 *stale;          /**< Highest level not yet summed into each S column. */
+} lambda_workspace_t;
+
+/** Statistics of a lambda_search(). */
+typedef struct {
+  u32 n_candidates;    /**< Number of candidates found. */
+  double ratio;        /**< Ratio of the second best to the best distance. */
+  double success_rate; /**< Success rate of integer bootstrapping. */
+  u32 iterations;      /**< Number of nodes visited. */
+} lambda_stats_t;
+
+s8 lambda_init(lambda_workspace_t *ws, u8 n, const double *Q, void *buff);
+s8 lambda_search(lambda_workspace_t *ws, const double *a, u32 k,
+                 double max_dist, double *F, double *s,
+                 lambda_stats_t *stats);
+
 int lambda_reduction(int n, const double *Q, double *Z);
-int lambda_solution(int n, int m, const double *a, const double *Q, double *F, 
-                      double *s); 
+int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
+                      double *s);
 
 #endif /* LIBSWIFTNAV_LAMBDA_H */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_LAPACK_WORK_H
+#define LIBSWIFTNAV_LAPACK_WORK_H
+
+#include "constants.h"
+
+/** \defgroup lapack_work LAPACK Workspaces
+ * Fixed size LAPACK workspaces.
+ *
+ * Every LAPACK routine called in the per-epoch path works on matrices with
+ * at most ::MAX_CHANNELS rows and columns, so rather than asking LAPACK for
+ * the optimal workspace size (an extra call) or letting LAPACKE allocate it
+ * (a malloc()), callers declare a workspace of ::LAPACK_WORK_SIZE doubles on
+ * the stack and pass that size as `LWORK`:
+ *
+ *     double work[LAPACK_WORK_SIZE];
+ *     integer lwork = LAPACK_WORK_SIZE;
+ *
+ * The size is always above the documented minimum `LWORK` of each routine,
+ * so the results are correct with any LAPACK. It is also at least the
+ * optimal size reported by the bundled reference LAPACK, so its blocked
+ * algorithms are used. An optimised system LAPACK (see the
+ * `LIBSWIFTNAV_SYSTEM_BLAS` CMake option) may prefer larger blocks and
+ * report a larger optimal size, e.g. OpenBLAS asks for over 4000 doubles
+ * for `DGELSS`; it then falls back to its unblocked algorithms, which for
+ * these small matrices costs little.
+ * \{ */
+
+/** Block size assumed when sizing workspaces, the block size the reference
+ * LAPACK `ILAENV` returns for the QR and SVD routines we use. */
+#define LAPACK_WORK_NB 32
+
+/** Largest dimension of any matrix passed to LAPACK. */
+#define LAPACK_WORK_MAX_DIM MAX_CHANNELS
+
+/** Size of a LAPACK workspace in doubles. For up to ::LAPACK_WORK_MAX_DIM
+ * rows and three columns this exceeds the minimum `LWORK` of `DGEQP3`
+ * (`3*N+1`), `DORGQR` (`N`, here the number of rows), `DGELSS` (`9+M`) and
+ * `DGELSY` (`13`), and covers the reference LAPACK's optimal sizes of at
+ * most `(N+1)*NB`. */
+#define LAPACK_WORK_SIZE ((LAPACK_WORK_MAX_DIM + 3) * LAPACK_WORK_NB)
+
+/** \} */
+
+#endif /* LIBSWIFTNAV_LAPACK_WORK_H */
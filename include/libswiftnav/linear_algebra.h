@@ -65,6 +65,16 @@ int matrix_ataiat(u32 n, u32 m, const double *a, double *b);
 int matrix_atawati(u32 n, u32 m, const double *a, const double *w, double *b);
 int matrix_ataati(u32 n, u32 m, const double *a, double *b);
 
+int matrix_cholesky(u32 n, const double *a, double *l);
+void matrix_cholesky_solve(u32 n, const double *l, const double *b,
+                           double *x);
+void matrix_cholesky_inverse(u32 n, const double *l, double *b);
+void matrix_cholesky_update(u32 n, double *l, double *x);
+int matrix_cholesky_downdate(u32 n, double *l, double *x);
+int matrix_ldl(u32 n, const double *a, double *l, double *d);
+void matrix_ldl_solve(u32 n, const double *l, const double *d,
+                      const double *b, double *x);
+
 double vector_dot(u32 n, const double *a, const double *b);
 double vector_norm(u32 n, const double *a);
 double vector_mean(u32 n, const double *a);
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_PARALLEL_H
+#define LIBSWIFTNAV_PARALLEL_H
+
+#include "common.h"
+
+/** Maximum number of threads, including the calling thread. */
+#define PARALLEL_MAX_THREADS 16
+
+/** A task run by parallel_for(), `task` runs from 0 to `n_tasks-1`. */
+typedef void (*parallel_task_t)(void *arg, u32 task);
+
+s8 parallel_init(u8 n_threads);
+void parallel_deinit(void);
+u8 parallel_n_threads(void);
+void parallel_for(u32 n_tasks, parallel_task_t fn, void *arg);
+
+#endif /* LIBSWIFTNAV_PARALLEL_H */
@@ -15,6 +15,7 @@
 
 void print_s32_mtx_diff(u32 m, u32 n, s32 *Z_inv1, s32 *Z_inv2);
 void print_hyp(void *arg, element_t *elem);
+void print_hypothesis_store(u8 num_dds, const hypothesis_store_t *hyps);
 void print_double_mtx(double *m, u32 _r, u32 _c);
 void print_pearson_mtx(double *m, u32 dim);
 void print_s32_mtx_diff(u32 m, u32 n, s32 *mat1, s32 *mat2);
@@ -16,9 +16,13 @@
 
 #include "common.h"
 #include "track.h"
+#include "tropo.h"
 
 #define PVT_MAX_ITERATIONS 20
 
+/** Number of problems solved together by calc_PVT_batch(). */
+#define PVT_BATCH_LANES 8
+
 typedef struct {
   double pdop;
   double gdop;
@@ -66,10 +70,102 @@ typedef struct __attribute__((packed)) {
   u8 n_used;
 } gnss_solution;
 
+/** Maximum RMS pre-fit pseudorange residual [m] for which ::PVT_INIT_AUTO
+ * will keep using the warm start rather than a Bancroft initial solution. */
+#define PVT_WARM_START_MAX_RESIDUAL 1000.0
+
+/** How a PVT solver chooses the initial state for Newton-Raphson iteration. */
+typedef enum {
+  /** Always start from the previous solution (or the center of the Earth). */
+  PVT_INIT_WARM,
+  /** Always start from the closed form Bancroft solution. */
+  PVT_INIT_BANCROFT,
+  /** Use the previous solution if it still fits the measurements, otherwise
+   * fall back to the Bancroft solution. */
+  PVT_INIT_AUTO,
+} pvt_init_policy_t;
+
+/** Standard normal quantile for the RAIM probability of false alarm
+ * (3.09 corresponds to a false alarm probability of 10^-3). */
+#define PVT_RAIM_Z 3.090232
+
+/** Returned by calc_PVT_solver() when RAIM detects a fault that it cannot
+ * exclude. */
+#define PVT_RAIM_ALARM -5
+
+/** How a PVT solver weights pseudorange measurements. */
+typedef enum {
+  /** All measurements have the same weight (ordinary least squares). */
+  PVT_WEIGHT_NONE,
+  /** Pseudorange standard deviation proportional to 1/sin(elevation). */
+  PVT_WEIGHT_ELEVATION,
+  /** Pseudorange variance inversely proportional to C/N0. */
+  PVT_WEIGHT_SNR,
+} pvt_weighting_t;
+
+/** Iteration statistics of a PVT solver instance. */
+typedef struct {
+  u32 n_solves;          /**< Number of solutions attempted. */
+  u32 n_failed;          /**< Number of solutions that were not valid. */
+  u32 n_bancroft;        /**< Number of solves started from Bancroft. */
+  u32 total_iterations;  /**< Newton-Raphson iterations over all solves. */
+  u32 n_raim_alarms;     /**< Number of RAIM faults that could not be
+                              excluded. */
+  u32 n_exclusions;      /**< Number of measurements excluded by RAIM. */
+  u8 last_iterations;    /**< Iterations taken by the most recent solve. */
+  u8 max_iterations;     /**< Most iterations taken by any solve. */
+} pvt_solver_stats_t;
+
+/** State of a PVT solver instance.
+ * Holds the Newton-Raphson warm start between calls to calc_PVT_solver().
+ * Each receiver being processed should have its own instance. */
+typedef struct {
+  /** Receiver state: pos[3], clock error, vel[3], intermediate freq error. */
+  double rx_state[8];
+  /** Initial state policy, ::PVT_INIT_AUTO after pvt_solver_init(). */
+  pvt_init_policy_t init_policy;
+  /** Measurement weighting, ::PVT_WEIGHT_NONE after pvt_solver_init(). */
+  pvt_weighting_t weighting;
+  /** Standard deviation of a zenith / 45 dB-Hz pseudorange [m]. Used to
+   * scale the weights and the RAIM test statistic. */
+  double pr_sigma;
+  /** Correct the pseudoranges for the troposphere using the UNB3 model if
+   * non-zero. */
+  u8 tropo;
+  /** Troposphere model, updated as the receiver moves. */
+  tropo_model_t tropo_model;
+  /** Perform RAIM fault detection and exclusion if non-zero. */
+  u8 raim;
+  /** PRN excluded by RAIM in the most recent solve, or -1 if none. */
+  s16 excluded_prn;
+  /** Iteration statistics, reset by pvt_solver_init(). */
+  pvt_solver_stats_t stats;
+} pvt_solver_t;
+
+void compute_dops(const double H[4][4], const double pos_ecef[3],
+                  dops_t *dops);
+u8 filter_solution(gnss_solution* soln, dops_t* dops);
+
+void pvt_solver_init(pvt_solver_t *solver);
+s8 pvt_bancroft(const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                double rx_state[4]);
+s8 calc_PVT_solver(pvt_solver_t *solver,
+                   const u8 n_used,
+                   const navigation_measurement_t nav_meas[n_used],
+                   gnss_solution *soln,
+                   dops_t *dops);
 s8 calc_PVT(const u8 n_used,
             const navigation_measurement_t nav_meas[n_used],
             gnss_solution *soln,
             dops_t *dops);
+u32 calc_PVT_batch(const u32 n_epochs,
+                   const u8 n_used[n_epochs],
+                   const navigation_measurement_t *const nav_meas[n_epochs],
+                   pvt_solver_t solvers[],
+                   gnss_solution solns[n_epochs],
+                   dops_t dops[n_epochs],
+                   s8 ret[n_epochs]);
 
 #endif /* LIBSWIFTNAV_PVT_H */
 
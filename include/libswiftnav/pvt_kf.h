@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2014 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef LIBSWIFTNAV_PVT_KF_H
+#define LIBSWIFTNAV_PVT_KF_H
+
+#include "common.h"
+#include "gpstime.h"
+#include "track.h"
+#include "pvt.h"
+
+/** Number of states in the PVT Kalman filter:
+ * pos[3] [m], vel[3] [m/s], clock bias [m], clock drift [m/s]. */
+#define PVT_KF_STATE_DIM 8
+
+/** Longest time between epochs [s] before the filter is re-initialised from
+ * a snapshot solution. */
+#define PVT_KF_MAX_DT 10.0
+
+/** Innovation gate, measurements whose squared normalised innovation exceeds
+ * this are rejected. */
+#define PVT_KF_INNOVATION_GATE 25.0
+
+/** Returned by pvt_kf_update() for an epoch without measurements. */
+#define PVT_KF_NO_MEASUREMENTS -6
+
+typedef struct {
+  /** State estimate: pos[3], vel[3], clock bias, clock drift (ECEF, m). */
+  double x[PVT_KF_STATE_DIM];
+  /** State covariance. */
+  double P[PVT_KF_STATE_DIM][PVT_KF_STATE_DIM];
+  /** Receiver time of the state estimate. */
+  gps_time_t t;
+  /** Non-zero once the filter has been initialised from a snapshot fix. */
+  u8 initialized;
+
+  /** Power spectral density of the acceleration process noise [m^2/s^3]. */
+  double accel_psd;
+  /** Power spectral density of the clock bias process noise [m^2/s]. */
+  double clock_bias_psd;
+  /** Power spectral density of the clock drift process noise [m^2/s^3]. */
+  double clock_drift_psd;
+  /** Pseudorange measurement variance [m^2]. */
+  double pr_var;
+  /** Pseudorange rate measurement variance [m^2/s^2]. */
+  double rr_var;
+
+  /** Snapshot solver used to (re-)initialise the filter. */
+  pvt_solver_t init_solver;
+} pvt_kf_t;
+
+void pvt_kf_init(pvt_kf_t *kf, double accel_psd, double pr_var, double rr_var);
+void pvt_kf_predict(pvt_kf_t *kf, double dt);
+s8 pvt_kf_update(pvt_kf_t *kf, const u8 n_used,
+                 const navigation_measurement_t nav_meas[n_used],
+                 gnss_solution *soln, dops_t *dops);
+
+#endif /* LIBSWIFTNAV_PVT_KF_H */
@@ -13,7 +13,37 @@
 #ifndef LIBSWIFTNAV_TROPO_H
 #define LIBSWIFTNAV_TROPO_H
 
+#include "common.h"
+
+/** Change in latitude [rad] that causes tropo_model_update() to recompute
+ * the zenith delays. */
+#define TROPO_MODEL_MAX_DLAT 1e-4
+/** Change in height [m] that causes tropo_model_update() to recompute the
+ * zenith delays. */
+#define TROPO_MODEL_MAX_DHEIGHT 1.0
+/** Change in day of year that causes tropo_model_update() to recompute the
+ * zenith delays. */
+#define TROPO_MODEL_MAX_DDAY 1.0
+
+/** Troposphere model for a receiver location, see tropo_model_init(). */
+typedef struct {
+  double zenith_dry;   /**< Zenith hydrostatic delay [m]. */
+  double zenith_wet;   /**< Zenith wet delay [m]. */
+  double lat;          /**< Latitude the delays were computed for [rad]. */
+  double height;       /**< Height the delays were computed for [m]. */
+  double day_of_year;  /**< Day of year the delays were computed for. */
+} tropo_model_t;
+
 double tropo_correction(double elevation);
 
+void tropo_model_init(tropo_model_t *model, double lat, double height,
+                      double day_of_year);
+u8 tropo_model_update(tropo_model_t *model, double lat, double height,
+                      double day_of_year);
+double tropo_model_correction(const tropo_model_t *model, double elevation);
+void tropo_model_correction_array(const tropo_model_t *model, u8 n,
+                                  const double elevation[n],
+                                  double correction[n]);
+
 #endif /* LIBSWIFTNAV_TROPO_H */
 
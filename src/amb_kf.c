@@ -30,6 +30,8 @@
 #include "almanac.h"
 #include "gpstime.h"
 #include "amb_kf.h"
+#include "lapack_work.h"
+#include "dd_cov.h"
 
 /** Measure the integer ambiguity just from the code and carrier measurements.
  * The expectation value of carrier + code / lambda is
@@ -403,21 +405,11 @@ void _least_squares_solve_b(u8 num_dds_u8, const double *state_mean,
   double s[3];
   double rcond = 1e-12;
   s32 rank;
-  double w[1]; /* try 25 + 10*num_sats. */
-  s32 lwork = -1;
+  double work[LAPACK_WORK_SIZE];
+  s32 lwork = LAPACK_WORK_SIZE;
   s32 info;
   s32 three = 3;
   s32 one = 1;
-  dgelss_(&num_dds, &three, &one, /* M, N, NRHS. */
-          DET, &num_dds,          /* A, LDA. */
-          phase_ranges, &ldb,     /* B, LDB. */
-          s, &rcond,              /* S, RCOND. */
-          &rank,                  /* RANK. */
-          w, &lwork,              /* WORK, LWORK. */
-          &info);                 /* INFO. */
-  lwork = round(w[0]);
-
-  double work[lwork];
   dgelss_(&num_dds, &three, &one, /* M, N, NRHS. */
           DET, &num_dds,          /* A, LDA. */
           phase_ranges, &ldb,     /* B, LDB. */
@@ -472,18 +464,11 @@ void initialize_state(nkf_t *kf, double *dd_measurements, double init_var)
 
 void QR_part1(integer m, integer n, double *A, double *tau)
 {
-  double w[1];
-  integer lwork = -1;
+  double work[LAPACK_WORK_SIZE];
+  integer lwork = LAPACK_WORK_SIZE;
   integer info;
   integer jpvt[3];
   memset(jpvt, 0, 3 * sizeof(integer));
-  dgeqp3_(&m, &n,
-          A, &m,
-          jpvt,
-          tau,
-          w, &lwork, &info);
-  lwork = round(w[0]);
-  double work[lwork];
   dgeqp3_(&m, &n,
           A, &m,
           jpvt,
@@ -493,15 +478,9 @@ void QR_part1(integer m, integer n, double *A, double *tau)
 
 void QR_part2(integer m, integer n, double *A, double *tau)
 {
-  double w[1];
-  integer lwork = -1;
+  double work[LAPACK_WORK_SIZE];
+  integer lwork = LAPACK_WORK_SIZE;
   integer info;
-  dorgqr_(&m, &m, &n,
-          A, &m,
-          tau,
-          w, &lwork, &info);
-  lwork = round(w[0]);
-  double work[lwork];
   dorgqr_(&m, &m, &n,
           A, &m,
           tau,
@@ -510,6 +489,12 @@ void QR_part2(integer m, integer n, double *A, double *tau)
 
 void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q)
 {
+  /* With three or fewer DDs the left null space of DE is empty and there is
+   * nothing to write. The QR below also needs at least three rows. */
+  if (num_dds <= 3) {
+    return;
+  }
+
   /* DE is num_sats-1 by 3, need to transpose it to column major. */
   double A[num_dds * num_dds];
   for (u8 i=0; i < num_dds; i++) {
@@ -525,108 +510,62 @@ void assign_phase_obs_null_basis(u8 num_dds, double *DE_mtx, double *q)
   memcpy(q, &A[3*num_dds], CLAMP_DIFF(num_dds, 3) * num_dds * sizeof(double));
 }
 
-/* TODO this could be made more efficient, if it matters. */
 void assign_dd_obs_cov(u8 num_dds, double phase_var, double code_var, double *dd_obs_cov)
 {
+  u32 dd_dim = 2 * num_dds;
+  memset(dd_obs_cov, 0, dd_dim * dd_dim * sizeof(double));
   for (u8 i = 0; i < num_dds; i++) {
     for (u8 j = 0; j < num_dds; j++) {
-      if (i == j) {
-        dd_obs_cov[i*2*num_dds + j] = 2 * phase_var;
-        dd_obs_cov[(i+num_dds)*2*num_dds + num_dds + j] = 2 * code_var;
-      }
-      else {
-        dd_obs_cov[i*2*num_dds + j] = phase_var;
-        dd_obs_cov[(i+num_dds)*2*num_dds + num_dds + j] = code_var;
-      }
+      dd_obs_cov[i*dd_dim + j] = (i == j) ? 2 * phase_var : phase_var;
+      dd_obs_cov[(i+num_dds)*dd_dim + num_dds + j] =
+        (i == j) ? 2 * code_var : code_var;
     }
-    memset(&dd_obs_cov[i*2*num_dds + num_dds], 0, num_dds * sizeof(double));
-    memset(&dd_obs_cov[(i+num_dds)*2*num_dds], 0, num_dds * sizeof(double));
   }
 }
 
-/* TODO make this more efficient (e.g. via pages 3/6.2-3/2014 of ian's notebook). */
+/* The residual covariance Q~ * Sig_v * Q~^T (see get_kf_matrices) written out
+ * blockwise, with K = I + 1*1^T, u = Q*1 and c = code_var / lambda^2:
+ *
+ *   ( p * (Q*Q^T + u*u^T)   p * (Q + u*1^T) )
+ *   ( p * (Q^T + 1*u^T)     (p + c) * K     )
+ */
 void assign_residual_obs_cov(u8 num_dds, double phase_var, double code_var, double *q, double *r_cov)
 {
-  double dd_obs_cov[4 * num_dds * num_dds];
-  assign_dd_obs_cov(num_dds, phase_var, code_var, dd_obs_cov);
-  integer nullspace_dim = CLAMP_DIFF(num_dds, 3);
-  integer dd_dim = 2*num_dds;
-  integer res_dim = num_dds + nullspace_dim;
-  double q_tilde[res_dim * dd_dim];
-  memset(q_tilde, 0, res_dim * dd_dim * sizeof(double));
+  u8 nullspace_dim = CLAMP_DIFF(num_dds, 3);
+  u8 res_dim = num_dds + nullspace_dim;
+  double p = phase_var;
+  double c = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
 
+  double u[nullspace_dim];
   for (u8 i=0; i<nullspace_dim; i++) {
-    memcpy(&q_tilde[i*dd_dim], &q[i*num_dds], num_dds * sizeof(double));
-  }
-  for (u8 i=0; i<num_dds; i++) {
-    q_tilde[(i+nullspace_dim)*dd_dim + i] = 1;
-    q_tilde[(i+nullspace_dim)*dd_dim + i+num_dds] = -1 / GPS_L1_LAMBDA_NO_VAC;
+    u[i] = 0;
+    for (u8 k=0; k<num_dds; k++) {
+      u[i] += q[i*num_dds + k];
+    }
   }
 
-  /* TODO make more efficient via the structure of q_tilde, and it's relation to the I + 1*1^T structure of the obs cov mtx. */
-  double QC[res_dim * dd_dim];
-  cblas_dsymm(CblasRowMajor, CblasRight, CblasUpper, /* CBLAS_ORDER, CBLAS_SIDE, CBLAS_UPLO. */
-              res_dim, dd_dim,                       /* int M, int N. */
-              1, dd_obs_cov, dd_dim,                 /* double alpha, double *A, int lda. */
-              q_tilde, dd_dim,                       /* double *B, int ldb. */
-              0, QC, dd_dim);                        /* double beta, double *C, int ldc. */
-
-  /* TODO make more efficient via the structure of q_tilde, and it's relation to the I + 1*1^T structure of the obs cov mtx. */
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, /*  CBLAS_ORDER, CBLAS_TRANSPOSE transA, cBLAS_TRANSPOSE transB. */
-              res_dim, res_dim, dd_dim,                /* int M, int N, int K. */
-              1, QC, dd_dim,                           /* double alpha, double *A, int lda. */
-              q_tilde, dd_dim,                         /* double *B, int ldb. */
-              0, r_cov, res_dim);                      /* beta, double *C, int ldc. */
-}
-
-/*  In place inversion of U. */
-void invert_U(u8 res_dim, double *U)
-{
-  char uplo = 'U'; /* upper triangular. */
-  char diag = 'U'; /* unit triangular. */
-  integer dim = res_dim;
-  integer lda = res_dim;
-  integer info;
-  dtrtri_(&uplo, &diag,
-          &dim, U, &lda, &info);
-}
-
-void assign_simple_sig(u8 num_dds, double var, double *simple_cov)
-{
-  for (u8 i = 0; i < num_dds; i++) {
-    for (u8 j = 0; j < num_dds; j++) {
-      if (i == j) {
-        simple_cov[i*num_dds + j] = 2 * var;
-      }
-      else {
-        simple_cov[i*num_dds + j] = var;
+  for (u8 i=0; i<nullspace_dim; i++) {
+    for (u8 j=i; j<nullspace_dim; j++) {
+      double x = u[i] * u[j];
+      for (u8 k=0; k<num_dds; k++) {
+        x += q[i*num_dds + k] * q[j*num_dds + k];
       }
+      r_cov[i*res_dim + j] = p * x;
+      r_cov[j*res_dim + i] = p * x;
+    }
+    for (u8 k=0; k<num_dds; k++) {
+      double x = p * (q[i*num_dds + k] + u[i]);
+      r_cov[i*res_dim + nullspace_dim + k] = x;
+      r_cov[(nullspace_dim + k)*res_dim + i] = x;
     }
   }
-}
 
-/* From get_kf_matrices:
- * U^-1 * y == y'
- *           = U^-1 * H * x
- *          == H' * x
- *
- * H = ( Q )
- *     ( I )
- * where Q's rows form a basis for the left null space for DE
- */
-void assign_H_prime(u8 res_dim, u8 constraint_dim, u8 num_dds,
-                    double *Q, double *U_inv, double *H_prime)
-{
-  /*  set the H_prime variable to equal H. */
-  memcpy(H_prime, Q, constraint_dim * num_dds * sizeof(double));
-  matrix_eye(num_dds, &H_prime[constraint_dim * num_dds]);
-
-  /*  multiply H_prime by U_inv to make it the actual H_prime. */
-  cblas_dtrmm(CblasRowMajor, CblasLeft, CblasUpper, CblasNoTrans, CblasUnit,
-              /* ^ CBLAS_ORDER, CBLAS_SIDE, CBLAS_UPLO, CBLAS_TRANSPOSE, CBLAS_DIAG. */
-              res_dim, num_dds,  /* M, N. */
-              1, U_inv, res_dim, /* alpha, A, lda. */
-              H_prime, num_dds); /* B, ldb. */
+  double K[num_dds * num_dds];
+  dd_cov_assign(num_dds, p + c, K);
+  for (u8 k=0; k<num_dds; k++) {
+    memcpy(&r_cov[(nullspace_dim + k)*res_dim + nullspace_dim],
+           &K[k*num_dds], num_dds * sizeof(double));
+  }
 }
 
 /* REQUIRES num_sdiffs > 0 */
@@ -649,6 +588,22 @@ void assign_H_prime(u8 res_dim, u8 constraint_dim, u8 num_dds,
  *     and D*D^T = 1*1^T + I
  *
  * This function constructs D, U^-1, and H'
+ *
+ * Sig is never formed. With K = D*D^T, p = var_phi, c = var_rho / lambda^2
+ * and the blocks of Sig as in assign_residual_obs_cov, the lower right block
+ * (p + c)*K factors in closed form and its Schur complement is
+ *
+ *   S = p*c/(p+c) * Q*K*Q^T = p*c/(p+c) * (I + u*u^T),  u = Q*1
+ *
+ * since the rows of Q are orthonormal. So with S = U_S * D_S * U_S^T and
+ * (p+c)*K = U_K * D_K * U_K^T, both identity plus rank one and so factored
+ * by dd_cov_rank_one_udu_inverse and dd_cov_udu_inverse,
+ *
+ *   U^-1 = ( U_S^-1   -p/(p+c) * U_S^-1 * Q )    D = ( D_S )
+ *          ( 0         U_K^-1               )        ( D_K )
+ *
+ *   H' = ( c/(p+c) * U_S^-1 * Q )
+ *        ( U_K^-1               )
  */
 void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
                      double ref_ecef[3],
@@ -663,31 +618,54 @@ void get_kf_matrices(u8 num_sdiffs, sdiff_t *sdiffs_with_ref_first,
   u8 constraint_dim = CLAMP_DIFF(num_dds, 3);
   u8 res_dim = num_dds + constraint_dim;
 
-  double Sig[res_dim * res_dim];
+  double p = phase_var;
+  double c = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
+
+  double U_K_inv[num_dds * num_dds];
+  dd_cov_udu_inverse(num_dds, p + c, U_K_inv, &D[constraint_dim]);
+
+  memset(U_inv, 0, res_dim * res_dim * sizeof(double));
+  for (u8 k = 0; k < num_dds; k++) {
+    memcpy(&U_inv[(constraint_dim + k)*res_dim + constraint_dim],
+           &U_K_inv[k*num_dds], num_dds * sizeof(double));
+  }
+  memcpy(&H_prime[constraint_dim * num_dds], U_K_inv,
+         num_dds * num_dds * sizeof(double));
 
-  /* assign Sig and H. */
   if (constraint_dim > 0) {
     double DE[num_dds * 3];
     assign_de_mtx(num_sdiffs, sdiffs_with_ref_first, ref_ecef, DE);
     assign_phase_obs_null_basis(num_dds, DE, null_basis_Q);
-    assign_residual_obs_cov(num_dds, phase_var, code_var, null_basis_Q, Sig);
-    /* TODO U seems to have that fancy blockwise structure we love so much. Use it. */
-    matrix_udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
-    invert_U(res_dim, U_inv);
-    /* TODO this also has fancy structure. */
-    assign_H_prime(res_dim, constraint_dim, num_dds, null_basis_Q, U_inv, H_prime);
-  }
-  else {
-    assign_simple_sig(num_dds,
-                      phase_var + code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC),
-                      Sig);
-    matrix_udu(res_dim, Sig, U_inv, D); /* U_inv holds U after this. */
-    invert_U(res_dim, U_inv);
 
-    /* H = I in this case, so H' = U^-1 * H = U^-1. */
-    memcpy(H_prime, U_inv, num_dds * num_dds * sizeof(double));
+    double u[constraint_dim];
+    for (u8 i = 0; i < constraint_dim; i++) {
+      u[i] = 0;
+      for (u8 k = 0; k < num_dds; k++) {
+        u[i] += null_basis_Q[i*num_dds + k];
+      }
+    }
+    double U_S_inv[constraint_dim * constraint_dim];
+    dd_cov_rank_one_udu_inverse(constraint_dim, p * c / (p + c), u,
+                                U_S_inv, D);
+
+    /* H_prime's top block holds U_S^-1 * Q. */
+    memcpy(H_prime, null_basis_Q, constraint_dim * num_dds * sizeof(double));
+    cblas_dtrmm(CblasRowMajor, CblasLeft, CblasUpper, CblasNoTrans, CblasUnit,
+                /* ^ CBLAS_ORDER, CBLAS_SIDE, CBLAS_UPLO, CBLAS_TRANSPOSE, CBLAS_DIAG. */
+                constraint_dim, num_dds,        /* M, N. */
+                1, U_S_inv, constraint_dim,     /* alpha, A, lda. */
+                H_prime, num_dds);              /* B, ldb. */
+
+    for (u8 i = 0; i < constraint_dim; i++) {
+      memcpy(&U_inv[i*res_dim], &U_S_inv[i*constraint_dim],
+             constraint_dim * sizeof(double));
+      for (u8 k = 0; k < num_dds; k++) {
+        double x = H_prime[i*num_dds + k];
+        U_inv[i*res_dim + constraint_dim + k] = -p / (p + c) * x;
+        H_prime[i*num_dds + k] = c / (p + c) * x;
+      }
+    }
   }
-
 }
 
 
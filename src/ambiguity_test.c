@@ -11,11 +11,13 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <clapack.h>
 #include <inttypes.h>
 #include <cblas.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "logging.h"
 #include "ambiguity_test.h"
 #include "common.h"
@@ -23,8 +25,11 @@
 #include "linear_algebra.h"
 #include "single_diff.h"
 #include "amb_kf.h"
+#include "dd_cov.h"
+#include "hypothesis_store.h"
 #include "lambda.h"
 #include "memory_pool.h"
+#include "parallel.h"
 #include "printing_utils.h"
 #include "sats_management.h"
 
@@ -33,19 +38,51 @@
 #define NUM_SEARCH_STDS 5
 #define LOG_PROB_RAT_THRESHOLD -90
 #define SINGLE_OBS_CHISQ_THRESHOLD 20
+/** Number of hypotheses get_quadratic_terms() works on at once. */
+#define QUADRATIC_TERMS_BLOCK 64
+/** Largest error in the log likelihood ratio of two hypotheses a cycle apart
+ * that update_residual_matrices() allows, before rebuilding the matrices for
+ * the current geometry. Hypotheses are only dropped when they fall
+ * LOG_PROB_RAT_THRESHOLD below the best, so an error of this size each epoch
+ * stays well under that even summed over the life of the cached matrices. */
+#define RESIDUAL_MTXS_LL_TOL 0.1
+/** Minimum number of hypotheses per thread when testing hypotheses in
+ * parallel, below this the threads cost more than they save. */
+#define HYPOTHESIS_CHUNK_MIN 512
+
+/** Size of the memory pool working area for a given number of hypotheses. */
+#define POOL_BUFF_SIZE(n) ((n) * (sizeof(hypothesis_t) + sizeof(void *)))
+
+/* Hypothesis storage, shared by all ambiguity tests. Storage for
+ * MAX_HYPOTHESES is allocated statically, ambiguity_test_set_max_hypotheses()
+ * replaces it with a larger heap allocation when asked for more. */
+static u8 default_pool_buff[POOL_BUFF_SIZE(MAX_HYPOTHESES)];
+static u8 default_hyps_buff[HYPOTHESIS_STORE_BUFF_SIZE(MAX_HYPOTHESES)]
+  __attribute__((aligned(32)));
+static memory_pool_t pool;
+static u8 *pool_buff = default_pool_buff;
+static u8 *hyps_buff = default_hyps_buff;
+/* Number of hypotheses the storage can hold. */
+static u32 hyps_capacity = MAX_HYPOTHESES;
+/* Number of hypotheses we are allowed to carry, <= hyps_capacity. */
+static u32 hyps_limit = MAX_HYPOTHESES;
+/* Per-epoch time budget for testing hypotheses [s], 0 for none. */
+static double hyps_time_budget = 0;
+/* Measured time to test one hypothesis for one epoch [s]. */
+static double hyps_time_cost = 0;
 
 /** \defgroup ambiguity_test Integer Ambiguity Resolution
  * Integer ambiguity resolution using bayesian hypothesis testing.
  * \{ */
 void create_empty_ambiguity_test(ambiguity_test_t *amb_test)
 {
-  static u8 pool_buff[MAX_HYPOTHESES*(sizeof(hypothesis_t) + sizeof(void *))];
-  static memory_pool_t pool;
   amb_test->pool = &pool;
-  memory_pool_init(amb_test->pool, MAX_HYPOTHESES, sizeof(hypothesis_t), pool_buff);
+  memory_pool_init(amb_test->pool, hyps_capacity, sizeof(hypothesis_t), pool_buff);
+  hypothesis_store_init(&amb_test->hyps, hyps_capacity, hyps_buff);
 
   amb_test->sats.num_sats = 0;
   amb_test->amb_check.initialized = 0;
+  amb_test->res_mtxs.dd_num_dds = 0;
 }
 void create_ambiguity_test(ambiguity_test_t *amb_test)
 {
@@ -55,14 +92,173 @@ void create_ambiguity_test(ambiguity_test_t *amb_test)
    * zero length N vector, i.e. no satellites. When we take the
    * product of this single element with the set of new satellites
    * we will just get a set of elements corresponding to the new sats. */
-  hypothesis_t *empty_element = (hypothesis_t *)memory_pool_add(amb_test->pool);
   /* Start with ll = 0, just for the sake of argument. */
-  empty_element->ll = 0;
+  hypothesis_store_add(&amb_test->hyps, 0, NULL, 0);
 }
 
+/** Release any heap storage for hypotheses.
+ * Hypothesis storage goes back to the static default for ::MAX_HYPOTHESES.
+ * The ambiguity test must be recreated before it is used again.
+ *
+ * \param amb_test The ambiguity test to destroy.
+ */
 void destroy_ambiguity_test(ambiguity_test_t *amb_test)
 {
-  memory_pool_destroy(amb_test->pool);
+  if (hyps_buff != default_hyps_buff) {
+    free(hyps_buff);
+    free(pool_buff);
+  }
+  hyps_buff = default_hyps_buff;
+  pool_buff = default_pool_buff;
+  hyps_capacity = MAX_HYPOTHESES;
+  hyps_limit = MAX_HYPOTHESES;
+  hypothesis_store_init(&amb_test->hyps, hyps_capacity, hyps_buff);
+}
+
+/** Set the maximum number of hypotheses an ambiguity test may carry.
+ * Storage grows as needed, keeping the hypotheses currently in `amb_test`.
+ * This is the only place hypothesis storage is allocated, so call it at
+ * start-up on systems where allocation is a concern. Lowering the maximum
+ * doesn't free any storage.
+ *
+ * Satellite inclusion only adds satellites if the resulting hypotheses fit
+ * within the maximum (see also ambiguity_test_set_time_budget()).
+ *
+ * \param amb_test The ambiguity test whose hypotheses to keep.
+ * \param max_hyps The new maximum number of hypotheses.
+ * \return 0 on success, -1 if `max_hyps` is less than the number of
+ *         hypotheses in `amb_test`, -2 if memory allocation failed.
+ */
+s8 ambiguity_test_set_max_hypotheses(ambiguity_test_t *amb_test, u32 max_hyps)
+{
+  if (max_hyps == 0 || max_hyps < amb_test->hyps.n) {
+    return -1;
+  }
+
+  if (max_hyps > hyps_capacity) {
+    u8 *new_pool_buff = malloc(POOL_BUFF_SIZE(max_hyps));
+    u8 *new_hyps_buff = malloc(HYPOTHESIS_STORE_BUFF_SIZE(max_hyps));
+    if (!new_pool_buff || !new_hyps_buff) {
+      free(new_pool_buff);
+      free(new_hyps_buff);
+      return -2;
+    }
+
+    hypothesis_store_t new_hyps;
+    hypothesis_store_init(&new_hyps, max_hyps, new_hyps_buff);
+    hypothesis_store_reindex(&new_hyps, amb_test->hyps.index_dds);
+    for (u32 i=0; i<amb_test->hyps.n; i++) {
+      s32 N[HYPOTHESIS_STORE_MAX_DDS];
+      hypothesis_store_get(&amb_test->hyps, i, HYPOTHESIS_STORE_MAX_DDS, N);
+      hypothesis_store_add(&new_hyps, HYPOTHESIS_STORE_MAX_DDS, N,
+                           amb_test->hyps.ll[i]);
+    }
+
+    if (hyps_buff != default_hyps_buff) {
+      free(hyps_buff);
+      free(pool_buff);
+    }
+    hyps_buff = new_hyps_buff;
+    pool_buff = new_pool_buff;
+    hyps_capacity = max_hyps;
+    amb_test->hyps = new_hyps;
+    amb_test->pool = &pool;
+    memory_pool_init(amb_test->pool, hyps_capacity, sizeof(hypothesis_t), pool_buff);
+  }
+
+  hyps_limit = max_hyps;
+  return 0;
+}
+
+/** Memory needed to carry a given number of hypotheses.
+ *
+ * \param max_hyps Maximum number of hypotheses.
+ * \return Size of the hypothesis storage in bytes.
+ */
+size_t ambiguity_test_memory_required(u32 max_hyps)
+{
+  return POOL_BUFF_SIZE(max_hyps) + HYPOTHESIS_STORE_BUFF_SIZE(max_hyps);
+}
+
+/** Set the maximum number of hypotheses from a memory budget.
+ * Carries as many hypotheses as fit in `bytes`, see
+ * ambiguity_test_set_max_hypotheses().
+ *
+ * \param amb_test The ambiguity test whose hypotheses to keep.
+ * \param bytes    Memory budget for hypothesis storage.
+ * \return As ambiguity_test_set_max_hypotheses().
+ */
+s8 ambiguity_test_set_memory_budget(ambiguity_test_t *amb_test, size_t bytes)
+{
+  size_t per_hyp = ambiguity_test_memory_required(HYPOTHESIS_STORE_ALIGN)
+                   / HYPOTHESIS_STORE_ALIGN;
+  u32 max_hyps = bytes / per_hyp;
+  while (max_hyps > 0 && ambiguity_test_memory_required(max_hyps) > bytes) {
+    max_hyps--;
+  }
+  return ambiguity_test_set_max_hypotheses(amb_test, max_hyps);
+}
+
+/** Set the time budget for testing hypotheses each epoch.
+ * The time taken per hypothesis is measured each epoch by test_ambiguities()
+ * and satellite inclusion won't grow the hypothesis set beyond what can be
+ * tested within the budget.
+ *
+ * \param seconds Time budget per epoch [s], or 0 for no time budget.
+ */
+void ambiguity_test_set_time_budget(double seconds)
+{
+  hyps_time_budget = seconds;
+}
+
+/** Number of hypotheses we can currently carry.
+ * The lesser of the maximum number of hypotheses and the number that can be
+ * tested within the time budget.
+ *
+ * \return Maximum number of hypotheses.
+ */
+u32 ambiguity_test_max_hypotheses(void)
+{
+  u32 max_hyps = hyps_limit;
+  if (hyps_time_budget > 0 && hyps_time_cost > 0) {
+    double n = hyps_time_budget / hyps_time_cost;
+    if (n < max_hyps) {
+      max_hyps = MAX(1, (u32) n);
+    }
+  }
+  return max_hyps;
+}
+
+/* The hypotheses live in amb_test->hyps. Satellite projection and inclusion
+ * are built on the generic memory pool operations (group by, product) and
+ * only run when the satellites change, so for those the hypotheses are moved
+ * into amb_test->pool and back again afterwards, keeping their order. */
+static void hyps_to_pool(ambiguity_test_t *amb_test)
+{
+  hypothesis_store_t *hyps = &amb_test->hyps;
+  memory_pool_clear(amb_test->pool);
+  /* memory_pool_add() inserts at the head of the list, so add backwards. */
+  for (s32 i = hyps->n - 1; i >= 0; i--) {
+    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test->pool);
+    hypothesis_store_get(hyps, i, HYPOTHESIS_STORE_MAX_DDS, hyp->N);
+    hyp->ll = hyps->ll[i];
+  }
+}
+
+static void append_hyp(void *arg, element_t *elem)
+{
+  hypothesis_t *hyp = (hypothesis_t *)elem;
+  hypothesis_store_add((hypothesis_store_t *)arg, HYPOTHESIS_STORE_MAX_DDS,
+                       hyp->N, hyp->ll);
+}
+
+/* Move the hypotheses back from amb_test->pool, indexing them on their first
+ * num_dds ambiguities as they are added. */
+static void hyps_from_pool(ambiguity_test_t *amb_test, u8 num_dds)
+{
+  hypothesis_store_clear(&amb_test->hyps);
+  hypothesis_store_reindex(&amb_test->hyps, num_dds);
+  memory_pool_map(amb_test->pool, &amb_test->hyps, &append_hyp);
 }
 
 /** Gets the hypothesis out of an ambiguity test struct, if there is only one.
@@ -76,47 +272,27 @@ void destroy_ambiguity_test(ambiguity_test_t *amb_test)
  */
 s8 get_single_hypothesis(ambiguity_test_t *amb_test, s32 *hyp_N)
 {
-  if (memory_pool_n_allocated(amb_test->pool) == 1) {
-    hypothesis_t hyp;
-    memory_pool_to_array(amb_test->pool, &hyp);
-    memcpy(hyp_N, hyp.N, (amb_test->sats.num_sats-1) * sizeof(s32));
+  if (amb_test->hyps.n == 1) {
+    hypothesis_store_get(&amb_test->hyps, 0, amb_test->sats.num_sats-1, hyp_N);
     return 0;
   }
   return -1;
 }
 
-/** A struct to be used as the x in a memory pool fold, checking set membership.
- * Used in fold_contains().
- */
-typedef struct {
-  u8 num_dds;             /**< The number of double differences in the hypotheses. */
-  s32 N[MAX_CHANNELS-1];  /**< The ambiguity vector being searched for. */
-  u8 found;               /**< Whether or not the ambiguity vector is found yet. */
-} fold_contains_t;
-
-/** A memory pool fold method to check if a hypothesis is in the pool.
- *
- * Should be used in memory_pool_fold().
- *
- * \param x    The accumulator. Contains the hypothesis and whether it's found.
- * \param elem The hypothesis being folded against (checked for match).
- */
-void fold_contains(void *x, element_t *elem)
+/* Make sure the hash index of the hypotheses is keyed on the current number
+ * of ambiguities. It is normally kept up to date as the hypotheses change, so
+ * this only rebuilds it after changes made outside of this file. */
+static void index_hyps(ambiguity_test_t *amb_test)
 {
-  fold_contains_t *acc = (fold_contains_t *) x;
-  hypothesis_t *hyp = (hypothesis_t *) elem;
-  if (acc->found == 1) {
-    return;
-  }
-  for (u8 i=0; i<acc->num_dds; i++) {
-    if (hyp->N[i] != acc->N[i]) {
-      return;
-    }
+  hypothesis_store_t *hyps = &amb_test->hyps;
+  u8 num_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
+  if (!hyps->indexed || hyps->index_dds != num_dds) {
+    hypothesis_store_reindex(hyps, num_dds);
   }
-  acc->found = 1;
 }
 
 /** Tests whether an ambiguity test has a particular hypothesis.
+ * Takes constant time, using the hash index of the hypotheses.
  *
  * \param amb_test    The test to check against.
  * \param ambs        The ambiguity hypothesis to look for.
@@ -124,48 +300,19 @@ void fold_contains(void *x, element_t *elem)
  */
 u8 ambiguity_test_pool_contains(ambiguity_test_t *amb_test, double *ambs)
 {
-  fold_contains_t acc;
-  acc.num_dds = amb_test->sats.num_sats-1;
-  for (u8 i=0; i<acc.num_dds; i++) {
-    acc.N[i] = lround(ambs[i]);
-  }
-  acc.found = 0;
-  memory_pool_fold(amb_test->pool, (void *) &acc, &fold_contains);
-  return acc.found;
-}
-
-
-/** A struct to be used in a memory pool fold to find the most likely hypothesis.
- * Should be used in fold_mle().
- */
-typedef struct {
-  u8 started;            /**< Whether the test has actually been started yet. */
-  double max_ll;         /**< The likelihood of the most likely hypothesis so far. */
-  u8 num_dds;            /**< The number of double differences in the hypotheses being tested. */
-  s32 N[MAX_CHANNELS-1]; /**< The most likely hypothesis so far. */
-} fold_mle_t; // fold omelette
-
-/** A memory pool fold method to find the max likelihood estimate of the ambiguities.
- *
- * Should be used in memory_pool_fold().
- *
- * \param x     The fold accumulator. Contains the MLE and supporting fields.
- * \param elem  The hypothesis to fold.
- */
-void fold_mle(void *x, element_t *elem)
-{
-  hypothesis_t *hyp = (hypothesis_t *) elem;
-  fold_mle_t *mle = (fold_mle_t *) x;
-  if (mle->started == 0 || hyp->ll > mle->max_ll) {
-    mle->started = 1;
-    mle->max_ll = hyp->ll;
-    memcpy(mle->N, hyp->N, mle->num_dds * sizeof(s32));
+  u8 num_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
+  s32 N[num_dds];
+  for (u8 k=0; k<num_dds; k++) {
+    N[k] = lround(ambs[k]);
   }
+  index_hyps(amb_test);
+  return hypothesis_store_find(&amb_test->hyps, num_dds, N) >= 0;
 }
 
 /** Performs max likelihood estimation on an ambiguity test.
  *
  * Assuming an ambiguity test already has hypotheses, finds the MLE hypothesis.
+ * Takes constant time, the MLE is tracked as the hypotheses are updated.
  * WARNING: Does not handle the case where the test is not populated.
  *
  * \param amb_test  The ambiguity test to perform MLE in.
@@ -173,11 +320,13 @@ void fold_mle(void *x, element_t *elem)
  */
 void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs)
 {
-  fold_mle_t mle;
-  mle.started = 0;
-  mle.num_dds = CLAMP_DIFF(amb_test->sats.num_sats, 1);
-  memory_pool_fold(amb_test->pool, (void *) &mle, &fold_mle);
-  memcpy(ambs, mle.N, mle.num_dds * sizeof(s32));
+  index_hyps(amb_test);
+  s32 mle = hypothesis_store_mle(&amb_test->hyps);
+  if (mle < 0) {
+    return;
+  }
+  hypothesis_store_get(&amb_test->hyps, mle,
+                       CLAMP_DIFF(amb_test->sats.num_sats, 1), ambs);
 }
 
 /** Updates the IAR process with new measurements.
@@ -191,6 +340,8 @@ void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs)
  * \todo Return error codes?
  *
  * \param ref_ecef    The ecef coordinate to pretend we are at to use relative to the sats.
+ * \param b           Float estimate of the baseline [m], only used to decide
+ *                    when the residual matrices need rebuilding.
  * \param phase_var   The variance of the carrier phase measurements.
  * \param code_var    The variance of the code pseudorange measurements.
  * \param amb_test    The ambiguity test to update.
@@ -201,14 +352,18 @@ void ambiguity_test_MLE_ambs(ambiguity_test_t *amb_test, s32 *ambs)
  * \param float_cov_U The U in the UDU' decomposition of the covariance of the float estimate.
  * \param float_cov_D The D in the UDU' decomposition of the covariance of the float estimate.
  *
- *  INVALIDATES unanimous ambiguities
+ *  Updates the unanimous ambiguities if the hypotheses are tested,
+ *  otherwise INVALIDATES them.
  */
-void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var,
+void update_ambiguity_test(double ref_ecef[3], const double b[3],
+                           double phase_var, double code_var,
                            ambiguity_test_t *amb_test, u8 state_dim, sdiff_t *sdiffs,
                            u8 changed_sats)
 {
   DEBUG_ENTRY();
 
+  amb_test->amb_check.initialized = 0;
+
   u8 num_sdiffs = state_dim + 1;
 
   if (amb_test->sats.num_sats < 5) {
@@ -228,30 +383,11 @@ void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var
     return;
   }
 
-  if (1 == 1 || changed_sats == 1) { //TODO add logic about when to update DE
-    double DE_mtx[(amb_test->sats.num_sats-1) * 3];
-    assign_de_mtx(amb_test->sats.num_sats, ambiguity_sdiffs, ref_ecef, DE_mtx);
-    double obs_cov[(amb_test->sats.num_sats-1) * (amb_test->sats.num_sats-1) * 4];
-    memset(obs_cov, 0, (amb_test->sats.num_sats-1) * (amb_test->sats.num_sats-1) * 4 * sizeof(double));
-    u8 num_dds = amb_test->sats.num_sats-1;
-    for (u8 i=0; i<num_dds; i++) {
-      for (u8 j=0; j<num_dds; j++) {
-        u8 i_ = i+num_dds;
-        u8 j_ = j+num_dds;
-        if (i==j) {
-          obs_cov[i*2*num_dds + j] = phase_var * 2;
-          obs_cov[i_*2*num_dds + j_] = code_var * 2;
-        }
-        else {
-          obs_cov[i*2*num_dds + j] = phase_var;
-          obs_cov[i_*2*num_dds + j_] = code_var;
-        }
-      }
-    }
-    // MAT_PRINTF(DE_mtx, ((u32) amb_test->sats.num_sats-1), 3);
-    // MAT_PRINTF(obs_cov, 2*num_dds, 2*num_dds);
-    init_residual_matrices(&amb_test->res_mtxs, amb_test->sats.num_sats-1, DE_mtx, obs_cov);
-  }
+  u8 num_dds = amb_test->sats.num_sats-1;
+  double DE_mtx[num_dds * 3];
+  assign_de_mtx(amb_test->sats.num_sats, ambiguity_sdiffs, ref_ecef, DE_mtx);
+  update_residual_matrices(&amb_test->res_mtxs, num_dds, DE_mtx, b,
+                           phase_var, code_var, changed_sats != 0);
 
   test_ambiguities(amb_test, ambiguity_dd_measurements);
 
@@ -265,163 +401,326 @@ void update_ambiguity_test(double ref_ecef[3], double phase_var, double code_var
  */
 u32 ambiguity_test_n_hypotheses(ambiguity_test_t *amb_test)
 {
-  return memory_pool_n_allocated(amb_test->pool);
+  return amb_test->hyps.n;
 }
 
-/** A memory pool filter to do most everything related to the estimation algorithm.
- * To be used by update_and_get_max_ll() and filter_and_renormalize().
- */
+/** A hypothesis store split into chunks that can be worked on concurrently.
+ * Each chunk is a contiguous range of hypotheses, the per-chunk results are
+ * combined once every chunk has finished. */
 typedef struct {
-  u8 num_dds;                                 /**< Number of ambiguities. */
-  double r_vec[2*MAX_CHANNELS-5];             /**< Transformed measurement to check hypotheses against. */
-  double max_ll;                              /**< The greatest log likelihood in the pool so far. */
-  residual_mtxs_t *res_mtxs;                  /**< Matrices necessary for testing hypotheses. */
-  unanimous_amb_check_t *unanimous_amb_check; /**< A struct to check which int ambs are agreed upon among all hyps. */
-} hyp_filter_t;
-
-/** A mapAccum styled function to update the hypothesis log-likelihoods and find the greatest LL.
- * Simultaneously performs a map, doing a Bayesian update of the log likelihoods
- * of each hypothesis, while performing a fold on those updated log likelihoods
- * to find the likelihood of the MLE hypothesis.
+  hypothesis_store_t *hyps;
+  u8 num_dds;
+  u32 n_chunks;
+  u32 chunk_size;
+  const quadratic_expansion_t *qe;
+  double chunk_max_ll[PARALLEL_MAX_THREADS];
+  u32 chunk_n[PARALLEL_MAX_THREADS];
+  s32 chunk_ambs[PARALLEL_MAX_THREADS][HYPOTHESIS_STORE_MAX_DDS];
+  u8 chunk_unanimous[PARALLEL_MAX_THREADS][HYPOTHESIS_STORE_MAX_DDS];
+} hypothesis_chunks_t;
+
+/** Split a hypothesis store into one chunk per thread.
+ * Small stores are split into fewer chunks, down to one, so that each chunk
+ * has at least HYPOTHESIS_CHUNK_MIN hypotheses. Chunks start on a multiple
+ * of HYPOTHESIS_STORE_ALIGN.
+ *
+ * \param chunks  Chunking to initialize.
+ * \param hyps    The hypotheses to split.
+ * \param num_dds Number of ambiguities in the hypotheses.
+ */
+static void split_hypotheses(hypothesis_chunks_t *chunks,
+                             hypothesis_store_t *hyps, u8 num_dds)
+{
+  chunks->hyps = hyps;
+  chunks->num_dds = num_dds;
+  u32 n_chunks = MIN((u32) parallel_n_threads(), hyps->n / HYPOTHESIS_CHUNK_MIN);
+  n_chunks = MAX(n_chunks, 1);
+  chunks->chunk_size = HYPOTHESIS_STORE_STRIDE((hyps->n + n_chunks - 1) / n_chunks);
+  chunks->n_chunks = hyps->n == 0 ? 0
+                   : (hyps->n + chunks->chunk_size - 1) / chunks->chunk_size;
+}
+
+static void chunk_range(const hypothesis_chunks_t *chunks, u32 c,
+                        u32 *start, u32 *end)
+{
+  *start = c * chunks->chunk_size;
+  *end = MIN(*start + chunks->chunk_size, chunks->hyps->n);
+}
+
+/** Test, filter and compact one chunk of hypotheses in a single pass.
  *
- * If a single observation was sufficiently unlikely to come from this hypothesis, we reject
- * the hypothesis. (In addition to the accumulated relative likelihood that is filtered upon later).
+ * Does a Bayesian update of the log likelihood of each hypothesis while
+ * keeping track of the greatest log likelihood in the chunk. A hypothesis is
+ * dropped if a single observation was sufficiently unlikely to come from it,
+ * or if its accumulated log likelihood falls below the threshold.
  *
- * To be given to memory_pool_fold().
+ * The thresholding is done before the normalization for both numerical
+ * stability, and so that hypotheses which are just REALLY BAD are removed,
+ * even if they are the best we have. This is a kinda arbitrary choice of how
+ * to do things. Maybe we should see if it has practical implications?
  *
- * \param x     Points to a hyp_filter_t containing the accumulator and everything needed for the map.
- * \param elem  The hypothesis to be mapAccum'd.
+ * The hypotheses are worked on a block at a time. The survivors of each
+ * block are moved down to the start of the chunk while the block is still in
+ * cache, and are checked for agreement with the first survivor along the way.
+ * Renormalization needs the greatest log likelihood over all chunks so it is
+ * left to the caller.
  */
-s8 update_and_get_max_ll(void *x_, element_t *elem) {
-  hyp_filter_t *x = (hyp_filter_t *) x_;
-  hypothesis_t *hyp = (hypothesis_t *) elem;
-  double hypothesis_N[x->num_dds];
-
-  for (u8 i=0; i < x->num_dds; i++) {
-    hypothesis_N[i] = hyp->N[i];
-  }
-  double q = get_quadratic_term(x->res_mtxs, x->num_dds, hypothesis_N, x->r_vec);
-  hyp->ll += q;
-  x->max_ll = MAX(x->max_ll, hyp->ll);
-  return (abs(q) < SINGLE_OBS_CHISQ_THRESHOLD);
-  /* Doesn't appear to need a dependence on d.o.f. to be effective.
-   * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
-}
-
-/** Keeps track of which integer ambiguities are uninimously agreed upon in the pool.
- * \param num_dds   The number of DDs in each hypothesis. (Used to initialize amb_check).
- * \param hyp       The hypothesis to be checked against.
- * \param amb_check Keeps track of which ambs are still unanimous and their values.
- */
-void check_unanimous_ambs(u8 num_dds, hypothesis_t *hyp,
-                          unanimous_amb_check_t *amb_check)
-{
-  if (amb_check->initialized) {
-    u8 j = 0; // index in newly constructed amb_check matches
-    for (u8 i = 0; i < amb_check->num_matching_ndxs; i++) {
-      if (amb_check->ambs[i] == hyp->N[amb_check->matching_ndxs[i]]) {
-        if (i != j) { //  j <= i necessarily
-          amb_check->matching_ndxs[j] = amb_check->matching_ndxs[i];
-          amb_check->ambs[j] = amb_check->ambs[i];
-        }
-        j++;
+static void test_chunk(void *arg, u32 c)
+{
+  hypothesis_chunks_t *chunks = (hypothesis_chunks_t *) arg;
+  hypothesis_store_t *hyps = chunks->hyps;
+  u8 num_dds = chunks->num_dds;
+  s32 *ambs = chunks->chunk_ambs[c];
+  u8 *unanimous = chunks->chunk_unanimous[c];
+  u32 start, end;
+  chunk_range(chunks, c, &start, &end);
+
+  memset(unanimous, 1, num_dds);
+  double max_ll = -1e20;
+  u32 n = start;
+  for (u32 i0=start; i0<end; i0+=QUADRATIC_TERMS_BLOCK) {
+    u32 m = MIN(QUADRATIC_TERMS_BLOCK, end - i0);
+    float q[QUADRATIC_TERMS_BLOCK];
+    u8 keep[QUADRATIC_TERMS_BLOCK];
+    get_quadratic_terms(chunks->qe, m, &hyps->N[i0], hyps->stride, q);
+
+    u32 n_block = n;
+    for (u32 j=0; j<m; j++) {
+      float ll = hyps->ll[i0 + j] + q[j];
+      max_ll = MAX(max_ll, ll);
+      /* Doesn't appear to need a dependence on d.o.f. to be effective.
+       * We should revisit SINGLE_OBS_CHISQ_THRESHOLD when our noise model is tighter. */
+      keep[j] = (fabsf(q[j]) < SINGLE_OBS_CHISQ_THRESHOLD) &&
+                (ll > LOG_PROB_RAT_THRESHOLD);
+      if (keep[j]) {
+        hyps->ll[n_block++] = ll;
       }
     }
-    amb_check->num_matching_ndxs = j;
-  } else {
-    amb_check->initialized = 1;
-    amb_check->num_matching_ndxs = num_dds;
-    for (u8 i=0; i < num_dds; i++) {
-      amb_check->matching_ndxs[i] = i;
+
+    for (u8 k=0; k<num_dds; k++) {
+      s32 *col = &hyps->N[k*hyps->stride];
+      u32 nk = n;
+      for (u32 j=0; j<m; j++) {
+        if (keep[j]) {
+          s32 v = col[i0 + j];
+          if (nk == start) {
+            ambs[k] = v;
+          } else {
+            unanimous[k] &= (v == ambs[k]);
+          }
+          col[nk++] = v;
+        }
+      }
     }
-    memcpy(amb_check->ambs, hyp->N, num_dds * sizeof(s32));
+    n = n_block;
   }
+
+  chunks->chunk_max_ll[c] = max_ll;
+  chunks->chunk_n[c] = n - start;
 }
 
-/** A combination fold/map/filter to renormalize the log likelihoods and remove unlikely hyps.
+/** Combine the unanimous ambiguities found in each chunk.
+ * An ambiguity is unanimous if it has the same value in every hypothesis of
+ * every non-empty chunk.
  *
- * The log likelihood of the hypotheses are filtered against a threshold.
- * Those hypotheses that make the cut are (1) normalized such that the MLE has
- * value 0, making them logs of the probability ratio against the MLE hyp,
- * and (2) checked to see if any of their integer ambiguities are unanimous
- * amongst all hypotheses in the test pool.
- *
- * The thresholding is done before the normalization for both numerical
- * stability, and so that hypotheses which are just REALLY BAD are removed,
- * even if they are the best we have. This is a kinda arbitrary choice of how
- * to do things. Maybe we should see if it has practical implications?
+ * \param chunks    Chunks with per-chunk unanimity filled in.
+ * \param amb_check Keeps track of which ambs are unanimous and their values.
+ */
+static void merge_unanimous_ambs(const hypothesis_chunks_t *chunks,
+                                 unanimous_amb_check_t *amb_check)
+{
+  s32 first = -1;
+  for (u32 c=0; c<chunks->n_chunks; c++) {
+    if (chunks->chunk_n[c] > 0) {
+      first = c;
+      break;
+    }
+  }
+  amb_check->initialized = (first >= 0);
+  amb_check->num_matching_ndxs = 0;
+  if (first < 0) {
+    return;
+  }
+
+  u8 j = 0; // index in newly constructed amb_check matches
+  for (u8 k=0; k<chunks->num_dds; k++) {
+    s32 amb = chunks->chunk_ambs[first][k];
+    u8 unanimous = 1;
+    for (u32 c=first; c<chunks->n_chunks && unanimous; c++) {
+      if (chunks->chunk_n[c] > 0) {
+        unanimous = chunks->chunk_unanimous[c][k] &&
+                    chunks->chunk_ambs[c][k] == amb;
+      }
+    }
+    if (unanimous) {
+      amb_check->matching_ndxs[j] = k;
+      amb_check->ambs[j] = amb;
+      j++;
+    }
+  }
+  amb_check->num_matching_ndxs = j;
+}
+
+/** Update, filter and renormalize the hypotheses, and find the unanimous
+ * ambiguities among those that survive.
  *
- * This function is used by memory_pool_filter().
+ * Each chunk is tested and compacted in parallel by test_chunk(). The chunks
+ * are then moved down to close the gaps between them, keeping the order of
+ * the hypotheses. Only the log likelihoods are touched again afterwards, to
+ * normalize them such that the MLE has value 0, making them logs of the
+ * probability ratio against the MLE hyp. The most likely survivor is found
+ * in the same pass, and the hash index is rebuilt if any hypotheses were
+ * removed.
  *
- * \param arg     The accumulator/map/filter information
- * \param elem    The hypothesis to be mapped/filtered/folded against.
- * \return        Whether or not this hypothesis made the cut.
+ * \param hyps      The hypotheses to test.
+ * \param res_mtxs  Matrices necessary for testing hypotheses.
+ * \param num_dds   Number of ambiguities.
+ * \param r_vec     Transformed measurement to check hypotheses against.
+ * \param amb_check Set to the ambiguities unanimous among the survivors.
  */
-s8 filter_and_renormalize(void *arg, element_t *elem) {
-  hypothesis_t *hyp = (hypothesis_t *) elem;
+static void test_and_filter(hypothesis_store_t *hyps, residual_mtxs_t *res_mtxs,
+                            u8 num_dds, double *r_vec,
+                            unanimous_amb_check_t *amb_check)
+{
+  hypothesis_chunks_t chunks;
+  split_hypotheses(&chunks, hyps, num_dds);
+  if (chunks.n_chunks == 0) {
+    amb_check->initialized = 0;
+    return;
+  }
+
+  /* The hypotheses are all close together, expand about the first one. */
+  s32 N0[num_dds];
+  hypothesis_store_get(hyps, 0, num_dds, N0);
+  quadratic_expansion_t qe;
+  expand_quadratic_term(res_mtxs, num_dds, N0, r_vec, &qe);
+  chunks.qe = &qe;
 
-  u8 keep_it = (hyp->ll > LOG_PROB_RAT_THRESHOLD);
-  if (keep_it) {
-    hyp->ll -= ((hyp_filter_t *) arg)->max_ll;
+  parallel_for(chunks.n_chunks, test_chunk, &chunks);
+
+  double max_ll = -1e20; // TODO get the first element, or use this as threshold to restart test
+  for (u32 c=0; c<chunks.n_chunks; c++) {
+    max_ll = MAX(max_ll, chunks.chunk_max_ll[c]);
+  }
+
+  u32 n_tested = hyps->n;
+  u32 n = 0;
+  for (u32 c=0; c<chunks.n_chunks; c++) {
+    hypothesis_store_move(hyps, num_dds, n, c * chunks.chunk_size,
+                          chunks.chunk_n[c]);
+    n += chunks.chunk_n[c];
   }
-  return keep_it;
+  hyps->n = n;
+  u32 mle = 0;
+  for (u32 i=0; i<n; i++) {
+    hyps->ll[i] -= max_ll;
+    if (hyps->ll[i] > hyps->ll[mle]) {
+      mle = i;
+    }
+  }
+
+  if (n == n_tested && hyps->indexed && hyps->index_dds == num_dds) {
+    /* Nothing moved, the index still holds. */
+    hyps->mle = mle;
+  } else {
+    hypothesis_store_reindex(hyps, num_dds);
+  }
+
+  merge_unanimous_ambs(&chunks, amb_check);
 }
 
-static void _check_unanimous(void *arg, element_t *elem)
+/** Find which ambiguities are the same for every hypothesis in one chunk. */
+static void unanimous_chunk(void *arg, u32 c)
 {
-  hypothesis_t *hyp = (hypothesis_t *) elem;
+  hypothesis_chunks_t *chunks = (hypothesis_chunks_t *) arg;
+  const hypothesis_store_t *hyps = chunks->hyps;
+  u32 start, end;
+  chunk_range(chunks, c, &start, &end);
+
+  for (u8 k=0; k<chunks->num_dds; k++) {
+    const s32 *col = &hyps->N[k*hyps->stride];
+    u32 i = start + 1;
+    while (i < end && col[i] == col[start]) {
+      i++;
+    }
+    chunks->chunk_ambs[c][k] = col[start];
+    chunks->chunk_unanimous[c][k] = (i == end);
+  }
+  chunks->chunk_n[c] = end - start;
+}
 
-  check_unanimous_ambs(((hyp_filter_t *) arg)->num_dds, hyp,
-                       ((hyp_filter_t *) arg)->unanimous_amb_check);
+/** Finds which integer ambiguities are unanimously agreed upon in the pool.
+ * Each chunk is checked in parallel, an ambiguity is unanimous if it is
+ * unanimous within every chunk with the same value.
+ *
+ * \param num_dds   The number of DDs in each hypothesis.
+ * \param hyps      The hypotheses to check.
+ * \param amb_check Keeps track of which ambs are unanimous and their values.
+ */
+static void check_unanimous_ambs(u8 num_dds, hypothesis_store_t *hyps,
+                                 unanimous_amb_check_t *amb_check)
+{
+  hypothesis_chunks_t chunks;
+  split_hypotheses(&chunks, hyps, num_dds);
+  parallel_for(chunks.n_chunks, unanimous_chunk, &chunks);
+  merge_unanimous_ambs(&chunks, amb_check);
 }
 
 void update_unanimous_ambiguities(ambiguity_test_t *amb_test)
 {
-  hyp_filter_t x;
   if (amb_test->sats.num_sats <= 1) {
     amb_test->amb_check.num_matching_ndxs = 0;
     return;
   }
-  x.num_dds = amb_test->sats.num_sats-1;
-  x.unanimous_amb_check = &amb_test->amb_check;
-  x.unanimous_amb_check->initialized = 0;
-
-  memory_pool_map(amb_test->pool, (void *) &x, &_check_unanimous);
+  check_unanimous_ambs(amb_test->sats.num_sats-1, &amb_test->hyps,
+                       &amb_test->amb_check);
 }
 
 /* Updates the IAR hypothesis pool log likelihood ratios and filters them.
  *  It assumes that the observations are structured to match the amb_test sats.
- *  INVALIDATES unanimous ambiguities
+ *  Also updates the unanimous ambiguities, in the same pass over the pool.
  */
 void test_ambiguities(ambiguity_test_t *amb_test, double *dd_measurements)
 {
   DEBUG_ENTRY();
 
-  hyp_filter_t x;
-  x.num_dds = amb_test->sats.num_sats-1;
-  assign_r_vec(&amb_test->res_mtxs, x.num_dds, dd_measurements, x.r_vec);
-  x.max_ll = -1e20; // TODO get the first element, or use this as threshold to restart test
-  x.res_mtxs = &amb_test->res_mtxs;
-  x.unanimous_amb_check = &amb_test->amb_check;
-  x.unanimous_amb_check->initialized = 0;
-
-  memory_pool_filter(amb_test->pool, (void *) &x, &update_and_get_max_ll);
-  memory_pool_filter(amb_test->pool, (void *) &x, &filter_and_renormalize);
-  if (memory_pool_empty(amb_test->pool)) {
+  u8 num_dds = amb_test->sats.num_sats-1;
+  double r_vec[2*MAX_CHANNELS-5];
+  assign_r_vec(&amb_test->res_mtxs, num_dds, dd_measurements, r_vec);
+
+  hypothesis_store_t *hyps = &amb_test->hyps;
+  u32 n_tested = hyps->n;
+  clock_t start = hyps_time_budget > 0 ? clock() : (clock_t) -1;
+
+  test_and_filter(hyps, &amb_test->res_mtxs, num_dds, r_vec,
+                  &amb_test->amb_check);
+
+  if (start != (clock_t) -1 && n_tested > 0) {
+    clock_t end = clock();
+    if (end != (clock_t) -1) {
+      double cost = (double) (end - start) / CLOCKS_PER_SEC / n_tested;
+      /* Smooth the measurement, clock() is coarse on some platforms. It also
+       * counts processor time over all threads, so with parallel_for() threads
+       * the budget errs on the safe side. */
+      hyps_time_cost = hyps_time_cost > 0 ? 0.9 * hyps_time_cost + 0.1 * cost
+                                          : cost;
+    }
+  }
+  if (hyps->n == 0) {
     log_debug("Ambiguity pool empty\n");
     /* Initialize pool with single element with num_dds = 0, i.e.
      * zero length N vector, i.e. no satellites. When we take the
      * product of this single element with the set of new satellites
      * we will just get a set of elements corresponding to the new sats. */
-    hypothesis_t *empty_element = (hypothesis_t *)memory_pool_add(amb_test->pool);
     /* Start with ll = 0, just for the sake of argument. */
-    empty_element->ll = 0;
+    hypothesis_store_reindex(hyps, 0);
+    hypothesis_store_add(hyps, 0, NULL, 0);
     amb_test->sats.num_sats = 0;
     amb_test->amb_check.initialized = 0;
   }
   if (DEBUG) {
-    memory_pool_map(amb_test->pool, &x.num_dds, &print_hyp);
-    printf("num_unanimous_ndxs=%u\n", x.unanimous_amb_check->num_matching_ndxs);
+    print_hypothesis_store(num_dds, &amb_test->hyps);
+    printf("num_unanimous_ndxs=%u\n", amb_test->amb_check.num_matching_ndxs);
   }
 
   DEBUG_EXIT();
@@ -780,7 +1079,15 @@ u8 ambiguity_update_reference(ambiguity_test_t *amb_test, const u8 num_sdiffs, c
       rebase_prns_t prns = {.num_sats = amb_test->sats.num_sats};
       memcpy(prns.old_prns, old_prns, amb_test->sats.num_sats * sizeof(u8));
       memcpy(prns.new_prns, new_prns, amb_test->sats.num_sats * sizeof(u8));
-      memory_pool_map(amb_test->pool, &prns, &rebase_hypothesis);
+      hypothesis_store_t *hyps = &amb_test->hyps;
+      u8 num_dds = CLAMP_DIFF(prns.num_sats, 1);
+      for (u32 i=0; num_dds > 0 && i<hyps->n; i++) {
+        hypothesis_t hyp;
+        hypothesis_store_get(hyps, i, num_dds, hyp.N);
+        rebase_hypothesis(&prns, (element_t *)&hyp);
+        hypothesis_store_set(hyps, i, num_dds, hyp.N);
+      }
+      hypothesis_store_reindex(hyps, num_dds);
     }
   }
 
@@ -854,12 +1161,14 @@ u8 ambiguity_sat_projection(ambiguity_test_t *amb_test, const u8 num_dds_in_inte
   memcpy(intersection.intersection_ndxs, dd_intersection_ndxs, num_dds_in_intersection * sizeof(u8));
 
 
-  log_info("IAR: %"PRIu32" hypotheses before projection\n", memory_pool_n_allocated(amb_test->pool));
+  log_info("IAR: %"PRIu32" hypotheses before projection\n", amb_test->hyps.n);
+  hyps_to_pool(amb_test);
   memory_pool_group_by(amb_test->pool,
                        &intersection, &projection_comparator,
                        &intersection, sizeof(intersection),
                        &projection_aggregator);
-  log_info("IAR: updates to %"PRIu32"\n", memory_pool_n_allocated(amb_test->pool));
+  hyps_from_pool(amb_test, num_dds_in_intersection);
+  log_info("IAR: updates to %"PRIu32"\n", amb_test->hyps.n);
   log_info("After projection, num_sats = %d", num_dds_in_intersection + 1);
   u8 work_prns[MAX_CHANNELS];
   memcpy(work_prns, amb_test->sats.prns, amb_test->sats.num_sats * sizeof(u8));
@@ -950,6 +1259,144 @@ void fold_intersection_count(void *arg, element_t *elem)
                   x->itr_lower_bounds, x->itr_upper_bounds));
 }
 
+/* Integer division rounding towards minus infinity. */
+static s64 floor_div(s64 a, s64 b)
+{
+  s64 q = a / b;
+  if (a % b != 0 && ((a < 0) != (b < 0))) {
+    q--;
+  }
+  return q;
+}
+
+static s64 ceil_div(s64 a, s64 b)
+{
+  return -floor_div(-a, b);
+}
+
+/* Step counter[1..] to the next row of the iteration box, keeping zimage up
+ * to date. Returns 0 once every row has been visited. */
+static u8 next_intersection_row(intersection_count_t *x)
+{
+  u8 full_dim = x->old_dim + x->new_dim;
+  for (u8 j = 1; j < x->new_dim; j++) {
+    if (x->counter[j] < x->itr_upper_bounds[j]) {
+      x->counter[j]++;
+      vec_plus(x->new_dim, full_dim, x->zimage, x->Z, 1, j);
+      return 1;
+    }
+    vec_plus(x->new_dim, full_dim, x->zimage, x->Z,
+             x->itr_lower_bounds[j] - x->counter[j], j);
+    x->counter[j] = x->itr_lower_bounds[j];
+  }
+  return 0;
+}
+
+/** Count the new hypotheses that lie inside the V1 box.
+ * Gives the same count as folding fold_intersection_count() over the
+ * hypotheses, but prunes with the box bounds so that most of the iteration
+ * box is never visited:
+ *  - Over the whole iteration box each V1 coordinate ranges over an interval
+ *    about the image of the old hypothesis. Hypotheses whose interval misses
+ *    the V1 box on any coordinate contribute nothing and are skipped.
+ *  - Along the first (fastest) counter dimension each V1 coordinate is
+ *    linear, so the points of a row inside the box form an interval that is
+ *    found directly rather than by testing each point.
+ *
+ * \param x              Intersection state, as set up for the fold.
+ * \param hyps           The current hypotheses, with `x->old_dim` ambiguities.
+ * \param max_count      Stop counting once this many have been found.
+ * \param max_iterations Give up after visiting this many rows. Row counts
+ *                       are saturated at this, so a huge box can't wrap
+ *                       around it.
+ * \return 1 if fewer than `max_count` were found, 0 otherwise or if the count
+ *         took too many iterations.
+ */
+u8 count_intersection(intersection_count_t *x, const hypothesis_store_t *hyps,
+                      u32 max_count, u32 max_iterations)
+{
+  u8 new_dim = x->new_dim;
+  u8 full_dim = x->old_dim + new_dim;
+  x->intersection_size = 0;
+
+  /* Range of Z * (counter - lower_bound) over the iteration box. */
+  s64 delta_lo[full_dim];
+  s64 delta_hi[full_dim];
+  for (u8 i = 0; i < full_dim; i++) {
+    delta_lo[i] = 0;
+    delta_hi[i] = 0;
+    for (u8 j = 0; j < new_dim; j++) {
+      s64 d = (s64) x->Z[i*new_dim + j] *
+              (x->itr_upper_bounds[j] - x->itr_lower_bounds[j]);
+      delta_lo[i] += MIN(d, 0);
+      delta_hi[i] += MAX(d, 0);
+    }
+  }
+  s64 row_len = x->itr_upper_bounds[0] - x->itr_lower_bounds[0];
+  u64 rows_per_hyp = 1;
+  for (u8 j = 1; j < new_dim && rows_per_hyp > 0; j++) {
+    s64 width = (s64) x->itr_upper_bounds[j] - x->itr_lower_bounds[j] + 1;
+    if (width <= 0) {
+      rows_per_hyp = 0;
+    } else if (rows_per_hyp > max_iterations / (u64) width) {
+      rows_per_hyp = (u64) max_iterations + 1;
+    } else {
+      rows_per_hyp *= width;
+    }
+  }
+
+  u64 iterations = 0;
+  hypothesis_t hyp;
+  for (u32 h = 0; h < hyps->n; h++) {
+    hypothesis_store_get(hyps, h, x->old_dim, hyp.N);
+    init_intersection_count_vector(x, &hyp);
+
+    u8 missed = 0;
+    for (u8 i = 0; i < full_dim && !missed; i++) {
+      missed = x->zimage[i] + delta_hi[i] < x->box_lower_bounds[i] ||
+               x->zimage[i] + delta_lo[i] > x->box_upper_bounds[i];
+    }
+    if (missed) {
+      continue;
+    }
+
+    iterations += rows_per_hyp;
+    if (iterations > max_iterations) {
+      return 0;
+    }
+
+    /* Iterate over the rows, i.e. counter[1..] with counter[0] at its lower
+     * bound, and find the interval of t = counter[0] - lower_bound for which
+     * zimage + t * Z[:,0] is inside the box. */
+    do {
+      s64 t_lo = 0;
+      s64 t_hi = row_len;
+      for (u8 i = 0; i < full_dim && t_lo <= t_hi; i++) {
+        s64 a = x->Z[i*new_dim];
+        s64 lo = (s64) x->box_lower_bounds[i] - x->zimage[i];
+        s64 hi = (s64) x->box_upper_bounds[i] - x->zimage[i];
+        if (a > 0) {
+          t_lo = MAX(t_lo, ceil_div(lo, a));
+          t_hi = MIN(t_hi, floor_div(hi, a));
+        } else if (a < 0) {
+          t_lo = MAX(t_lo, ceil_div(hi, a));
+          t_hi = MIN(t_hi, floor_div(lo, a));
+        } else if (lo > 0 || hi < 0) {
+          t_hi = -1;
+        }
+      }
+      if (t_lo <= t_hi) {
+        if (t_hi - t_lo + 1 >= (s64) max_count - x->intersection_size) {
+          x->intersection_size = max_count;
+          return 0;
+        }
+        x->intersection_size += t_hi - t_lo + 1;
+      }
+    } while (next_intersection_row(x));
+  }
+  return 1;
+}
+
 void round_matrix(u32 rows, u32 cols, const double *A, s32 *B)
 {
   for (u8 i=0; i < rows; i++) {
@@ -1100,7 +1547,7 @@ s32 add_sats(ambiguity_test_t *amb_test,
   //round_inverse(x->new_dim, Z_new, s.Z_new_inv);
   s.Z_new_inv = x->Z2_inv;
   remap_prns(amb_test, ref_prn, x->new_dim, added_prns, &s);
-  s32 count = memory_pool_product_generator(amb_test->pool, &s, MAX_HYPOTHESES, sizeof(s),
+  s32 count = memory_pool_product_generator(amb_test->pool, &s, hyps_capacity, sizeof(s),
                   &intersection_init,
                   &intersection_generate_next_hypothesis1,
                   &intersection_hypothesis_prod);
@@ -1139,63 +1586,69 @@ s32 add_sats(ambiguity_test_t *amb_test,
  *  sats to make progress towards an RTK solution (< 4 double differences
  *  total) we return without adding any.
  */
+static u32 decorrelate(const double *addible_float_cov,
+                       const double *addible_float_mean,
+                       u8 num_addible_dds,
+                       u8 num_dds_to_add,
+                       s32 *lower_bounds, s32 *upper_bounds,
+                       double *Z_);
+static void round_decor(u8 dim, const double *Z_, z_t *Z, z_t *Z_inv);
+
 static u8 inclusion_loop_body(
        u8 num_dds_to_add,
-       memory_pool_t *pool, u8 state_dim, u8 num_addible_dds,
+       const hypothesis_store_t *hyps, u8 state_dim, u8 num_addible_dds,
        const double *ordered_N_cov, const double *ordered_N_mean,
        const double *addible_cov, const double *addible_mean,
        intersection_count_t *x, u32 *full_size_return)
 {
   x->new_dim = num_dds_to_add;
-  s32 current_num_hyps = memory_pool_n_allocated(pool);
-  u32 max_num_hyps = memory_pool_n_elements(pool);
+  u32 max_num_hyps = ambiguity_test_max_hypotheses();
 
   u8 num_current_dds = x->old_dim;
   u8 full_dim = num_current_dds + num_dds_to_add;
 
   /* TODO(dsk) tune this constant.
-   * This determines how many hypotheses will be examined by the intersection
-   * memory_pool fold below. */
+   * This determines how many rows of the iteration box will be examined by
+   * the intersection count below. */
   u32 max_iteration_size = 10000;
 
-  /* Calculate the two decorrelation matrices and their related matrices. */
+  /* Calculate the two decorrelations. Each is only done once, and rounded
+   * for use in the intersection count and add_sats(). */
+  double Z1_[full_dim * full_dim];
   u32 full_size =
-    float_to_decor(ordered_N_cov, ordered_N_mean,
+    decorrelate(ordered_N_cov, ordered_N_mean,
         state_dim, full_dim,
-        x->box_lower_bounds, x->box_upper_bounds, x->Z1, x->Z1_inv);
+        x->box_lower_bounds, x->box_upper_bounds, Z1_);
 
   /* Useful for debugging. */
   *full_size_return = full_size;
 
+  double Z2_[num_dds_to_add * num_dds_to_add];
   u32 box_size =
-    float_to_decor(addible_cov, addible_mean,
+    decorrelate(addible_cov, addible_mean,
       num_addible_dds, num_dds_to_add,
-      x->itr_lower_bounds, x->itr_upper_bounds, x->Z2, x->Z2_inv);
+      x->itr_lower_bounds, x->itr_upper_bounds, Z2_);
 
+  round_decor(full_dim, Z1_, x->Z1, x->Z1_inv);
+  round_decor(num_dds_to_add, Z2_, x->Z2, x->Z2_inv);
   compute_Z(num_current_dds, num_dds_to_add, x->Z1, x->Z2_inv, x->Z);
 
   if (full_size <= max_num_hyps) {
     log_debug("BRANCH 1: num dds: %i. full size: %"PRIu32", itr size: %"PRIu32"\n", num_dds_to_add, full_size, box_size);
     /* The hypotheses generated for these double-differences fit. */
     return 1;
-  } else if (box_size * current_num_hyps <= max_iteration_size) {
-    log_debug("BRANCH 2: num dds: %i. full size: %"PRIu32", itr size: %"PRIu32"\n", num_dds_to_add, full_size, box_size);
-
-    x->intersection_size = 0;
+  }
 
-    /* Do intersection */
-    memory_pool_fold(pool, (void *)x, &fold_intersection_count);
+  log_debug("BRANCH 2: num dds: %i. full size: %"PRIu32", itr size: %"PRIu32"\n", num_dds_to_add, full_size, box_size);
 
-    log_debug("intersection size: %i\n", x->intersection_size);
+  /* Do intersection */
+  u8 fits = count_intersection(x, hyps, max_num_hyps, max_iteration_size);
 
-    if (x->intersection_size < max_num_hyps) {
-      /* The hypotheses generated for these double-differences fit. */
-      return 1;
-    }
-  }
+  log_debug("intersection size: %"PRIu32"\n", x->intersection_size);
 
-  /* Can't add sats for this value of num_dds_to_add. */
-  return 0;
+  /* If it fits, the hypotheses generated for these double-differences fit.
+   * Otherwise we can't add sats for this value of num_dds_to_add. */
+  return fits;
 }
 
 /** Perform the inclusion step of adding satellites to the amb test (as we can).
@@ -1215,9 +1668,9 @@ static u8 inclusion_loop_body(
  *          1 if we changed the sats, but don't need to start over.
  *          2 if we need to start over (e.g. we have no hypotheses left).
  */
-u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_intersection,
-                           const sats_management_t *float_sats, const double *float_mean,
-                           const double *float_cov_U, const double *float_cov_D)
+static u8 sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_intersection,
+                        const sats_management_t *float_sats, const double *float_mean,
+                        const double *float_cov_U, const double *float_cov_D)
 {
   if (float_sats->num_sats <= num_dds_in_intersection + 1 || float_sats->num_sats < 5) {
     /* Nothing added if we alread have all the sats or the KF has too few sats
@@ -1306,77 +1759,117 @@ u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_inter
   submatrix(1, state_dim, state_dim, N_mean,
       row_map, reordering, N_mean_ordered);
 
-  /* Initialize intersection struct. */
+  /* Initialize intersection structs. Each probe decorrelates into `x`, and
+   * the largest size found to fit so far is kept in `best` by swapping the
+   * two, so the size finally chosen never has to be decorrelated again. The
+   * counter and zimage are scratch and can be shared. */
   s32 counter[num_addible_dds];
-  s32 lower_bounds1[state_dim];
-  s32 upper_bounds1[state_dim];
-  s32 lower_bounds2[num_addible_dds];
-  s32 upper_bounds2[num_addible_dds];
   z_t zimage[state_dim];
-  z_t Z1[state_dim * state_dim];
-  z_t Z1_inv[state_dim * state_dim];
-  z_t Z2[num_addible_dds * num_addible_dds];
-  z_t Z2_inv[num_addible_dds * num_addible_dds];
-  z_t Z1_Z2_inv[state_dim * num_addible_dds];
-
-  intersection_count_t x;
-  x.new_dim = num_addible_dds;
-  x.old_dim = num_current_dds;
-  x.counter = counter;
-  // TODO(dsk) clarify name in struct
-  x.box_lower_bounds = lower_bounds1;
-  x.box_upper_bounds = upper_bounds1;
-  x.itr_lower_bounds = lower_bounds2;
-  x.itr_upper_bounds = upper_bounds2;
-  x.zimage = zimage;
-  x.Z = Z1_Z2_inv;
-  x.Z1 = Z1;
-  x.Z2 = Z2;
-  x.Z1_inv = Z1_inv;
-  x.Z2_inv = Z2_inv;
+  s32 lower_bounds1[2][state_dim];
+  s32 upper_bounds1[2][state_dim];
+  s32 lower_bounds2[2][num_addible_dds];
+  s32 upper_bounds2[2][num_addible_dds];
+  z_t Z1[2][state_dim * state_dim];
+  z_t Z1_inv[2][state_dim * state_dim];
+  z_t Z2[2][num_addible_dds * num_addible_dds];
+  z_t Z2_inv[2][num_addible_dds * num_addible_dds];
+  z_t Z1_Z2_inv[2][state_dim * num_addible_dds];
+
+  intersection_count_t xs[2];
+  for (u8 k = 0; k < 2; k++) {
+    xs[k].new_dim = num_addible_dds;
+    xs[k].old_dim = num_current_dds;
+    xs[k].counter = counter;
+    // TODO(dsk) clarify name in struct
+    xs[k].box_lower_bounds = lower_bounds1[k];
+    xs[k].box_upper_bounds = upper_bounds1[k];
+    xs[k].itr_lower_bounds = lower_bounds2[k];
+    xs[k].itr_upper_bounds = upper_bounds2[k];
+    xs[k].zimage = zimage;
+    xs[k].Z = Z1_Z2_inv[k];
+    xs[k].Z1 = Z1[k];
+    xs[k].Z2 = Z2[k];
+    xs[k].Z1_inv = Z1_inv[k];
+    xs[k].Z2_inv = Z2_inv[k];
+  }
+  intersection_count_t *x = &xs[0];
+  intersection_count_t *best = &xs[1];
+  intersection_count_t *tmp;
 
   u32 full_size = 0;
 
   /* Check to see if min_dds_to_add will not fit. If so, don't bother
-   * iterating through all the sats below. */
+   * searching through the sats above. */
   u8 fits = inclusion_loop_body(
-      min_dds_to_add, amb_test->pool, state_dim, num_addible_dds,
+      min_dds_to_add, &amb_test->hyps, state_dim, num_addible_dds,
       N_cov_ordered, N_mean_ordered, addible_float_cov, addible_float_mean,
-      &x, &full_size);
+      x, &full_size);
   if (fits == 0) {
+    log_debug("BRANCH 3: covariance too large. full: %"PRIu32"\n", full_size);
+    /* Covariance too large, nothing added. */
     return 0;
   }
-
-  /* Try to add as many dds to the IAR as possible; return 0 if no amount fits. */
-  for (u8 num_dds_to_add = num_addible_dds;
-       num_dds_to_add >= min_dds_to_add;
-       num_dds_to_add--)
-  {
-    u8 fits = inclusion_loop_body(
-        num_dds_to_add, amb_test->pool, state_dim, num_addible_dds,
-        N_cov_ordered, N_mean_ordered, addible_float_cov, addible_float_mean,
-        &x, &full_size);
-
-    if (fits == 1) {
-      /* Sats should be added. The struct x contains new_dim, the correct
-       * number to add, along with the matrices needed to do so . */
-      s32 num_hyps = add_sats(amb_test, ref_prn, new_dd_prns, &x);
-      if (num_hyps == 0) {
-        return 2;
-      } else {
-        return 1;
-      }
+  tmp = best; best = x; x = tmp;
+
+  /* Find the most dds that fit, assuming that if some number of dds fit then
+   * any fewer do too. The most that fit lie in [lo, hi]. Usually everything
+   * fits so try that first, otherwise binary search. */
+  u8 lo = min_dds_to_add;
+  u8 hi = num_addible_dds;
+  if (hi > lo) {
+    if (inclusion_loop_body(hi, &amb_test->hyps, state_dim, num_addible_dds,
+          N_cov_ordered, N_mean_ordered, addible_float_cov, addible_float_mean,
+          x, &full_size)) {
+      lo = hi;
+      tmp = best; best = x; x = tmp;
+    } else {
+      hi--;
     }
   }
-  log_debug("BRANCH 3: covariance too large. full: %"PRIu32"\n", full_size);
-  /* Covariance too large, nothing added. */
-  return 0;
+  while (lo < hi) {
+    u8 mid = (lo + hi + 1) / 2;
+    if (inclusion_loop_body(mid, &amb_test->hyps, state_dim, num_addible_dds,
+          N_cov_ordered, N_mean_ordered, addible_float_cov, addible_float_mean,
+          x, &full_size)) {
+      lo = mid;
+      tmp = best; best = x; x = tmp;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  assert(best->new_dim == lo);
+
+  /* Sats should be added. The struct best contains new_dim, the correct
+   * number to add, along with the matrices needed to do so . */
+  s32 num_hyps = add_sats(amb_test, ref_prn, new_dd_prns, best);
+  if (num_hyps == 0) {
+    return 2;
+  } else {
+    return 1;
+  }
 }
 
+u8 ambiguity_sat_inclusion(ambiguity_test_t *amb_test, const u8 num_dds_in_intersection,
+                           const sats_management_t *float_sats, const double *float_mean,
+                           const double *float_cov_U, const double *float_cov_D)
+{
+  hyps_to_pool(amb_test);
+  u8 ret = sat_inclusion(amb_test, num_dds_in_intersection, float_sats,
+                         float_mean, float_cov_U, float_cov_D);
+  hyps_from_pool(amb_test, CLAMP_DIFF(amb_test->sats.num_sats, 1));
+  return ret;
+}
+
+static void add_sats_old_pool(ambiguity_test_t *amb_test,
+                              u8 ref_prn,
+                              u32 num_added_dds, u8 *added_prns,
+                              s32 *lower_bounds, s32 *upper_bounds,
+                              s32 *Z_inv);
+
 /* TODO(dsk) remove dead code. */
-u8 ambiguity_sat_inclusion_old(ambiguity_test_t *amb_test, u8 num_dds_in_intersection,
-                               sats_management_t *float_sats, double *float_mean,
-                               double *float_cov_U, double *float_cov_D)
+static u8 sat_inclusion_old(ambiguity_test_t *amb_test, u8 num_dds_in_intersection,
+                            sats_management_t *float_sats, double *float_mean,
+                            double *float_cov_U, double *float_cov_D)
 {
   DEBUG_ENTRY();
 
@@ -1443,7 +1936,7 @@ u8 ambiguity_sat_inclusion_old(ambiguity_test_t *amb_test, u8 num_dds_in_interse
                                             lower_bounds, upper_bounds, &num_dds_to_add,
                                             Z_inv);
   if (add_any_sats == 1) {
-    add_sats_old(amb_test, float_prns[0], num_dds_to_add, new_dd_prns, lower_bounds, upper_bounds, Z_inv);
+    add_sats_old_pool(amb_test, float_prns[0], num_dds_to_add, new_dd_prns, lower_bounds, upper_bounds, Z_inv);
     log_debug("adding sats\n");
     DEBUG_EXIT();
     return 1;
@@ -1454,17 +1947,39 @@ u8 ambiguity_sat_inclusion_old(ambiguity_test_t *amb_test, u8 num_dds_in_interse
   }
 }
 
-u32 float_to_decor(const double *addible_float_cov,
-                   const double *addible_float_mean,
-                   u8 num_addible_dds,
-                   u8 num_dds_to_add,
-                   s32 *lower_bounds, s32 *upper_bounds,
-                   z_t *Z, z_t *Z_inv)
+u8 ambiguity_sat_inclusion_old(ambiguity_test_t *amb_test, u8 num_dds_in_intersection,
+                               sats_management_t *float_sats, double *float_mean,
+                               double *float_cov_U, double *float_cov_D)
 {
-  u8 dim = num_dds_to_add;
-  double Z_[dim * dim];
-  double Z_inv_[dim * dim];
+  hyps_to_pool(amb_test);
+  u8 ret = sat_inclusion_old(amb_test, num_dds_in_intersection, float_sats,
+                             float_mean, float_cov_U, float_cov_D);
+  hyps_from_pool(amb_test, CLAMP_DIFF(amb_test->sats.num_sats, 1));
+  return ret;
+}
 
+/** Decorrelate the leading block of a float ambiguity estimate.
+ * Finds the LAMBDA decorrelation of the leading `num_dds_to_add` square
+ * block of the covariance and the box of likely integer ambiguities in the
+ * decorrelated space.
+ *
+ * \param addible_float_cov  Float covariance, `num_addible_dds` square.
+ * \param addible_float_mean Float mean, length `num_addible_dds`.
+ * \param num_addible_dds    Dimension of the float estimate.
+ * \param num_dds_to_add     Dimension of the leading block to decorrelate.
+ * \param lower_bounds       Output lower corner of the search box.
+ * \param upper_bounds       Output upper corner of the search box.
+ * \param Z_                 Output real valued decorrelating transformation.
+ * \return The number of integer points in the search box, saturated at
+ *         `UINT32_MAX`.
+ */
+static u32 decorrelate(const double *addible_float_cov,
+                       const double *addible_float_mean,
+                       u8 num_addible_dds,
+                       u8 num_dds_to_add,
+                       s32 *lower_bounds, s32 *upper_bounds,
+                       double *Z_)
+{
   double added_float_cov[num_dds_to_add * num_dds_to_add];
   for (u8 i=0; i<num_dds_to_add; i++) {
     for (u8 j=0; j<num_dds_to_add; j++) {
@@ -1502,23 +2017,46 @@ u32 float_to_decor(const double *addible_float_cov,
     }
   }
 
-  u32 new_hyp_set_cardinality = 1;
+  /* Saturate rather than wrap, a wrapped count could pass as small. */
+  u64 new_hyp_set_cardinality = 1;
   for (u8 i=0; i<num_dds_to_add; i++) {
     double search_distance = NUM_SEARCH_STDS * sqrt(decor_float_cov_diag[i]);
     upper_bounds[i] = lround(ceil(decor_float_mean[i] + search_distance));
     lower_bounds[i] = lround(floor(decor_float_mean[i] - search_distance));
-    new_hyp_set_cardinality *= upper_bounds[i] - lower_bounds[i] + 1;
+    new_hyp_set_cardinality *= (s64) upper_bounds[i] - lower_bounds[i] + 1;
+    new_hyp_set_cardinality = MIN(new_hyp_set_cardinality, UINT32_MAX);
   }
 
+  return new_hyp_set_cardinality;
+}
+
+/* Rounds a real valued decorrelation and its inverse to integer matrices. */
+static void round_decor(u8 dim, const double *Z_, z_t *Z, z_t *Z_inv)
+{
+  double Z_inv_[dim * dim];
+  round_matrix(dim, dim, Z_, Z);
+  matrix_inverse(dim, Z_, Z_inv_);
+  round_matrix(dim, dim, Z_inv_, Z_inv);
+}
+
+u32 float_to_decor(const double *addible_float_cov,
+                   const double *addible_float_mean,
+                   u8 num_addible_dds,
+                   u8 num_dds_to_add,
+                   s32 *lower_bounds, s32 *upper_bounds,
+                   z_t *Z, z_t *Z_inv)
+{
+  double Z_[num_dds_to_add * num_dds_to_add];
+  u32 cardinality = decorrelate(addible_float_cov, addible_float_mean,
+                                num_addible_dds, num_dds_to_add,
+                                lower_bounds, upper_bounds, Z_);
   if (Z_inv) {
-    round_matrix(dim, dim, Z_, Z);
-    matrix_inverse(dim, Z_, Z_inv_);
-    round_matrix(dim, dim, Z_inv_, Z_inv);
+    round_decor(num_dds_to_add, Z_, Z, Z_inv);
   }
-
-  return new_hyp_set_cardinality;
+  return cardinality;
 }
 
+
 /* TODO(dsk) remove this function. */
 s8 determine_sats_addition(ambiguity_test_t *amb_test,
                            double *float_N_cov, u8 num_float_dds, double *float_N_mean,
@@ -1532,7 +2070,7 @@ s8 determine_sats_addition(ambiguity_test_t *amb_test,
 
   u32 max_new_hyps_cardinality;
   s32 current_num_hyps = memory_pool_n_allocated(amb_test->pool);
-  u32 max_num_hyps = memory_pool_n_elements(amb_test->pool);
+  u32 max_num_hyps = ambiguity_test_max_hypotheses();
   if (current_num_hyps <= 0) {
     max_new_hyps_cardinality = max_num_hyps;
   } else {
@@ -1767,11 +2305,11 @@ static s8 no_init(void *x, element_t *elem) {
   (void) x; (void) elem;
   return 1;
 }
-void add_sats_old(ambiguity_test_t *amb_test,
-                  u8 ref_prn,
-                  u32 num_added_dds, u8 *added_prns,
-                  s32 *lower_bounds, s32 *upper_bounds,
-                  s32 *Z_inv)
+static void add_sats_old_pool(ambiguity_test_t *amb_test,
+                              u8 ref_prn,
+                              u32 num_added_dds, u8 *added_prns,
+                              s32 *lower_bounds, s32 *upper_bounds,
+                              s32 *Z_inv)
 {
   /* Make a generator that iterates over the new hypotheses. */
   generate_hypothesis_state_t x0;
@@ -1830,7 +2368,7 @@ void add_sats_old(ambiguity_test_t *amb_test,
   }
   memcpy(x0.Z_inv, Z_inv, num_added_dds * num_added_dds * sizeof(s32));
   /* Take the product of our current hypothesis state with the generator, recorrelating the new ones as we go. */
-  memory_pool_product_generator(amb_test->pool, &x0, MAX_HYPOTHESES, sizeof(x0),
+  memory_pool_product_generator(amb_test->pool, &x0, hyps_capacity, sizeof(x0),
                                 &no_init, &generate_next_hypothesis, &hypothesis_prod);
   log_info("IAR: updates to %"PRIu32"\n", memory_pool_n_allocated(amb_test->pool));
   if (DEBUG) {
@@ -1838,12 +2376,146 @@ void add_sats_old(ambiguity_test_t *amb_test,
   }
 }
 
+void add_sats_old(ambiguity_test_t *amb_test,
+                  u8 ref_prn,
+                  u32 num_added_dds, u8 *added_prns,
+                  s32 *lower_bounds, s32 *upper_bounds,
+                  s32 *Z_inv)
+{
+  hyps_to_pool(amb_test);
+  add_sats_old_pool(amb_test, ref_prn, num_added_dds, added_prns,
+                    lower_bounds, upper_bounds, Z_inv);
+  hyps_from_pool(amb_test, CLAMP_DIFF(amb_test->sats.num_sats, 1));
+}
+
+/* Fills in the parts of res_mtxs derived from half_res_cov_inv. */
+static void finish_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds)
+{
+  u32 res_dim = res_mtxs->res_dim;
+
+  /* r_mean = M N with M = [null_projector; I], so the part of the quadratic
+   * form that is quadratic in N is N^T M^T half_res_cov_inv M N. */
+  u8 null_dim = res_mtxs->null_space_dim;
+  const double *A = res_mtxs->half_res_cov_inv;
+  const double *P = res_mtxs->null_projector;
+  double AM[res_dim * num_dds];
+  for (u32 a=0; a<res_dim; a++) {
+    for (u8 k=0; k<num_dds; k++) {
+      u32 b = null_dim + k;
+      double acc = a <= b ? A[a*res_dim + b] : A[b*res_dim + a];
+      for (b=0; b<null_dim; b++) {
+        acc += (a <= b ? A[a*res_dim + b] : A[b*res_dim + a]) * P[b*num_dds + k];
+      }
+      AM[a*num_dds + k] = acc;
+    }
+  }
+  for (u8 k=0; k<num_dds; k++) {
+    for (u8 l=0; l<num_dds; l++) {
+      double acc = AM[(null_dim + k)*num_dds + l];
+      for (u8 a=0; a<null_dim; a++) {
+        acc += P[a*num_dds + k] * AM[a*num_dds + l];
+      }
+      res_mtxs->amb_quad[k*num_dds + l] = acc;
+    }
+  }
+}
+
 void init_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds, double *DE_mtx, double *obs_cov)
 {
   res_mtxs->res_dim = num_dds + CLAMP_DIFF(num_dds, 3);
   res_mtxs->null_space_dim = CLAMP_DIFF(num_dds, 3);
+  res_mtxs->dd_num_dds = 0;
   assign_phase_obs_null_basis(num_dds, DE_mtx, res_mtxs->null_projector);
   assign_residual_covariance_inverse(num_dds, obs_cov, res_mtxs->null_projector, res_mtxs->half_res_cov_inv);
+  finish_residual_matrices(res_mtxs, num_dds);
+}
+
+/** Initialize the residual matrices for double differenced observations.
+ * Same as init_residual_matrices() with the double difference observation
+ * covariance `phase_var (I + 11^T)` for the carrier phase and
+ * `code_var (I + 11^T)` for the pseudoranges, but uses that structure to
+ * write down the inverse directly, see
+ * assign_dd_residual_covariance_inverse().
+ *
+ * \param res_mtxs  The residual matrices to initialize.
+ * \param num_dds   Number of double differences.
+ * \param DE_mtx    The double differenced line of sight matrix.
+ * \param phase_var Variance of the single differenced carrier phase.
+ * \param code_var  Variance of the single differenced pseudorange.
+ */
+void init_residual_matrices_dd(residual_mtxs_t *res_mtxs, u8 num_dds,
+                               double *DE_mtx, double phase_var, double code_var)
+{
+  res_mtxs->res_dim = num_dds + CLAMP_DIFF(num_dds, 3);
+  res_mtxs->null_space_dim = CLAMP_DIFF(num_dds, 3);
+  assign_phase_obs_null_basis(num_dds, DE_mtx, res_mtxs->null_projector);
+  assign_dd_residual_covariance_inverse(num_dds, phase_var, code_var,
+                                        res_mtxs->null_projector,
+                                        res_mtxs->half_res_cov_inv);
+  finish_residual_matrices(res_mtxs, num_dds);
+
+  res_mtxs->dd_num_dds = num_dds;
+  res_mtxs->dd_phase_var = phase_var;
+  res_mtxs->dd_code_var = code_var;
+  memcpy(res_mtxs->dd_DE_mtx, DE_mtx, num_dds * 3 * sizeof(double));
+}
+
+/** Update the residual matrices for double differenced observations.
+ * The matrices only depend on the geometry and the observation variances,
+ * which change slowly. They are rebuilt with init_residual_matrices_dd() only
+ * if the number of double differences or the variances have changed, if
+ * `force` is set (e.g. because the satellites changed), or if the geometry
+ * has moved far enough to matter.
+ *
+ * Keeping the null space projector Q built for DE_0 when the geometry is now
+ * DE biases the phase residuals by e = Q (DE - DE_0) b / lambda, with
+ * |e| <= |(DE - DE_0) b| / lambda as the rows of Q are orthonormal. That
+ * shifts the log likelihood ratio of two hypotheses a cycle apart by at most
+ * about |e| / s, where s = p c / (p + c) is the smallest eigenvalue of the
+ * phase residual covariance for the phase and code variances p and c in
+ * cycles^2. The matrices are rebuilt once that could exceed
+ * RESIDUAL_MTXS_LL_TOL. Line of sight vectors move by around 1e-4 per
+ * second, so for a baseline of around a meter the matrices last a couple of
+ * seconds, but on longer baselines they are rebuilt more often, every epoch
+ * if need be.
+ *
+ * \param res_mtxs  The residual matrices to update.
+ * \param num_dds   Number of double differences.
+ * \param DE_mtx    The double differenced line of sight matrix.
+ * \param b         Estimate of the baseline [m], need only be accurate to
+ *                  within a small fraction of its length.
+ * \param phase_var Variance of the single differenced carrier phase.
+ * \param code_var  Variance of the single differenced pseudorange.
+ * \param force     Rebuild the matrices regardless.
+ * \return 1 if the matrices were rebuilt, 0 if they were kept.
+ */
+u8 update_residual_matrices(residual_mtxs_t *res_mtxs, u8 num_dds,
+                            double *DE_mtx, const double b[3],
+                            double phase_var, double code_var, u8 force)
+{
+  u8 changed = force ||
+               res_mtxs->dd_num_dds != num_dds ||
+               res_mtxs->dd_phase_var != phase_var ||
+               res_mtxs->dd_code_var != code_var;
+  if (!changed) {
+    /* Bias of the phase residuals from the stale projector [m]. */
+    double bias2 = 0;
+    for (u8 i=0; i<num_dds; i++) {
+      double e = 0;
+      for (u8 j=0; j<3; j++) {
+        e += (DE_mtx[i*3 + j] - res_mtxs->dd_DE_mtx[i*3 + j]) * b[j];
+      }
+      bias2 += e * e;
+    }
+    double c = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
+    double max_bias = RESIDUAL_MTXS_LL_TOL * phase_var * c / (phase_var + c)
+                      * GPS_L1_LAMBDA_NO_VAC;
+    changed = bias2 > max_bias * max_bias;
+  }
+  if (changed) {
+    init_residual_matrices_dd(res_mtxs, num_dds, DE_mtx, phase_var, code_var);
+  }
+  return changed;
 }
 
 
@@ -1965,6 +2637,91 @@ void assign_residual_covariance_inverse(u8 num_dds, double *obs_cov, double *q,
   // MAT_PRINTF(r_cov_inv, res_dim, res_dim);
 }
 
+/** Inverse of the residual covariance for double differenced observations.
+ * Gives the same result as assign_residual_covariance_inverse() for the
+ * observation covariance `C = diag(p K, c0 K)`, with `K = I + 11^T`, but
+ * without forming or factorizing the `res_dim` square residual covariance.
+ *
+ * With `c = c0 / lambda^2`, the residual covariance `Q~ C Q~^T` has blocks
+ *
+ *     [ p Q K Q^T   p Q K   ]
+ *     [ p K Q^T    (p + c) K ]
+ *
+ * and taking the Schur complement of the lower right block gives
+ *
+ *     [ (p+c)/(pc) G^-1        -1/c G^-1 Q                          ]
+ *     [ -1/c Q^T G^-1   K^-1/(p+c) + p/(c(p+c)) Q^T G^-1 Q ]
+ *
+ * for the inverse, where `G = Q K Q^T = I + u u^T` with `u = Q 1` as the rows
+ * of `Q` are orthonormal. Both `K` and `G` are the identity plus a rank one
+ * term and so are inverted with the Sherman-Morrison formula.
+ *
+ * \param num_dds   Number of double differences.
+ * \param phase_var Variance of the single differenced carrier phase, `p`.
+ * \param code_var  Variance of the single differenced pseudorange, `c0`.
+ * \param q         Orthonormal basis of the phase observation null space.
+ * \param r_cov_inv Output, half the inverse residual covariance.
+ */
+void assign_dd_residual_covariance_inverse(u8 num_dds, double phase_var,
+                                           double code_var, double *q,
+                                           double *r_cov_inv)
+{
+  u32 null_dim = CLAMP_DIFF(num_dds, 3);
+  u32 res_dim = num_dds + null_dim;
+  double p = phase_var;
+  double c = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
+
+  /* u = Q 1, v = Q^T u and G^-1 = I - w u u^T. */
+  double u[null_dim];
+  double uu = 0;
+  for (u32 i=0; i<null_dim; i++) {
+    u[i] = 0;
+    for (u8 k=0; k<num_dds; k++) {
+      u[i] += q[i*num_dds + k];
+    }
+    uu += u[i] * u[i];
+  }
+  double w = 1 / (1 + uu);
+  double v[num_dds];
+  for (u8 k=0; k<num_dds; k++) {
+    v[k] = 0;
+    for (u32 i=0; i<null_dim; i++) {
+      v[k] += q[i*num_dds + k] * u[i];
+    }
+  }
+
+  /* The covariance is doubled, so its inverse is halved. */
+  double s_tl = 0.5 * (p + c) / (p * c);
+  double s_tr = -0.5 / c;
+  double s_br = 0.5 * p / (c * (p + c));
+
+  for (u32 i=0; i<null_dim; i++) {
+    for (u32 j=0; j<null_dim; j++) {
+      r_cov_inv[i*res_dim + j] = s_tl * ((i == j) - w * u[i] * u[j]);
+    }
+    for (u8 k=0; k<num_dds; k++) {
+      /* (G^-1 Q)_ik = Q_ik - w u_i v_k */
+      double x = s_tr * (q[i*num_dds + k] - w * u[i] * v[k]);
+      r_cov_inv[i*res_dim + null_dim + k] = x;
+      r_cov_inv[(null_dim + k)*res_dim + i] = x;
+    }
+  }
+  double k_inv[num_dds * num_dds];
+  dd_cov_inverse(num_dds, p + c, k_inv);
+  for (u8 k=0; k<num_dds; k++) {
+    for (u8 l=k; l<num_dds; l++) {
+      /* (Q^T G^-1 Q)_kl = (Q^T Q)_kl - w v_k v_l */
+      double qtq = 0;
+      for (u32 i=0; i<null_dim; i++) {
+        qtq += q[i*num_dds + k] * q[i*num_dds + l];
+      }
+      double x = 0.5 * k_inv[k*num_dds + l] + s_br * (qtq - w * v[k] * v[l]);
+      r_cov_inv[(null_dim + k)*res_dim + null_dim + l] = x;
+      r_cov_inv[(null_dim + l)*res_dim + null_dim + k] = x;
+    }
+  }
+}
+
 void assign_r_vec(residual_mtxs_t *res_mtxs, u8 num_dds, double *dd_measurements, double *r_vec)
 {
   cblas_dgemv(CblasRowMajor, CblasNoTrans,
@@ -2013,4 +2770,108 @@ double get_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, double *hypothe
   return quad_term;
 }
 
+/** Expand the quadratic term of the hypothesis log likelihood about N0.
+ * With the residual about N0, r0 = r_vec - M N0, and d = N - N0,
+ *
+ * \f[
+ *   q(N) = -(r0 - M d)^T A (r0 - M d) = c + g^T d - d^T H d
+ * \f]
+ *
+ * where \f$c = -r0^T A r0\f$, \f$g = 2 M^T A r0\f$ and \f$H = M^T A M\f$.
+ * Expanding about a hypothesis near the rest, rather than about zero, keeps d
+ * small so the terms don't cancel and the expansion can be evaluated in
+ * single precision.
+ *
+ * \param res_mtxs Residual matrices, from init_residual_matrices().
+ * \param num_dds  Number of double differenced ambiguities.
+ * \param N0       Hypothesis to expand about, length num_dds.
+ * \param r_vec    Transformed measurement, from assign_r_vec().
+ * \param qe       Output expansion, for get_quadratic_terms().
+ */
+void expand_quadratic_term(residual_mtxs_t *res_mtxs, u8 num_dds, const s32 *N0,
+                           double *r_vec, quadratic_expansion_t *qe)
+{
+  u32 res_dim = res_mtxs->res_dim;
+  u8 null_dim = res_mtxs->null_space_dim;
+
+  double N0_d[num_dds];
+  for (u8 k=0; k<num_dds; k++) {
+    N0_d[k] = N0[k];
+  }
+  double r0[res_dim];
+  assign_r_mean(res_mtxs, num_dds, N0_d, r0);
+  for (u32 i=0; i<res_dim; i++) {
+    r0[i] = r_vec[i] - r0[i];
+  }
+  double Ar0[res_dim];
+  cblas_dsymv(CblasRowMajor, CblasUpper,
+              res_dim,
+              1, res_mtxs->half_res_cov_inv, res_dim,
+              r0, 1,
+              0, Ar0, 1);
+
+  qe->num_dds = num_dds;
+  memcpy(qe->N0, N0, num_dds * sizeof(s32));
+  qe->c = -vector_dot(res_dim, r0, Ar0);
+  for (u8 k=0; k<num_dds; k++) {
+    double g = Ar0[null_dim + k];
+    for (u8 a=0; a<null_dim; a++) {
+      g += res_mtxs->null_projector[a*num_dds + k] * Ar0[a];
+    }
+    qe->g[k] = 2 * g;
+  }
+  for (u32 i=0; i<(u32)num_dds*num_dds; i++) {
+    qe->H[i] = res_mtxs->amb_quad[i];
+  }
+}
+
+/** Evaluate the quadratic term of the log likelihood for many hypotheses.
+ * Gives the same result as get_quadratic_term(), but using the expansion from
+ * expand_quadratic_term() each hypothesis costs a small integer quadratic
+ * form. Hypotheses are processed in blocks with the inner loops running
+ * across the block, so they vectorize over hypotheses.
+ *
+ * \param qe     Expansion of the quadratic term for this epoch.
+ * \param n      Number of hypotheses.
+ * \param N      Ambiguities, `N[k*stride + i]` is ambiguity k of hypothesis i
+ *               (i.e. the layout of ::hypothesis_store_t).
+ * \param stride Distance between the ambiguity columns of N.
+ * \param q      Output quadratic terms, length n.
+ */
+void get_quadratic_terms(const quadratic_expansion_t *qe, u32 n,
+                         const s32 *N, u32 stride, float *q)
+{
+  u8 num_dds = qe->num_dds;
+  for (u32 i0=0; i0<n; i0+=QUADRATIC_TERMS_BLOCK) {
+    u32 m = MIN(QUADRATIC_TERMS_BLOCK, n - i0);
+    float d[num_dds][QUADRATIC_TERMS_BLOCK];
+    for (u8 k=0; k<num_dds; k++) {
+      const s32 *col = &N[k*stride + i0];
+      for (u32 i=0; i<m; i++) {
+        d[k][i] = (float) (col[i] - qe->N0[k]);
+      }
+    }
+    float *qb = &q[i0];
+    for (u32 i=0; i<m; i++) {
+      qb[i] = qe->c;
+    }
+    /* q += d_k (g_k - sum_l H_kl d_l) */
+    for (u8 k=0; k<num_dds; k++) {
+      float t[QUADRATIC_TERMS_BLOCK];
+      for (u32 i=0; i<m; i++) {
+        t[i] = qe->g[k];
+      }
+      for (u8 l=0; l<num_dds; l++) {
+        float h = qe->H[k*num_dds + l];
+        for (u32 i=0; i<m; i++) {
+          t[i] -= h * d[l][i];
+        }
+      }
+      for (u32 i=0; i<m; i++) {
+        qb[i] += d[k][i] * t[i];
+      }
+    }
+  }
+}
+
 /** \} */
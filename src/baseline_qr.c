@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "amb_kf.h"
+#include "baseline_qr.h"
+
+/** \defgroup baseline_qr Incremental Baseline Solver
+ * Least squares baseline solution from double differenced phase ranges,
+ * \f$ DE \, b = y \f$, that keeps the QR factor of the geometry between
+ * epochs.
+ *
+ * Only \f$ R \f$ is stored, not \f$ Q \f$. Each solve uses the corrected
+ * semi-normal equations: \f$ R^T R \, b = DE^T y \f$ is solved by two
+ * triangular solves and the result polished by iterative refinement against
+ * the current geometry. This makes the solution that of the current
+ * geometry even while \f$ R \f$ lags behind the slowly moving satellites,
+ * so rows only need replacing in \f$ R \f$ once they have drifted by
+ * ::BASELINE_QR_REFRESH_TOL.
+ * \{ */
+
+/** Smallest diagonal element of R for the geometry to be full rank. */
+#define BASELINE_QR_RANK_EPSILON 1e-9
+
+/** Initialise an incremental baseline solver.
+ *
+ * \param qr Solver to initialise.
+ */
+void baseline_qr_init(baseline_qr_t *qr)
+{
+  memset(qr, 0, sizeof(*qr));
+}
+
+/* Fold a row into R with a sequence of Givens rotations. */
+static void qr_add_row(double R[3][3], const double row[3])
+{
+  double x[3] = {row[0], row[1], row[2]};
+  for (u8 k=0; k<3; k++) {
+    if (x[k] == 0) {
+      continue;
+    }
+    double r = hypot(R[k][k], x[k]);
+    double c = R[k][k] / r;
+    double s = x[k] / r;
+    R[k][k] = r;
+    for (u8 j=k+1; j<3; j++) {
+      double t = c * R[k][j] + s * x[j];
+      x[j] = c * x[j] - s * R[k][j];
+      R[k][j] = t;
+    }
+  }
+}
+
+/* Remove a row from R with hyperbolic rotations. Returns -1 if the remaining
+ * rows are (numerically) rank deficient, in which case R is invalid. */
+static s8 qr_remove_row(double R[3][3], const double row[3])
+{
+  double x[3] = {row[0], row[1], row[2]};
+  for (u8 k=0; k<3; k++) {
+    double r2 = R[k][k] * R[k][k] - x[k] * x[k];
+    if (r2 <= BASELINE_QR_RANK_EPSILON * BASELINE_QR_RANK_EPSILON) {
+      return -1;
+    }
+    double r = sqrt(r2);
+    double c = r / R[k][k];
+    double s = x[k] / R[k][k];
+    R[k][k] = r;
+    for (u8 j=k+1; j<3; j++) {
+      R[k][j] = (R[k][j] - s * x[j]) / c;
+      x[j] = c * x[j] - s * R[k][j];
+    }
+  }
+  return 0;
+}
+
+/* Rebuild R from scratch from the given rows. */
+static void qr_factor(baseline_qr_t *qr, u8 num_dds, u8 ref_prn,
+                      const u8 *prns, const double *DE)
+{
+  memset(qr->R, 0, sizeof(qr->R));
+  for (u8 i=0; i<num_dds; i++) {
+    qr->prns[i] = prns[i];
+    memcpy(qr->rows[i], &DE[3*i], sizeof(qr->rows[i]));
+    qr_add_row(qr->R, qr->rows[i]);
+  }
+  qr->num_dds = num_dds;
+  qr->ref_prn = ref_prn;
+  qr->initialized = 1;
+  qr->n_factorizations++;
+}
+
+/* Bring R up to date with the new satellite set, returns -1 if it has to be
+ * rebuilt. */
+static s8 qr_update(baseline_qr_t *qr, u8 num_dds, const u8 *prns,
+                    const double *DE)
+{
+  /* Drop the rows of satellites that have gone. */
+  for (s16 i=qr->num_dds-1; i>=0; i--) {
+    if (find_index_of_element_in_u8s(num_dds, qr->prns[i], prns) >= 0) {
+      continue;
+    }
+    if (qr_remove_row(qr->R, qr->rows[i]) < 0) {
+      return -1;
+    }
+    qr->num_dds--;
+    qr->prns[i] = qr->prns[qr->num_dds];
+    memcpy(qr->rows[i], qr->rows[qr->num_dds], sizeof(qr->rows[i]));
+  }
+
+  /* Add new satellites and replace rows that have drifted. */
+  for (u8 j=0; j<num_dds; j++) {
+    const double *row = &DE[3*j];
+    s32 i = find_index_of_element_in_u8s(qr->num_dds, prns[j], qr->prns);
+    if (i < 0) {
+      i = qr->num_dds++;
+      qr->prns[i] = prns[j];
+    } else if (fabs(row[0] - qr->rows[i][0]) > BASELINE_QR_REFRESH_TOL ||
+               fabs(row[1] - qr->rows[i][1]) > BASELINE_QR_REFRESH_TOL ||
+               fabs(row[2] - qr->rows[i][2]) > BASELINE_QR_REFRESH_TOL) {
+      if (qr_remove_row(qr->R, qr->rows[i]) < 0) {
+        return -1;
+      }
+    } else {
+      continue;
+    }
+    memcpy(qr->rows[i], row, sizeof(qr->rows[i]));
+    qr_add_row(qr->R, row);
+  }
+  return 0;
+}
+
+/* Solve R^T R x = v. */
+static void rtr_solve(const double R[3][3], const double v[3], double x[3])
+{
+  double z[3];
+  for (u8 i=0; i<3; i++) {
+    double s = v[i];
+    for (u8 k=0; k<i; k++) {
+      s -= R[k][i] * z[k];
+    }
+    z[i] = s / R[i][i];
+  }
+  for (s8 i=2; i>=0; i--) {
+    double s = z[i];
+    for (u8 k=i+1; k<3; k++) {
+      s -= R[i][k] * x[k];
+    }
+    x[i] = s / R[i][i];
+  }
+}
+
+/** Least squares baseline from a double difference geometry matrix.
+ * Updates the solver's R factor for any change in the satellite set and
+ * solves \f$ DE \, b = y \f$ in the least squares sense.
+ *
+ * \param qr      Solver state, carried between epochs.
+ * \param num_dds Number of double differences (rows of `DE`).
+ * \param ref_prn PRN of the reference satellite. Changing the reference
+ *                changes every row, so R is rebuilt.
+ * \param prns    PRN of the non-reference satellite of each row.
+ * \param DE      Row major `num_dds` x 3 geometry matrix, see
+ *                assign_de_mtx().
+ * \param y       Double differenced phase ranges [m].
+ * \param b       Output baseline [m].
+ * \return 0 on success, -1 if there are fewer than three double differences
+ *         or the geometry is degenerate.
+ */
+s8 baseline_qr_solve_de(baseline_qr_t *qr, u8 num_dds, u8 ref_prn,
+                        const u8 *prns, const double *DE, const double *y,
+                        double b[3])
+{
+  if (num_dds < 3 || num_dds > MAX_CHANNELS-1) {
+    return -1;
+  }
+
+  if (!qr->initialized || qr->ref_prn != ref_prn ||
+      qr_update(qr, num_dds, prns, DE) < 0) {
+    qr_factor(qr, num_dds, ref_prn, prns, DE);
+  }
+
+  for (u8 k=0; k<3; k++) {
+    if (fabs(qr->R[k][k]) < BASELINE_QR_RANK_EPSILON) {
+      qr->initialized = 0;
+      return -1;
+    }
+  }
+
+  /* Corrected semi-normal equations, starting from b = 0 the first step is
+   * the plain semi-normal solution. */
+  double r[num_dds];
+  memcpy(r, y, sizeof(r));
+  memset(b, 0, 3 * sizeof(double));
+  for (u8 it=0; it<BASELINE_QR_MAX_REFINE; it++) {
+    double g[3] = {0, 0, 0};
+    for (u8 i=0; i<num_dds; i++) {
+      for (u8 k=0; k<3; k++) {
+        g[k] += DE[3*i + k] * r[i];
+      }
+    }
+    double db[3];
+    rtr_solve((const double (*)[3])qr->R, g, db);
+    for (u8 k=0; k<3; k++) {
+      b[k] += db[k];
+    }
+    if (fabs(db[0]) + fabs(db[1]) + fabs(db[2]) < 1e-9) {
+      break;
+    }
+    for (u8 i=0; i<num_dds; i++) {
+      r[i] = y[i] - (DE[3*i] * b[0] + DE[3*i + 1] * b[1] + DE[3*i + 2] * b[2]);
+    }
+  }
+
+  return 0;
+}
+
+/** Least squares baseline from single differences.
+ * Forms the geometry matrix with assign_de_mtx() and calls
+ * baseline_qr_solve_de().
+ *
+ * \param qr                    Solver state, carried between epochs.
+ * \param num_sats              Number of sdiffs, including the reference.
+ * \param sdiffs_with_ref_first Single differences, reference first.
+ * \param ref_ecef              Reference position for the line of sight
+ *                              vectors.
+ * \param y                     Double differenced phase ranges [m], one per
+ *                              non-reference sdiff.
+ * \param b                     Output baseline [m].
+ * \return 0 on success, -1 if there are too few satellites or the geometry
+ *         is degenerate.
+ */
+s8 baseline_qr_solve(baseline_qr_t *qr, u8 num_sats,
+                     const sdiff_t *sdiffs_with_ref_first,
+                     const double ref_ecef[3], const double *y, double b[3])
+{
+  if (num_sats < 4) {
+    return -1;
+  }
+  u8 num_dds = num_sats - 1;
+  double DE[num_dds * 3];
+  u8 prns[num_dds];
+  assign_de_mtx(num_sats, sdiffs_with_ref_first, ref_ecef, DE);
+  for (u8 i=0; i<num_dds; i++) {
+    prns[i] = sdiffs_with_ref_first[i+1].prn;
+  }
+  return baseline_qr_solve_de(qr, num_dds, sdiffs_with_ref_first[0].prn,
+                              prns, DE, y, b);
+}
+
+/** \} */
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <cblas.h>
+#include <clapack.h>
+
+#include "blas_check.h"
+
+/** \defgroup blas_check BLAS/LAPACK Self Check
+ * Sanity check of the BLAS/LAPACK backend the library was linked against.
+ * \{ */
+
+#define BLAS_CHECK_TOL 1e-12
+
+static u8 close_to(u32 n, const double *a, const double *b)
+{
+  for (u32 i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > BLAS_CHECK_TOL) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** Check that the BLAS/LAPACK backend gives correct results.
+ * The library can be built against the bundled reference BLAS/LAPACK or a
+ * system library (see the `LIBSWIFTNAV_SYSTEM_BLAS` CMake option). A system
+ * library built with a different integer size or calling convention links
+ * without complaint but returns garbage, so applications should call this
+ * once at startup. It exercises the CBLAS and Fortran LAPACK interfaces the
+ * library uses on small problems with known solutions.
+ *
+ * \return 0 if the backend works,
+ *         -1 if the CBLAS results are wrong,
+ *         -2 if the LAPACK results are wrong.
+ */
+s8 blas_self_check(void)
+{
+  /* CBLAS, general and symmetric matrix-vector products. */
+  double A[4] = {1, 2,
+                 3, 4};
+  double x[2] = {1, 2};
+  double y[2];
+  cblas_dgemv(CblasRowMajor, CblasNoTrans, 2, 2, 1, A, 2, x, 1, 0, y, 1);
+  const double y_gemv[2] = {5, 11};
+  if (!close_to(2, y, y_gemv)) {
+    return -1;
+  }
+  /* Only the upper triangle is referenced, A is taken as [[1, 2], [2, 4]]. */
+  cblas_dsymv(CblasRowMajor, CblasUpper, 2, 1, A, 2, x, 1, 0, y, 1);
+  const double y_symv[2] = {5, 10};
+  if (!close_to(2, y, y_symv)) {
+    return -1;
+  }
+
+  /* LAPACK, Cholesky factorisation and inverse (column major). */
+  double P[4] = {4, 2,
+                 2, 3};
+  integer n = 2, info;
+  char uplo = 'U';
+  dpotrf_(&uplo, &n, P, &n, &info);
+  if (info != 0 || fabs(P[0] - 2) > BLAS_CHECK_TOL ||
+      fabs(P[2] - 1) > BLAS_CHECK_TOL ||
+      fabs(P[3] - sqrt(2)) > BLAS_CHECK_TOL) {
+    return -2;
+  }
+  dpotri_(&uplo, &n, P, &n, &info);
+  if (info != 0 || fabs(P[0] - 0.375) > BLAS_CHECK_TOL ||
+      fabs(P[2] + 0.25) > BLAS_CHECK_TOL ||
+      fabs(P[3] - 0.5) > BLAS_CHECK_TOL) {
+    return -2;
+  }
+
+  /* LAPACK, least squares solution of a consistent overdetermined system
+   * (column major), as used through LAPACKE_dgelsy(). */
+  double M[6] = {1, 0, 1,
+                 0, 1, 1};
+  double b[3] = {1, 2, 3};
+  integer m = 3, nrhs = 1, jpvt[2] = {0, 0}, rank, lwork = 32;
+  double rcond = -1, work[32];
+  dgelsy_(&m, &n, &nrhs, M, &m, b, &m, jpvt, &rcond, &rank, work, &lwork,
+          &info);
+  const double x_lsq[2] = {1, 2};
+  if (info != 0 || rank != 2 || !close_to(2, b, x_lsq)) {
+    return -2;
+  }
+
+  return 0;
+}
+
+/** \} */
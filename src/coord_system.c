@@ -217,6 +217,167 @@ void wgsecef2llh(const double ecef[3], double llh[3]) {
   llh[2] = (p*e_c*C + fabs(ecef[2])*S - WGS84_A*e_c*A_n) / sqrt(e_c*e_c*C*C + S*S);
 }
 
+/** Converts from WGS84 Earth Centered, Earth Fixed (ECEF) Cartesian
+ * coordinates (X, Y and Z) into WGS84 geodetic coordinates (latitude,
+ * longitude and height) using a closed form solution.
+ *
+ * Implements the method of Vermeille (2002) which reduces the problem to the
+ * root of a quartic with a fixed sequence of operations, two square roots
+ * and a cube root, without iteration or data dependent branches. This makes
+ * it a good choice when converting large numbers of points, see
+ * wgsecef2llh_array() and wgsecef2llh_soa().
+ *
+ * The solution is exact up to rounding for all points more than
+ * \f$ e^2 a \approx 43 \f$ km from the center of the Earth, i.e. outside the
+ * evolute of the ellipsoid. In double precision it agrees with
+ * wgsecef2llh() to better than 1e-7 arcseconds and 1 micrometer for heights
+ * from -1000 km up to beyond geostationary orbit.
+ *
+ * References:
+ *   -# "Direct transformation from geocentric coordinates to geodetic
+ *      coordinates", H. Vermeille (2002), Journal of Geodesy.
+ *
+ * \param ecef Cartesian coordinates to be converted, passed as [X, Y, Z],
+ *             all in meters.
+ * \param llh  Converted geodetic coordinates are written into this array as
+ *             [lat, lon, height] in [radians, radians, meters].
+ */
+void wgsecef2llh_vermeille(const double ecef[3], double llh[3]) {
+  const double e2 = WGS84_E*WGS84_E;
+  const double e4 = e2*e2;
+
+  const double xy2 = ecef[0]*ecef[0] + ecef[1]*ecef[1];
+  const double xy = sqrt(xy2);
+  const double z = ecef[2];
+
+  const double p = xy2 / (WGS84_A*WGS84_A);
+  const double q = (1 - e2) / (WGS84_A*WGS84_A) * z*z;
+  const double r = (p + q - e4) / 6;
+  const double s = e4 * p * q / (4 * r*r*r);
+  const double t = cbrt(1 + s + sqrt(s * (2 + s)));
+  const double u = r * (1 + t + 1/t);
+  const double v = sqrt(u*u + e4*q);
+  const double w = e2 * (u + v - q) / (2*v);
+  const double k = sqrt(u + v + w*w) - w;
+  const double D = k * xy / (k + e2);
+  const double Dz = sqrt(D*D + z*z);
+
+  llh[0] = 2 * atan2(z, D + Dz);
+  llh[1] = atan2(ecef[1], ecef[0]);
+  llh[2] = (k + e2 - 1) / k * Dz;
+}
+
+/** Converts an array of WGS84 geodetic coordinates into ECEF coordinates.
+ * Equivalent to calling wgsllh2ecef() on each point.
+ *
+ * \param n    Number of points.
+ * \param llh  Geodetic coordinates of each point as [lat, lon, height] in
+ *             [radians, radians, meters].
+ * \param ecef Cartesian coordinates of each point are written into this array
+ *             as [X, Y, Z], all in meters.
+ */
+void wgsllh2ecef_array(u32 n, const double llh[n][3], double ecef[n][3]) {
+  for (u32 i=0; i<n; i++) {
+    wgsllh2ecef(llh[i], ecef[i]);
+  }
+}
+
+/** Converts an array of WGS84 ECEF coordinates into geodetic coordinates.
+ * Uses the closed form wgsecef2llh_vermeille() conversion, see there for the
+ * accuracy and range of validity.
+ *
+ * \param n    Number of points.
+ * \param ecef Cartesian coordinates of each point as [X, Y, Z], all in
+ *             meters.
+ * \param llh  Geodetic coordinates of each point are written into this array
+ *             as [lat, lon, height] in [radians, radians, meters].
+ */
+void wgsecef2llh_array(u32 n, const double ecef[n][3], double llh[n][3]) {
+  for (u32 i=0; i<n; i++) {
+    wgsecef2llh_vermeille(ecef[i], llh[i]);
+  }
+}
+
+/** Converts WGS84 geodetic coordinates stored as separate arrays (structure
+ * of arrays) into ECEF coordinates.
+ * The loop has no branches and the arrays must not overlap, so it can be
+ * vectorised by the compiler where a vector math library is available.
+ *
+ * \param n   Number of points.
+ * \param lat Latitude of each point [rad].
+ * \param lon Longitude of each point [rad].
+ * \param hgt Height of each point [m].
+ * \param x   ECEF X of each point is written here [m].
+ * \param y   ECEF Y of each point is written here [m].
+ * \param z   ECEF Z of each point is written here [m].
+ */
+void wgsllh2ecef_soa(u32 n, const double *restrict lat,
+                     const double *restrict lon, const double *restrict hgt,
+                     double *restrict x, double *restrict y,
+                     double *restrict z) {
+  const double e2 = WGS84_E*WGS84_E;
+  for (u32 i=0; i<n; i++) {
+    double sin_lat = sin(lat[i]), cos_lat = cos(lat[i]);
+    double N = WGS84_A / sqrt(1. - e2*sin_lat*sin_lat);
+    x[i] = (N + hgt[i]) * cos_lat * cos(lon[i]);
+    y[i] = (N + hgt[i]) * cos_lat * sin(lon[i]);
+    z[i] = ((1 - e2)*N + hgt[i]) * sin_lat;
+  }
+}
+
+/** Converts WGS84 ECEF coordinates stored as separate arrays (structure of
+ * arrays) into geodetic coordinates.
+ * Uses the closed form conversion of wgsecef2llh_vermeille(), see there for
+ * the accuracy and range of validity. The loop has no branches and the
+ * arrays must not overlap, so it can be vectorised by the compiler where a
+ * vector math library is available.
+ *
+ * \param n   Number of points.
+ * \param x   ECEF X of each point [m].
+ * \param y   ECEF Y of each point [m].
+ * \param z   ECEF Z of each point [m].
+ * \param lat Latitude of each point is written here [rad].
+ * \param lon Longitude of each point is written here [rad].
+ * \param hgt Height of each point is written here [m].
+ */
+void wgsecef2llh_soa(u32 n, const double *restrict x,
+                     const double *restrict y, const double *restrict z,
+                     double *restrict lat, double *restrict lon,
+                     double *restrict hgt) {
+  for (u32 i=0; i<n; i++) {
+    double ecef[3] = {x[i], y[i], z[i]};
+    double llh[3];
+    wgsecef2llh_vermeille(ecef, llh);
+    lat[i] = llh[0];
+    lon[i] = llh[1];
+    hgt[i] = llh[2];
+  }
+}
+
+/** Helper function which populates a provided 3x3 matrix with the
+ * appropriate rotation matrix to transform from ECEF to NED coordinates,
+ * given the geodetic coordinates of the reference point. Down is along the
+ * normal to the WGS84 ellipsoid.
+ *
+ * \param ref_llh Geodetic coordinates of the reference point, passed as
+ *                [lat, lon, height] in [radians, radians, meters].
+ * \param M       3x3 matrix to be populated with rotation matrix.
+ */
+static void llh2ned_matrix(const double ref_llh[3], double M[3][3]) {
+  double sin_lat = sin(ref_llh[0]), cos_lat = cos(ref_llh[0]);
+  double sin_lon = sin(ref_llh[1]), cos_lon = cos(ref_llh[1]);
+
+  M[0][0] = -sin_lat * cos_lon;
+  M[0][1] = -sin_lat * sin_lon;
+  M[0][2] = cos_lat;
+  M[1][0] = -sin_lon;
+  M[1][1] = cos_lon;
+  M[1][2] = 0.0;
+  M[2][0] = -cos_lat * cos_lon;
+  M[2][1] = -cos_lat * sin_lon;
+  M[2][2] = -sin_lat;
+}
+
 /** Helper function which populates a provided 3x3 matrix with the
  * appropriate rotation matrix to transform from ECEF to NED coordinates,
  * given the provided ECEF reference vector.
@@ -226,26 +387,9 @@ void wgsecef2llh(const double ecef[3], double llh[3]) {
  * \param M        3x3 matrix to be populated with rotation matrix.
  */
 static void ecef2ned_matrix(const double ref_ecef[3], double M[3][3]) {
-  double hyp_az, hyp_el;
-  double sin_el, cos_el, sin_az, cos_az;
-
-  /* Convert reference point to spherical earth centered coordinates. */
-  hyp_az = sqrt(ref_ecef[0]*ref_ecef[0] + ref_ecef[1]*ref_ecef[1]);
-  hyp_el = sqrt(hyp_az*hyp_az + ref_ecef[2]*ref_ecef[2]);
-  sin_el = ref_ecef[2] / hyp_el;
-  cos_el = hyp_az / hyp_el;
-  sin_az = ref_ecef[1] / hyp_az;
-  cos_az = ref_ecef[0] / hyp_az;
-
-  M[0][0] = -sin_el * cos_az;
-  M[0][1] = -sin_el * sin_az;
-  M[0][2] = cos_el;
-  M[1][0] = -sin_az;
-  M[1][1] = cos_az;
-  M[1][2] = 0.0;
-  M[2][0] = -cos_el * cos_az;
-  M[2][1] = -cos_el * sin_az;
-  M[2][2] = -sin_el;
+  double ref_llh[3];
+  wgsecef2llh(ref_ecef, ref_llh);
+  llh2ned_matrix(ref_llh, M);
 }
 
 
@@ -376,5 +520,185 @@ void wgsecef2azel(const double ecef[3], const double ref_ecef[3],
   *elevation = asin(-ned[2]/vector_norm(3, ned));
 }
 
-/** \} */
+/** Returns the vectors to an array of points from a single reference point
+ * in the local North, East, Down (NED) frame of the reference point.
+ * Equivalent to calling wgsecef2ned_d() on each point, but the rotation into
+ * the NED frame is only computed once.
+ *
+ * \param n         Number of points.
+ * \param ecef      Cartesian coordinates of each point as [X, Y, Z], all in
+ *                  meters.
+ * \param ref_ecef  Cartesian coordinates of the reference point, passed as
+ *                  [X, Y, Z], all in meters.
+ * \param ned       The North, East, Down vector to each point is written into
+ *                  this array as [N, E, D], all in meters.
+ */
+void wgsecef2ned_d_array(u32 n, const double ecef[n][3],
+                         const double ref_ecef[3], double ned[n][3]) {
+  ltp_frame_t frame;
+  ltp_frame_init(&frame, ref_ecef);
+  ltp_ecef2ned_d_array(&frame, n, ecef, ned);
+}
+
+/** Determine the azimuth and elevation of an array of points from a single
+ * reference point. Equivalent to calling wgsecef2azel() on each point, but
+ * the rotation into the NED frame is only computed once.
+ *
+ * \param n         Number of points.
+ * \param ecef      Cartesian coordinates of each point as [X, Y, Z], all in
+ *                  meters.
+ * \param ref_ecef  Cartesian coordinates of the reference point, passed as
+ *                  [X, Y, Z], all in meters.
+ * \param azimuth   The azimuth of each point is written here [rad].
+ * \param elevation The elevation of each point is written here [rad].
+ */
+void wgsecef2azel_array(u32 n, const double ecef[n][3],
+                        const double ref_ecef[3],
+                        double azimuth[n], double elevation[n]) {
+  ltp_frame_t frame;
+  ltp_frame_init(&frame, ref_ecef);
+  ltp_ecef2azel_array(&frame, n, ecef, azimuth, elevation);
+}
+
+/** Initialise a local tangent plane frame about a reference point.
+ * Computes the reference point's geodetic coordinates and the rotation from
+ * ECEF into its North, East, Down frame once, so that subsequent ltp_*
+ * transforms cost only a 3x3 matrix-vector product each.
+ *
+ * \param frame     Frame to initialise.
+ * \param ref_ecef  Cartesian coordinates of the reference point, passed as
+ *                  [X, Y, Z], all in meters.
+ */
+void ltp_frame_init(ltp_frame_t *frame, const double ref_ecef[3]) {
+  for (u8 i=0; i<3; i++) {
+    frame->ref_ecef[i] = ref_ecef[i];
+  }
+  wgsecef2llh(ref_ecef, frame->ref_llh);
+  llh2ned_matrix(frame->ref_llh, frame->M);
+}
+
+/** Rotate a vector from ECEF into the NED frame, as wgsecef2ned().
+ *
+ * \param frame Local tangent plane frame.
+ * \param ecef  ECEF vector, [X, Y, Z].
+ * \param ned   The vector in the NED frame is written here, [N, E, D].
+ */
+void ltp_ecef2ned(const ltp_frame_t *frame, const double ecef[3],
+                  double ned[3]) {
+  for (u8 j=0; j<3; j++) {
+    ned[j] = frame->M[j][0]*ecef[0] + frame->M[j][1]*ecef[1]
+             + frame->M[j][2]*ecef[2];
+  }
+}
+
+/** Vector from the frame's reference point to an ECEF point in the NED
+ * frame, as wgsecef2ned_d().
+ *
+ * \param frame Local tangent plane frame.
+ * \param ecef  ECEF position of the point [m].
+ * \param ned   The NED vector to the point is written here [m].
+ */
+void ltp_ecef2ned_d(const ltp_frame_t *frame, const double ecef[3],
+                    double ned[3]) {
+  double d[3] = {
+    ecef[0] - frame->ref_ecef[0],
+    ecef[1] - frame->ref_ecef[1],
+    ecef[2] - frame->ref_ecef[2],
+  };
+  ltp_ecef2ned(frame, d, ned);
+}
+
+/** Rotate a vector from the NED frame into ECEF, as wgsned2ecef().
+ *
+ * \param frame Local tangent plane frame.
+ * \param ned   Vector in the NED frame, [N, E, D].
+ * \param ecef  The ECEF vector is written here, [X, Y, Z].
+ */
+void ltp_ned2ecef(const ltp_frame_t *frame, const double ned[3],
+                  double ecef[3]) {
+  for (u8 j=0; j<3; j++) {
+    ecef[j] = frame->M[0][j]*ned[0] + frame->M[1][j]*ned[1]
+              + frame->M[2][j]*ned[2];
+  }
+}
+
+/** ECEF position of a point given in the NED frame of the reference point,
+ * as wgsned2ecef_d().
+ *
+ * \param frame Local tangent plane frame.
+ * \param ned   NED vector from the reference point to the point [m].
+ * \param ecef  The ECEF position of the point is written here [m].
+ */
+void ltp_ned2ecef_d(const ltp_frame_t *frame, const double ned[3],
+                    double ecef[3]) {
+  ltp_ned2ecef(frame, ned, ecef);
+  for (u8 i=0; i<3; i++) {
+    ecef[i] += frame->ref_ecef[i];
+  }
+}
 
+/** Azimuth and elevation of an ECEF point from the frame's reference point,
+ * as wgsecef2azel().
+ *
+ * \param frame     Local tangent plane frame.
+ * \param ecef      ECEF position of the point [m].
+ * \param azimuth   Azimuth of the point in [0, 2pi) is written here [rad].
+ * \param elevation Elevation of the point is written here [rad].
+ */
+void ltp_ecef2azel(const ltp_frame_t *frame, const double ecef[3],
+                   double *azimuth, double *elevation) {
+  double ned[3];
+  ltp_ecef2ned_d(frame, ecef, ned);
+
+  *azimuth = atan2(ned[1], ned[0]);
+  if (*azimuth < 0)
+    *azimuth += 2*M_PI;
+
+  *elevation = asin(-ned[2]/vector_norm(3, ned));
+}
+
+/** Batched ltp_ecef2ned_d().
+ *
+ * \param frame Local tangent plane frame.
+ * \param n     Number of points.
+ * \param ecef  ECEF position of each point [m].
+ * \param ned   The NED vector to each point is written here [m].
+ */
+void ltp_ecef2ned_d_array(const ltp_frame_t *frame, u32 n,
+                          const double ecef[n][3], double ned[n][3]) {
+  for (u32 i=0; i<n; i++) {
+    ltp_ecef2ned_d(frame, ecef[i], ned[i]);
+  }
+}
+
+/** Batched ltp_ned2ecef_d().
+ *
+ * \param frame Local tangent plane frame.
+ * \param n     Number of points.
+ * \param ned   NED vector from the reference point to each point [m].
+ * \param ecef  The ECEF position of each point is written here [m].
+ */
+void ltp_ned2ecef_d_array(const ltp_frame_t *frame, u32 n,
+                          const double ned[n][3], double ecef[n][3]) {
+  for (u32 i=0; i<n; i++) {
+    ltp_ned2ecef_d(frame, ned[i], ecef[i]);
+  }
+}
+
+/** Batched ltp_ecef2azel().
+ *
+ * \param frame     Local tangent plane frame.
+ * \param n         Number of points.
+ * \param ecef      ECEF position of each point [m].
+ * \param azimuth   The azimuth of each point is written here [rad].
+ * \param elevation The elevation of each point is written here [rad].
+ */
+void ltp_ecef2azel_array(const ltp_frame_t *frame, u32 n,
+                         const double ecef[n][3],
+                         double azimuth[n], double elevation[n]) {
+  for (u32 i=0; i<n; i++) {
+    ltp_ecef2azel(frame, ecef[i], &azimuth[i], &elevation[i]);
+  }
+}
+
+/** \} */
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "dd_cov.h"
+
+/** \defgroup dd_cov Double Difference Covariance
+ * Closed form operations on double difference observation covariances.
+ *
+ * Differencing `n+1` independent single difference observations of variance
+ * \f$\sigma^2\f$ against a common reference gives `n` double differences with
+ * covariance
+ *
+ * \f[ C = \sigma^2 (I + 1 1^T) \f]
+ *
+ * where \f$1\f$ is the vector of ones. Being the identity plus a rank one
+ * term, inverses, factorizations and determinants of \f$C\f$ can be written
+ * down directly, see e.g. the Sherman-Morrison formula, rather than computed
+ * with \f$O(n^3)\f$ dense linear algebra.
+ *
+ * All matrices are \f$n \times n\f$, row major.
+ * \{ */
+
+/** Fill in the dense double difference covariance.
+ *
+ * \param n   Number of double differences
+ * \param var Single difference variance \f$\sigma^2\f$
+ * \param C   Output \f$\sigma^2 (I + 1 1^T)\f$
+ */
+void dd_cov_assign(u8 n, double var, double *C)
+{
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      C[i*n + j] = (i == j) ? 2 * var : var;
+    }
+  }
+}
+
+/** Multiply by the double difference covariance.
+ * Computes \f$C B\f$ in \f$O(n \cdot cols)\f$, as
+ * \f$\sigma^2 (B + 1 (1^T B))\f$. `B` and `C` may be the same.
+ *
+ * \param n    Number of double differences
+ * \param var  Single difference variance \f$\sigma^2\f$
+ * \param cols Number of columns of `B`
+ * \param B    Input matrix, \f$n \times cols\f$
+ * \param C    Output matrix, \f$n \times cols\f$
+ */
+void dd_cov_multiply(u8 n, double var, u32 cols, const double *B, double *C)
+{
+  for (u32 j = 0; j < cols; j++) {
+    double sum = 0;
+    for (u8 i = 0; i < n; i++) {
+      sum += B[i*cols + j];
+    }
+    for (u8 i = 0; i < n; i++) {
+      C[i*cols + j] = var * (B[i*cols + j] + sum);
+    }
+  }
+}
+
+/** Inverse of the double difference covariance.
+ * By Sherman-Morrison,
+ * \f$C^{-1} = \sigma^{-2} (I - 1 1^T / (n + 1))\f$.
+ *
+ * \param n     Number of double differences
+ * \param var   Single difference variance \f$\sigma^2\f$
+ * \param C_inv Output inverse
+ */
+void dd_cov_inverse(u8 n, double var, double *C_inv)
+{
+  double off = -1.0 / ((n + 1) * var);
+  double diag = 1.0 / var + off;
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      C_inv[i*n + j] = (i == j) ? diag : off;
+    }
+  }
+}
+
+/** Solve \f$C x = b\f$ in \f$O(n)\f$. `b` and `x` may be the same.
+ *
+ * \param n   Number of double differences
+ * \param var Single difference variance \f$\sigma^2\f$
+ * \param b   Right hand side, length `n`
+ * \param x   Output solution, length `n`
+ */
+void dd_cov_solve(u8 n, double var, const double *b, double *x)
+{
+  double sum = 0;
+  for (u8 i = 0; i < n; i++) {
+    sum += b[i];
+  }
+  double mean = sum / (n + 1);
+  for (u8 i = 0; i < n; i++) {
+    x[i] = (b[i] - mean) / var;
+  }
+}
+
+/** Cholesky factor of the double difference covariance.
+ * Gives the lower triangular \f$L\f$ with \f$L L^T = C\f$, which is
+ *
+ * \f[ L_{ii} = \sigma \sqrt{(i+2)/(i+1)}, \quad
+ *     L_{ij} = \sigma / \sqrt{(j+1)(j+2)} \quad (i > j) \f]
+ *
+ * counting from zero.
+ *
+ * \param n   Number of double differences
+ * \param var Single difference variance \f$\sigma^2\f$
+ * \param L   Output lower triangular factor, upper triangle zeroed
+ */
+void dd_cov_cholesky(u8 n, double var, double *L)
+{
+  double sigma = sqrt(var);
+  memset(L, 0, n * n * sizeof(double));
+  for (u8 j = 0; j < n; j++) {
+    L[j*n + j] = sigma * sqrt((j + 2.0) / (j + 1.0));
+    double l = sigma / sqrt((j + 1.0) * (j + 2.0));
+    for (u8 i = j + 1; i < n; i++) {
+      L[i*n + j] = l;
+    }
+  }
+}
+
+/** \f$U D U^T\f$ decomposition of the double difference covariance.
+ * Gives the same result as matrix_udu(), which is
+ *
+ * \f[ U_{ij} = 1 / (n + 1 - j) \quad (i < j), \quad
+ *     D_i = \sigma^2 (n + 1 - i) / (n - i) \f]
+ *
+ * counting from zero.
+ *
+ * \param n   Number of double differences
+ * \param var Single difference variance \f$\sigma^2\f$
+ * \param U   Output upper unit triangular factor, lower triangle zeroed
+ * \param D   Output diagonal, length `n`
+ */
+void dd_cov_udu(u8 n, double var, double *U, double *D)
+{
+  memset(U, 0, n * n * sizeof(double));
+  for (u8 j = 0; j < n; j++) {
+    U[j*n + j] = 1;
+    for (u8 i = 0; i < j; i++) {
+      U[i*n + j] = 1.0 / (n + 1 - j);
+    }
+    D[j] = var * (n + 1.0 - j) / (n - j);
+  }
+}
+
+/** Inverse factor of the \f$U D U^T\f$ decomposition.
+ * As dd_cov_udu() but gives \f$U^{-1}\f$, for decorrelating double
+ * difference observations. \f$U^{-1}\f$ is unit upper triangular with
+ * \f$(U^{-1})_{ij} = -1 / (n - i)\f$ for \f$i < j\f$.
+ *
+ * \param n     Number of double differences
+ * \param var   Single difference variance \f$\sigma^2\f$
+ * \param U_inv Output inverse of the upper unit triangular factor
+ * \param D     Output diagonal, length `n`
+ */
+void dd_cov_udu_inverse(u8 n, double var, double *U_inv, double *D)
+{
+  memset(U_inv, 0, n * n * sizeof(double));
+  for (u8 i = 0; i < n; i++) {
+    U_inv[i*n + i] = 1;
+    double u = -1.0 / (n - i);
+    for (u8 j = i + 1; j < n; j++) {
+      U_inv[i*n + j] = u;
+    }
+    D[i] = var * (n + 1.0 - i) / (n - i);
+  }
+}
+
+/** Inverse factor of the \f$U D U^T\f$ decomposition of
+ * \f$\sigma^2 (I + u u^T)\f$.
+ * Generalizes dd_cov_udu_inverse() to any rank one term, such as the
+ * double difference covariance projected onto an orthonormal basis. Working
+ * up from the last row, the remainder after each step is again the identity
+ * plus a multiple \f$\beta\f$ of \f$u u^T\f$, which gives
+ *
+ * \f[ D_j = \sigma^2 (1 + \beta_j u_j^2), \quad
+ *     (U^{-1})_{ij} = -u_i c_j \prod_{i<k<j} \frac{\sigma^2}{D_k}
+ *     \quad (i < j) \f]
+ *
+ * where \f$\beta_{n-1} = 1\f$, \f$c_j = \sigma^2 \beta_j u_j / D_j\f$ and
+ * \f$\beta_{j-1} = \sigma^2 \beta_j / D_j\f$. Takes \f$O(n^2)\f$.
+ *
+ * \param n     Dimension
+ * \param var   Scale \f$\sigma^2\f$
+ * \param u     Rank one term, length `n`
+ * \param U_inv Output inverse of the upper unit triangular factor
+ * \param D     Output diagonal, length `n`
+ */
+void dd_cov_rank_one_udu_inverse(u8 n, double var, const double *u,
+                                 double *U_inv, double *D)
+{
+  double c[n];
+  double beta = 1;
+  for (u8 j = n; j-- > 0;) {
+    double d = 1 + beta * u[j] * u[j];
+    D[j] = var * d;
+    c[j] = beta * u[j] / d;
+    beta /= d;
+  }
+
+  memset(U_inv, 0, n * n * sizeof(double));
+  for (u8 j = 0; j < n; j++) {
+    U_inv[j*n + j] = 1;
+    double r = c[j];
+    for (u8 i = j; i-- > 0;) {
+      U_inv[i*n + j] = -u[i] * r;
+      r *= var / D[i];
+    }
+  }
+}
+
+/** Log determinant of the double difference covariance.
+ * By the matrix determinant lemma,
+ * \f$\log |C| = n \log \sigma^2 + \log (n + 1)\f$.
+ *
+ * \param n   Number of double differences
+ * \param var Single difference variance \f$\sigma^2\f$
+ * \return \f$\log |C|\f$
+ */
+double dd_cov_log_det(u8 n, double var)
+{
+  return n * log(var) + log(n + 1.0);
+}
+
+/** \} */
@@ -19,11 +19,18 @@
 #include "dgnss_management.h"
 #include "linear_algebra.h"
 #include "ambiguity_test.h"
+#include "baseline_qr.h"
+#include "constants.h"
 
 nkf_t nkf;
 sats_management_t sats_management;
 ambiguity_test_t ambiguity_test;
 
+/* Baseline solvers for the float and IAR solutions, carried between epochs
+ * so their geometry factors can be updated incrementally. */
+static baseline_qr_t float_baseline_qr;
+static baseline_qr_t fixed_baseline_qr;
+
 dgnss_settings_t dgnss_settings = {
   .phase_var_test = DEFAULT_PHASE_VAR_TEST,
   .code_var_test = DEFAULT_CODE_VAR_TEST,
@@ -48,6 +55,21 @@ void dgnss_set_settings(double phase_var_test, double code_var_test,
   dgnss_settings.new_int_var    = new_int_var;
 }
 
+/** Set the resources the IAR hypothesis test may use.
+ * See ambiguity_test_set_max_hypotheses() and
+ * ambiguity_test_set_time_budget().
+ *
+ * \param max_hyps    Maximum number of hypotheses to carry.
+ * \param time_budget Time budget for testing hypotheses each epoch [s], or 0
+ *                    for no time budget.
+ * \return As ambiguity_test_set_max_hypotheses().
+ */
+s8 dgnss_set_iar_budget(u32 max_hyps, double time_budget)
+{
+  ambiguity_test_set_time_budget(time_budget);
+  return ambiguity_test_set_max_hypotheses(&ambiguity_test, max_hyps);
+}
+
 void make_measurements(u8 num_double_diffs, const sdiff_t *sdiffs, double *raw_measurements)
 {
   DEBUG_ENTRY();
@@ -280,11 +302,19 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3])
   dgnss_update_sats(num_sats, reciever_ecef, sdiffs_with_ref_first, dd_measurements);
 
   double ref_ecef[3];
+  double b2[3] = {0, 0, 0};
   if (num_sats >= 5) {
     dgnss_incorporate_observation(sdiffs_with_ref_first, dd_measurements, reciever_ecef);
 
-    double b2[3];
-    least_squares_solve_b(&nkf, sdiffs_with_ref_first, dd_measurements, reciever_ecef, b2);
+    double y[num_sats-1];
+    for (u8 i=0; i<num_sats-1; i++) {
+      y[i] = (dd_measurements[i] - nkf.state_mean[i]) * GPS_L1_LAMBDA_NO_VAC;
+    }
+    if (baseline_qr_solve(&float_baseline_qr, num_sats, sdiffs_with_ref_first,
+                          reciever_ecef, y, b2) < 0) {
+      least_squares_solve_b(&nkf, sdiffs_with_ref_first, dd_measurements,
+                            reciever_ecef, b2);
+    }
 
     ref_ecef[0] = reciever_ecef[0] + 0.5 * b2[0];
     ref_ecef[1] = reciever_ecef[1] + 0.5 * b2[1];
@@ -295,13 +325,16 @@ void dgnss_update(u8 num_sats, sdiff_t *sdiffs, double reciever_ecef[3])
                                           &sats_management, nkf.state_mean,
                                           nkf.state_cov_U, nkf.state_cov_D);
 
-  update_ambiguity_test(ref_ecef,
+  update_ambiguity_test(ref_ecef, b2,
                         dgnss_settings.phase_var_test,
                         dgnss_settings.code_var_test,
                         &ambiguity_test, nkf.state_dim,
                         sdiffs, changed_sats);
 
-  update_unanimous_ambiguities(&ambiguity_test);
+  /* Testing the hypotheses finds the unanimous ambiguities as it goes. */
+  if (!ambiguity_test.amb_check.initialized) {
+    update_unanimous_ambiguities(&ambiguity_test);
+  }
 
   if (DEBUG) {
     if (num_sats >=4) {
@@ -368,6 +401,25 @@ void dgnss_new_float_baseline(u8 num_sats, sdiff_t *sdiffs, double receiver_ecef
   DEBUG_EXIT();
 }
 
+/* Least squares baseline from the ambiguity resolved double differences,
+ * using the incremental solver where possible. */
+static void iar_baseline_solve(const sdiff_t *ambiguity_sdiffs,
+                               double *dd_meas, double *DE, double b[3])
+{
+  u8 num_dds = ambiguity_test.amb_check.num_matching_ndxs;
+  double y[num_dds];
+  u8 prns[num_dds];
+  for (u8 i=0; i<num_dds; i++) {
+    y[i] = (dd_meas[i] - ambiguity_test.amb_check.ambs[i])
+           * GPS_L1_LAMBDA_NO_VAC;
+    prns[i] = ambiguity_sdiffs[i+1].prn;
+  }
+  if (baseline_qr_solve_de(&fixed_baseline_qr, num_dds,
+                           ambiguity_sdiffs[0].prn, prns, DE, y, b) < 0) {
+    lesq_solution(num_dds, dd_meas, ambiguity_test.amb_check.ambs, DE, b, 0);
+  }
+}
+
 /* Returns the fixed baseline iff there are at least 3 dd ambs unanimously
  * agreed upon in the ambiguity_test.
  * \return 1 If fixed baseline calculation succeeds
@@ -398,8 +450,7 @@ s8 dgnss_fixed_baseline(u8 num_sdiffs, sdiff_t *sdiffs, double ref_ecef[3],
   assign_de_mtx(ambiguity_test.amb_check.num_matching_ndxs + 1,
                 ambiguity_sdiffs, ref_ecef, DE);
   *num_used = ambiguity_test.amb_check.num_matching_ndxs + 1;
-  lesq_solution(ambiguity_test.amb_check.num_matching_ndxs, dd_meas,
-                ambiguity_test.amb_check.ambs, DE, b, 0);
+  iar_baseline_solve(ambiguity_sdiffs, dd_meas, DE, b);
   return 1;
 }
 
@@ -534,8 +585,7 @@ s8 _dgnss_low_latency_IAR_baseline(u8 num_sdiffs, sdiff_t *sdiffs,
   assign_de_mtx(ambiguity_test.amb_check.num_matching_ndxs + 1,
                 ambiguity_sdiffs, ref_ecef, DE);
   *num_used = ambiguity_test.amb_check.num_matching_ndxs + 1;
-  lesq_solution(ambiguity_test.amb_check.num_matching_ndxs,
-                dd_meas, ambiguity_test.amb_check.ambs, DE, b, 0);
+  iar_baseline_solve(ambiguity_sdiffs, dd_meas, DE, b);
 
   DEBUG_EXIT();
   return 0;
@@ -611,29 +661,16 @@ void dgnss_init_known_baseline(u8 num_sats, sdiff_t *sdiffs,
   dgnss_reset_iar();
 
   memcpy(&ambiguity_test.sats, &sats_management, sizeof(sats_management));
-  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(ambiguity_test.pool);
-  hyp->ll = 0;
-  amb_from_baseline(num_sats, DE, dds, b, hyp->N);
-
-  double obs_cov[(num_sats-1) * (num_sats-1) * 4];
-  memset(obs_cov, 0, (num_sats-1) * (num_sats-1) * 4 * sizeof(double));
-  u8 num_dds = num_sats-1;
-  for (u8 i=0; i<num_dds; i++) {
-    for (u8 j=0; j<num_dds; j++) {
-      u8 i_ = i+num_dds;
-      u8 j_ = j+num_dds;
-      if (i==j) {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test * 2;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test * 2;
-      }
-      else {
-        obs_cov[i*2*num_dds + j] = dgnss_settings.phase_var_test;
-        obs_cov[i_*2*num_dds + j_] = dgnss_settings.code_var_test;
-      }
-    }
-  }
+  s32 N[num_sats-1];
+  amb_from_baseline(num_sats, DE, dds, b, N);
+  /* The known baseline is the only hypothesis. */
+  hypothesis_store_clear(&ambiguity_test.hyps);
+  hypothesis_store_reindex(&ambiguity_test.hyps, num_sats-1);
+  hypothesis_store_add(&ambiguity_test.hyps, num_sats-1, N, 0);
 
-  init_residual_matrices(&ambiguity_test.res_mtxs, num_sats-1, DE, obs_cov);
+  init_residual_matrices_dd(&ambiguity_test.res_mtxs, num_sats-1, DE,
+                            dgnss_settings.phase_var_test,
+                            dgnss_settings.code_var_test);
 }
 
 /* TODO deadcode? */
@@ -684,12 +721,14 @@ void dgnss_init_known_baseline2(u8 num_sats, sdiff_t *sdiffs,
   u8 changed_sats = ambiguity_update_sats(&ambiguity_test, num_sats, sdiffs,
                                           &sats_management, nkf.state_mean,
                                           nkf.state_cov_U, nkf.state_cov_D);
-  update_ambiguity_test(ref_ecef,
+  update_ambiguity_test(ref_ecef, b,
                         dgnss_settings.phase_var_test,
                         dgnss_settings.code_var_test,
                         &ambiguity_test, nkf.state_dim,
                         sdiffs, changed_sats);
-  update_unanimous_ambiguities(&ambiguity_test);
+  if (!ambiguity_test.amb_check.initialized) {
+    update_unanimous_ambiguities(&ambiguity_test);
+  }
 }
 
 double l2_dist(double x1[3], double x2[3])
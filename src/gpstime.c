@@ -16,7 +16,8 @@
 
 /** Normalize a `gps_time_t` GPS time struct.
  * Ensures that the time of week is greater than zero and less than one week by
- * wrapping and adjusting the week number accordingly.
+ * wrapping and adjusting the week number accordingly. A time of week that
+ * is not finite is returned unchanged.
  *
  * \param t GPS time struct.
  * \return Normalized GPS time struct.
@@ -24,31 +25,36 @@
 /* TODO: Either normalise in place or rename to normalised. */
 gps_time_t normalize_gps_time(gps_time_t t)
 {
-  while(t.tow < 0) {
-    t.tow += 3600*24*7;
-    t.wn += 1;
-  }
-
-  while(t.tow > 3600*24*7) {
-    t.tow -= 3600*24*7;
-    t.wn -= 1;
+  /* Whole weeks to move, computed directly so the cost does not depend on
+   * how far out of range the time of week is. */
+  double weeks = floor(t.tow / (3600*24*7));
+  if (!isfinite(weeks)) {
+    return t;
   }
+  t.tow -= weeks * (3600*24*7);
+  t.wn += (s32)weeks;
 
   return t;
 }
 
 /** Convert a `gps_time_t` GPS time to a Unix `time_t`.
- * \note Adjusts for leap seconds using the current constant offset.
+ * \note Adjusts for leap seconds using the leap second table, see
+ *       gps_utc_offset().
  *
  * \param t GPS time struct.
- * \return Unix time.
+ * \return Unix time, or `(time_t)-1` if the time of week is not finite.
  */
 time_t gps2time(gps_time_t gps_t)
 {
-  time_t t = GPS_EPOCH - GPS_MINUS_UTC_SECS;
+  if (!isfinite(gps_t.tow)) {
+    return (time_t)-1;
+  }
+
+  time_t t = GPS_EPOCH;
 
   t += 7*24*3600*gps_t.wn;
   t += (s32)gps_t.tow;
+  t -= gps_utc_offset(gps_time_to_ns(gps_t));
 
   return t;
 }
@@ -66,4 +72,223 @@ double gpsdifftime(gps_time_t end, gps_time_t beginning)
          end.tow - beginning.tow;
 }
 
+/* Days from 1970-01-01 to January 1st of `year` in the proleptic Gregorian
+ * calendar, valid for years after 0 AD. */
+static s32 days_to_jan1(s32 year)
+{
+  /* Count from March 1st of the year before so the leap day comes last. */
+  s32 y = year - 1;
+  s32 era = y / 400;
+  s32 yoe = y - era * 400;
+  s32 doe = yoe * 365 + yoe / 4 - yoe / 100 + 306;
+  return era * 146097 + doe - 719468;
+}
+
+/** Day of the year of a GPS time.
+ * The UTC leap second offset is ignored, which is negligible for the
+ * seasonal models this is intended for.
+ *
+ * \param t GPS time struct.
+ * \return Day of the year, 1.0 at the start of January 1st, or NaN if the
+ *         time of week is not finite.
+ */
+double gps_day_of_year(gps_time_t t)
+{
+  double days = GPS_EPOCH / (24*3600) + 7.0 * t.wn + t.tow / (24*3600);
+  if (!isfinite(days)) {
+    return NAN;
+  }
+  s32 year = 1970 + (s32)(days / 365.2425);
+  while (days < days_to_jan1(year)) {
+    year--;
+  }
+  while (days >= days_to_jan1(year + 1)) {
+    year++;
+  }
+  return days - days_to_jan1(year) + 1;
+}
 
+/** Convert a `gps_time_t` to a nanosecond resolution `gps_time_ns_t`.
+ * The time of week is rounded to the nearest nanosecond.
+ *
+ * \param t GPS time struct.
+ * \return Nanosecond GPS time.
+ */
+gps_time_ns_t gps_time_to_ns(gps_time_t t)
+{
+  gps_time_ns_t r = {
+    .ns = t.wn * GPS_NS_PER_WEEK + llround(t.tow * GPS_NS_PER_S)
+  };
+  return r;
+}
+
+/** Convert a nanosecond resolution `gps_time_ns_t` to a normalized
+ * `gps_time_t`.
+ *
+ * \param t Nanosecond GPS time.
+ * \return GPS time struct.
+ */
+gps_time_t gps_time_from_ns(gps_time_ns_t t)
+{
+  gps_time_t r = {
+    .wn = gps_ns_wn(t),
+    .tow = (double)gps_ns_tow(t) / GPS_NS_PER_S
+  };
+  return r;
+}
+
+/** Construct a nanosecond GPS time from a week number and time of week.
+ * The time of week may be outside of the week, the result is normalized.
+ *
+ * \param wn     GPS week number.
+ * \param tow_ns Nanoseconds since the start of the week.
+ * \return Nanosecond GPS time.
+ */
+gps_time_ns_t gps_ns_from_wn_tow(u16 wn, s64 tow_ns)
+{
+  gps_time_ns_t r = {.ns = wn * GPS_NS_PER_WEEK + tow_ns};
+  return r;
+}
+
+/** GPS week number of a nanosecond GPS time.
+ *
+ * \param t Nanosecond GPS time.
+ * \return GPS week number.
+ */
+u16 gps_ns_wn(gps_time_ns_t t)
+{
+  s64 wn = t.ns / GPS_NS_PER_WEEK;
+  if (t.ns % GPS_NS_PER_WEEK < 0) {
+    wn--;
+  }
+  return (u16)wn;
+}
+
+/** Time of week of a nanosecond GPS time.
+ *
+ * \param t Nanosecond GPS time.
+ * \return Nanoseconds since the start of the GPS week, in
+ *         [0, ::GPS_NS_PER_WEEK).
+ */
+s64 gps_ns_tow(gps_time_ns_t t)
+{
+  s64 tow = t.ns % GPS_NS_PER_WEEK;
+  if (tow < 0) {
+    tow += GPS_NS_PER_WEEK;
+  }
+  return tow;
+}
+
+/** Add a time interval to a nanosecond GPS time.
+ *
+ * \param t     Nanosecond GPS time.
+ * \param dt_ns Interval to add [ns], may be negative.
+ * \return The time `dt_ns` after `t`.
+ */
+gps_time_ns_t gps_ns_add(gps_time_ns_t t, s64 dt_ns)
+{
+  t.ns += dt_ns;
+  return t;
+}
+
+/** Exact time difference between two nanosecond GPS times.
+ *
+ * \param end       Higher bound of the time interval.
+ * \param beginning Lower bound of the time interval.
+ * \return The time from `beginning` to `end` [ns].
+ */
+s64 gps_ns_diff(gps_time_ns_t end, gps_time_ns_t beginning)
+{
+  return end.ns - beginning.ns;
+}
+
+/** Time difference in seconds between two nanosecond GPS times.
+ * The integer difference is formed before converting so the result is as
+ * accurate as a double allows regardless of the magnitude of the times.
+ *
+ * \param end       Higher bound of the time interval.
+ * \param beginning Lower bound of the time interval.
+ * \return The time from `beginning` to `end` [s].
+ */
+double gps_ns_diff_s(gps_time_ns_t end, gps_time_ns_t beginning)
+{
+  return (double)gps_ns_diff(end, beginning) / GPS_NS_PER_S;
+}
+
+/* Leap second table, the Unix (UTC) time at which each new offset between
+ * GPS and UTC time took effect and the new offset. Add new leap seconds to
+ * the end as they are announced. */
+static const struct {
+  s64 unix_s;
+  s8 offset;
+} leap_seconds[] = {
+  {362793600,  1}, /* 1981-07-01 */
+  {394329600,  2}, /* 1982-07-01 */
+  {425865600,  3}, /* 1983-07-01 */
+  {489024000,  4}, /* 1985-07-01 */
+  {567993600,  5}, /* 1988-01-01 */
+  {631152000,  6}, /* 1990-01-01 */
+  {662688000,  7}, /* 1991-01-01 */
+  {709948800,  8}, /* 1992-07-01 */
+  {741484800,  9}, /* 1993-07-01 */
+  {773020800, 10}, /* 1994-07-01 */
+  {820454400, 11}, /* 1996-01-01 */
+  {867715200, 12}, /* 1997-07-01 */
+  {915148800, 13}, /* 1999-01-01 */
+  {1136073600, 14}, /* 2006-01-01 */
+  {1230768000, 15}, /* 2009-01-01 */
+  {1341100800, 16}, /* 2012-07-01 */
+  {1435708800, 17}, /* 2015-07-01 */
+  {1483228800, 18}, /* 2017-01-01 */
+};
+#define N_LEAP_SECONDS (sizeof(leap_seconds) / sizeof(leap_seconds[0]))
+
+/** Offset between GPS and UTC time at a given GPS time.
+ * Looks up the leap second table, searching from the most recent entry so
+ * that current times are found immediately.
+ *
+ * \param t Nanosecond GPS time.
+ * \return GPS time minus UTC time [s].
+ */
+s8 gps_utc_offset(gps_time_ns_t t)
+{
+  for (s32 i = N_LEAP_SECONDS - 1; i >= 0; i--) {
+    /* GPS time at which this offset took effect. */
+    s64 start_ns = (leap_seconds[i].unix_s - GPS_EPOCH + leap_seconds[i].offset)
+                   * GPS_NS_PER_S;
+    if (t.ns >= start_ns) {
+      return leap_seconds[i].offset;
+    }
+  }
+  return 0;
+}
+
+/** Convert a nanosecond GPS time to UTC, as nanoseconds since the Unix
+ * epoch.
+ *
+ * \param t Nanosecond GPS time.
+ * \return Unix time [ns].
+ */
+s64 gps_ns_to_unix_ns(gps_time_ns_t t)
+{
+  return t.ns + (GPS_EPOCH - gps_utc_offset(t)) * GPS_NS_PER_S;
+}
+
+/** Convert a UTC time, as nanoseconds since the Unix epoch, to a nanosecond
+ * GPS time.
+ *
+ * \param unix_ns Unix time [ns].
+ * \return Nanosecond GPS time.
+ */
+gps_time_ns_t unix_ns_to_gps_ns(s64 unix_ns)
+{
+  s8 offset = 0;
+  for (s32 i = N_LEAP_SECONDS - 1; i >= 0; i--) {
+    if (unix_ns >= leap_seconds[i].unix_s * GPS_NS_PER_S) {
+      offset = leap_seconds[i].offset;
+      break;
+    }
+  }
+  gps_time_ns_t t = {.ns = unix_ns - (GPS_EPOCH - offset) * GPS_NS_PER_S};
+  return t;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <string.h>
+
+#include "hypothesis_store.h"
+
+/** \defgroup hypothesis_store Hypothesis Store
+ * Contiguous storage for integer ambiguity hypotheses.
+ *
+ * Unlike the general purpose ::memory_pool_t, the hypothesis store keeps the
+ * log likelihoods and each ambiguity of the hypotheses in separate contiguous
+ * arrays. Iterating over the store is then a set of linear memory streams
+ * rather than a linked list traversal, and filtering is done by compacting
+ * the arrays in place.
+ *
+ * Hypotheses are kept in the order in which they were added, and filtering
+ * preserves that order.
+ *
+ * Looking up a hypothesis by its ambiguities and finding the most likely
+ * hypothesis use a hash index and a running maximum. Adding hypotheses keeps
+ * these up to date, operations that move hypotheses or change their
+ * ambiguities mark them stale until the next hypothesis_store_reindex().
+ * Code that writes to the log likelihoods directly must reindex, or set
+ * `mle` itself, afterwards.
+ * \{ */
+
+/* Hash of the first `num_dds` ambiguities of a hypothesis, `N` has stride
+ * `stride` between ambiguities. */
+static u32 hash_ambs(const s32 *N, u32 stride, u8 num_dds)
+{
+  u32 h = 2166136261u;
+  for (u8 k = 0; k < num_dds; k++) {
+    h = (h ^ (u32)N[k*stride]) * 16777619u;
+  }
+  /* Neighbouring hypotheses differ in the low bits of a few ambiguities,
+   * mix those into the high bits too. */
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+/* Whether hypothesis `i` has the ambiguities `N`, with stride `stride`. */
+static u8 ambs_equal(const hypothesis_store_t *store, u32 i,
+                     const s32 *N, u32 stride, u8 num_dds)
+{
+  for (u8 k = 0; k < num_dds; k++) {
+    if (store->N[k*store->stride + i] != N[k*stride]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Add hypothesis `i` to the hash index, unless a hypothesis with the same
+ * ambiguities is already there. Linear probing, the index is at most half
+ * full. */
+static void index_insert(hypothesis_store_t *store, u32 i)
+{
+  const s32 *N = &store->N[i];
+  u8 num_dds = store->index_dds;
+  u32 slot = hash_ambs(N, store->stride, num_dds) % store->index_size;
+  while (store->index[slot]) {
+    if (ambs_equal(store, store->index[slot] - 1, N, store->stride, num_dds)) {
+      return;
+    }
+    slot = (slot + 1) % store->index_size;
+  }
+  store->index[slot] = i + 1;
+}
+
+/** Initialise a hypothesis store.
+ * This function does not allocate memory and must be passed a buffer of at
+ * least `HYPOTHESIS_STORE_BUFF_SIZE(capacity)` bytes, aligned to at least
+ * four bytes. Aligning it to 32 bytes also aligns every column, see
+ * ::HYPOTHESIS_STORE_ALIGN, which helps the compiler vectorize loops over
+ * them but isn't required.
+ *
+ * \param store    Pointer to the hypothesis store to initialise
+ * \param capacity Maximum number of hypotheses the store can hold
+ * \param buff     Pointer to a buffer to use as the store working area
+ * \return `0` on success, `<0` on failure.
+ */
+s8 hypothesis_store_init(hypothesis_store_t *store, u32 capacity, void *buff)
+{
+  if (!store) {
+    return -1;
+  }
+  if (!buff) {
+    return -2;
+  }
+
+  store->capacity = capacity;
+  store->stride = HYPOTHESIS_STORE_STRIDE(capacity);
+  store->n = 0;
+  store->ll = (float *)buff;
+  store->N = (s32 *)(store->ll + store->stride);
+  store->index = (u32 *)(store->N + HYPOTHESIS_STORE_MAX_DDS * store->stride);
+  store->index_size = HYPOTHESIS_STORE_INDEX_SLOTS * store->stride;
+  store->keep = (u8 *)(store->index + store->index_size);
+  hypothesis_store_reindex(store, 0);
+
+  return 0;
+}
+
+/** Remove all hypotheses from a hypothesis store.
+ * The hash index stays keyed on the same number of ambiguities.
+ *
+ * \param store Pointer to a hypothesis store
+ */
+void hypothesis_store_clear(hypothesis_store_t *store)
+{
+  store->n = 0;
+  hypothesis_store_reindex(store, store->index_dds);
+}
+
+/** Add a hypothesis to the end of a hypothesis store.
+ * If the hash index is up to date it is updated to include the new
+ * hypothesis, in which case `num_dds` should be at least `store->index_dds`.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities in the hypothesis
+ * \param N       Integer ambiguities of the hypothesis, length `num_dds`
+ * \param ll      Log likelihood of the hypothesis
+ * \return Index of the new hypothesis, or `-1` if the store is full.
+ */
+s32 hypothesis_store_add(hypothesis_store_t *store, u8 num_dds,
+                         const s32 *N, float ll)
+{
+  if (store->n >= store->capacity) {
+    return -1;
+  }
+
+  u32 i = store->n++;
+  store->ll[i] = ll;
+  for (u8 k = 0; k < num_dds; k++) {
+    store->N[k*store->stride + i] = N[k];
+  }
+  if (store->indexed) {
+    index_insert(store, i);
+    if (i == 0 || ll > store->ll[store->mle]) {
+      store->mle = i;
+    }
+  }
+  return i;
+}
+
+/** Get the ambiguities of a hypothesis in a hypothesis store.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param i       Index of the hypothesis, less than `store->n`
+ * \param num_dds Number of ambiguities in the hypothesis
+ * \param N       Output ambiguities, length `num_dds`
+ */
+void hypothesis_store_get(const hypothesis_store_t *store, u32 i, u8 num_dds,
+                          s32 *N)
+{
+  for (u8 k = 0; k < num_dds; k++) {
+    N[k] = store->N[k*store->stride + i];
+  }
+}
+
+/** Set the ambiguities of a hypothesis in a hypothesis store.
+ * Marks the hash index as stale.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param i       Index of the hypothesis, less than `store->n`
+ * \param num_dds Number of ambiguities in the hypothesis
+ * \param N       New ambiguities, length `num_dds`
+ */
+void hypothesis_store_set(hypothesis_store_t *store, u32 i, u8 num_dds,
+                          const s32 *N)
+{
+  for (u8 k = 0; k < num_dds; k++) {
+    store->N[k*store->stride + i] = N[k];
+  }
+  store->indexed = 0;
+}
+
+/** Remove hypotheses from part of a hypothesis store.
+ * Removes every hypothesis `i` in `[start, end)` for which `store->keep[i]`
+ * is zero, moving the remaining hypotheses of the range down to its start.
+ * Hypotheses outside the range are not touched, so disjoint ranges can be
+ * compacted concurrently and then joined up with hypothesis_store_move().
+ * `store->n` is not changed and the hash index is left as it was, it must be
+ * rebuilt with hypothesis_store_reindex() if any hypotheses were removed.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities in the hypotheses
+ * \param start   Index of the first hypothesis in the range
+ * \param end     One past the index of the last hypothesis in the range
+ * \return Number of hypotheses kept, they are at `[start, start + return)`.
+ */
+u32 hypothesis_store_compact_range(hypothesis_store_t *store, u8 num_dds,
+                                   u32 start, u32 end)
+{
+  const u8 *keep = store->keep;
+
+  /* Skip over the leading run of kept hypotheses, they don't move. */
+  u32 first = start;
+  while (first < end && keep[first]) {
+    first++;
+  }
+
+  u32 j = first;
+  for (u32 i = first; i < end; i++) {
+    if (keep[i]) {
+      store->ll[j++] = store->ll[i];
+    }
+  }
+  for (u8 k = 0; k < num_dds; k++) {
+    s32 *col = &store->N[k*store->stride];
+    u32 jk = first;
+    for (u32 i = first; i < end; i++) {
+      if (keep[i]) {
+        col[jk++] = col[i];
+      }
+    }
+  }
+
+  return j - start;
+}
+
+/** Move a block of hypotheses within a hypothesis store.
+ * The source and destination may overlap. `store->n` is not changed. Marks
+ * the hash index as stale, unless nothing moves.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities in the hypotheses
+ * \param dst     Index the block is moved to
+ * \param src     Index of the first hypothesis in the block
+ * \param count   Number of hypotheses in the block
+ */
+void hypothesis_store_move(hypothesis_store_t *store, u8 num_dds,
+                           u32 dst, u32 src, u32 count)
+{
+  if (dst == src || count == 0) {
+    return;
+  }
+  store->indexed = 0;
+  memmove(&store->ll[dst], &store->ll[src], count * sizeof(float));
+  for (u8 k = 0; k < num_dds; k++) {
+    s32 *col = &store->N[k*store->stride];
+    memmove(&col[dst], &col[src], count * sizeof(s32));
+  }
+}
+
+/** Remove hypotheses from a hypothesis store.
+ * Removes every hypothesis `i` for which `store->keep[i]` is zero, moving the
+ * remaining hypotheses down to fill the gaps. The caller fills in
+ * `store->keep[0 .. store->n-1]` before calling. The hash index is rebuilt
+ * if any hypotheses were removed.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities in the hypotheses
+ * \return Number of hypotheses left in the store.
+ */
+u32 hypothesis_store_compact(hypothesis_store_t *store, u8 num_dds)
+{
+  u32 n = hypothesis_store_compact_range(store, num_dds, 0, store->n);
+  if (n != store->n) {
+    store->n = n;
+    hypothesis_store_reindex(store, store->index_dds);
+  }
+  return n;
+}
+
+/** Rebuild the hash index and find the most likely hypothesis.
+ * Takes time linear in the number of hypotheses.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities to key the hash index on
+ */
+void hypothesis_store_reindex(hypothesis_store_t *store, u8 num_dds)
+{
+  store->index_dds = num_dds;
+  store->indexed = 1;
+  store->mle = 0;
+  memset(store->index, 0, store->index_size * sizeof(u32));
+  for (u32 i = 0; i < store->n; i++) {
+    index_insert(store, i);
+    if (store->ll[i] > store->ll[store->mle]) {
+      store->mle = i;
+    }
+  }
+}
+
+/** Find a hypothesis by its ambiguities.
+ * Takes constant time if the hash index is up to date and keyed on `num_dds`
+ * ambiguities, otherwise falls back to a linear search.
+ *
+ * \param store   Pointer to a hypothesis store
+ * \param num_dds Number of ambiguities to compare
+ * \param N       Ambiguities to look for, length `num_dds`
+ * \return Index of a hypothesis with ambiguities `N`, or `-1` if there is
+ *         none.
+ */
+s32 hypothesis_store_find(const hypothesis_store_t *store, u8 num_dds,
+                          const s32 *N)
+{
+  if (store->indexed && store->index_dds == num_dds) {
+    u32 slot = hash_ambs(N, 1, num_dds) % store->index_size;
+    while (store->index[slot]) {
+      u32 i = store->index[slot] - 1;
+      if (ambs_equal(store, i, N, 1, num_dds)) {
+        return i;
+      }
+      slot = (slot + 1) % store->index_size;
+    }
+    return -1;
+  }
+
+  for (u32 i = 0; i < store->n; i++) {
+    if (ambs_equal(store, i, N, 1, num_dds)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/** Find the hypothesis with the greatest log likelihood.
+ * Takes constant time if the hash index is up to date, otherwise falls back
+ * to a linear search.
+ *
+ * \param store Pointer to a hypothesis store
+ * \return Index of the most likely hypothesis, or `-1` if the store is
+ *         empty.
+ */
+s32 hypothesis_store_mle(const hypothesis_store_t *store)
+{
+  if (store->n == 0) {
+    return -1;
+  }
+  if (store->indexed) {
+    return store->mle;
+  }
+
+  u32 mle = 0;
+  for (u32 i = 1; i < store->n; i++) {
+    if (store->ll[i] > store->ll[mle]) {
+      mle = i;
+    }
+  }
+  return mle;
+}
+
+/** \} */
@@ -9,6 +9,8 @@
 *         1995
 *     [2] X.-W.Chang, X.Yang, T.Zhou, MLAMBDA: A modified LAMBDA method for
 *         integer least-squares estimation, J.Geodesy, Vol.79, 552-565, 2005
+*     [3] P.J.G.Teunissen, An optimality property of the integer least-squares
+*         estimator, J.Geodesy, Vol.73, 587-593, 1999
 *
 * version : $Revision: 1.1 $ $Date: 2008/07/17 21:48:06 $
 * history : 2007/01/13 1.0 new
@@ -16,103 +18,51 @@
 
 #include <string.h>
 #include <math.h>
-#include <cblas.h>
-#include <clapack.h>
 
-#include "amb_kf.h"
+#include "lambda.h"
 #include "logging.h"
 
 /* constants/macros ----------------------------------------------------------*/
 
-#define LOOPMAX     10000           /* maximum count of search loop */
-
 #define SGN(x)      ((x)<=0.0?-1.0:1.0)
 #define ROUND(x)    (floor((x)+0.5))
 #define SWAP(x,y)   do {double tmp_; tmp_=x; x=y; y=tmp_;} while (0)
 
-
-static void triu2(u32 n, double *M)
-{
-  for (u32 i=1; i<n; i++) {
-    for (u32 j=0; j<i; j++) {
-      M[i*n + j] = 0;
-    }
-  }
-}
-
-static void eye2(u32 n, double *M)
-{
-  memset(M, 0, n * n * sizeof(double));
-  for (u32 i=0; i<n; i++) {
-    M[i*n + i] = 1;
-  }
-}
-
-static s8 udu2(u32 n, double *M, double *U, double *D) //todo: replace with DSYTRF
-{
-  double alpha, beta;
-  triu2(n, M);
-  eye2(n, U);
-  memset(D, 0, n * sizeof(double));
-
-  for (u32 j=n; j>=2; j--) {
-    D[j - 1] = M[(j-1)*n + j-1];
-    if (D[j-1] > 0) {
-      alpha = 1.0 / D[j-1];
-    } else {
-      alpha = 0.0;
-    }
-    for (u32 k=1; k<j; k++) {
-      beta = M[(k-1)*n + j-1];
-      U[(k-1)*n + j-1] = alpha * beta;
-      for (u32 kk = 0; kk < k; kk++) {
-        M[kk*n + k-1] = M[kk*n + k-1] - beta * U[kk*n + j-1];
-      }
-    }
-
-  }
-  D[0] = M[0];
-  return 0;
-}
-
-
-/* LD factorization (Q=L'*diag(D)*L) -----------------------------------------*/
-int LD(int n, const double *Q, double *L, double *D)
+/* LD factorization (Q=L'*diag(D)*L), A is n x n scratch ---------------------*/
+static int LD(int n, const double *Q, double *L, double *D, double *A)
 {
-    int i,j,k,info=0;
+    int i,j,k;
     double a;
-    double A[n*n];
     memset(L, 0, sizeof(double)*n*n);
     memset(D, 0, sizeof(double)*n);
 
     memcpy(A,Q,sizeof(double)*n*n);
     for (i=n-1;i>=0;i--) {
-        if ((D[i]=A[i+i*n])<=0.0) {info=-1; break;}
+        if ((D[i]=A[i+i*n])<=0.0) {
+            log_error("%s : LD factorization error\n",__FILE__);
+            return -1;
+        }
         a=sqrt(D[i]);
         for (j=0;j<=i;j++) L[i+j*n]=A[i+j*n]/a;
         for (j=0;j<=i-1;j++) for (k=0;k<=j;k++) A[j+k*n]-=L[i+k*n]*L[i+j*n];
         for (j=0;j<=i;j++) L[i+j*n]/=L[i+i*n];
     }
-    if (info) {
-        log_error("%s : LD factorization error, trying UD from Gibbs (col major UD = LD)\n",__FILE__);
-        double Qcopy[n * n];
-        memcpy(Qcopy, Q, n * n * sizeof(double));
-        udu2(n, Qcopy, L, D);
-    }
-    return info;
+    return 0;
 }
-/* integer gauss transformation ----------------------------------------------*/
-void gauss(int n, double *L, double *Z, int i, int j)
+/* integer gauss transformation, Zi=Z^-1 -------------------------------------*/
+static void gauss(int n, double *L, double *Z, double *Zi, int i, int j)
 {
     int k,mu;
 
     if ((mu=(int)ROUND(L[i+j*n]))!=0) {
         for (k=i;k<n;k++) L[k+n*j]-=(double)mu*L[k+i*n];
         for (k=0;k<n;k++) Z[k+n*j]-=(double)mu*Z[k+i*n];
+        for (k=0;k<n;k++) Zi[i+n*k]+=(double)mu*Zi[j+n*k];
     }
 }
-/* permutations --------------------------------------------------------------*/
-void perm(int n, double *L, double *D, int j, double del, double *Z)
+/* permutations, Zi=Z^-1 -----------------------------------------------------*/
+static void perm(int n, double *L, double *D, int j, double del, double *Z,
+                 double *Zi)
 {
     int k;
     double eta,lam,a0,a1;
@@ -128,90 +78,285 @@ void perm(int n, double *L, double *D, int j, double del, double *Z)
     L[j+1+j*n]=lam;
     for (k=j+2;k<n;k++) SWAP(L[k+j*n],L[k+(j+1)*n]);
     for (k=0;k<n;k++) SWAP(Z[k+j*n],Z[k+(j+1)*n]);
+    for (k=0;k<n;k++) SWAP(Zi[j+k*n],Zi[j+1+k*n]);
 }
 /* lambda reduction (z=Z'*a, Qz=Z'*Q*Z=L'*diag(D)*L) (ref.[1]) ---------------*/
-void reduction(int n, double *L, double *D, double *Z)
+static void reduction(int n, double *L, double *D, double *Z, double *Zi)
 {
     int i,j,k;
     double del;
 
     j=n-2; k=n-2;
     while (j>=0) {
-        if (j<=k) for (i=j+1;i<n;i++) gauss(n,L,Z,i,j);
+        if (j<=k) for (i=j+1;i<n;i++) gauss(n,L,Z,Zi,i,j);
         del=D[j]+L[j+1+j*n]*L[j+1+j*n]*D[j+1];
         if (del+1E-6<D[j+1]) { /* compared considering numerical error */
-            perm(n,L,D,j,del,Z);
+            perm(n,L,D,j,del,Z,Zi);
             k=j; j=n-2;
         }
         else j--;
     }
 }
-/* modified lambda (mlambda) search (ref. [2]) -------------------------------*/
-static int search(int n, int m, const double *L, const double *D,
-                  const double *zs, double *zn, double *s)
+
+/** \defgroup lambda LAMBDA
+ * Integer least squares estimation with the LAMBDA method.
+ *
+ * The float covariance is decorrelated by an integer transformation
+ * (ref. [1]) once in lambda_init(), and the best `k` integer candidates for
+ * a float solution are then found by a depth first search of the reduced
+ * problem (ref. [2]) in lambda_search(). All matrices are column major.
+ * \{ */
+
+/** Set up a LAMBDA workspace for a float covariance.
+ * Factorizes and reduces `Q`, this doesn't depend on the float parameters
+ * so the workspace can be reused for any number of searches. Does not
+ * allocate memory, `buff` must be at least `LAMBDA_WORKSPACE_SIZE(n)` bytes
+ * and aligned for doubles.
+ *
+ * \param ws   Workspace to set up.
+ * \param n    Number of float parameters.
+ * \param Q    Covariance of the float parameters, `n` x `n`.
+ * \param buff Buffer for the workspace.
+ * \return `0` on success, `-1` if `n` is zero or `Q` is not positive
+ *         definite, in which case `ws->Z` is the identity.
+ */
+s8 lambda_init(lambda_workspace_t *ws, u8 n, const double *Q, void *buff)
+{
+  double *p = (double *)buff;
+  ws->n = n;
+  ws->max_iterations = LAMBDA_MAX_ITERATIONS;
+  ws->L = p; p += n*n;
+  ws->Z = p; p += n*n;
+  ws->Z_inv = p; p += n*n;
+  ws->S = p; p += n*n;
+  ws->D = p; p += n;
+  ws->z_float = p; p += n;
+  ws->z_cond = p; p += n;
+  ws->z = p; p += n;
+  ws->step = p; p += n;
+  ws->dist = p; p += n;
+  ws->stale = (u8 *)p;
+
+  if (n == 0) {
+    return -1;
+  }
+
+  memset(ws->Z, 0, n * n * sizeof(double));
+  memset(ws->Z_inv, 0, n * n * sizeof(double));
+  for (u8 i = 0; i < n; i++) {
+    ws->Z[i*n + i] = 1;
+    ws->Z_inv[i*n + i] = 1;
+  }
+
+  if (LD(n, Q, ws->L, ws->D, ws->S)) {
+    return -1;
+  }
+  reduction(n, ws->L, ws->D, ws->Z, ws->Z_inv);
+  return 0;
+}
+
+/* Max-heap of candidates on their distance. Candidate `i` is column `i` of
+ * `E`, with distance `s[i]`. */
+static void heap_swap(u8 n, double *E, double *s, u32 i, u32 j)
+{
+  SWAP(s[i], s[j]);
+  for (u8 l = 0; l < n; l++) {
+    SWAP(E[l + i*n], E[l + j*n]);
+  }
+}
+
+static void heap_sift_up(u8 n, double *E, double *s, u32 i)
+{
+  while (i > 0 && s[(i - 1) / 2] < s[i]) {
+    heap_swap(n, E, s, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void heap_sift_down(u8 n, double *E, double *s, u32 count, u32 i)
+{
+  while (1) {
+    u32 largest = i;
+    u32 c = 2*i + 1;
+    if (c < count && s[c] > s[largest]) {
+      largest = c;
+    }
+    if (c + 1 < count && s[c + 1] > s[largest]) {
+      largest = c + 1;
+    }
+    if (largest == i) {
+      return;
+    }
+    heap_swap(n, E, s, i, largest);
+    i = largest;
+  }
+}
+
+/* Record that the conditional residual at `level` has changed. Columns of S
+ * below it are brought up to date lazily, when the search next descends into
+ * them (ref. [2]). */
+static void mark_stale(lambda_workspace_t *ws, u8 level)
+{
+  if (level > 0 && ws->stale[level - 1] < level) {
+    ws->stale[level - 1] = level;
+  }
+}
+
+/** Find the best integer candidates for a float solution.
+ * Searches for the `k` integer vectors closest to `a` in the metric of the
+ * covariance given to lambda_init(), i.e. those with the smallest
+ * \f$(a - F)^T Q^{-1} (a - F)\f$.
+ *
+ * The search only visits integer vectors within `max_dist` of `a`, or
+ * within the distance of the `k`th best candidate found so far if that is
+ * smaller, so a tight `max_dist` (e.g. from a chi-square bound) lets it
+ * terminate early. The partial sums of the conditional estimates are only
+ * brought up to date for the levels the search actually descends into, so
+ * the work per visited node doesn't grow with `n`.
+ *
+ * The ratio statistic is set to zero if fewer than two candidates are found
+ * or the best candidate has zero distance. The success rate is that of integer
+ * bootstrapping on the reduced problem, a lower bound on the success rate of
+ * integer least squares (ref. [3]).
+ *
+ * \param ws       Workspace set up by lambda_init().
+ * \param a        Float parameters, length `n`.
+ * \param k        Number of candidates to find.
+ * \param max_dist Distance bound, or 0 for none.
+ * \param F        Output candidates, `n` x `k`, best first.
+ * \param s        Output distances of the candidates, length `k`, ascending.
+ * \param stats    Output statistics of the search, may be `NULL`.
+ * \return `0` on success, `-1` if `k` is zero, in which case nothing is
+ *         output, or if the search was stopped after `ws->max_iterations`
+ *         nodes. The candidates found up to that point are still output.
+ */
+s8 lambda_search(lambda_workspace_t *ws, const double *a, u32 k,
+                 double max_dist, double *F, double *s,
+                 lambda_stats_t *stats)
 {
-    int i,j,k,c,nn=0,imax=0;
-    double newdist,maxdist=1E99,y;
-    double S[n*n];
-    double dist[n];
-    double zb[n];
-    double z[n];
-    double step[n];
-    memset(S, 0, sizeof(double)*n*n);
-
-    k=n-1; dist[k]=0.0;
-    zb[k]=zs[k];
-    z[k]=ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
-    for (c=0;c<LOOPMAX;c++) {
-        newdist=dist[k]+y*y/D[k];
-        if (newdist<maxdist) {
-            if (k!=0) {
-                dist[--k]=newdist;
-                for (i=0;i<=k;i++)
-                    S[k+i*n]=S[k+1+i*n]+(z[k+1]-zb[k+1])*L[k+1+i*n];
-                zb[k]=zs[k]+S[k+k*n];
-                z[k]=ROUND(zb[k]); y=zb[k]-z[k]; step[k]=SGN(y);
-            }
-            else {
-                if (nn<m) {
-                    if (nn==0||newdist>s[imax]) imax=nn;
-                    for (i=0;i<n;i++) zn[i+nn*n]=z[i];
-                    s[nn++]=newdist;
-                }
-                else {
-                    if (newdist<s[imax]) {
-                        for (i=0;i<n;i++) zn[i+imax*n]=z[i];
-                        s[imax]=newdist;
-                        for (i=imax=0;i<m;i++) if (s[imax]<s[i]) imax=i;
-                    }
-                    maxdist=s[imax];
-                }
-                z[0]+=step[0]; y=zb[0]-z[0]; step[0]=-step[0]-SGN(step[0]);
-            }
+  u8 n = ws->n;
+  const double *L = ws->L;
+  const double *D = ws->D;
+  double *S = ws->S;
+  double *zs = ws->z_float;
+  double *zb = ws->z_cond;
+  double *z = ws->z;
+  double *step = ws->step;
+  double *dist = ws->dist;
+  u8 *stale = ws->stale;
+
+  if (k == 0) {
+    return -1;
+  }
+
+  /* zs = Z^T a */
+  for (u8 i = 0; i < n; i++) {
+    zs[i] = 0;
+    for (u8 j = 0; j < n; j++) {
+      zs[i] += ws->Z[j + i*n] * a[j];
+    }
+  }
+
+  memset(S, 0, n * n * sizeof(double));
+  memset(stale, n - 1, n);
+
+  double maxdist = max_dist > 0 ? max_dist : 1E99;
+  u32 count = 0;
+  u32 c;
+  u8 l = n - 1;
+  dist[l] = 0;
+  zb[l] = zs[l];
+  z[l] = ROUND(zb[l]);
+  double y = zb[l] - z[l];
+  step[l] = SGN(y);
+  for (c = 0; c < ws->max_iterations; c++) {
+    double newdist = dist[l] + y*y/D[l];
+    if (newdist < maxdist) {
+      if (l != 0) {
+        /* Bring column l-1 of S up to date and move down a level. */
+        u8 m = l - 1;
+        double *S_m = &S[m*n];
+        const double *L_m = &L[m*n];
+        for (u8 j = stale[m]; j > m; j--) {
+          S_m[j - 1] = S_m[j] + (z[j] - zb[j]) * L_m[j];
         }
-        else {
-            if (k==n-1) break;
-            else {
-                k++;
-                z[k]+=step[k]; y=zb[k]-z[k]; step[k]=-step[k]-SGN(step[k]);
-            }
+        if (m > 0 && stale[m - 1] < stale[m]) {
+          stale[m - 1] = stale[m];
         }
-    }
-    for (i=0;i<m-1;i++) { /* sort by s */
-        for (j=i+1;j<m;j++) {
-            if (s[i]<s[j]) continue;
-            SWAP(s[i],s[j]);
-            for (k=0;k<n;k++) SWAP(zn[k+i*n],zn[k+j*n]);
+        stale[m] = m;
+
+        dist[m] = newdist;
+        l = m;
+        zb[l] = zs[l] + S_m[l];
+        z[l] = ROUND(zb[l]);
+        y = zb[l] - z[l];
+        step[l] = SGN(y);
+        mark_stale(ws, l);
+      } else {
+        /* A candidate, keep it if it is among the best k. */
+        if (count < k) {
+          memcpy(&F[count*n], z, n * sizeof(double));
+          s[count] = newdist;
+          heap_sift_up(n, F, s, count++);
+        } else if (newdist < s[0]) {
+          memcpy(F, z, n * sizeof(double));
+          s[0] = newdist;
+          heap_sift_down(n, F, s, count, 0);
         }
+        if (count == k) {
+          maxdist = MIN(maxdist, s[0]);
+        }
+        z[0] += step[0];
+        y = zb[0] - z[0];
+        step[0] = -step[0] - SGN(step[0]);
+      }
+    } else {
+      if (l == n - 1) {
+        break;
+      }
+      l++;
+      z[l] += step[l];
+      y = zb[l] - z[l];
+      step[l] = -step[l] - SGN(step[l]);
+      mark_stale(ws, l);
     }
+  }
 
-    if (c>=LOOPMAX) {
-        log_error("LAMBDA search loop count overflow\n");
-        return -1;
+  /* Sort the candidates by distance, and transform back with F = Z^-T E. */
+  for (u32 i = count; i > 1; i--) {
+    heap_swap(n, F, s, 0, i - 1);
+    heap_sift_down(n, F, s, i - 1, 0);
+  }
+  for (u32 j = 0; j < count; j++) {
+    double *F_j = &F[j*n];
+    memcpy(zb, F_j, n * sizeof(double));
+    for (u8 i = 0; i < n; i++) {
+      F_j[i] = 0;
+      for (u8 m = 0; m < n; m++) {
+        F_j[i] += ws->Z_inv[m + i*n] * zb[m];
+      }
     }
-    return 0;
+  }
+
+  if (stats) {
+    stats->n_candidates = count;
+    stats->ratio = (count >= 2 && s[0] > 0) ? s[1] / s[0] : 0;
+    stats->success_rate = 1;
+    for (u8 i = 0; i < n; i++) {
+      stats->success_rate *= erf(1 / (2 * sqrt(2 * D[i])));
+    }
+    stats->iterations = c;
+  }
+
+  if (c >= ws->max_iterations) {
+    log_error("LAMBDA search loop count overflow\n");
+    return -1;
+  }
+  return 0;
 }
 
+/** \} */
+
 /* lambda reduction transformation ------------------------------
 * integer least-square estimation. reduction is performed by lambda (ref.[1]),
 * and search by mlambda (ref.[2]).
@@ -223,75 +368,15 @@ static int search(int n, int m, const double *L, const double *D,
 *-----------------------------------------------------------------------------*/
 int lambda_reduction(int n, const double *Q, double *Z)
 {
-    int info;
-
     if (n<=0) return -1;
 
-    double L[n*n];
-    double D[n];
-
-    /* L = zeros(n,n) */
-    memset(L, 0, sizeof(double)*n*n);
-
-    /* Z = eye(n) */
-    memset(Z, 0, sizeof(double)*n*n);
-    for (int i=0; i<n; i++)
-      Z[i+n*i] = 1;
-
-    /* LD factorization */
-    if (!(info=LD(n,Q,L,D))) {
-        /* lambda reduction */
-        reduction(n,L,D,Z);
-    }
-
-    return info;
-}
-
-/* multiply matrix (wrapper of blas dgemm) -------------------------------------
-* multiply matrix by matrix (C=alpha*A*B+beta*C)
-* args   : char   *tr       I  transpose flags ("N":normal,"T":transpose)
-*          int    n,k,m     I  size of (transposed) matrix A,B
-*          double alpha     I  alpha
-*          double *A,*B     I  (transposed) matrix A (n x m), B (m x k)
-*          double beta      I  beta
-*          double *C        IO matrix C (n x k)
-* return : none
-*-----------------------------------------------------------------------------*/
-void matmul(const char *tr, integer n, integer k, integer m, double alpha,
-                   const double *A, const double *B, double beta, double *C)
-{
-    integer lda=tr[0]=='T'?m:n,ldb=tr[1]=='T'?k:m;
-
-    dgemm_((char *)tr,(char *)tr+1,&n,&k,&m,&alpha,(double *)A,&lda,(double *)B,
-           &ldb,&beta,C,&n);
-}
-
-/* solve linear equation -------------------------------------------------------
-* solve linear equation (X=A\Y or X=A'\Y)
-* args   : char   *tr       I   transpose flag ("N":normal,"T":transpose)
-*          double *A        I   input matrix A (n x n)
-*          double *Y        I   input matrix Y (n x m)
-*          int    n,m       I   size of matrix A,Y
-*          double *X        O   X=A\Y or X=A'\Y (n x m)
-* return : status (0:ok,0>:error)
-* notes  : matirix stored by column-major order (fortran convention)
-*          X can be same as Y
-*-----------------------------------------------------------------------------*/
-int solve(const char *tr, const double *A, const double *Y, integer n,
-                 integer m, double *X)
-{
-    double B[n*n];
-    integer info;
-    integer ipiv[n];
-
-    memcpy(B, A, sizeof(double)*n*n);
-    memcpy(X, Y, sizeof(double)*n*m);
-    dgetrf_(&n,&n,B,&n,ipiv,&info);
-    if (!info) dgetrs_((char *)tr,&n,&m,B,&n,ipiv,X,&n,&info);
+    double buff[LAMBDA_WORKSPACE_SIZE(n)/sizeof(double)+1];
+    lambda_workspace_t ws;
+    int info=lambda_init(&ws,n,Q,buff);
+    memcpy(Z,ws.Z,sizeof(double)*n*n);
     return info;
 }
 
-
 /* lambda/mlambda integer least-square estimation ------------------------------
 * integer least-square estimation. reduction is performed by lambda (ref.[1]),
 * and search by mlambda (ref.[2]).
@@ -310,32 +395,11 @@ int lambda_solution(int n, int m, const double *a, const double *Q, double *F,
     int info;
 
     if (n<=0||m<=0) return -1;
-    double L[n*n];
-    double D[n];
-    double Z[n*n];
-    double z[n];
-    double E[n*m];
 
-    /* L = zeros(n,n) */
-    memset(L, 0, sizeof(double)*n*n);
-
-    /* Z = eye(n) */
-    memset(Z, 0, sizeof(double)*n*n);
-    for (int i=0; i<n; i++)
-      Z[i+n*i] = 1;
-
-    /* LD factorization */
-    if (!(info=LD(n,Q,L,D))) {
-
-        /* lambda reduction */
-        reduction(n,L,D,Z);
-        matmul("TN",n,1,n,1.0,Z,a,0.0,z); /* z=Z'*a */
-
-        /* mlambda search */
-        if (!(info=search(n,m,L,D,z,E,s))) {
-
-            info=solve("T",Z,E,n,m,F); /* F=Z'\E */
-        }
+    double buff[LAMBDA_WORKSPACE_SIZE(n)/sizeof(double)+1];
+    lambda_workspace_t ws;
+    if (!(info=lambda_init(&ws,n,Q,buff))) {
+        info=lambda_search(&ws,a,m,0,F,s,NULL);
     }
     return info;
 }
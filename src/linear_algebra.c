@@ -302,8 +302,10 @@ static void row_swap(double *a, double *b, u32 size) {
 }
 
 /* rref is "reduced row echelon form" -- a helper function for the
- * gaussian elimination code. */
-static int rref(u32 order, u32 cols, double *m) {
+ * gaussian elimination code.  Always inlined so that the fixed size
+ * kernels below get constant loop bounds. */
+static inline __attribute__((always_inline))
+int rref(u32 order, u32 cols, double *m) {
   int i, j, k, maxrow;
   double tmp;
 
@@ -345,12 +347,182 @@ static int rref(u32 order, u32 cols, double *m) {
   return 0;
 }
 
+/* Gauss-Jordan inverse, shared by matrix_inverse() and the fixed size
+ * kernels. */
+static inline __attribute__((always_inline))
+int inverse_gj(u32 n, const double *const a, double *b) {
+  int res;
+  u32 i, j, k, cols = n*2;
+  double m[n*cols];
+
+  /* Set up an augmented matrix M = [A I] */
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < cols; j++) {
+      if (j >= n) {
+        if (j-n == i) {
+          m[i*cols+j] = 1.0;
+        } else {
+          m[i*cols+j] = 0;
+        }
+      } else {
+        m[i*cols+j] = a[i*n+j];
+      }
+    }
+  }
+
+  if ((res = rref(n, cols, m)) < 0) {
+    /* Singular matrix! */
+    return res;
+  }
+
+  /* Extract B from the augmented matrix M = [I inv(A)] */
+  for (i = 0; i < n; i++) {
+    for (j = n, k = 0; j < cols; j++, k++) {
+      b[i*n+k] = m[i*cols+j];
+    }
+  }
+
+  return 0;
+}
+
+/* Matrix product kernel.  Accumulates each row of C in i-k-j order so that
+ * the inner loop runs along contiguous rows of B and C. */
+static inline __attribute__((always_inline))
+void multiply_kernel(u32 n, u32 m, u32 p, const double *restrict a,
+                     const double *restrict b, double *restrict c) {
+  for (u32 i = 0; i < n; i++) {
+    double row[p];
+    for (u32 j = 0; j < p; j++)
+      row[j] = 0;
+    for (u32 k = 0; k < m; k++) {
+      double aik = a[m*i + k];
+      for (u32 j = 0; j < p; j++)
+        row[j] += aik * b[p*k + j];
+    }
+    for (u32 j = 0; j < p; j++)
+      c[p*i + j] = row[j];
+  }
+}
+
+static inline __attribute__((always_inline))
+void transpose_kernel(u32 n, u32 m, const double *restrict a,
+                      double *restrict b) {
+  for (u32 i = 0; i < n; i++)
+    for (u32 j = 0; j < m; j++)
+      b[n*j+i] = a[m*i+j];
+}
+
+/* Body of matrix_udu(), see there for details. */
+static inline __attribute__((always_inline))
+void udu_kernel(u32 n, double *M, double *U, double *D) {
+  double alpha, beta;
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j < n; j++) {
+      if (j < i)
+        M[i*n + j] = 0;
+      U[i*n + j] = (i == j) ? 1 : 0;
+    }
+    D[i] = 0;
+  }
+
+  for (u32 j=n; j>=2; j--) {
+    D[j - 1] = M[(j-1)*n + j-1];
+    if (D[j-1] != 0) {
+      alpha = 1.0 / D[j-1];
+    } else {
+      alpha = 0.0;
+    }
+    for (u32 k=1; k<j; k++) {
+      beta = M[(k-1)*n + j-1];
+      U[(k-1)*n + j-1] = alpha * beta;
+      for (u32 kk = 0; kk < k; kk++) {
+        M[kk*n + k-1] = M[kk*n + k-1] - beta * U[kk*n + j-1];
+      }
+    }
+  }
+  D[0] = M[0];
+}
+
+/** \defgroup fixed_kernels Fixed Size Kernels
+ * Square matrix kernels specialised for each size from ::MATRIX_FIXED_MIN to
+ * ::MATRIX_FIXED_MAX, which covers the state sizes of the navigation and
+ * ambiguity filters.  Each kernel instantiates the generic inline kernel
+ * with a constant size so the compiler can fully unroll and vectorise it.
+ * The public functions dispatch to them when the dimensions match, i.e. only
+ * for square matrices; matrix_multiply() needs all three dimensions equal.
+ * Inversion of 4x4 and smaller matrices is done by the closed form routines
+ * above, so the inverse kernels start at ::MATRIX_FIXED_INVERSE_MIN.
+ * \{ */
+
+/** Smallest size with a fixed size kernel. */
+#define MATRIX_FIXED_MIN 3
+/** Smallest size with a fixed size inverse kernel. */
+#define MATRIX_FIXED_INVERSE_MIN 5
+/** Largest size with a fixed size kernel. */
+#define MATRIX_FIXED_MAX 11
+
+#define MATRIX_FIXED_KERNELS(N)                                           \
+  static void multiply_##N(const double *a, const double *b, double *c) { \
+    multiply_kernel(N, N, N, a, b, c);                                    \
+  }                                                                       \
+  static void transpose_##N(const double *a, double *b) {                 \
+    transpose_kernel(N, N, a, b);                                         \
+  }                                                                       \
+  static void udu_##N(double *M, double *U, double *D) {                  \
+    udu_kernel(N, M, U, D);                                               \
+  }
+
+#define MATRIX_FIXED_INVERSE(N)                                           \
+  static int inverse_##N(const double *a, double *b) {                    \
+    return inverse_gj(N, a, b);                                           \
+  }
+
+MATRIX_FIXED_KERNELS(3)
+MATRIX_FIXED_KERNELS(4)
+MATRIX_FIXED_KERNELS(5)
+MATRIX_FIXED_KERNELS(6)
+MATRIX_FIXED_KERNELS(7)
+MATRIX_FIXED_KERNELS(8)
+MATRIX_FIXED_KERNELS(9)
+MATRIX_FIXED_KERNELS(10)
+MATRIX_FIXED_KERNELS(11)
+
+MATRIX_FIXED_INVERSE(5)
+MATRIX_FIXED_INVERSE(6)
+MATRIX_FIXED_INVERSE(7)
+MATRIX_FIXED_INVERSE(8)
+MATRIX_FIXED_INVERSE(9)
+MATRIX_FIXED_INVERSE(10)
+MATRIX_FIXED_INVERSE(11)
+
+#define MATRIX_FIXED_TABLE(name) {                           \
+    name##_3, name##_4, name##_5, name##_6, name##_7,        \
+    name##_8, name##_9, name##_10, name##_11                 \
+  }
+
+static int (*const inverse_fixed[])(const double *, double *) = {
+  inverse_5, inverse_6, inverse_7, inverse_8, inverse_9, inverse_10, inverse_11
+};
+static void (*const multiply_fixed[])(const double *, const double *,
+                                      double *) =
+  MATRIX_FIXED_TABLE(multiply);
+static void (*const transpose_fixed[])(const double *, double *) =
+  MATRIX_FIXED_TABLE(transpose);
+static void (*const udu_fixed[])(double *, double *, double *) =
+  MATRIX_FIXED_TABLE(udu);
+
+/** Is there a fixed size kernel for an `n` x `n` matrix? */
+#define MATRIX_HAS_FIXED(n) ((n) >= MATRIX_FIXED_MIN && (n) <= MATRIX_FIXED_MAX)
+
+/* \} */
+
 /** Invert a square matrix.
  *  Calculate the inverse of a square matrix: \f$ B := A^{-1} \f$,
  *  where \f$A\f$ and \f$B\f$ are matrices on \f$\mathbb{R}^{n \times
  *  n}\f$. For matrices size 4x4 and smaller, this is done by
  *  autogenerated hard-coded routines.  For larger matrices, this is
- *  done by Gauss-Jordan elimination (which is \f$ O(n^{3}) \f$).
+ *  done by Gauss-Jordan elimination (which is \f$ O(n^{3}) \f$), using a
+ *  fixed size kernel up to ::MATRIX_FIXED_MAX.
  *
  *  \param n            The rank of a and b
  *  \param a            The matrix to invert (input)
@@ -366,13 +538,6 @@ inline int matrix_inverse(u32 n, const double *const a, double *b){
    * least-squares fit.  (This may apply also to a least-norm fit if
    * we have too few satellites.)  The Cholesky decomposition becomes
    * even more important for unscented filters. */
-  int res;
-  u32 i, j, k, cols = n*2;
-  double m[n*cols];
-
-  /* For now, we special-case only small matrices.  If we bring back
-   * multiple antennas, it won't be hard to auto-generate cases 5 and
-   * 6 if hard-coded routines prove more efficient. */
   switch (n) {
     case 2:
       return inv2(a, b);
@@ -384,34 +549,9 @@ inline int matrix_inverse(u32 n, const double *const a, double *b){
       return inv4(a, b);
       break;
     default:
-      /* Set up an augmented matrix M = [A I] */
-      for (i = 0; i < n; i++) {
-        for (j = 0; j < cols; j++) {
-          if (j >= n) {
-            if (j-n == i) {
-              m[i*cols+j] = 1.0;
-            } else {
-              m[i*cols+j] = 0;
-            }
-          } else {
-            m[i*cols+j] = a[i*n+j];
-          }
-        }
-      }
-
-      if ((res = rref(n, cols, m)) < 0) {
-        /* Singular matrix! */
-        return res;
-      }
-
-      /* Extract B from the augmented matrix M = [I inv(A)] */
-      for (i = 0; i < n; i++) {
-        for (j = n, k = 0; j < cols; j++, k++) {
-          b[i*n+k] = m[i*cols+j];
-        }
-      }
-
-      return 0;
+      if (n >= MATRIX_FIXED_INVERSE_MIN && n <= MATRIX_FIXED_MAX)
+        return inverse_fixed[n - MATRIX_FIXED_INVERSE_MIN](a, b);
+      return inverse_gj(n, a, b);
       break;
   }
 }
@@ -460,11 +600,15 @@ int matrix_pseudoinverse(u32 n, u32 m, const double *a, double *b) {
  *  Compute \f$ B := (A^{T} W A)^{-1} A^{T} \f$, where \f$ A \f$ is a
  *  matrix on \f$\mathbb{R}^{n \times m}\f$, \f$ W \f$ is a diagonal
  *  weighting matrix on \f$\mathbb{R}^{n \times n}\f$ and \f$B\f$ is
- *  (therefore) a matrix on \f$\mathbb{R}^{m \times m}\f$, for \f$ n >
+ *  (therefore) a matrix on \f$\mathbb{R}^{m \times n}\f$, for \f$ n >
  *  m \f$.
  *
+ *  The normal matrix \f$ A^{T} W A \f$ is factored with matrix_cholesky()
+ *  and each column of \f$ B \f$ found by a triangular solve, so no
+ *  explicit inverse is formed.
+ *
  *  \param n            Number of rows in a
- *  \param m            Number of columns in a and rows and columns in b
+ *  \param m            Number of columns in a and rows in b
  *  \param a            Input matrix
  *  \param w            Diagonal vector of weighting matrix
  *  \param b            Output matrix
@@ -474,34 +618,25 @@ int matrix_pseudoinverse(u32 n, u32 m, const double *a, double *b) {
 inline int matrix_atwaiat(u32 n, u32 m, const double *a,
                           const double *w, double *b) {
   u32 i, j, k;
-  double c[m*m], inv[m*m];
+  double c[m*m], x[m];
   /* Check to make sure we're doing the right operation */
   if (n <= m) return -1;
 
-  /* The resulting matrix is symmetric, so compute both halves at
-   * once */
+  /* The resulting matrix is symmetric, so only compute the lower
+   * triangle, which is all that matrix_cholesky() reads. */
   for (i = 0; i < m; i++)
-    for (j = i; j < m; j++) {
+    for (j = 0; j <= i; j++) {
       c[m*i + j] = 0;
-      if (i == j) {
-        /* If this is a diagonal element, just sum the squares of the
-         * column of A weighted by the weighting vector. */
-        for (k = 0; k < n; k++)
-          c[m*i + j] += w[k]*a[m*k + j]*a[m*k + j];
-      } else {
-        /* Otherwise, assign both off-diagonal elements at once. */
-        for (k = 0; k < n; k++)
-          c[m*i + j] = c[m*j + i] = w[k]*a[m*k + j]*a[m*k + i];
-        c[m*j + i] = c[m*i + j];
-      }
-    }
-  if (matrix_inverse(m, c, inv) < 0) return -1;
-  for (i = 0; i < m; i++)
-    for (j = 0; j < n; j++) {
-      b[n*i + j] = 0;
-      for (k = 0; k < m; k++)
-        b[n*i + j] += inv[n*i+k] * a[m*j + k];
+      for (k = 0; k < n; k++)
+        c[m*i + j] += w[k]*a[m*k + i]*a[m*k + j];
     }
+  if (matrix_cholesky(m, c, c) < 0) return -1;
+  /* Column j of A^T is row j of A. */
+  for (j = 0; j < n; j++) {
+    matrix_cholesky_solve(m, c, &a[m*j], x);
+    for (i = 0; i < m; i++)
+      b[n*i + j] = x[i];
+  }
   return 0;
 }
 
@@ -509,56 +644,47 @@ inline int matrix_atwaiat(u32 n, u32 m, const double *a,
  *  Compute \f$ B := A^T (A W A^{T})^{-1} \f$, where \f$ A \f$ is a
  *  matrix on \f$\mathbb{R}^{n \times m}\f$, \f$ W \f$ is a diagonal
  *  weighting matrix on \f$\mathbb{R}^{m \times m}\f$ and \f$B\f$ is
- *  (therefore) a matrix on \f$\mathbb{R}^{n \times n}\f$, for \f$ n <
+ *  (therefore) a matrix on \f$\mathbb{R}^{m \times n}\f$, for \f$ n <
  *  m \f$.
  *
- *  \param n            Number of rows in a and rows and columns in b
- *  \param m            Number of columns in a
+ *  \param n            Number of rows in a and columns in b
+ *  \param m            Number of columns in a and rows in b
  *  \param a            Input matrix
  *  \param w            Diagonal vector of weighting matrix
  *  \param b            Output matrix
  *
- *  \return     -1 if n <= m or singular; 0 otherwise
+ *  \return     -1 if n >= m or singular; 0 otherwise
  */
 inline int matrix_atawati(u32 n, u32 m, const double *a,
                           const double *w, double *b) {
   u32 i, j, k;
-  double c[m*m], inv[m*m];
+  double c[n*n], x[n], col[n];
   /* Check to make sure we're doing the right operation */
-  if (n <= m) return -1;
+  if (n >= m) return -1;
 
-  /* TODO(MP) -- implement! */
-  /* The resulting matrix is symmetric, so compute both halves at
-   * once */
-  for (i = 0; i < m; i++)
-    for (j = i; j < m; j++) {
-      c[m*i + j] = 0;
-      if (i == j) {
-        /* If this is a diagonal element, just sum the squares of the
-         * column of A weighted by the weighting vector. */
-        for (k = 0; k < n; k++)
-          c[m*i + j] += w[k]*a[m*k + j]*a[m*k + j];
-      } else {
-        /* Otherwise, assign both off-diagonal elements at once. */
-        for (k = 0; k < n; k++)
-          c[m*i + j] = c[m*j + i] = w[k]*a[m*k + j]*a[m*k + i];
-        c[m*j + i] = c[m*i + j];
-      }
-    }
-  if (matrix_inverse(m, c, inv) < 0) return -1;
-  for (i = 0; i < m; i++)
-    for (j = 0; j < n; j++) {
-      b[n*i + j] = 0;
+  /* Lower triangle of A W A^T. */
+  for (i = 0; i < n; i++)
+    for (j = 0; j <= i; j++) {
+      c[n*i + j] = 0;
       for (k = 0; k < m; k++)
-        b[n*i + j] += inv[n*i+k] * a[m*j + k];
+        c[n*i + j] += w[k]*a[m*i + k]*a[m*j + k];
     }
+  if (matrix_cholesky(n, c, c) < 0) return -1;
+  /* B^T = (A W A^T)^{-1} A, solved one column of A at a time. */
+  for (k = 0; k < m; k++) {
+    for (i = 0; i < n; i++)
+      col[i] = a[m*i + k];
+    matrix_cholesky_solve(n, c, col, x);
+    for (i = 0; i < n; i++)
+      b[n*k + i] = x[i];
+  }
   return 0;
 }
 
 /** Compute \f$ B := (A^{T} A)^{-1} A^{T} \f$.
  *  Compute \f$ B := (A^{T} A)^{-1} A^{T} \f$, where \f$ A \f$ is a
  *  matrix on \f$\mathbb{R}^{n \times m}\f$ and \f$B\f$ is (therefore)
- *  a matrix on \f$\mathbb{R}^{m \times m}\f$, for \f$ n > m \f$.
+ *  a matrix on \f$\mathbb{R}^{m \times n}\f$, for \f$ n > m \f$.
  *
  *  \param n            Number of rows in a
  *  \param m            Number of columns in a and rows and columns in b
@@ -577,9 +703,9 @@ inline int matrix_ataiat(u32 n, u32 m, const double *a, double *b) {
 /** Compute \f$ B := A^{T} (A A^{T})^{-1} \f$.
  *  Compute \f$ B := A^{T} (A A^{T})^{-1} \f$, where \f$ A \f$ is a
  *  matrix on \f$\mathbb{R}^{n \times m}\f$ and \f$B\f$ is (therefore)
- *  a matrix on \f$\mathbb{R}^{n \times n}\f$, for \f$ n < m \f$.
+ *  a matrix on \f$\mathbb{R}^{m \times n}\f$, for \f$ n < m \f$.
  *
- *  \param n            Number of rows in a and rows and columns in b
+ *  \param n            Number of rows in a and columns in b
  *  \param m            Number of columns in a
  *  \param a            Input matrix
  *  \param b            Output matrix
@@ -588,16 +714,214 @@ inline int matrix_ataiat(u32 n, u32 m, const double *a, double *b) {
  */
 inline int matrix_ataati(u32 n, u32 m, const double *a, double *b) {
   u32 i;
-  double w[n];
-  for (i = 0; i < n; i++) w[i] = 1;
+  double w[m];
+  for (i = 0; i < m; i++) w[i] = 1;
   return matrix_atawati(n, m, a, w, b);
 }
 
+/** Cholesky decomposition of a symmetric positive definite matrix.
+ *  Compute the lower triangular \f$ L \f$ such that \f$ A = L L^{T} \f$,
+ *  where \f$ A \f$ and \f$ L \f$ are matrices on \f$\mathbb{R}^{n
+ *  \times n}\f$.  Only the lower triangle of \f$ A \f$ is read and the
+ *  upper triangle of \f$ L \f$ is zeroed, so `a` and `l` may point to the
+ *  same matrix to factor in place.
+ *
+ *  Factoring once and then using matrix_cholesky_solve() is cheaper and
+ *  better conditioned than matrix_inverse() for normal equations and
+ *  covariance matrices.
+ *
+ *  \param n            Size of a and l
+ *  \param a            Matrix to factor (input)
+ *  \param l            Lower triangular factor (output)
+ *
+ *  \return     -1 if a is not positive definite; 0 otherwise.
+ */
+int matrix_cholesky(u32 n, const double *a, double *l) {
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j <= i; j++) {
+      double s = a[n*i + j];
+      for (u32 k = 0; k < j; k++)
+        s -= l[n*i + k] * l[n*j + k];
+      if (i == j) {
+        if (s <= MATRIX_EPSILON)
+          return -1;
+        l[n*i + i] = sqrt(s);
+      } else {
+        l[n*i + j] = s / l[n*j + j];
+      }
+    }
+    for (u32 j = i+1; j < n; j++)
+      l[n*i + j] = 0;
+  }
+  return 0;
+}
+
+/** Solve a linear system from its Cholesky decomposition.
+ *  Solve \f$ A x = b \f$ given \f$ L \f$ from matrix_cholesky(), by
+ *  forward substitution with \f$ L \f$ then back substitution with \f$
+ *  L^{T} \f$.  `b` and `x` may point to the same vector.
+ *
+ *  \param n            Size of l, b and x
+ *  \param l            Lower triangular Cholesky factor of A
+ *  \param b            Right hand side vector
+ *  \param x            Solution vector (output)
+ */
+void matrix_cholesky_solve(u32 n, const double *l, const double *b,
+                           double *x) {
+  for (u32 i = 0; i < n; i++) {
+    double s = b[i];
+    for (u32 k = 0; k < i; k++)
+      s -= l[n*i + k] * x[k];
+    x[i] = s / l[n*i + i];
+  }
+  for (u32 i = n; i-- > 0;) {
+    double s = x[i];
+    for (u32 k = i+1; k < n; k++)
+      s -= l[n*k + i] * x[k];
+    x[i] = s / l[n*i + i];
+  }
+}
+
+/** Invert a matrix from its Cholesky decomposition.
+ *  Compute \f$ B := A^{-1} \f$ given \f$ L \f$ from matrix_cholesky().
+ *  Only needed when the inverse itself is wanted, e.g. as a covariance;
+ *  use matrix_cholesky_solve() to solve linear systems.
+ *
+ *  \param n            Size of l and b
+ *  \param l            Lower triangular Cholesky factor of A
+ *  \param b            Inverse of A (output)
+ */
+void matrix_cholesky_inverse(u32 n, const double *l, double *b) {
+  double x[n];
+  for (u32 j = 0; j < n; j++) {
+    for (u32 i = 0; i < n; i++)
+      x[i] = (i == j) ? 1 : 0;
+    matrix_cholesky_solve(n, l, x, x);
+    /* The inverse is symmetric, fill in column j and row j together. */
+    for (u32 i = j; i < n; i++)
+      b[n*i + j] = b[n*j + i] = x[i];
+  }
+}
+
+/** Rank-one update of a Cholesky decomposition.
+ *  Given \f$ L \f$ from matrix_cholesky() of \f$ A \f$, overwrite it
+ *  with the factor of \f$ A + x x^{T} \f$ in \f$ O(n^{2}) \f$ operations.
+ *
+ *  \param n            Size of l and x
+ *  \param l            Lower triangular Cholesky factor (input / output)
+ *  \param x            Update vector, overwritten
+ */
+void matrix_cholesky_update(u32 n, double *l, double *x) {
+  for (u32 k = 0; k < n; k++) {
+    double lkk = l[n*k + k];
+    double r = sqrt(lkk*lkk + x[k]*x[k]);
+    double c = r / lkk;
+    double s = x[k] / lkk;
+    l[n*k + k] = r;
+    for (u32 i = k+1; i < n; i++) {
+      l[n*i + k] = (l[n*i + k] + s * x[i]) / c;
+      x[i] = c * x[i] - s * l[n*i + k];
+    }
+  }
+}
+
+/** Rank-one downdate of a Cholesky decomposition.
+ *  Given \f$ L \f$ from matrix_cholesky() of \f$ A \f$, overwrite it
+ *  with the factor of \f$ A - x x^{T} \f$ in \f$ O(n^{2}) \f$ operations.
+ *
+ *  \param n            Size of l and x
+ *  \param l            Lower triangular Cholesky factor (input / output)
+ *  \param x            Downdate vector, overwritten
+ *
+ *  \return     -1 if the downdated matrix is not positive definite, in
+ *              which case l is left partially modified; 0 otherwise.
+ */
+int matrix_cholesky_downdate(u32 n, double *l, double *x) {
+  for (u32 k = 0; k < n; k++) {
+    double lkk = l[n*k + k];
+    double r2 = lkk*lkk - x[k]*x[k];
+    if (r2 <= MATRIX_EPSILON)
+      return -1;
+    double r = sqrt(r2);
+    double c = r / lkk;
+    double s = x[k] / lkk;
+    l[n*k + k] = r;
+    for (u32 i = k+1; i < n; i++) {
+      l[n*i + k] = (l[n*i + k] - s * x[i]) / c;
+      x[i] = c * x[i] - s * l[n*i + k];
+    }
+  }
+  return 0;
+}
+
+/** \f$ L D L^{T} \f$ decomposition of a symmetric positive definite matrix.
+ *  Compute the unit lower triangular \f$ L \f$ and diagonal \f$ D \f$
+ *  such that \f$ A = L D L^{T} \f$.  Avoids the square roots of
+ *  matrix_cholesky().  Only the lower triangle of \f$ A \f$ is read, so
+ *  `a` and `l` may point to the same matrix.
+ *
+ *  \param n            Size of a, l and d
+ *  \param a            Matrix to factor (input)
+ *  \param l            Unit lower triangular factor (output)
+ *  \param d            Diagonal of D (output)
+ *
+ *  \return     -1 if a is not positive definite; 0 otherwise.
+ */
+int matrix_ldl(u32 n, const double *a, double *l, double *d) {
+  for (u32 i = 0; i < n; i++) {
+    for (u32 j = 0; j < i; j++) {
+      double s = a[n*i + j];
+      for (u32 k = 0; k < j; k++)
+        s -= l[n*i + k] * l[n*j + k] * d[k];
+      l[n*i + j] = s / d[j];
+    }
+    double s = a[n*i + i];
+    for (u32 k = 0; k < i; k++)
+      s -= l[n*i + k] * l[n*i + k] * d[k];
+    if (s <= MATRIX_EPSILON)
+      return -1;
+    d[i] = s;
+    l[n*i + i] = 1;
+    for (u32 j = i+1; j < n; j++)
+      l[n*i + j] = 0;
+  }
+  return 0;
+}
+
+/** Solve a linear system from its \f$ L D L^{T} \f$ decomposition.
+ *  Solve \f$ A x = b \f$ given \f$ L \f$ and \f$ D \f$ from
+ *  matrix_ldl().  `b` and `x` may point to the same vector.
+ *
+ *  \param n            Size of l, d, b and x
+ *  \param l            Unit lower triangular factor of A
+ *  \param d            Diagonal of D
+ *  \param b            Right hand side vector
+ *  \param x            Solution vector (output)
+ */
+void matrix_ldl_solve(u32 n, const double *l, const double *d,
+                      const double *b, double *x) {
+  for (u32 i = 0; i < n; i++) {
+    double s = b[i];
+    for (u32 k = 0; k < i; k++)
+      s -= l[n*i + k] * x[k];
+    x[i] = s;
+  }
+  for (u32 i = 0; i < n; i++)
+    x[i] /= d[i];
+  for (u32 i = n; i-- > 0;) {
+    double s = x[i];
+    for (u32 k = i+1; k < n; k++)
+      s -= l[n*k + i] * x[k];
+    x[i] = s;
+  }
+}
+
 /** Multiply two matrices.
  *  Multiply two matrices: \f$ C := AB \f$, where \f$ A \f$ is a
  *  matrix on \f$\mathbb{R}^{n \times m}\f$, \f$B\f$ is a matrix on
  *  \f$\mathbb{R}^{m \times p}\f$ and \f$C\f$ is (therefore) a matrix
- *  in \f$\mathbb{R}^{n \times p}\f$.
+ *  in \f$\mathbb{R}^{n \times p}\f$. Square products of size
+ *  ::MATRIX_FIXED_MIN to ::MATRIX_FIXED_MAX use a fixed size kernel.
  *
  *  \param n            Number of rows in a and c
  *  \param m            Number of columns in a and rows in b
@@ -609,6 +933,10 @@ inline int matrix_ataati(u32 n, u32 m, const double *a, double *b) {
 inline void matrix_multiply(u32 n, u32 m, u32 p, const double *a,
                             const double *b, double *c)
 {
+  if (n == m && m == p && MATRIX_HAS_FIXED(n)) {
+    multiply_fixed[n - MATRIX_FIXED_MIN](a, b, c);
+    return;
+  }
   u32 i, j, k;
   for (i = 0; i < n; i++)
     for (j = 0; j < p; j++) {
@@ -693,27 +1021,11 @@ void matrix_udu(u32 n, double *M, double *U, double *D)
   /* TODO: replace with DSYTRF? */
   /* NOTE: This function has been bounds checked. Please check again if
    * modifying. */
-  double alpha, beta;
-  matrix_triu(n, M);
-  matrix_eye(n, U);
-  memset(D, 0, n * sizeof(double));
-
-  for (u32 j=n; j>=2; j--) {
-    D[j - 1] = M[(j-1)*n + j-1];
-    if (D[j-1] != 0) {
-      alpha = 1.0 / D[j-1];
-    } else {
-      alpha = 0.0;
-    }
-    for (u32 k=1; k<j; k++) {
-      beta = M[(k-1)*n + j-1];
-      U[(k-1)*n + j-1] = alpha * beta;
-      for (u32 kk = 0; kk < k; kk++) {
-        M[kk*n + k-1] = M[kk*n + k-1] - beta * U[kk*n + j-1];
-      }
-    }
+  if (MATRIX_HAS_FIXED(n)) {
+    udu_fixed[n - MATRIX_FIXED_MIN](M, U, D);
+    return;
   }
-  D[0] = M[0];
+  udu_kernel(n, M, U, D);
 }
 
 /** Reconstructs a matrix from its \f$U D U^{T}\f$ decomposition.
@@ -783,10 +1095,11 @@ void matrix_add_sc(u32 n, u32 m, const double *a,
  */
 void matrix_transpose(u32 n, u32 m,
                       const double *a, double *b) {
-  u32 i, j;
-  for (i = 0; i < n; i++)
-    for (j = 0; j < m; j++)
-      b[n*j+i] = a[m*i+j];
+  if (n == m && MATRIX_HAS_FIXED(n)) {
+    transpose_fixed[n - MATRIX_FIXED_MIN](a, b);
+    return;
+  }
+  transpose_kernel(n, m, a, b);
 }
 
 /** Copy a matrix.
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifdef LIBSWIFTNAV_THREADS
+#include <pthread.h>
+#endif
+
+#include "parallel.h"
+
+/** \defgroup parallel Parallel For
+ * Minimal fork-join helper for splitting work over a fixed pool of threads.
+ *
+ * The pool is only backed by real threads when the library is built with the
+ * `LIBSWIFTNAV_THREADS` CMake option. Otherwise parallel_for() runs the tasks
+ * one after the other on the calling thread, so code written against this
+ * interface works unchanged on targets without an operating system. The
+ * number of threads still controls how callers split up their work, which is
+ * useful for testing the split on such targets.
+ *
+ * parallel_for() must not be called from more than one thread at a time, or
+ * from inside a task.
+ * \{ */
+
+static u8 n_threads = 1;
+
+#ifdef LIBSWIFTNAV_THREADS
+
+static pthread_t workers[PARALLEL_MAX_THREADS - 1];
+static u8 n_workers = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+  parallel_task_t fn;
+  void *arg;
+  u32 n_tasks;
+  u32 next;       /**< Next task to hand out. */
+  u32 pending;    /**< Tasks handed out or waiting, but not finished. */
+  u32 generation; /**< Incremented for each call to parallel_for(). */
+  u8 quit;
+} job;
+
+/* Run tasks from the current job until there are none left. Called with the
+ * lock held, returns with it held. */
+static void run_tasks(void)
+{
+  while (job.next < job.n_tasks) {
+    u32 task = job.next++;
+    pthread_mutex_unlock(&lock);
+    job.fn(job.arg, task);
+    pthread_mutex_lock(&lock);
+    if (--job.pending == 0) {
+      pthread_cond_signal(&done_cond);
+    }
+  }
+}
+
+static void *worker(void *unused)
+{
+  (void)unused;
+  pthread_mutex_lock(&lock);
+  u32 seen = job.generation;
+  while (1) {
+    while (!job.quit && job.generation == seen) {
+      pthread_cond_wait(&work_cond, &lock);
+    }
+    if (job.quit) {
+      break;
+    }
+    seen = job.generation;
+    run_tasks();
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+#endif /* LIBSWIFTNAV_THREADS */
+
+/** Set the number of threads used by parallel_for().
+ * Any existing pool is shut down first. With one thread (the default) no
+ * threads are created.
+ *
+ * \param n Number of threads including the calling thread, between 1 and
+ *          ::PARALLEL_MAX_THREADS
+ * \return `0` on success, `-1` if `n` is out of range, `-2` if the threads
+ *         could not be started (the pool is left with as many as started).
+ */
+s8 parallel_init(u8 n)
+{
+  if (n < 1 || n > PARALLEL_MAX_THREADS) {
+    return -1;
+  }
+  parallel_deinit();
+
+#ifdef LIBSWIFTNAV_THREADS
+  job.quit = 0;
+  for (u8 i = 0; i < n - 1; i++) {
+    if (pthread_create(&workers[i], NULL, worker, NULL) != 0) {
+      n_threads = n_workers + 1;
+      return -2;
+    }
+    n_workers++;
+  }
+#endif
+
+  n_threads = n;
+  return 0;
+}
+
+/** Shut down the threads started by parallel_init().
+ * parallel_for() runs everything on the calling thread afterwards.
+ */
+void parallel_deinit(void)
+{
+#ifdef LIBSWIFTNAV_THREADS
+  pthread_mutex_lock(&lock);
+  job.quit = 1;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+  for (u8 i = 0; i < n_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  n_workers = 0;
+#endif
+  n_threads = 1;
+}
+
+/** Number of threads work should be split over.
+ *
+ * \return The number of threads set by parallel_init(), 1 by default.
+ */
+u8 parallel_n_threads(void)
+{
+  return n_threads;
+}
+
+/** Run `fn(arg, task)` for each `task` from 0 to `n_tasks-1`.
+ * The calling thread takes part in the work and the function returns once
+ * every task has finished. Tasks may run in any order and concurrently with
+ * each other, so they must only write to memory that is not shared with
+ * another task.
+ *
+ * \param n_tasks Number of tasks
+ * \param fn      Function run for each task
+ * \param arg     Argument passed to each call of `fn`
+ */
+void parallel_for(u32 n_tasks, parallel_task_t fn, void *arg)
+{
+#ifdef LIBSWIFTNAV_THREADS
+  if (n_workers > 0 && n_tasks > 1) {
+    pthread_mutex_lock(&lock);
+    job.fn = fn;
+    job.arg = arg;
+    job.n_tasks = n_tasks;
+    job.next = 0;
+    job.pending = n_tasks;
+    job.generation++;
+    pthread_cond_broadcast(&work_cond);
+    run_tasks();
+    while (job.pending > 0) {
+      pthread_cond_wait(&done_cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+#endif
+
+  for (u32 i = 0; i < n_tasks; i++) {
+    fn(arg, i);
+  }
+}
+
+/** \} */
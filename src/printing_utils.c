@@ -134,6 +134,21 @@ void print_hyp(void *arg, element_t *elem)
   printf("]: %f\n", hyp->ll);
 }
 
+/** Prints every hypothesis in a hypothesis store, in the format of print_hyp().
+ *
+ * \param num_dds The number of ambiguities in each hypothesis.
+ * \param hyps    The hypotheses to print.
+ */
+void print_hypothesis_store(u8 num_dds, const hypothesis_store_t *hyps)
+{
+  for (u32 i=0; i<hyps->n; i++) {
+    hypothesis_t hyp;
+    hypothesis_store_get(hyps, i, num_dds, hyp.N);
+    hyp.ll = hyps->ll[i];
+    print_hyp(&num_dds, (element_t *)&hyp);
+  }
+}
+
 /* Utilities for debugging inclusion algorithm in ambiguity_test.c */
 void print_Z(s8 label, u8 full_dim, u8 new_dim, z_t * Z)
 {
@@ -22,6 +22,16 @@
 
 #include "pvt.h"
 
+/** Default standard deviation of a zenith / 45 dB-Hz pseudorange [m]. */
+#define PVT_DEFAULT_PR_SIGMA 5.0
+
+/** Lowest elevation used when computing elevation weights [rad]. */
+#define PVT_WLS_MIN_ELEVATION (5 * D2R)
+
+/** Reference C/N0 for SNR weighting, 45 dB-Hz as the linear ratio stored in
+ * navigation_measurement_t::snr (C/N0 = 10 log10(snr) + 40). */
+#define PVT_SNR_REF 3.16227766
+
 static double vel_solve(double rx_vel[],
                         const u8 n_used,
                         const navigation_measurement_t nav_meas[n_used],
@@ -94,6 +104,69 @@ void compute_dops(const double H[4][4],
 }
 
 
+/* Linearise the pseudorange equations about `rx_state`, filling in the
+ * geometry matrix G and the vector of observed minus predicted pseudoranges.
+ * `pr_corr` holds corrections (e.g. tropospheric delay) to be subtracted
+ * from the measured pseudoranges. */
+static void pvt_geometry(const double rx_state[],
+                         const u8 n_used,
+                         const navigation_measurement_t nav_meas[n_used],
+                         const double pr_corr[n_used],
+                         double G[n_used][4],
+                         double omp[n_used])
+{
+  double tempv[3];
+  double los[3];
+  double xk_new[3];
+
+  for (u8 j = 0; j < n_used; j++) {
+    /* The satellite positions need to be corrected for Earth's rotation during
+     * the signal time of flight. */
+    /* TODO: Explain more about how this corrects for the Sagnac effect. */
+
+    /* Magnitude of range vector converted into an approximate time in secs. */
+    vector_subtract(3, rx_state, nav_meas[j].sat_pos, tempv);
+    double tau = vector_norm(3, tempv) / GPS_C;
+
+    /* Rotation of Earth during time of flight in radians. */
+    double wEtau = GPS_OMEGAE_DOT * tau;
+
+    /* Apply linearlised rotation about Z-axis which will adjust for the
+     * satellite's position at time t-tau. Note the rotation is through
+     * -wEtau because it is the ECEF frame that is rotating with the Earth and
+     * hence in the ECEF frame free falling bodies appear to rotate in the
+     * opposite direction.
+     *
+     * Making a small angle approximation here leads to less than 1mm error in
+     * the satellite position. */
+    xk_new[0] = nav_meas[j].sat_pos[0] + wEtau * nav_meas[j].sat_pos[1];
+    xk_new[1] = nav_meas[j].sat_pos[1] - wEtau * nav_meas[j].sat_pos[0];
+    xk_new[2] = nav_meas[j].sat_pos[2];
+
+    /* Line of sight vector. */
+    vector_subtract(3, xk_new, rx_state, los);
+
+    /* Predicted range from satellite position and estimated Rx position. */
+    double p_pred = vector_norm(3, los);
+
+    /* omp means "observed minus predicted" range -- this is E, the
+     * prediction error vector (or innovation vector in Kalman/LS
+     * filtering terms).
+     */
+    omp[j] = nav_meas[j].pseudorange - pr_corr[j] - p_pred;
+
+    /* Construct a geometry matrix.  Each row (satellite) is
+     * independently normalized into a unit vector. */
+    for (u8 i=0; i<3; i++) {
+      G[j][i] = -los[i] / p_pred;
+    }
+
+    /* Set time covariance to 1. */
+    G[j][3] = 1;
+
+  } /* End of channel loop. */
+}
+
 /* This function is the key to GPS solution, so it's commented
  * liberally.  It does a single step of a multi-dimensional
  * Newton-Raphson solution for the variables X, Y, Z (in ECEF) plus
@@ -130,10 +203,10 @@ void compute_dops(const double H[4][4],
 static double pvt_solve(double rx_state[],
                         const u8 n_used,
                         const navigation_measurement_t nav_meas[n_used],
+                        const double w[n_used],
+                        const double pr_corr[n_used],
                         double H[4][4])
 {
-  double p_pred[n_used];
-
   /* Vector of prediction errors */
   double omp[n_used];
 
@@ -142,7 +215,8 @@ static double pvt_solve(double rx_state[],
    * x_j are x, y, z, Δt. */
   double G[n_used][4];
   double Gtrans[4][n_used];
-  double GtG[4][4];
+  double GtW[4][n_used];
+  double GtWG[4][4];
 
   /* H is the square of the Jacobian matrix; it tells us the shape of
      our error (or, if you prefer, the direction in which we need to
@@ -152,9 +226,6 @@ static double pvt_solve(double rx_state[],
    * Jacobian update */
   double X[4][n_used];
 
-  double tempv[3];
-  double los[3];
-  double xk_new[3];
   double tempd;
   double correction[4];
 
@@ -162,52 +233,7 @@ static double pvt_solve(double rx_state[],
     correction[j] = 0.0;
   }
 
-  for (u8 j = 0; j < n_used; j++) {
-    /* The satellite positions need to be corrected for Earth's rotation during
-     * the signal time of flight. */
-    /* TODO: Explain more about how this corrects for the Sagnac effect. */
-
-    /* Magnitude of range vector converted into an approximate time in secs. */
-    vector_subtract(3, rx_state, nav_meas[j].sat_pos, tempv);
-    double tau = vector_norm(3, tempv) / GPS_C;
-
-    /* Rotation of Earth during time of flight in radians. */
-    double wEtau = GPS_OMEGAE_DOT * tau;
-
-    /* Apply linearlised rotation about Z-axis which will adjust for the
-     * satellite's position at time t-tau. Note the rotation is through
-     * -wEtau because it is the ECEF frame that is rotating with the Earth and
-     * hence in the ECEF frame free falling bodies appear to rotate in the
-     * opposite direction.
-     *
-     * Making a small angle approximation here leads to less than 1mm error in
-     * the satellite position. */
-    xk_new[0] = nav_meas[j].sat_pos[0] + wEtau * nav_meas[j].sat_pos[1];
-    xk_new[1] = nav_meas[j].sat_pos[1] - wEtau * nav_meas[j].sat_pos[0];
-    xk_new[2] = nav_meas[j].sat_pos[2];
-
-    /* Line of sight vector. */
-    vector_subtract(3, xk_new, rx_state, los);
-
-    /* Predicted range from satellite position and estimated Rx position. */
-    p_pred[j] = vector_norm(3, los);
-
-    /* omp means "observed minus predicted" range -- this is E, the
-     * prediction error vector (or innovation vector in Kalman/LS
-     * filtering terms).
-     */
-    omp[j] = nav_meas[j].pseudorange - p_pred[j];
-
-    /* Construct a geometry matrix.  Each row (satellite) is
-     * independently normalized into a unit vector. */
-    for (u8 i=0; i<3; i++) {
-      G[j][i] = -los[i] / p_pred[j];
-    }
-
-    /* Set time covariance to 1. */
-    G[j][3] = 1;
-
-  } /* End of channel loop. */
+  pvt_geometry(rx_state, n_used, nav_meas, pr_corr, G, omp);
 
   /* Solve for position corrections using batch least-squares.  When
    * all-at-once least-squares estimation for a nonlinear problem is
@@ -219,14 +245,23 @@ static double pvt_solve(double rx_state[],
 
   /* Gt := G^{T} */
   matrix_transpose(n_used, 4, (double *) G, (double *) Gtrans);
-  /* GtG := G^{T} G */
-  matrix_multiply(4, n_used, 4, (double *) Gtrans, (double *) G, (double *) GtG);
-  /* H \elem \mathbb{R}^{4 \times 4} := GtG^{-1} */
-  matrix_inverse(4, (const double *) GtG, (double *) H);
-  /* X := H * G^{T} */
-  matrix_multiply(4, 4, n_used, (double *) H, (double *) Gtrans, (double *) X);
-  /* correction := X * E (= X * omp) */
-  matrix_multiply(4, n_used, 1, (double *) X, (double *) omp, (double *) correction);
+  /* GtW := G^{T} W, where W = diag(w) holds the relative measurement
+   * weights. */
+  for (u8 i=0; i<4; i++) {
+    for (u8 j=0; j<n_used; j++) {
+      GtW[i][j] = Gtrans[i][j] * w[j];
+    }
+  }
+  /* GtWG := G^{T} W G */
+  matrix_multiply(4, n_used, 4, (double *) GtW, (double *) G, (double *) GtWG);
+  /* Factor GtWG = L L^{T} rather than inverting it. */
+  if (matrix_cholesky(4, (const double *) GtWG, (double *) GtWG) < 0) {
+    /* Singular geometry, further iterations will not help. */
+    return -INFINITY;
+  }
+  /* correction := GtWG^{-1} G^{T} W E (= ... * omp) */
+  matrix_multiply(4, n_used, 1, (double *) GtW, (double *) omp, correction);
+  matrix_cholesky_solve(4, (const double *) GtWG, correction, correction);
 
   /* Increment ecef estimate by the new corrections */
   for (u8 i=0; i<3; i++) {
@@ -251,6 +286,13 @@ static double pvt_solve(double rx_state[],
 
   /* The solution has converged! */
 
+  /* H \elem \mathbb{R}^{4 \times 4} := GtWG^{-1}, only needed once the
+   * iteration has converged. */
+  matrix_cholesky_inverse(4, (const double *) GtWG, (double *) H);
+
+  /* X := H * G^{T} W */
+  matrix_multiply(4, 4, n_used, (double *) H, (double *) GtW, (double *) X);
+
   /* Perform the velocity solution. */
   vel_solve(&rx_state[4], n_used, nav_meas, (const double (*)[4]) G, (const double (*)[n_used]) X);
 
@@ -278,42 +320,30 @@ u8 filter_solution(gnss_solution* soln, dops_t* dops)
   return 0;
 }
 
-s8 calc_PVT(const u8 n_used,
-            const navigation_measurement_t nav_meas[n_used],
-            gnss_solution *soln,
-            dops_t *dops)
+/* Fill in a solution from a Newton-Raphson result. Computes the DOPs and
+ * error covariance from H, converts the receiver state into the various
+ * solution frames and applies filter_solution(). On failure the position part
+ * of `rx_state` is reset so the next solve starts from scratch. H is only
+ * read if the iteration converged, otherwise the DOPs are zeroed. */
+static s8 pvt_finish(double rx_state[8],
+                     const double H[4][4],
+                     const u8 converged,
+                     const u8 n_used,
+                     const navigation_measurement_t nav_meas[n_used],
+                     gnss_solution *soln,
+                     dops_t *dops)
 {
-  /* Initial state is the center of the Earth with zero velocity and zero
-   * clock error, if we have some a priori position estimate we could use
-   * that here to speed convergence a little on the first iteration.
-   *
-   *  rx_state format:
-   *    pos[3], clock error, vel[3], intermediate freq error
-   */
-  static double rx_state[8];
-
-  double H[4][4];
-
-  soln->valid = 0;
-
-  soln->n_used = n_used; // Keep track of number of working channels
-
-  /* reset state to zero !? */
-  for(u8 i=4; i<8; i++) {
-    rx_state[i] = 0;
-  }
-
-  double update;
-  u8 iters;
-  /* Newton-Raphson iteration. */
-  for (iters=0; iters<PVT_MAX_ITERATIONS; iters++) {
-    if ((update = pvt_solve(rx_state, n_used, nav_meas, H)) > 0) {
-      break;
-    }
+  if (!converged) {
+    memset(dops, 0, sizeof(*dops));
+    /* Reset state if solution fails */
+    rx_state[0] = 0;
+    rx_state[1] = 0;
+    rx_state[2] = 0;
+    return -4;
   }
 
   /* Compute various dilution of precision metrics. */
-  compute_dops((const double(*)[4])H, rx_state, dops);
+  compute_dops(H, rx_state, dops);
   soln->err_cov[6] = dops->gdop;
 
   /* Populate error covariances according to layout in definition
@@ -326,14 +356,6 @@ s8 calc_PVT(const u8 n_used,
   soln->err_cov[4] = H[1][2];
   soln->err_cov[5] = H[2][2];
 
-  if (iters >= PVT_MAX_ITERATIONS) {
-    /* Reset state if solution fails */
-    rx_state[0] = 0;
-    rx_state[1] = 0;
-    rx_state[2] = 0;
-    return -4;
-  }
-
   /* Save as x, y, z. */
   for (u8 i=0; i<3; i++) {
     soln->pos_ecef[i] = rx_state[i];
@@ -370,3 +392,806 @@ s8 calc_PVT(const u8 n_used,
   return 0;
 }
 
+/* Lorentz inner product used by the Bancroft method. */
+static double lorentz(const double a[4], const double b[4])
+{
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2] - a[3]*b[3];
+}
+
+/* Sum of squared pseudorange residuals for a given position and clock error,
+ * ignoring Earth rotation. */
+static double pvt_prefit_sse(const double rx_state[4],
+                             const u8 n_used,
+                             const navigation_measurement_t nav_meas[n_used])
+{
+  double sse = 0;
+  for (u8 j=0; j<n_used; j++) {
+    double tempv[3];
+    vector_subtract(3, nav_meas[j].sat_pos, rx_state, tempv);
+    double r = nav_meas[j].pseudorange - vector_norm(3, tempv) - rx_state[3];
+    sse += r*r;
+  }
+  return sse;
+}
+
+/** Closed form position and clock solution by Bancroft's method.
+ * Solves the pseudorange equations directly, without iteration or an initial
+ * guess, by finding the roots of a quadratic in the Lorentz norm of the
+ * receiver state. Earth rotation during the signal time of flight is not
+ * modelled so the solution is only accurate to tens of meters, but it is
+ * close enough that pvt_solve() converges in one or two further iterations.
+ *
+ * References:
+ *   -# Bancroft, S. "An Algebraic Solution of the GPS Equations",
+ *      IEEE Transactions on Aerospace and Electronic Systems, 1985.
+ *
+ * \param n_used   Number of measurements in `nav_meas`, at least four.
+ * \param nav_meas Navigation measurements to solve with.
+ * \param rx_state The ECEF position [m] and clock error [m] are written here.
+ * \return `0` on success, `-1` if there are too few measurements or the
+ *         geometry is degenerate.
+ */
+s8 pvt_bancroft(const u8 n_used,
+                const navigation_measurement_t nav_meas[n_used],
+                double rx_state[4])
+{
+  if (n_used < 4) {
+    return -1;
+  }
+
+  /* Normal equations of B M u = alpha + lambda 1 where row j of B is
+   * [sat_pos, pseudorange], alpha_j = <B_j, B_j> / 2, M = diag(1, 1, 1, -1)
+   * and lambda = <u, u> / 2. */
+  double BtB[4][4] = {{0}};
+  double Bt_alpha[4] = {0};
+  double Bt_1[4] = {0};
+
+  for (u8 j=0; j<n_used; j++) {
+    double b[4] = {
+      nav_meas[j].sat_pos[0],
+      nav_meas[j].sat_pos[1],
+      nav_meas[j].sat_pos[2],
+      nav_meas[j].pseudorange,
+    };
+    double alpha = 0.5 * lorentz(b, b);
+    for (u8 r=0; r<4; r++) {
+      for (u8 c=0; c<4; c++) {
+        BtB[r][c] += b[r] * b[c];
+      }
+      Bt_alpha[r] += b[r] * alpha;
+      Bt_1[r] += b[r];
+    }
+  }
+
+  if (matrix_cholesky(4, (const double *)BtB, (double *)BtB) < 0) {
+    return -1;
+  }
+
+  /* M u = lambda e + r */
+  double e[4], r[4];
+  matrix_cholesky_solve(4, (const double *)BtB, Bt_1, e);
+  matrix_cholesky_solve(4, (const double *)BtB, Bt_alpha, r);
+
+  /* Substituting into the definition of lambda gives a quadratic. */
+  double qa = lorentz(e, e);
+  double qb = lorentz(e, r) - 1;
+  double qc = lorentz(r, r);
+
+  double lambdas[2];
+  u8 n_roots;
+  if (fabs(qa) < 1e-30) {
+    if (qb == 0) {
+      return -1;
+    }
+    lambdas[0] = -qc / (2*qb);
+    n_roots = 1;
+  } else {
+    double disc = qb*qb - qa*qc;
+    /* Noise can push a double root slightly negative. */
+    double sq = disc > 0 ? sqrt(disc) : 0;
+    lambdas[0] = (-qb + sq) / qa;
+    lambdas[1] = (-qb - sq) / qa;
+    n_roots = 2;
+  }
+
+  /* Keep whichever root best fits the measurements. */
+  double best_sse = INFINITY;
+  for (u8 k=0; k<n_roots; k++) {
+    double u[4];
+    for (u8 i=0; i<3; i++) {
+      u[i] = lambdas[k]*e[i] + r[i];
+    }
+    u[3] = -(lambdas[k]*e[3] + r[3]);
+
+    double sse = pvt_prefit_sse(u, n_used, nav_meas);
+    if (sse < best_sse) {
+      best_sse = sse;
+      memcpy(rx_state, u, sizeof(u));
+    }
+  }
+
+  return isfinite(best_sse) ? 0 : -1;
+}
+
+/* Choose the Newton-Raphson starting point for a solve according to
+ * `policy`. Returns 1 if the Bancroft solution was used, 0 otherwise. */
+static u8 pvt_initial_state(const pvt_init_policy_t policy,
+                            double rx_state[8],
+                            const u8 n_used,
+                            const navigation_measurement_t nav_meas[n_used])
+{
+  /* reset state to zero !? */
+  for(u8 i=4; i<8; i++) {
+    rx_state[i] = 0;
+  }
+
+  switch (policy) {
+  case PVT_INIT_WARM:
+    return 0;
+
+  case PVT_INIT_AUTO:
+    if (rx_state[0] != 0 || rx_state[1] != 0 || rx_state[2] != 0) {
+      /* Only the clock error is unknown for the warm start, remove it by
+       * taking the residual about the mean. */
+      double warm[4] = {rx_state[0], rx_state[1], rx_state[2], 0};
+      double mean = 0;
+      for (u8 j=0; j<n_used; j++) {
+        double tempv[3];
+        vector_subtract(3, nav_meas[j].sat_pos, warm, tempv);
+        mean += nav_meas[j].pseudorange - vector_norm(3, tempv);
+      }
+      warm[3] = mean / n_used;
+      double sse = pvt_prefit_sse(warm, n_used, nav_meas);
+      if (sse <= n_used * PVT_WARM_START_MAX_RESIDUAL
+                        * PVT_WARM_START_MAX_RESIDUAL) {
+        return 0;
+      }
+    }
+    /* Fall through. */
+
+  case PVT_INIT_BANCROFT:
+  default:
+    {
+      double init[4];
+      if (pvt_bancroft(n_used, nav_meas, init) == 0) {
+        memcpy(rx_state, init, sizeof(init));
+        return 1;
+      }
+    }
+    return 0;
+  }
+}
+
+/* Record the outcome of a solve in the solver statistics. */
+static void pvt_update_stats(pvt_solver_stats_t *stats, const u8 iters,
+                             const u8 bancroft, const s8 ret)
+{
+  stats->n_solves++;
+  if (ret != 0) {
+    stats->n_failed++;
+  }
+  if (bancroft) {
+    stats->n_bancroft++;
+  }
+  stats->total_iterations += iters;
+  stats->last_iterations = iters;
+  stats->max_iterations = MAX(stats->max_iterations, iters);
+}
+
+/* Compute the relative weight of and the correction to be subtracted from
+ * each pseudorange for the solver's weighting and troposphere settings. */
+static void pvt_measurement_model(pvt_solver_t *solver,
+                                  const double rx_state[3],
+                                  const u8 n_used,
+                                  const navigation_measurement_t nav_meas[n_used],
+                                  double w[n_used],
+                                  double pr_corr[n_used])
+{
+  for (u8 j=0; j<n_used; j++) {
+    w[j] = 1;
+    pr_corr[j] = 0;
+  }
+
+  if (solver->weighting == PVT_WEIGHT_NONE && !solver->tropo) {
+    return;
+  }
+
+  /* Elevations are meaningless until the estimate is near the surface, e.g.
+   * when starting from the center of the Earth. */
+  u8 have_el = vector_norm(3, rx_state) > WGS84_A / 2;
+  ltp_frame_t frame;
+  if (have_el) {
+    ltp_frame_init(&frame, rx_state);
+    if (solver->tropo) {
+      tropo_model_update(&solver->tropo_model, frame.ref_llh[0],
+                         frame.ref_llh[2], gps_day_of_year(nav_meas[0].tot));
+    }
+  }
+
+  for (u8 j=0; j<n_used; j++) {
+    double az, el = M_PI / 2;
+    if (have_el) {
+      ltp_ecef2azel(&frame, nav_meas[j].sat_pos, &az, &el);
+    }
+
+    switch (solver->weighting) {
+    case PVT_WEIGHT_ELEVATION:
+      {
+        double sin_el = sin(MAX(el, PVT_WLS_MIN_ELEVATION));
+        w[j] = sin_el * sin_el;
+      }
+      break;
+    case PVT_WEIGHT_SNR:
+      w[j] = MAX(nav_meas[j].snr, 1e-3) / PVT_SNR_REF;
+      break;
+    case PVT_WEIGHT_NONE:
+    default:
+      break;
+    }
+
+    if (solver->tropo && have_el) {
+      pr_corr[j] = tropo_model_correction(&solver->tropo_model, el);
+    }
+  }
+}
+
+/* Run Newton-Raphson iterations from the current `rx_state` until the
+ * solution converges, adding the number of iterations taken to `iters`.
+ * Returns 1 if the solution converged, 0 otherwise. */
+static u8 pvt_iterate(pvt_solver_t *solver,
+                      double rx_state[8],
+                      const u8 n_used,
+                      const navigation_measurement_t nav_meas[n_used],
+                      double w[n_used],
+                      double pr_corr[n_used],
+                      double H[4][4],
+                      u8 *iters)
+{
+  for (u8 i=0; i<PVT_MAX_ITERATIONS; i++) {
+    (*iters)++;
+    pvt_measurement_model(solver, rx_state, n_used, nav_meas, w, pr_corr);
+    double r = pvt_solve(rx_state, n_used, nav_meas, w, pr_corr, H);
+    if (r >= 0) {
+      return 1;
+    }
+    if (isinf(r)) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+/* Approximate upper quantile of the chi-square distribution with `dof`
+ * degrees of freedom at the RAIM false alarm probability, using the
+ * Wilson-Hilferty transformation. */
+static double pvt_raim_threshold(const u8 dof)
+{
+  double a = 2.0 / (9.0 * dof);
+  double t = 1 - a + PVT_RAIM_Z * sqrt(a);
+  return dof * t * t * t;
+}
+
+/* RAIM fault detection and exclusion on a converged solution.
+ *
+ * Tests the weighted sum of squared residuals against a chi-square
+ * threshold. If it fails, the residual sum of every leave-one-out subset is
+ * found without re-solving using the rank-one downdate
+ *
+ *    SSE_{-j} = SSE - w_j v_j^2 / (1 - h_jj),   h_jj = w_j g_j^T H g_j
+ *
+ * and the measurement whose removal best explains the fault is excluded if
+ * the remaining subset passes. `rx_state` is then moved to the subset
+ * solution, dx_{-j} = dx - H g_j w_j v_j / (1 - h_jj), ready for polishing.
+ *
+ * Returns the index of the excluded measurement, -1 if no fault was detected
+ * (or there is no redundancy to detect one) or -2 if a fault was detected but
+ * could not be excluded. */
+static s16 pvt_raim_fde(double rx_state[8],
+                        const double pr_sigma,
+                        const u8 n_used,
+                        const navigation_measurement_t nav_meas[n_used],
+                        const double w[n_used],
+                        const double pr_corr[n_used])
+{
+  if (n_used < 5) {
+    return -1;
+  }
+
+  double G[n_used][4];
+  double omp[n_used];
+  pvt_geometry(rx_state, n_used, nav_meas, pr_corr, G, omp);
+
+  double GtWG[4][4] = {{0}};
+  double H[4][4];
+  double GtWomp[4] = {0};
+  for (u8 j=0; j<n_used; j++) {
+    for (u8 r=0; r<4; r++) {
+      for (u8 c=0; c<4; c++) {
+        GtWG[r][c] += G[j][r] * w[j] * G[j][c];
+      }
+      GtWomp[r] += G[j][r] * w[j] * omp[j];
+    }
+  }
+  if (matrix_cholesky(4, (const double *)GtWG, (double *)GtWG) < 0) {
+    return -1;
+  }
+  matrix_cholesky_inverse(4, (const double *)GtWG, (double *)H);
+
+  double dx[4];
+  matrix_cholesky_solve(4, (const double *)GtWG, GtWomp, dx);
+
+  double v[n_used];
+  double sse = 0;
+  for (u8 j=0; j<n_used; j++) {
+    v[j] = omp[j] - vector_dot(4, G[j], dx);
+    sse += w[j] * v[j] * v[j];
+  }
+  sse /= pr_sigma * pr_sigma;
+
+  if (sse <= pvt_raim_threshold(n_used - 4)) {
+    return -1;
+  }
+
+  if (n_used < 6) {
+    /* Not enough redundancy to tell which measurement is faulty. */
+    return -2;
+  }
+
+  s16 best = -1;
+  double best_sse = INFINITY;
+  double best_k = 0;
+  double best_Hg[4];
+  for (u8 j=0; j<n_used; j++) {
+    double Hg[4];
+    matrix_multiply(4, 4, 1, (double *)H, G[j], Hg);
+    double h = w[j] * vector_dot(4, G[j], Hg);
+    if (1 - h < 1e-9) {
+      /* Geometry depends entirely on this measurement. */
+      continue;
+    }
+    double k = w[j] * v[j] / (1 - h);
+    double sse_j = sse - k * v[j] / (pr_sigma * pr_sigma);
+    if (sse_j < best_sse) {
+      best = j;
+      best_sse = sse_j;
+      best_k = k;
+      memcpy(best_Hg, Hg, sizeof(Hg));
+    }
+  }
+
+  if (best < 0 || best_sse > pvt_raim_threshold(n_used - 5)) {
+    return -2;
+  }
+
+  for (u8 i=0; i<3; i++) {
+    rx_state[i] += dx[i] - best_k * best_Hg[i];
+  }
+  rx_state[3] = dx[3] - best_k * best_Hg[3];
+
+  return best;
+}
+
+/** Initialise a PVT solver instance.
+ * Clears the warm-start state and statistics and selects the
+ * ::PVT_INIT_AUTO initial state policy, so the first solution is started from
+ * the Bancroft solution and later ones from the previous solution while it
+ * still fits the measurements. Measurements are unweighted, with no
+ * troposphere correction and no RAIM, until the corresponding fields of
+ * `solver` are set.
+ *
+ * \param solver Pointer to the solver state to initialise.
+ */
+void pvt_solver_init(pvt_solver_t *solver)
+{
+  memset(solver, 0, sizeof(*solver));
+  solver->init_policy = PVT_INIT_AUTO;
+  solver->weighting = PVT_WEIGHT_NONE;
+  solver->pr_sigma = PVT_DEFAULT_PR_SIGMA;
+  solver->excluded_prn = -1;
+  /* Force the troposphere model to be computed on first use. */
+  solver->tropo_model.day_of_year = -1000;
+}
+
+/** Calculate a position, velocity and time solution.
+ * Solves for the receiver state using the pseudoranges and Dopplers in
+ * `nav_meas`. The converged position is kept in `solver` and used as the
+ * starting point for the next call, so each receiver being processed should
+ * have its own ::pvt_solver_t. Calls with distinct solver instances share no
+ * state and may be made concurrently from different threads.
+ *
+ * \param solver   Solver state for this receiver.
+ * \param n_used   Number of measurements in `nav_meas`.
+ * \param nav_meas Navigation measurements to solve with.
+ * \param soln     The solution is written into this struct.
+ * \param dops     Dilution of precision of the solution is written here.
+ * If `solver->raim` is set the converged solution is checked for
+ * consistency. A single faulty measurement is excluded and the solution
+ * recomputed without it, in which case `soln->n_used` is reduced and
+ * `solver->excluded_prn` identifies the excluded measurement.
+ *
+ * \return `0` on success, `-4` if the solution failed to converge,
+ *         ::PVT_RAIM_ALARM if RAIM detected a fault it could not exclude or
+ *         the negated return code of filter_solution() if it was rejected.
+ */
+s8 calc_PVT_solver(pvt_solver_t *solver,
+                   const u8 n_used,
+                   const navigation_measurement_t nav_meas[n_used],
+                   gnss_solution *soln,
+                   dops_t *dops)
+{
+  /* Initial state is the previous solution or the closed form Bancroft
+   * solution depending on the solver's policy.
+   *
+   *  rx_state format:
+   *    pos[3], clock error, vel[3], intermediate freq error
+   */
+  double *rx_state = solver->rx_state;
+
+  double H[4][4];
+
+  soln->valid = 0;
+
+  soln->n_used = n_used; // Keep track of number of working channels
+
+  u8 bancroft = pvt_initial_state(solver->init_policy, rx_state,
+                                  n_used, nav_meas);
+
+  /* Measurement weights and pseudorange corrections. */
+  double w[n_used];
+  double pr_corr[n_used];
+
+  /* Newton-Raphson iteration. */
+  u8 iters = 0;
+  u8 converged = pvt_iterate(solver, rx_state, n_used, nav_meas,
+                             w, pr_corr, H, &iters);
+
+  const navigation_measurement_t *meas = nav_meas;
+  navigation_measurement_t subset[n_used];
+  u8 n_meas = n_used;
+  u8 raim_alarm = 0;
+  solver->excluded_prn = -1;
+
+  if (converged && solver->raim) {
+    s16 excluded = pvt_raim_fde(rx_state, solver->pr_sigma,
+                                n_used, nav_meas, w, pr_corr);
+    if (excluded == -2) {
+      raim_alarm = 1;
+      solver->stats.n_raim_alarms++;
+    } else if (excluded >= 0) {
+      /* Polish the subset solution starting from the downdated estimate. */
+      memcpy(subset, nav_meas, excluded * sizeof(subset[0]));
+      memcpy(&subset[excluded], &nav_meas[excluded + 1],
+             (n_used - excluded - 1) * sizeof(subset[0]));
+      meas = subset;
+      n_meas--;
+      solver->excluded_prn = nav_meas[excluded].prn;
+      solver->stats.n_exclusions++;
+      soln->n_used = n_meas;
+      converged = pvt_iterate(solver, rx_state, n_meas, meas,
+                              w, pr_corr, H, &iters);
+    }
+  }
+
+  s8 ret = pvt_finish(rx_state, (const double (*)[4])H,
+                      converged, n_meas, meas, soln, dops);
+  if (ret == 0 && raim_alarm) {
+    memset(soln, 0, sizeof(*soln));
+    ret = PVT_RAIM_ALARM;
+  }
+  pvt_update_stats(&solver->stats, iters, bancroft, ret);
+  return ret;
+}
+
+/** Calculate a position, velocity and time solution.
+ * Equivalent to calc_PVT_solver() using a single library-wide solver
+ * instance. This function is not reentrant; applications solving for more
+ * than one receiver, or calling from more than one thread, should use
+ * calc_PVT_solver() with their own ::pvt_solver_t instances instead.
+ *
+ * \param n_used   Number of measurements in `nav_meas`.
+ * \param nav_meas Navigation measurements to solve with.
+ * \param soln     The solution is written into this struct.
+ * \param dops     Dilution of precision of the solution is written here.
+ * \return See calc_PVT_solver().
+ */
+s8 calc_PVT(const u8 n_used,
+            const navigation_measurement_t nav_meas[n_used],
+            gnss_solution *soln,
+            dops_t *dops)
+{
+  static pvt_solver_t default_solver = {
+    .init_policy = PVT_INIT_AUTO,
+    .weighting = PVT_WEIGHT_NONE,
+    .pr_sigma = PVT_DEFAULT_PR_SIGMA,
+    .excluded_prn = -1,
+    .tropo_model = {.day_of_year = -1000},
+  };
+
+  return calc_PVT_solver(&default_solver, n_used, nav_meas, soln, dops);
+}
+
+/* Smallest Cholesky pivot accepted by pvt_batch_normal_inverse(), relative to
+ * the corresponding diagonal element of GtG. */
+#define PVT_BATCH_PIVOT_EPSILON 1e-12
+
+/* Index of element (i, j) of a symmetric 4x4 matrix stored as its packed
+ * upper triangle, row-first:
+ *
+ *    0  1  2  3
+ *    _  4  5  6
+ *    _  _  7  8
+ *    _  _  _  9
+ */
+#define SYM4(i, j) ((i) <= (j) ? (i)*4 - (i)*((i)+1)/2 + (j) \
+                               : (j)*4 - (j)*((j)+1)/2 + (i))
+
+/* Accumulate the normal equations for one Newton-Raphson step of one batch
+ * lane. Equivalent to the geometry matrix setup in pvt_solve() but rather than
+ * forming G, G^T and G^T G explicitly the products are summed directly into
+ * the lane's column of the structure-of-arrays accumulators:
+ *
+ *    GtG[k][lane] -- packed upper triangle of G^T G
+ *    Gtomp[k][lane] -- G^T (observed - predicted pseudorange)
+ *    Gtdot[k][lane] -- G^T (pseudorange rate residual), for the velocity
+ *                      solution once the position has converged.
+ */
+static void pvt_batch_accumulate(const double rx_state[4],
+                                 const u8 n_used,
+                                 const navigation_measurement_t nav_meas[n_used],
+                                 const u8 lane,
+                                 double GtG[10][PVT_BATCH_LANES],
+                                 double Gtomp[4][PVT_BATCH_LANES],
+                                 double Gtdot[4][PVT_BATCH_LANES])
+{
+  double A[10] = {0}, b[4] = {0}, v[4] = {0};
+
+  for (u8 j = 0; j < n_used; j++) {
+    const double *sat_pos = nav_meas[j].sat_pos;
+
+    /* Earth rotation correction, see pvt_solve(). */
+    double tempv[3];
+    vector_subtract(3, rx_state, sat_pos, tempv);
+    double wEtau = GPS_OMEGAE_DOT * vector_norm(3, tempv) / GPS_C;
+
+    double los[3] = {
+      sat_pos[0] + wEtau * sat_pos[1] - rx_state[0],
+      sat_pos[1] - wEtau * sat_pos[0] - rx_state[1],
+      sat_pos[2] - rx_state[2],
+    };
+    double p_pred = vector_norm(3, los);
+
+    double g[4] = {
+      -los[0] / p_pred,
+      -los[1] / p_pred,
+      -los[2] / p_pred,
+      1,
+    };
+    double omp = nav_meas[j].pseudorange - p_pred;
+    double dot = -nav_meas[j].doppler * GPS_C / GPS_L1_HZ
+                 + vector_dot(3, g, nav_meas[j].sat_vel);
+
+    for (u8 r=0; r<4; r++) {
+      for (u8 c=r; c<4; c++) {
+        A[SYM4(r, c)] += g[r] * g[c];
+      }
+      b[r] += g[r] * omp;
+      v[r] += g[r] * dot;
+    }
+  }
+
+  for (u8 k=0; k<10; k++) {
+    GtG[k][lane] = A[k];
+  }
+  for (u8 k=0; k<4; k++) {
+    Gtomp[k][lane] = b[k];
+    Gtdot[k][lane] = v[k];
+  }
+}
+
+/* Invert the normal equations of every lane of a batch at once.
+ * Each GtG is factored as L L^T with an unrolled Cholesky decomposition and
+ * H = (L^{-1})^T L^{-1} is formed directly. The loops run over lanes with no
+ * data dependent branches so that they can be vectorised by the compiler.
+ * Lanes whose GtG is not positive definite have `ok` cleared. */
+static void pvt_batch_normal_inverse(const double GtG[10][PVT_BATCH_LANES],
+                                     double H[10][PVT_BATCH_LANES],
+                                     u8 ok[PVT_BATCH_LANES])
+{
+  for (u8 l=0; l<PVT_BATCH_LANES; l++) {
+    double a00 = GtG[0][l], a01 = GtG[1][l], a02 = GtG[2][l], a03 = GtG[3][l];
+    double a11 = GtG[4][l], a12 = GtG[5][l], a13 = GtG[6][l];
+    double a22 = GtG[7][l], a23 = GtG[8][l];
+    double a33 = GtG[9][l];
+
+    /* GtG = L L^T */
+    double d0 = a00;
+    double L00 = sqrt(fabs(d0));
+    double L10 = a01 / L00, L20 = a02 / L00, L30 = a03 / L00;
+    double d1 = a11 - L10*L10;
+    double L11 = sqrt(fabs(d1));
+    double L21 = (a12 - L20*L10) / L11;
+    double L31 = (a13 - L30*L10) / L11;
+    double d2 = a22 - L20*L20 - L21*L21;
+    double L22 = sqrt(fabs(d2));
+    double L32 = (a23 - L30*L20 - L31*L21) / L22;
+    double d3 = a33 - L30*L30 - L31*L31 - L32*L32;
+    double L33 = sqrt(fabs(d3));
+
+    ok[l] = (d0 > 0) & (d1 > PVT_BATCH_PIVOT_EPSILON*a11) &
+            (d2 > PVT_BATCH_PIVOT_EPSILON*a22) &
+            (d3 > PVT_BATCH_PIVOT_EPSILON*a33);
+
+    /* M = L^{-1} */
+    double M00 = 1 / L00, M11 = 1 / L11, M22 = 1 / L22, M33 = 1 / L33;
+    double M10 = -L10*M00*M11;
+    double M21 = -L21*M11*M22;
+    double M20 = -(L20*M00 + L21*M10)*M22;
+    double M32 = -L32*M22*M33;
+    double M31 = -(L31*M11 + L32*M21)*M33;
+    double M30 = -(L30*M00 + L31*M10 + L32*M20)*M33;
+
+    /* H = M^T M */
+    H[0][l] = M00*M00 + M10*M10 + M20*M20 + M30*M30;
+    H[1][l] = M10*M11 + M20*M21 + M30*M31;
+    H[2][l] = M20*M22 + M30*M32;
+    H[3][l] = M30*M33;
+    H[4][l] = M11*M11 + M21*M21 + M31*M31;
+    H[5][l] = M21*M22 + M31*M32;
+    H[6][l] = M31*M33;
+    H[7][l] = M22*M22 + M32*M32;
+    H[8][l] = M32*M33;
+    H[9][l] = M33*M33;
+  }
+}
+
+/** Calculate position, velocity and time solutions for a batch of epochs.
+ * Solves `n_epochs` independent PVT problems, for example the epochs of a
+ * post-processed time series or the current epoch of many receivers. Each
+ * problem gives the same result as a call to calc_PVT_solver() but the
+ * Newton-Raphson iterations of up to ::PVT_BATCH_LANES problems are run
+ * together. calc_PVT_solver() forms G^T W G from the geometry matrix and
+ * factorises it with matrix_cholesky() one problem at a time, whereas here
+ * the normal equations are accumulated directly and inverted for all the
+ * problems in a batch by one unrolled, vectorisable 4x4 Cholesky inverse.
+ * Measurements are always unweighted and RAIM is not performed, whatever the
+ * settings of `solvers`.
+ *
+ * \param n_epochs Number of problems to solve.
+ * \param n_used   Number of measurements for each problem.
+ * \param nav_meas Navigation measurements for each problem.
+ * \param solvers  Optional solver state for each problem. If not `NULL`,
+ *                 `solvers[k]` provides the warm start and initial state
+ *                 policy for problem `k` and is updated as calc_PVT_solver()
+ *                 would. If `NULL`, every problem starts from its Bancroft
+ *                 solution.
+ * \param solns    The solution for each problem is written here.
+ * \param dops     Dilution of precision of each solution is written here.
+ * \param ret      The calc_PVT_solver() return code for each problem.
+ * \return Number of valid solutions.
+ */
+u32 calc_PVT_batch(const u32 n_epochs,
+                   const u8 n_used[n_epochs],
+                   const navigation_measurement_t *const nav_meas[n_epochs],
+                   pvt_solver_t solvers[],
+                   gnss_solution solns[n_epochs],
+                   dops_t dops[n_epochs],
+                   s8 ret[n_epochs])
+{
+  u32 n_valid = 0;
+
+  for (u32 base = 0; base < n_epochs; base += PVT_BATCH_LANES) {
+    u8 n_lanes = MIN(PVT_BATCH_LANES, n_epochs - base);
+
+    double rx_state[PVT_BATCH_LANES][8];
+    double GtG[10][PVT_BATCH_LANES];
+    double Gtomp[4][PVT_BATCH_LANES];
+    double Gtdot[4][PVT_BATCH_LANES];
+    double H[10][PVT_BATCH_LANES];
+    u8 ok[PVT_BATCH_LANES];
+    u8 active[PVT_BATCH_LANES];
+    u8 converged[PVT_BATCH_LANES];
+    u8 bancroft[PVT_BATCH_LANES];
+    u8 iters_used[PVT_BATCH_LANES];
+    u8 n_active = n_lanes;
+
+    for (u8 l=0; l<PVT_BATCH_LANES; l++) {
+      if (l < n_lanes && solvers) {
+        memcpy(rx_state[l], solvers[base + l].rx_state, sizeof(rx_state[l]));
+      } else {
+        memset(rx_state[l], 0, sizeof(rx_state[l]));
+      }
+      bancroft[l] = 0;
+      if (l < n_lanes) {
+        pvt_init_policy_t policy = solvers ? solvers[base + l].init_policy
+                                           : PVT_INIT_BANCROFT;
+        bancroft[l] = pvt_initial_state(policy, rx_state[l],
+                                        n_used[base + l], nav_meas[base + l]);
+      }
+      iters_used[l] = 0;
+      active[l] = l < n_lanes;
+      converged[l] = 0;
+      /* Unused lanes solve the identity. */
+      for (u8 k=0; k<10; k++) {
+        GtG[k][l] = 0;
+      }
+      GtG[SYM4(0, 0)][l] = GtG[SYM4(1, 1)][l] = 1;
+      GtG[SYM4(2, 2)][l] = GtG[SYM4(3, 3)][l] = 1;
+      for (u8 k=0; k<4; k++) {
+        Gtomp[k][l] = Gtdot[k][l] = 0;
+      }
+    }
+
+    /* Fused Newton-Raphson iteration across all lanes. */
+    for (u8 iters=0; iters<PVT_MAX_ITERATIONS && n_active; iters++) {
+      for (u8 l=0; l<n_lanes; l++) {
+        if (active[l]) {
+          pvt_batch_accumulate(rx_state[l], n_used[base + l],
+                               nav_meas[base + l], l, GtG, Gtomp, Gtdot);
+        }
+      }
+
+      pvt_batch_normal_inverse((const double (*)[PVT_BATCH_LANES])GtG, H, ok);
+
+      for (u8 l=0; l<n_lanes; l++) {
+        if (!active[l]) {
+          continue;
+        }
+        if (!ok[l]) {
+          /* Singular geometry, give up on this lane. */
+          active[l] = 0;
+          n_active--;
+          continue;
+        }
+
+        iters_used[l]++;
+
+        double correction[4], vel[4];
+        for (u8 r=0; r<4; r++) {
+          correction[r] = 0;
+          vel[r] = 0;
+          for (u8 c=0; c<4; c++) {
+            correction[r] += H[SYM4(r, c)][l] * Gtomp[c][l];
+            vel[r] += H[SYM4(r, c)][l] * Gtdot[c][l];
+          }
+        }
+
+        for (u8 i=0; i<3; i++) {
+          rx_state[l][i] += correction[i];
+        }
+        rx_state[l][3] = correction[3];
+
+        if (vector_norm(3, correction) <= 0.001) {
+          memcpy(&rx_state[l][4], vel, sizeof(vel));
+          converged[l] = 1;
+          active[l] = 0;
+          n_active--;
+        }
+      }
+    }
+
+    for (u8 l=0; l<n_lanes; l++) {
+      u32 k = base + l;
+      double H_full[4][4];
+      for (u8 r=0; r<4; r++) {
+        for (u8 c=0; c<4; c++) {
+          H_full[r][c] = H[SYM4(r, c)][l];
+        }
+      }
+
+      solns[k].valid = 0;
+      solns[k].n_used = n_used[k];
+      ret[k] = pvt_finish(rx_state[l], (const double (*)[4])H_full,
+                          converged[l], n_used[k], nav_meas[k],
+                          &solns[k], &dops[k]);
+      if (ret[k] == 0) {
+        n_valid++;
+      }
+      if (solvers) {
+        memcpy(solvers[k].rx_state, rx_state[l], sizeof(rx_state[l]));
+        pvt_update_stats(&solvers[k].stats, iters_used[l], bancroft[l], ret[k]);
+      }
+    }
+  }
+
+  return n_valid;
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2014 Swift Navigation Inc.
+ *
+ * This source is subject to the license found in the file 'LICENSE' which must
+ * be be distributed together with this source. All other rights reserved.
+ *
+ * THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY KIND,
+ * EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "constants.h"
+#include "linear_algebra.h"
+#include "coord_system.h"
+#include "pvt_kf.h"
+
+/** \defgroup pvt_kf PVT Kalman Filter
+ * Recursive position, velocity and time estimation.
+ *
+ * An extended Kalman filter with a constant velocity receiver model and a
+ * two state (bias and drift) clock model. Pseudoranges and Doppler derived
+ * pseudorange rates are processed one at a time as scalar updates, so the
+ * cost of an epoch is linear in the number of measurements and no matrix
+ * inversion is needed. The filter is initialised, and re-initialised after a
+ * long gap, from a snapshot calc_PVT_solver() fix.
+ * \{ */
+
+/* Default clock process noise, typical of a TCXO. */
+#define PVT_KF_DEFAULT_CLOCK_BIAS_PSD 1e-2
+#define PVT_KF_DEFAULT_CLOCK_DRIFT_PSD 4e-2
+
+/* State indices. */
+#define KF_POS 0
+#define KF_VEL 3
+#define KF_CLK_BIAS 6
+#define KF_CLK_DRIFT 7
+
+/** Initialise a PVT Kalman filter.
+ * The filter is left uninitialised until the first call to pvt_kf_update(),
+ * which starts it from a snapshot solution.
+ *
+ * \param kf        Filter to initialise.
+ * \param accel_psd Power spectral density of the receiver acceleration
+ *                  [m^2/s^3], larger values track manoeuvres more closely.
+ * \param pr_var    Pseudorange measurement variance [m^2].
+ * \param rr_var    Pseudorange rate measurement variance [m^2/s^2].
+ */
+void pvt_kf_init(pvt_kf_t *kf, double accel_psd, double pr_var, double rr_var)
+{
+  memset(kf, 0, sizeof(*kf));
+  kf->accel_psd = accel_psd;
+  kf->clock_bias_psd = PVT_KF_DEFAULT_CLOCK_BIAS_PSD;
+  kf->clock_drift_psd = PVT_KF_DEFAULT_CLOCK_DRIFT_PSD;
+  kf->pr_var = pr_var;
+  kf->rr_var = rr_var;
+  pvt_solver_init(&kf->init_solver);
+}
+
+/** Propagate the filter state forward in time.
+ *
+ * \param kf Filter to propagate.
+ * \param dt Time step [s].
+ */
+void pvt_kf_predict(pvt_kf_t *kf, double dt)
+{
+  /* x := F x, where F = I + dt E and E maps the velocity onto the position
+   * and the clock drift onto the clock bias. */
+  for (u8 i=0; i<3; i++) {
+    kf->x[KF_POS+i] += dt * kf->x[KF_VEL+i];
+  }
+  kf->x[KF_CLK_BIAS] += dt * kf->x[KF_CLK_DRIFT];
+
+  /* P := F P F^T, applied as row then column operations. */
+  for (u8 j=0; j<PVT_KF_STATE_DIM; j++) {
+    for (u8 i=0; i<3; i++) {
+      kf->P[KF_POS+i][j] += dt * kf->P[KF_VEL+i][j];
+    }
+    kf->P[KF_CLK_BIAS][j] += dt * kf->P[KF_CLK_DRIFT][j];
+  }
+  for (u8 i=0; i<PVT_KF_STATE_DIM; i++) {
+    for (u8 j=0; j<3; j++) {
+      kf->P[i][KF_POS+j] += dt * kf->P[i][KF_VEL+j];
+    }
+    kf->P[i][KF_CLK_BIAS] += dt * kf->P[i][KF_CLK_DRIFT];
+  }
+
+  /* P := P + Q, for white noise acceleration and clock drift rate. */
+  double dt2 = dt*dt, dt3 = dt2*dt;
+  for (u8 i=0; i<3; i++) {
+    kf->P[KF_POS+i][KF_POS+i] += kf->accel_psd * dt3 / 3;
+    kf->P[KF_POS+i][KF_VEL+i] += kf->accel_psd * dt2 / 2;
+    kf->P[KF_VEL+i][KF_POS+i] += kf->accel_psd * dt2 / 2;
+    kf->P[KF_VEL+i][KF_VEL+i] += kf->accel_psd * dt;
+  }
+  kf->P[KF_CLK_BIAS][KF_CLK_BIAS] += kf->clock_bias_psd * dt
+                                     + kf->clock_drift_psd * dt3 / 3;
+  kf->P[KF_CLK_BIAS][KF_CLK_DRIFT] += kf->clock_drift_psd * dt2 / 2;
+  kf->P[KF_CLK_DRIFT][KF_CLK_BIAS] += kf->clock_drift_psd * dt2 / 2;
+  kf->P[KF_CLK_DRIFT][KF_CLK_DRIFT] += kf->clock_drift_psd * dt;
+}
+
+/* Scalar measurement update with a sparse observation row. `idx` holds the
+ * indices of the `n` non-zero elements `h` of the row. Returns 0 if the
+ * measurement was applied or -1 if it failed the innovation gate. */
+static s8 kf_scalar_update(pvt_kf_t *kf, const u8 n, const u8 idx[n],
+                           const double h[n], const double innovation,
+                           const double var)
+{
+  /* PHt := P h^T */
+  double PHt[PVT_KF_STATE_DIM];
+  for (u8 i=0; i<PVT_KF_STATE_DIM; i++) {
+    PHt[i] = 0;
+    for (u8 k=0; k<n; k++) {
+      PHt[i] += kf->P[i][idx[k]] * h[k];
+    }
+  }
+
+  /* S := h P h^T + R */
+  double S = var;
+  for (u8 k=0; k<n; k++) {
+    S += h[k] * PHt[idx[k]];
+  }
+
+  if (innovation * innovation > PVT_KF_INNOVATION_GATE * S) {
+    return -1;
+  }
+
+  /* K := P h^T / S, x := x + K y, P := P - K S K^T */
+  for (u8 i=0; i<PVT_KF_STATE_DIM; i++) {
+    kf->x[i] += PHt[i] * innovation / S;
+  }
+  for (u8 i=0; i<PVT_KF_STATE_DIM; i++) {
+    for (u8 j=0; j<PVT_KF_STATE_DIM; j++) {
+      kf->P[i][j] -= PHt[i] * PHt[j] / S;
+    }
+  }
+  return 0;
+}
+
+/* Line of sight unit vector and range from the receiver to a satellite,
+ * with the satellite position rotated for the Earth's rotation during the
+ * signal time of flight as in pvt_solve(). */
+static double kf_line_of_sight(const double rx_pos[3], const double sat_pos[3],
+                               double los[3])
+{
+  double tempv[3];
+  vector_subtract(3, rx_pos, sat_pos, tempv);
+  double wEtau = GPS_OMEGAE_DOT * vector_norm(3, tempv) / GPS_C;
+
+  los[0] = sat_pos[0] + wEtau * sat_pos[1] - rx_pos[0];
+  los[1] = sat_pos[1] - wEtau * sat_pos[0] - rx_pos[1];
+  los[2] = sat_pos[2] - rx_pos[2];
+
+  double range = vector_norm(3, los);
+  for (u8 i=0; i<3; i++) {
+    los[i] /= range;
+  }
+  return range;
+}
+
+/* Report the filter's position, velocity and clock estimates in `soln`. */
+static void kf_solution(const pvt_kf_t *kf, gnss_solution *soln)
+{
+  /* gnss_solution is packed, convert from unpacked copies. */
+  double pos[3], vel[3], vel_ned[3], llh[3];
+  for (u8 i=0; i<3; i++) {
+    pos[i] = kf->x[KF_POS+i];
+    vel[i] = kf->x[KF_VEL+i];
+  }
+  wgsecef2ned(vel, pos, vel_ned);
+  wgsecef2llh(pos, llh);
+  for (u8 i=0; i<3; i++) {
+    soln->pos_ecef[i] = pos[i];
+    soln->vel_ecef[i] = vel[i];
+    soln->vel_ned[i] = vel_ned[i];
+    soln->pos_llh[i] = llh[i];
+  }
+
+  soln->err_cov[0] = kf->P[0][0];
+  soln->err_cov[1] = kf->P[0][1];
+  soln->err_cov[2] = kf->P[0][2];
+  soln->err_cov[3] = kf->P[1][1];
+  soln->err_cov[4] = kf->P[1][2];
+  soln->err_cov[5] = kf->P[2][2];
+
+  soln->clock_offset = kf->x[KF_CLK_BIAS] / GPS_C;
+  soln->clock_bias = kf->x[KF_CLK_DRIFT] / GPS_C;
+  soln->time = kf->t;
+}
+
+/* Start the filter from a snapshot least squares solution. */
+static s8 kf_initialize(pvt_kf_t *kf, const u8 n_used,
+                        const navigation_measurement_t nav_meas[n_used],
+                        gnss_solution *soln, dops_t *dops)
+{
+  kf->initialized = 0;
+
+  s8 ret = calc_PVT_solver(&kf->init_solver, n_used, nav_meas, soln, dops);
+  if (ret < 0) {
+    return ret;
+  }
+
+  const double *rx_state = kf->init_solver.rx_state;
+  memcpy(&kf->x[KF_POS], soln->pos_ecef, sizeof(soln->pos_ecef));
+  memcpy(&kf->x[KF_VEL], soln->vel_ecef, sizeof(soln->vel_ecef));
+  kf->x[KF_CLK_BIAS] = rx_state[3];
+  kf->x[KF_CLK_DRIFT] = rx_state[7];
+
+  /* The snapshot covariance is the unit weight (G^T G)^{-1} stored in
+   * err_cov, scaled by the measurement variances. Only the position block
+   * is available so clock terms are started from the GDOP. */
+  memset(kf->P, 0, sizeof(kf->P));
+  const u8 upper[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+  double gdop2 = dops->gdop * dops->gdop;
+  for (u8 i=0; i<3; i++) {
+    for (u8 j=0; j<3; j++) {
+      kf->P[KF_POS+i][KF_POS+j] = soln->err_cov[upper[i][j]] * kf->pr_var;
+      kf->P[KF_VEL+i][KF_VEL+j] = soln->err_cov[upper[i][j]] * kf->rr_var;
+    }
+  }
+  kf->P[KF_CLK_BIAS][KF_CLK_BIAS] = gdop2 * kf->pr_var;
+  kf->P[KF_CLK_DRIFT][KF_CLK_DRIFT] = gdop2 * kf->rr_var;
+
+  kf->t = soln->time;
+  kf->initialized = 1;
+  return 0;
+}
+
+/** Update the PVT Kalman filter with a new epoch of measurements.
+ * The state is propagated to the receiver time of the epoch and then
+ * corrected by each pseudorange and pseudorange rate in turn. Measurements
+ * inconsistent with the prediction by more than ::PVT_KF_INNOVATION_GATE
+ * are skipped. On the first call, or after a gap of more than
+ * ::PVT_KF_MAX_DT, the filter is instead started from a snapshot solution.
+ *
+ * An epoch without measurements can't be timed, so the filter is left as it
+ * is and its current estimate is reported in `soln` marked invalid. The
+ * caller may coast the filter over the gap with pvt_kf_predict().
+ *
+ * The solution is reported in the same form as calc_PVT(), except that
+ * `soln->err_cov` holds the filter's ECEF position covariance [m^2].
+ *
+ * \param kf       Filter to update.
+ * \param n_used   Number of measurements in `nav_meas`.
+ * \param nav_meas Navigation measurements for this epoch.
+ * \param soln     The solution is written into this struct.
+ * \param dops     Dilution of precision of the epoch's geometry.
+ * \return `0` on success, ::PVT_KF_NO_MEASUREMENTS if `n_used` is zero, the
+ *         calc_PVT_solver() error code if the filter could not be initialised
+ *         or the negated return code of filter_solution() if the solution was
+ *         rejected.
+ */
+s8 pvt_kf_update(pvt_kf_t *kf, const u8 n_used,
+                 const navigation_measurement_t nav_meas[n_used],
+                 gnss_solution *soln, dops_t *dops)
+{
+  soln->valid = 0;
+  soln->n_used = n_used;
+
+  if (n_used == 0) {
+    memset(dops, 0, sizeof(*dops));
+    if (kf->initialized) {
+      kf_solution(kf, soln);
+      soln->err_cov[6] = 0;
+    }
+    return PVT_KF_NO_MEASUREMENTS;
+  }
+
+  if (!kf->initialized) {
+    return kf_initialize(kf, n_used, nav_meas, soln, dops);
+  }
+
+  /* Receiver time of the epoch using the predicted clock bias. */
+  gps_time_t t = nav_meas[0].tot;
+  t.tow += (nav_meas[0].pseudorange - kf->x[KF_CLK_BIAS]) / GPS_C;
+  t = normalize_gps_time(t);
+
+  double dt = gpsdifftime(t, kf->t);
+  if (dt < 0 || dt > PVT_KF_MAX_DT) {
+    return kf_initialize(kf, n_used, nav_meas, soln, dops);
+  }
+
+  pvt_kf_predict(kf, dt);
+  kf->t = t;
+
+  /* Unit weight geometry for the DOPs. */
+  double GtG[4][4] = {{0}};
+
+  for (u8 j=0; j<n_used; j++) {
+    double los[3];
+    double range = kf_line_of_sight(&kf->x[KF_POS], nav_meas[j].sat_pos, los);
+
+    double g[4] = {-los[0], -los[1], -los[2], 1};
+    for (u8 r=0; r<4; r++) {
+      for (u8 c=0; c<4; c++) {
+        GtG[r][c] += g[r] * g[c];
+      }
+    }
+
+    /* Pseudorange: range + clock bias. */
+    const u8 pr_idx[4] = {KF_POS, KF_POS+1, KF_POS+2, KF_CLK_BIAS};
+    double pr_pred = range + kf->x[KF_CLK_BIAS];
+    kf_scalar_update(kf, 4, pr_idx, g, nav_meas[j].pseudorange - pr_pred,
+                     kf->pr_var);
+
+    /* Pseudorange rate: los . (sat_vel - rx_vel) + clock drift. The line of
+     * sight is kept from before the pseudorange update, the change is well
+     * below the Doppler noise. */
+    const u8 rr_idx[4] = {KF_VEL, KF_VEL+1, KF_VEL+2, KF_CLK_DRIFT};
+    double rr = -nav_meas[j].doppler * GPS_C / GPS_L1_HZ;
+    double rr_pred = vector_dot(3, los, nav_meas[j].sat_vel)
+                     - vector_dot(3, los, &kf->x[KF_VEL])
+                     + kf->x[KF_CLK_DRIFT];
+    kf_scalar_update(kf, 4, rr_idx, g, rr - rr_pred, kf->rr_var);
+  }
+
+  double H[4][4];
+  if (matrix_cholesky(4, (const double *)GtG, (double *)GtG) < 0) {
+    memset(H, 0, sizeof(H));
+  } else {
+    matrix_cholesky_inverse(4, (const double *)GtG, (double *)H);
+  }
+  compute_dops((const double (*)[4])H, &kf->x[KF_POS], dops);
+
+  kf_solution(kf, soln);
+  soln->err_cov[6] = dops->gdop;
+
+  u8 ret;
+  if ((ret = filter_solution(soln, dops))) {
+    memset(soln, 0, sizeof(*soln));
+    kf->initialized = 0;
+    return -ret;
+  }
+
+  soln->valid = 1;
+  return 0;
+}
+
+/** \} */
@@ -19,6 +19,7 @@
 #include "stupid_filter.h"
 #include "amb_kf.h"
 #include "linear_algebra.h"
+#include "lapack_work.h"
 
 #include <lapacke.h>
 
@@ -79,8 +80,13 @@ void amb_from_baseline(u8 num_sats, double *DE, double *dd_meas,
 
 void lesq_solution(u8 num_dds, double *dd_meas, s32 *N, double *DE, double b[3], double *resid)
 {
-  double DE_work[num_dds*3];
-  memcpy(DE_work, DE, num_dds * 3 * sizeof(double));
+  /* DGELSY overwrites A, and expects it in column major order. */
+  double DE_work[3*num_dds];
+  for (u8 i=0; i<num_dds; i++) {
+    for (u8 j=0; j<3; j++) {
+      DE_work[j*num_dds + i] = DE[i*3 + j];
+    }
+  }
 
   /* Solve for b via least squares, i.e.
    * dd_meas = DE . b + N
@@ -96,23 +102,21 @@ void lesq_solution(u8 num_dds, double *dd_meas, s32 *N, double *DE, double b[3],
     rhs[i] = (dd_meas[i] - N[i]) * GPS_L1_LAMBDA_NO_VAC;
   }
 
-  int jpvt[3] = {0, 0, 0};
-  int rank;
-  /* TODO: This function calls malloc to allocate work area, refactor to use
-   * LAPACKE_dgelsy_work instead. */
-  LAPACKE_dgelsy(
-    LAPACK_ROW_MAJOR, num_dds, 3,
-    1, DE_work, 3,
-    rhs, 1, jpvt,
-    -1, &rank
-  );
+  /* Call DGELSY directly rather than through LAPACKE_dgelsy(), which
+   * allocates both the workspace and row major transposes on the heap. */
+  lapack_int m = num_dds, n = 3, nrhs = 1, lda = num_dds, ldb = MAX(num_dds, 3);
+  lapack_int jpvt[3] = {0, 0, 0};
+  lapack_int rank, info;
+  lapack_int lwork = LAPACK_WORK_SIZE;
+  double rcond = -1;
+  double work[LAPACK_WORK_SIZE];
+  LAPACK_dgelsy(&m, &n, &nrhs, DE_work, &lda, rhs, &ldb, jpvt, &rcond,
+                &rank, work, &lwork, &info);
   memcpy(b, rhs, 3*sizeof(double));
 
   if (resid) {
     /* Calculate Least Squares Residuals */
 
-    memcpy(DE_work, DE, num_dds * 3 * sizeof(double));
-
     /* resid <= dd_meas - N
      * alpha <= - 1.0 / GPS_L1_LAMBDA_NO_VAC
      * beta <= 1.0
@@ -123,7 +127,7 @@ void lesq_solution(u8 num_dds, double *dd_meas, s32 *N, double *DE, double b[3],
     }
     cblas_dgemv(
       CblasRowMajor, CblasNoTrans, num_dds, 3,
-      -1.0 / GPS_L1_LAMBDA_NO_VAC, DE_work, 3, b, 1,
+      -1.0 / GPS_L1_LAMBDA_NO_VAC, DE, 3, b, 1,
       1.0, resid, 1
     );
   }
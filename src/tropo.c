@@ -12,6 +12,9 @@
 
 #include <math.h>
 
+#include "constants.h"
+#include "tropo.h"
+
 /* Simple Black model, inspired by GPSTk SimpleTropModel class. */
 
 double dry_zenith_delay(void)
@@ -47,3 +50,294 @@ double tropo_correction(double elevation)
         + wet_zenith_delay() * wet_mapping_function(elevation));
 }
 
+
+/* UNB3 troposphere model.
+ *
+ * Meteorological parameters are interpolated from the UNB3 latitude table
+ * with an annual variation, and used to compute Saastamoinen style zenith
+ * hydrostatic and wet delays at the receiver height.
+ *
+ * References:
+ *   -# Leandro R., Santos M. and Langley R. B. (2006), "UNB Neutral
+ *      Atmosphere Models: Development and Performance", ION NTM.
+ *   -# Collins J. P. and Langley R. B. (1997), "A Tropospheric Delay Model
+ *      for the User of the Wide Area Augmentation System", UNB Technical
+ *      Report 187.
+ */
+
+#define UNB3_N_LAT 5
+
+/* Latitudes of the UNB3 table [deg]. */
+static const double unb3_lat[UNB3_N_LAT] = {15, 30, 45, 60, 75};
+
+/* UNB3 average and seasonal amplitude of pressure [mbar], temperature [K],
+ * water vapour pressure [mbar], temperature lapse rate [K/m] and water
+ * vapour lapse rate [unitless]. */
+static const double unb3_avg[UNB3_N_LAT][5] = {
+  {1013.25, 299.65, 26.31, 6.30e-3, 2.77},
+  {1017.25, 294.15, 21.79, 6.05e-3, 3.15},
+  {1015.75, 283.15, 11.66, 5.58e-3, 2.57},
+  {1011.75, 272.15,  6.78, 5.39e-3, 1.81},
+  {1013.00, 263.65,  4.11, 4.53e-3, 1.55},
+};
+static const double unb3_amp[UNB3_N_LAT][5] = {
+  { 0.00,  0.00, 0.00, 0.00e-3, 0.00},
+  {-3.75,  7.00, 8.85, 0.25e-3, 0.33},
+  {-2.25, 11.00, 7.24, 0.32e-3, 0.46},
+  {-1.75, 15.00, 5.36, 0.81e-3, 0.74},
+  {-0.50, 14.50, 3.39, 0.62e-3, 0.30},
+};
+
+#define UNB3_K1 77.604     /* K/mbar */
+#define UNB3_K2P 16.6      /* K/mbar */
+#define UNB3_K3 377600.0   /* K^2/mbar */
+#define UNB3_RD 287.054    /* Gas constant of dry air [J/kg/K] */
+#define UNB3_GM 9.784      /* Mean gravity [m/s^2] */
+#define UNB3_G 9.80665     /* Standard gravity [m/s^2] */
+
+/** Initialise a troposphere model for a receiver location.
+ * Computes the zenith hydrostatic and wet delays of the UNB3 model, which
+ * depend only on the location and season and so can be reused for every
+ * satellite and for many epochs, see tropo_model_update().
+ *
+ * \param model       Model to initialise.
+ * \param lat         Receiver geodetic latitude [rad].
+ * \param height      Receiver height above the ellipsoid [m].
+ * \param day_of_year Day of year, 1.0 at the start of January 1st.
+ */
+void tropo_model_init(tropo_model_t *model, double lat, double height,
+                      double day_of_year)
+{
+  model->lat = lat;
+  model->height = height;
+  model->day_of_year = day_of_year;
+
+  /* Interpolate the meteorological parameters in latitude. */
+  double abs_lat = fabs(lat) * R2D;
+  u8 i = 0;
+  double frac = 0;
+  if (abs_lat >= unb3_lat[UNB3_N_LAT-1]) {
+    i = UNB3_N_LAT - 2;
+    frac = 1;
+  } else if (abs_lat > unb3_lat[0]) {
+    while (abs_lat > unb3_lat[i+1]) {
+      i++;
+    }
+    frac = (abs_lat - unb3_lat[i]) / (unb3_lat[i+1] - unb3_lat[i]);
+  }
+
+  /* Seasonal variation, minimum on day 28 in the northern hemisphere and
+   * half a year later in the southern. */
+  double d_min = lat < 0 ? 211 : 28;
+  double season = cos(2*M_PI*(day_of_year - d_min) / 365.25);
+
+  double met[5];
+  for (u8 k=0; k<5; k++) {
+    double avg = unb3_avg[i][k] + frac*(unb3_avg[i+1][k] - unb3_avg[i][k]);
+    double amp = unb3_amp[i][k] + frac*(unb3_amp[i+1][k] - unb3_amp[i][k]);
+    met[k] = avg - amp * season;
+  }
+  double P = met[0], T = met[1], e = met[2], beta = met[3], lambda = met[4];
+
+  /* Sea level zenith delays. */
+  double zhd0 = 1e-6 * UNB3_K1 * UNB3_RD * P / UNB3_GM;
+  double gm_lambda = UNB3_GM * (lambda + 1);
+  double Tm = T * (1 - beta * UNB3_RD / gm_lambda);
+  double zwd0 = 1e-6 * (Tm * UNB3_K2P + UNB3_K3) * UNB3_RD
+                / (gm_lambda - beta * UNB3_RD) * e / T;
+
+  /* Scale to the receiver height. */
+  double base = 1 - beta * height / T;
+  if (base < 1e-3) {
+    /* Above the troposphere. */
+    base = 1e-3;
+  }
+  double ep = UNB3_G / (UNB3_RD * beta);
+  model->zenith_dry = pow(base, ep) * zhd0;
+  model->zenith_wet = pow(base, (lambda + 1) * ep - 1) * zwd0;
+}
+
+/** Update a troposphere model for a new receiver location.
+ * The zenith delays are only recomputed if the receiver has moved or the
+ * season has changed enough to make a difference, so this can be called
+ * every epoch.
+ *
+ * \param model       Model initialised by tropo_model_init().
+ * \param lat         Receiver geodetic latitude [rad].
+ * \param height      Receiver height above the ellipsoid [m].
+ * \param day_of_year Day of year, 1.0 at the start of January 1st.
+ * \return 1 if the zenith delays were recomputed, 0 otherwise.
+ */
+u8 tropo_model_update(tropo_model_t *model, double lat, double height,
+                      double day_of_year)
+{
+  if (fabs(lat - model->lat) < TROPO_MODEL_MAX_DLAT &&
+      fabs(height - model->height) < TROPO_MODEL_MAX_DHEIGHT &&
+      fabs(day_of_year - model->day_of_year) < TROPO_MODEL_MAX_DDAY) {
+    return 0;
+  }
+  tropo_model_init(model, lat, height, day_of_year);
+  return 1;
+}
+
+/* Tabulated dry and wet mapping functions of the simple Black model used by
+ * tropo_correction(), at TROPO_MAPPING_STEP intervals from -0.5 to 90.5
+ * degrees elevation. The end points make the table symmetric about 0 and 90
+ * degrees for the cubic interpolation. */
+#define TROPO_MAPPING_STEP (0.5 * D2R)
+#define TROPO_MAPPING_N 183
+
+static const double dry_mapping_table[TROPO_MAPPING_N] = {
+  2.183044451348552e+01, 2.223685027027187e+01, 2.183044451348552e+01, 2.073320630918663e+01,
+  1.922300936500121e+01, 1.757404547197983e+01, 1.596959254797074e+01, 1.450059889399068e+01,
+  1.319711050160172e+01, 1.205741860977702e+01, 1.106631000635077e+01, 1.020456071683706e+01,
+  9.453262493265798e+00, 8.795500046205731e+00, 8.216788703395355e+00, 7.704984040196995e+00,
+  7.250000281083153e+00, 6.843487654384808e+00, 6.478530055414113e+00, 6.149383722706297e+00,
+  5.851259981836350e+00, 5.580148159238008e+00, 5.332672630986457e+00, 5.105977881729795e+00,
+  4.897636132593429e+00, 4.705572987081426e+00, 4.528007404905259e+00, 4.363403060980605e+00,
+  4.210428762885937e+00, 4.067926094192713e+00, 3.934882841488959e+00, 3.810411068957537e+00,
+  3.693728943401439e+00, 3.584145599137990e+00, 3.481048477872410e+00, 3.383892692689671e+00,
+  3.292192054808244e+00, 3.205511472234563e+00, 3.123460485188413e+00, 3.045687747403451e+00,
+  2.971876297659862e+00, 2.901739494116780e+00, 2.835017506682088e+00, 2.771474280949019e+00,
+  2.710894902048979e+00, 2.653083298824892e+00, 2.597860238573709e+00, 2.545061570676594e+00,
+  2.494536684075615e+00, 2.446147149039259e+00, 2.399765518203690e+00, 2.355274265656060e+00,
+  2.312564845979580e+00, 2.271536857819862e+00, 2.232097298748855e+00, 2.194159900069903e+00,
+  2.157644531784994e+00, 2.122476669281833e+00, 2.088586914433948e+00, 2.055910564774534e+00,
+  2.024387225231136e+00, 1.993960457615983e+00, 1.964577463674346e+00, 1.936188798016214e+00,
+  1.908748107707492e+00, 1.882211895687008e+00, 1.856539305513319e+00, 1.831691925238824e+00,
+  1.807633608463866e+00, 1.784330310846177e+00, 1.761749940535405e+00, 1.739862221172726e+00,
+  1.718638566244816e+00, 1.698051963712553e+00, 1.678076869950320e+00, 1.658689112133470e+00,
+  1.639865798301426e+00, 1.621585234403383e+00, 1.603826847703999e+00, 1.586571115988974e+00,
+  1.569799502065962e+00, 1.553494393105713e+00, 1.537639044412394e+00, 1.522217527251377e+00,
+  1.507214680397974e+00, 1.492616065102021e+00, 1.478407923191457e+00, 1.464577138063341e+00,
+  1.451111198333489e+00, 1.437998163936392e+00, 1.425226634485478e+00, 1.412785719720412e+00,
+  1.400665011883154e+00, 1.388854559878004e+00, 1.377344845083190e+00, 1.366126758692626e+00,
+  1.355191580476573e+00, 1.344530958859063e+00, 1.334136892218278e+00, 1.324001711323621e+00,
+  1.314118062830108e+00, 1.304478893756970e+00, 1.295077436883099e+00, 1.285907196997164e+00,
+  1.276961937945034e+00, 1.268235670421457e+00, 1.259722640457015e+00, 1.251417318554951e+00,
+  1.243314389435899e+00, 1.235408742351575e+00, 1.227695461931346e+00, 1.220169819528174e+00,
+  1.212827265032853e+00, 1.205663419127625e+00, 1.198674065952329e+00, 1.191855146158060e+00,
+  1.185202750325097e+00, 1.178713112723402e+00, 1.172382605395503e+00, 1.166207732542904e+00,
+  1.160185125198463e+00, 1.154311536168290e+00, 1.148583835227869e+00, 1.142999004558036e+00,
+  1.137554134407437e+00, 1.132246418968907e+00, 1.127073152458037e+00, 1.122031725382942e+00,
+  1.117119620994918e+00, 1.112334411910329e+00, 1.107673756894685e+00, 1.103135397800388e+00,
+  1.098717156650195e+00, 1.094416932858886e+00, 1.090232700586115e+00, 1.086162506213834e+00,
+  1.082204465942058e+00, 1.078356763497142e+00, 1.074617647947068e+00, 1.070985431618557e+00,
+  1.067458488111151e+00, 1.064035250403667e+00, 1.060714209048713e+00, 1.057493910451191e+00,
+  1.054372955226960e+00, 1.051349996638042e+00, 1.048423739100979e+00, 1.045592936765110e+00,
+  1.042856392157774e+00, 1.040212954893564e+00, 1.037661520444953e+00, 1.035201028971763e+00,
+  1.032830464207083e+00, 1.030548852397393e+00, 1.028355261294763e+00, 1.026248799199141e+00,
+  1.024228614048843e+00, 1.022293892557476e+00, 1.020443859395634e+00, 1.018677776415783e+00,
+  1.016994941918889e+00, 1.015394689961389e+00, 1.013876389701214e+00, 1.012439444781649e+00,
+  1.011083292751900e+00, 1.009807404523297e+00, 1.008611283860154e+00, 1.007494466904350e+00,
+  1.006456521732792e+00, 1.005497047946960e+00, 1.004615676293801e+00, 1.003812068317303e+00,
+  1.003085916040134e+00, 1.002436941674794e+00, 1.001864897363755e+00, 1.001369564948158e+00,
+  1.000950755764649e+00, 1.000608310470007e+00, 1.000342098893267e+00, 1.000152019915069e+00,
+  1.000038001374032e+00, 1.000000000000000e+00, 1.000038001374032e+00
+};
+
+static const double wet_mapping_table[TROPO_MAPPING_N] = {
+  3.951926985083789e+01, 4.210055795012094e+01, 3.951926985083789e+01, 3.393042340184984e+01,
+  2.829519972011180e+01, 2.369245021248482e+01, 2.013835824473481e+01, 1.740329520668958e+01,
+  1.526938222688715e+01, 1.357387135766602e+01, 1.220188781653006e+01, 1.107288240331940e+01,
+  1.012977626814524e+01, 9.331450930799347e+00, 8.647747799923202e+00, 8.056151514441485e+00,
+  7.539569480210692e+00, 7.084823462377186e+00, 6.681607942360985e+00, 6.321758717136083e+00,
+  5.998730958715953e+00, 5.707220976007734e+00, 5.442888126803417e+00, 5.202147586765750e+00,
+  4.982013970863976e+00, 4.779981943806751e+00, 4.593934076329501e+00, 4.422069008451515e+00,
+  4.262844915715921e+00, 4.114934627013151e+00, 3.977189699884522e+00, 3.848611444708732e+00,
+  3.728327385511694e+00, 3.615572008284707e+00, 3.509670916020897e+00, 3.410027709800248e+00,
+  3.316113065824265e+00, 3.227455592539368e+00, 3.143634139346147e+00, 3.064271295695583e+00,
+  2.989027871596026e+00, 2.917598191348797e+00, 2.849706064401712e+00, 2.785101322577496e+00,
+  2.723556833115842e+00, 2.664865913113210e+00, 2.608840083928556e+00, 2.555307114618096e+00,
+  2.504109311985933e+00, 2.455102021792158e+00, 2.408152311359700e+00, 2.363137808512283e+00,
+  2.319945675652137e+00, 2.278471701002082e+00, 2.238619491714323e+00, 2.200299755786205e+00,
+  2.163429661599825e+00, 2.127932265481373e+00, 2.093735999008950e+00, 2.060774208926169e+00,
+  2.028984743477198e+00, 1.998309579795253e+00, 1.968694487673680e+00, 1.940088725645805e+00,
+  1.912444765812349e+00, 1.885718044296434e+00, 1.859866734586965e+00, 1.834851541360444e+00,
+  1.810635512656728e+00, 1.787183868532275e+00, 1.764463844530317e+00, 1.742444548495822e+00,
+  1.721096829427806e+00, 1.700393157205801e+00, 1.680307512153969e+00, 1.660815283517610e+00,
+  1.641893176024939e+00, 1.623519123793513e+00, 1.605672210917186e+00, 1.588332598137186e+00,
+  1.571481455060971e+00, 1.555100897445851e+00, 1.539173929111815e+00, 1.523684388090288e+00,
+  1.508616896653233e+00, 1.493956814900729e+00, 1.479690197615306e+00, 1.465803754118301e+00,
+  1.452284810887776e+00, 1.439121276719253e+00, 1.426301610230138e+00, 1.413814789526307e+00,
+  1.401650283865233e+00, 1.389798027164368e+00, 1.378248393216469e+00, 1.366992172485270e+00,
+  1.356020550365543e+00, 1.345325086801186e+00, 1.334897697163770e+00, 1.324730634301857e+00,
+  1.314816471678676e+00, 1.305148087522278e+00, 1.295718649918309e+00, 1.286521602780994e+00,
+  1.277550652642908e+00, 1.268799756208692e+00, 1.260263108621995e+00, 1.251935132398806e+00,
+  1.243810466983775e+00, 1.235883958889361e+00, 1.228150652380590e+00, 1.220605780670885e+00,
+  1.213244757596946e+00, 1.206063169742915e+00, 1.199056768986186e+00, 1.192221465439148e+00,
+  1.185553320762934e+00, 1.179048541830924e+00, 1.172703474721221e+00, 1.166514599018792e+00,
+  1.160478522409210e+00, 1.154591975547177e+00, 1.148851807184096e+00, 1.143254979540012e+00,
+  1.137798563906196e+00, 1.132479736465517e+00, 1.127295774318607e+00, 1.122244051704550e+00,
+  1.117322036405578e+00, 1.112527286325886e+00, 1.107857446235321e+00, 1.103310244669248e+00,
+  1.098883490976470e+00, 1.094575072507531e+00, 1.090382951936238e+00, 1.086305164707640e+00,
+  1.082339816606144e+00, 1.078485081437781e+00, 1.074739198821046e+00, 1.071100472081007e+00,
+  1.067567266241747e+00, 1.064138006112451e+00, 1.060811174462750e+00, 1.057585310283174e+00,
+  1.054459007126810e+00, 1.051430911528506e+00, 1.048499721498138e+00, 1.045664185084684e+00,
+  1.042923099008040e+00, 1.040275307355661e+00, 1.037719700341312e+00, 1.035255213123342e+00,
+  1.032880824680063e+00, 1.030595556739941e+00, 1.028398472764459e+00, 1.026288676981600e+00,
+  1.024265313468064e+00, 1.022327565278411e+00, 1.020474653619436e+00, 1.018705837068191e+00,
+  1.017020410832164e+00, 1.015417706050205e+00, 1.013897089132888e+00, 1.012457961141081e+00,
+  1.011099757201565e+00, 1.009821945958632e+00, 1.008624029060648e+00, 1.007505540680666e+00,
+  1.006466047070197e+00, 1.005505146145360e+00, 1.004622467104647e+00, 1.003817670077648e+00,
+  1.003090445804088e+00, 1.002440515342624e+00, 1.001867629808889e+00, 1.001371570142310e+00,
+  1.000952146901319e+00, 1.000609200086567e+00, 1.000342598991858e+00, 1.000152242082537e+00,
+  1.000038056901120e+00, 1.000000000000000e+00, 1.000038056901120e+00
+};
+
+/* Catmull-Rom cubic interpolation of a mapping table. */
+static double interp_mapping(const double table[TROPO_MAPPING_N],
+                             u16 i, double t)
+{
+  const double *p = &table[i];
+  return p[1] + 0.5 * t * (p[2] - p[0]
+                + t * (2*p[0] - 5*p[1] + 4*p[2] - p[3]
+                + t * (3*(p[1] - p[2]) + p[3] - p[0])));
+}
+
+/** Troposphere delay for a satellite at a given elevation.
+ * Combines the model's zenith delays with tabulated mapping functions,
+ * avoiding any transcendental function calls. The mapping functions are
+ * those of tropo_correction(), interpolated to better than 1 mm of delay
+ * above 5 degrees elevation.
+ *
+ * \param model     Troposphere model for the receiver.
+ * \param elevation Satellite elevation [rad].
+ * \return Troposphere delay to be subtracted from the pseudorange [m].
+ */
+double tropo_model_correction(const tropo_model_t *model, double elevation)
+{
+  if (elevation < 0)
+    return 0;
+
+  /* Table entry i+1 is at elevation i*TROPO_MAPPING_STEP. */
+  double x = elevation / TROPO_MAPPING_STEP;
+  if (x > TROPO_MAPPING_N - 3) {
+    x = TROPO_MAPPING_N - 3;
+  }
+  u16 i = (u16)x;
+  if (i > TROPO_MAPPING_N - 4) {
+    i = TROPO_MAPPING_N - 4;
+  }
+  double t = x - i;
+
+  return model->zenith_dry * interp_mapping(dry_mapping_table, i, t)
+       + model->zenith_wet * interp_mapping(wet_mapping_table, i, t);
+}
+
+/** Troposphere delays for several satellites.
+ * Equivalent to calling tropo_model_correction() for each elevation.
+ *
+ * \param model      Troposphere model for the receiver.
+ * \param n          Number of satellites.
+ * \param elevation  Elevation of each satellite [rad].
+ * \param correction The delay for each satellite is written here [m].
+ */
+void tropo_model_correction_array(const tropo_model_t *model, u8 n,
+                                  const double elevation[n],
+                                  double correction[n])
+{
+  for (u8 j=0; j<n; j++) {
+    correction[j] = tropo_model_correction(model, elevation[j]);
+  }
+}
@@ -1,9 +1,17 @@
 
+#include <math.h>
+#include <string.h>
 #include <check.h>
 #include <stdio.h>
 #include "amb_kf.h"
 #include "single_diff.h"
 #include "check_utils.h"
+#include "lapack_work.h"
+#include "linear_algebra.h"
+#include "constants.h"
+#include "dd_cov.h"
+
+#include <clapack.h>
 
 START_TEST(test_lsq) {
   sdiff_t sdiffs[5];
@@ -66,12 +74,145 @@ START_TEST(test_lsq) {
 }
 END_TEST
 
+START_TEST(test_lapack_work_size) {
+  /* The fixed workspace must be at least the documented minimum LWORK of
+   * each routine, which LAPACK checks (INFO = -LWORK position) whatever
+   * block size the backend prefers. Run each on random data at the smallest
+   * and largest problem sizes the per-epoch path uses. */
+  seed_rng();
+  integer sizes[] = {4, LAPACK_WORK_MAX_DIM};
+  for (u8 t = 0; t < 2; t++) {
+    integer m = sizes[t], n = 3, one = 1, lwork = LAPACK_WORK_SIZE, info;
+    integer jpvt[3], rank;
+    double A[LAPACK_WORK_MAX_DIM * LAPACK_WORK_MAX_DIM];
+    double B[LAPACK_WORK_MAX_DIM], tau[3], s[3];
+    double rcond = -1;
+    double work[LAPACK_WORK_SIZE];
+
+    for (u32 i = 0; i < (u32)(m * n); i++) {
+      A[i] = frand(-1, 1);
+    }
+    memset(jpvt, 0, sizeof(jpvt));
+    dgeqp3_(&m, &n, A, &m, jpvt, tau, work, &lwork, &info);
+    fail_unless(info == 0, "DGEQP3 m = %d, INFO = %d", (int)m, (int)info);
+    dorgqr_(&m, &m, &n, A, &m, tau, work, &lwork, &info);
+    fail_unless(info == 0, "DORGQR m = %d, INFO = %d", (int)m, (int)info);
+
+    for (u32 i = 0; i < (u32)(m * n); i++) {
+      A[i] = frand(-1, 1);
+    }
+    for (u32 i = 0; i < (u32)m; i++) {
+      B[i] = frand(-1, 1);
+    }
+    dgelss_(&m, &n, &one, A, &m, B, &m, s, &rcond, &rank, work, &lwork,
+            &info);
+    fail_unless(info == 0, "DGELSS m = %d, INFO = %d", (int)m, (int)info);
+
+    for (u32 i = 0; i < (u32)(m * n); i++) {
+      A[i] = frand(-1, 1);
+    }
+    memset(jpvt, 0, sizeof(jpvt));
+    dgelsy_(&m, &n, &one, A, &m, B, &m, jpvt, &rcond, &rank, work, &lwork,
+            &info);
+    fail_unless(info == 0, "DGELSY m = %d, INFO = %d", (int)m, (int)info);
+  }
+}
+END_TEST
+
+START_TEST(test_set_nkf_matrices) {
+  double ref_ecef[3] = {-2704369.0, -4263211.0, 3884038.0};
+  double phase_var = 0.03;
+  double code_var = 2.5;
+  double c = code_var / (GPS_L1_LAMBDA_NO_VAC * GPS_L1_LAMBDA_NO_VAC);
+
+  seed_rng();
+  u8 sizes[] = {2, 4, 5, 9};
+  for (u8 t = 0; t < sizeof(sizes); t++) {
+    u8 num_sdiffs = sizes[t];
+    u8 num_dds = num_sdiffs - 1;
+    u8 q_dim = CLAMP_DIFF(num_dds, 3);
+    u8 res_dim = num_dds + q_dim;
+
+    sdiff_t sdiffs[num_sdiffs];
+    for (u8 i = 0; i < num_sdiffs; i++) {
+      for (u8 j = 0; j < 3; j++) {
+        sdiffs[i].sat_pos[j] = frand(-2.6e7, 2.6e7);
+      }
+    }
+    nkf_t kf;
+    set_nkf_matrices(&kf, phase_var, code_var, num_sdiffs, sdiffs, ref_ecef);
+    fail_unless(kf.obs_dim == res_dim);
+
+    /* Dense residual covariance Sig = H_v * Sig_v * H_v^T, with
+     * H_v = ( Q  0          )  and Sig_v = ( phase_var*K  0      )
+     *       ( I  -I/lambda  )              ( 0            c0*K   ) */
+    u8 dd_dim = 2 * num_dds;
+    double H_v[res_dim * dd_dim];
+    memset(H_v, 0, sizeof(H_v));
+    for (u8 i = 0; i < q_dim; i++) {
+      memcpy(&H_v[i*dd_dim], &kf.null_basis_Q[i*num_dds],
+             num_dds * sizeof(double));
+    }
+    for (u8 i = 0; i < num_dds; i++) {
+      H_v[(q_dim + i)*dd_dim + i] = 1;
+      H_v[(q_dim + i)*dd_dim + num_dds + i] = -1 / GPS_L1_LAMBDA_NO_VAC;
+    }
+    double K[num_dds * num_dds];
+    double Sig_v[dd_dim * dd_dim];
+    memset(Sig_v, 0, sizeof(Sig_v));
+    dd_cov_assign(num_dds, 1, K);
+    for (u8 i = 0; i < num_dds; i++) {
+      for (u8 j = 0; j < num_dds; j++) {
+        Sig_v[i*dd_dim + j] = phase_var * K[i*num_dds + j];
+        Sig_v[(num_dds + i)*dd_dim + num_dds + j] = code_var * K[i*num_dds + j];
+      }
+    }
+    double HS[res_dim * dd_dim], H_v_t[dd_dim * res_dim], Sig[res_dim * res_dim];
+    matrix_multiply(res_dim, dd_dim, dd_dim, H_v, Sig_v, HS);
+    matrix_transpose(res_dim, dd_dim, H_v, H_v_t);
+    matrix_multiply(res_dim, dd_dim, res_dim, HS, H_v_t, Sig);
+
+    /* U^-1 * Sig * U^-T should be diag(D). */
+    double US[res_dim * res_dim], U_inv_t[res_dim * res_dim];
+    double decor[res_dim * res_dim];
+    matrix_multiply(res_dim, res_dim, res_dim, kf.decor_mtx, Sig, US);
+    matrix_transpose(res_dim, res_dim, kf.decor_mtx, U_inv_t);
+    matrix_multiply(res_dim, res_dim, res_dim, US, U_inv_t, decor);
+    for (u8 i = 0; i < res_dim; i++) {
+      fail_unless(kf.decor_mtx[i*res_dim + i] == 1);
+      for (u8 j = 0; j < res_dim; j++) {
+        if (j < i) {
+          fail_unless(kf.decor_mtx[i*res_dim + j] == 0);
+        }
+        double expected = (i == j) ? kf.decor_obs_cov[i] : 0;
+        fail_unless(fabs(decor[i*res_dim + j] - expected) < 1e-9 * (phase_var + c),
+                    "%u sdiffs, element (%u, %u): %g vs %g",
+                    num_sdiffs, i, j, decor[i*res_dim + j], expected);
+      }
+    }
+
+    /* H' should be U^-1 * H, with H = ( Q ; I ). */
+    double H[res_dim * num_dds], H_prime[res_dim * num_dds];
+    memcpy(H, kf.null_basis_Q, q_dim * num_dds * sizeof(double));
+    matrix_eye(num_dds, &H[q_dim * num_dds]);
+    matrix_multiply(res_dim, res_dim, num_dds, kf.decor_mtx, H, H_prime);
+    for (u32 i = 0; i < (u32)res_dim * num_dds; i++) {
+      fail_unless(fabs(kf.decor_obs_mtx[i] - H_prime[i]) < 1e-12,
+                  "%u sdiffs, H' element %u: %g vs %g",
+                  num_sdiffs, i, kf.decor_obs_mtx[i], H_prime[i]);
+    }
+  }
+}
+END_TEST
+
 Suite* amb_kf_test_suite(void)
 {
   Suite *s = suite_create("Ambiguity Kalman Filter");
 
   TCase *tc_core = tcase_create("Core");
   tcase_add_test(tc_core, test_lsq);
+  tcase_add_test(tc_core, test_lapack_work_size);
+  tcase_add_test(tc_core, test_set_nkf_matrices);
   suite_add_tcase(s, tc_core);
 
   return s;
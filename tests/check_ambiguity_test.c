@@ -1,11 +1,14 @@
 #include <check.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <linear_algebra.h>
 #include <ambiguity_test.h>
 #include <printing_utils.h>
+#include <constants.h>
+#include <parallel.h>
 
 #include "check_utils.h"
 
@@ -48,10 +51,8 @@ START_TEST(test_update_sats_rebase)
                        {.prn = 4, .snr = 1}};
   u8 num_sdiffs = 3;
   
-  hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
-  hyp->N[0] = 0;
-  hyp->N[1] = 1;
-  hyp->N[2] = 2;
+  s32 N[3] = {0, 1, 2};
+  hypothesis_store_add(&amb_test.hyps, 3, N, 0);
 
   sats_management_t float_sats = {.num_sats = 3};
 
@@ -60,11 +61,12 @@ START_TEST(test_update_sats_rebase)
   fail_unless(amb_test.sats.prns[0] == 4);
   fail_unless(amb_test.sats.prns[1] == 1);
   fail_unless(amb_test.sats.prns[2] == 2);
-  printf("N0: %i\n", hyp->N[0]);
-  printf("N1: %i\n", hyp->N[1]);
-  printf("N2: %i\n", hyp->N[2]);
-  fail_unless(hyp->N[0] == -2);
-  fail_unless(hyp->N[1] == -1);
+  hypothesis_store_get(&amb_test.hyps, 0, 3, N);
+  printf("N0: %i\n", N[0]);
+  printf("N1: %i\n", N[1]);
+  printf("N2: %i\n", N[2]);
+  fail_unless(N[0] == -2);
+  fail_unless(N[1] == -1);
 }
 END_TEST
 
@@ -82,24 +84,23 @@ START_TEST(test_ambiguity_update_reference)
                        {.prn = 4, .snr = 1}};
   u8 num_sdiffs = 4;
 
+  u8 num_dds = MAX(0,amb_test.sats.num_sats - 1);
   for (u32 i=0; i<3; i++) {
-    hypothesis_t *hyp = (hypothesis_t *)memory_pool_add(amb_test.pool);
-    fail_unless(hyp != 0, "Null pointer returned by memory_pool_add");
-    for (u8 j=0; j<amb_test.sats.num_sats-1; j++) {
-      hyp->N[j] = sizerand(5);
+    s32 N[MAX_CHANNELS-1];
+    for (u8 j=0; j<num_dds; j++) {
+      N[j] = sizerand(5);
     }
-    hyp->ll = frand(0, 1);
+    s32 ndx = hypothesis_store_add(&amb_test.hyps, num_dds, N, frand(0, 1));
+    fail_unless(ndx >= 0, "Hypothesis store full");
   }
-
-  u8 num_dds = MAX(0,amb_test.sats.num_sats - 1);
   printf("Before rebase:\n");
-  memory_pool_map(amb_test.pool, &num_dds, &print_hyp);
+  print_hypothesis_store(num_dds, &amb_test.hyps);
 
   sdiff_t sdiffs_with_ref_first[4];
   ambiguity_update_reference(&amb_test, num_sdiffs, sdiffs, sdiffs_with_ref_first);
 
   printf("After rebase:\n");
-  memory_pool_map(amb_test.pool, &num_dds, &print_hyp);
+  print_hypothesis_store(num_dds, &amb_test.hyps);
 }
 END_TEST
 
@@ -198,24 +199,24 @@ START_TEST(test_amb_sat_inclusion)
 
   u16 pool_size;
   u8 flag;
-  pool_size = memory_pool_n_allocated(amb_test.pool);
+  pool_size = ambiguity_test_n_hypotheses(&amb_test);
   printf("pool size before: %i\n", pool_size);
   /* Include. This one should succeed. */
   flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
   printf("inclusion return code: %i\n", flag);
-  pool_size = memory_pool_n_allocated(amb_test.pool);
+  pool_size = ambiguity_test_n_hypotheses(&amb_test);
   printf("pool size after 1: %i\n", pool_size);
   fail_unless(flag == 1);
   /* Include again. This one should succeed. */
   flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
   printf("inclusion return code: %i\n", flag);
-  pool_size = memory_pool_n_allocated(amb_test.pool);
+  pool_size = ambiguity_test_n_hypotheses(&amb_test);
   printf("pool size after 2: %i\n", pool_size);
   fail_unless(flag == 1);
   /* Include again. This one should fail due to high covariance. */
   flag = ambiguity_sat_inclusion(&amb_test, 0, &float_sats, mean, u, d);
   printf("inclusion return code: %i\n", flag);
-  pool_size = memory_pool_n_allocated(amb_test.pool);
+  pool_size = ambiguity_test_n_hypotheses(&amb_test);
   printf("pool size after 3: %i\n", pool_size);
   fail_unless(flag == 0);
 
@@ -224,6 +225,747 @@ START_TEST(test_amb_sat_inclusion)
 }
 END_TEST
 
+/* The batched expansion of the quadratic term should agree with the direct
+ * evaluation for hypotheses around the one it is expanded about. */
+START_TEST(test_quadratic_terms_batch)
+{
+  srand(11);
+  for (u32 epoch = 0; epoch < 20; epoch++) {
+    u8 num_dds = 4 + epoch % 7;
+    double DE[num_dds * 3];
+    for (u8 i = 0; i < num_dds * 3; i++) {
+      DE[i] = frand(-1, 1);
+    }
+    double obs_cov[4 * num_dds * num_dds];
+    memset(obs_cov, 0, sizeof(obs_cov));
+    for (u8 i = 0; i < num_dds; i++) {
+      for (u8 j = 0; j < num_dds; j++) {
+        obs_cov[i*2*num_dds + j] = 9e-4 * 16 * (i == j ? 2 : 1);
+        obs_cov[(i+num_dds)*2*num_dds + j+num_dds] = 100 * 400 * (i == j ? 2 : 1);
+      }
+    }
+    residual_mtxs_t res_mtxs;
+    init_residual_matrices(&res_mtxs, num_dds, DE, obs_cov);
+
+    double b[3] = {frand(-10, 10), frand(-10, 10), frand(-10, 10)};
+    s32 N_true[num_dds];
+    double dd_meas[2 * num_dds];
+    for (u8 i = 0; i < num_dds; i++) {
+      N_true[i] = round(frand(-1e6, 1e6));
+      double range = DE[3*i]*b[0] + DE[3*i+1]*b[1] + DE[3*i+2]*b[2];
+      dd_meas[i] = range / GPS_L1_LAMBDA_NO_VAC + N_true[i] + frand(-0.05, 0.05);
+      dd_meas[i+num_dds] = range + frand(-2, 2);
+    }
+    double r_vec[res_mtxs.res_dim];
+    assign_r_vec(&res_mtxs, num_dds, dd_meas, r_vec);
+
+    /* 150 hypotheses in store layout, more than one block. */
+    u32 n = 150;
+    u32 stride = 152;
+    s32 N[num_dds * stride];
+    for (u32 h = 0; h < n; h++) {
+      for (u8 k = 0; k < num_dds; k++) {
+        N[k*stride + h] = N_true[k] + (h == 0 ? 0 : rand() % 7 - 3);
+      }
+    }
+
+    /* Expand about a hypothesis that isn't the true one. */
+    s32 N0[num_dds];
+    for (u8 k = 0; k < num_dds; k++) {
+      N0[k] = N[k*stride + 1];
+    }
+    quadratic_expansion_t qe;
+    expand_quadratic_term(&res_mtxs, num_dds, N0, r_vec, &qe);
+    float q_batch[n];
+    get_quadratic_terms(&qe, n, N, stride, q_batch);
+
+    for (u32 h = 0; h < n; h++) {
+      double hyp[num_dds];
+      for (u8 k = 0; k < num_dds; k++) {
+        hyp[k] = N[k*stride + h];
+      }
+      double q = get_quadratic_term(&res_mtxs, num_dds, hyp, r_vec);
+      fail_unless(fabs(q_batch[h] - q) <= 1e-4 * fabs(q) + 1e-2,
+                  "Batched quadratic term differs from direct evaluation "
+                  "(dim %u, hyp %u): %f vs %f",
+                  num_dds, h, q_batch[h], q);
+    }
+  }
+}
+END_TEST
+
+/* Accuracy harness for the single precision likelihood path. A recorded
+ * sequence of epochs is replayed through test_ambiguities(), which evaluates
+ * the hypotheses from the float expansion, and through a double precision
+ * reference using get_quadratic_term(). Both must keep the same hypotheses,
+ * other than ones within a whisker of a threshold, with the same MLE and log
+ * likelihoods. */
+#define ACCURACY_EPOCHS 60
+#define ACCURACY_LL_TOL 1e-3
+START_TEST(test_quadratic_terms_accuracy)
+{
+  srand(29);
+  const u8 num_dds = 6;
+  const double phase_var = 9e-4 * 16, code_var = 100 * 400;
+  double obs_cov[4 * num_dds * num_dds];
+  memset(obs_cov, 0, sizeof(obs_cov));
+  for (u8 i = 0; i < num_dds; i++) {
+    for (u8 j = 0; j < num_dds; j++) {
+      obs_cov[i*2*num_dds + j] = phase_var * (i == j ? 2 : 1);
+      obs_cov[(i+num_dds)*2*num_dds + j+num_dds] = code_var * (i == j ? 2 : 1);
+    }
+  }
+
+  /* Record the epochs: slowly moving geometry, a static baseline and
+   * measurement noise. */
+  static double DE[ACCURACY_EPOCHS][3 * (MAX_CHANNELS-1)];
+  static double dd_meas[ACCURACY_EPOCHS][2 * (MAX_CHANNELS-1)];
+  double DE_rate[num_dds * 3];
+  for (u8 i = 0; i < num_dds * 3; i++) {
+    DE[0][i] = frand(-1, 1);
+    DE_rate[i] = frand(-2e-3, 2e-3);
+  }
+  double b[3] = {5.3, -12.1, 2.4};
+  s32 N_true[num_dds];
+  for (u8 i = 0; i < num_dds; i++) {
+    N_true[i] = round(frand(-1e6, 1e6));
+  }
+  for (u32 e = 0; e < ACCURACY_EPOCHS; e++) {
+    for (u8 i = 0; i < num_dds * 3; i++) {
+      DE[e][i] = e == 0 ? DE[0][i] : DE[e-1][i] + DE_rate[i];
+    }
+    for (u8 i = 0; i < num_dds; i++) {
+      double range = DE[e][3*i]*b[0] + DE[e][3*i+1]*b[1] + DE[e][3*i+2]*b[2];
+      dd_meas[e][i] = range / GPS_L1_LAMBDA_NO_VAC + N_true[i]
+                      + frand(-0.05, 0.05);
+      dd_meas[e][i+num_dds] = range + frand(-2, 2);
+    }
+  }
+
+  /* Every hypothesis within a cycle of the truth. */
+  u32 n = 1;
+  for (u8 i = 0; i < num_dds; i++) {
+    n *= 3;
+  }
+  ambiguity_test_t amb_test;
+  create_ambiguity_test(&amb_test);
+  amb_test.sats.num_sats = num_dds + 1;
+  hypothesis_store_clear(&amb_test.hyps);
+  s32 *N = malloc(n * num_dds * sizeof(s32));
+  double *ll = malloc(n * sizeof(double));
+  u8 *alive = malloc(n);
+  for (u32 h = 0; h < n; h++) {
+    u32 q = h;
+    for (u8 k = 0; k < num_dds; k++) {
+      N[h*num_dds + k] = N_true[k] + (s32)(q % 3) - 1;
+      q /= 3;
+    }
+    ll[h] = 0;
+    alive[h] = 1;
+    hypothesis_store_add(&amb_test.hyps, num_dds, &N[h*num_dds], 0);
+  }
+
+  double max_ll_err = 0;
+  u32 n_borderline = 0;
+  for (u32 e = 0; e < ACCURACY_EPOCHS; e++) {
+    init_residual_matrices(&amb_test.res_mtxs, num_dds, DE[e], obs_cov);
+    test_ambiguities(&amb_test, dd_meas[e]);
+
+    /* Double precision reference over the hypotheses still in the store. */
+    double r_vec[amb_test.res_mtxs.res_dim];
+    assign_r_vec(&amb_test.res_mtxs, num_dds, dd_meas[e], r_vec);
+    double q[n];
+    double max_ll = -1e20;
+    for (u32 h = 0; h < n; h++) {
+      if (!alive[h]) {
+        continue;
+      }
+      double hyp[num_dds];
+      for (u8 k = 0; k < num_dds; k++) {
+        hyp[k] = N[h*num_dds + k];
+      }
+      q[h] = get_quadratic_term(&amb_test.res_mtxs, num_dds, hyp, r_vec);
+      ll[h] += q[h];
+      max_ll = MAX(max_ll, ll[h]);
+    }
+
+    /* Both keep their hypotheses in order, walk them together. */
+    u32 j = 0, mle = 0;
+    double mle_ll = -1e20;
+    for (u32 h = 0; h < n; h++) {
+      if (!alive[h]) {
+        continue;
+      }
+      ll[h] -= max_ll;
+      u8 keep = fabs(q[h]) < 20 && ll[h] > -90;
+      u8 kept = 0;
+      if (j < amb_test.hyps.n) {
+        s32 N_j[num_dds];
+        hypothesis_store_get(&amb_test.hyps, j, num_dds, N_j);
+        kept = memcmp(N_j, &N[h*num_dds], sizeof(N_j)) == 0;
+      }
+      if (keep != kept) {
+        fail_unless(fabs(fabs(q[h]) - 20) < ACCURACY_LL_TOL ||
+                    fabs(ll[h] + 90) < ACCURACY_LL_TOL,
+                    "Epoch %u hypothesis %u %s by the float path only, "
+                    "q %f, ll %f", e, h, kept ? "kept" : "dropped",
+                    q[h], ll[h]);
+        n_borderline++;
+      }
+      if (kept) {
+        max_ll_err = MAX(max_ll_err, fabs(amb_test.hyps.ll[j] - ll[h]));
+        /* Follow the float path so later epochs compare like with like. */
+        ll[h] = amb_test.hyps.ll[j];
+        if (ll[h] > mle_ll) {
+          mle_ll = ll[h];
+          mle = h;
+        }
+        j++;
+      } else {
+        alive[h] = 0;
+      }
+    }
+    fail_unless(j == amb_test.hyps.n, "Epoch %u: %u of %u hypotheses matched",
+                e, j, amb_test.hyps.n);
+
+    s32 N_mle[num_dds];
+    ambiguity_test_MLE_ambs(&amb_test, N_mle);
+    fail_unless(memcmp(N_mle, &N[mle*num_dds], sizeof(N_mle)) == 0,
+                "Epoch %u: MLE differs", e);
+  }
+
+  fail_unless(max_ll_err < ACCURACY_LL_TOL,
+              "Log likelihoods differ by up to %g", max_ll_err);
+  fail_unless(n_borderline <= 2, "%u borderline decisions", n_borderline);
+  /* The run should have narrowed the pool down to the truth. */
+  fail_unless(amb_test.hyps.n < n / 10, "%u hypotheses left", amb_test.hyps.n);
+  s32 N_mle[num_dds];
+  ambiguity_test_MLE_ambs(&amb_test, N_mle);
+  fail_unless(memcmp(N_mle, N_true, sizeof(N_mle)) == 0);
+
+  free(N);
+  free(ll);
+  free(alive);
+  destroy_ambiguity_test(&amb_test);
+}
+END_TEST
+
+START_TEST(test_ambiguity_test_max_hypotheses)
+{
+  ambiguity_test_t amb_test;
+  create_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_test_max_hypotheses() == MAX_HYPOTHESES);
+
+  u8 num_dds = 5;
+  hypothesis_store_clear(&amb_test.hyps);
+  for (u32 i = 0; i < 10; i++) {
+    s32 N[5] = {i, 2*i, 3*i, 4*i, 5*i};
+    hypothesis_store_add(&amb_test.hyps, num_dds, N, -(float)i);
+  }
+
+  /* Can't go below the number of hypotheses we have. */
+  fail_unless(ambiguity_test_set_max_hypotheses(&amb_test, 5) == -1);
+
+  /* Growing keeps the hypotheses. */
+  u32 big = 20 * MAX_HYPOTHESES;
+  fail_unless(ambiguity_test_set_max_hypotheses(&amb_test, big) == 0);
+  fail_unless(ambiguity_test_max_hypotheses() == big);
+  fail_unless(amb_test.hyps.capacity == big);
+  fail_unless(ambiguity_test_n_hypotheses(&amb_test) == 10);
+  for (u32 i = 0; i < 10; i++) {
+    s32 N[5];
+    hypothesis_store_get(&amb_test.hyps, i, num_dds, N);
+    fail_unless(N[0] == (s32)i && N[4] == (s32)(5*i),
+                "Hypothesis %u changed when growing", i);
+    fail_unless(amb_test.hyps.ll[i] == -(float)i);
+  }
+  s32 N[5] = {0};
+  while (amb_test.hyps.n < big) {
+    fail_unless(hypothesis_store_add(&amb_test.hyps, num_dds, N, 0) >= 0);
+  }
+
+  /* Recreating the test keeps the capacity. */
+  create_ambiguity_test(&amb_test);
+  fail_unless(amb_test.hyps.capacity == big);
+
+  /* Memory budget. */
+  size_t bytes = ambiguity_test_memory_required(3000) + 10;
+  fail_unless(ambiguity_test_set_memory_budget(&amb_test, bytes) == 0);
+  fail_unless(ambiguity_test_max_hypotheses() == 3000);
+
+  /* Without a time measurement a time budget doesn't limit anything. */
+  ambiguity_test_set_time_budget(1e-3);
+  fail_unless(ambiguity_test_max_hypotheses() == 3000);
+  ambiguity_test_set_time_budget(0);
+
+  /* Back to the static default. */
+  destroy_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_test_max_hypotheses() == MAX_HYPOTHESES);
+  create_ambiguity_test(&amb_test);
+  fail_unless(amb_test.hyps.capacity == MAX_HYPOTHESES);
+}
+END_TEST
+
+/* Testing hypotheses in one pass gives the same result as updating,
+ * filtering and renormalizing separately, and splitting them over several
+ * threads gives the same result as testing them on one. */
+START_TEST(test_test_ambiguities_parallel)
+{
+  srand(5);
+  u8 num_dds = 6;
+  u32 n = 4000;
+  double DE[num_dds * 3];
+  for (u8 i = 0; i < num_dds * 3; i++) {
+    DE[i] = frand(-1, 1);
+  }
+  double obs_cov[4 * num_dds * num_dds];
+  memset(obs_cov, 0, sizeof(obs_cov));
+  for (u8 i = 0; i < num_dds; i++) {
+    for (u8 j = 0; j < num_dds; j++) {
+      obs_cov[i*2*num_dds + j] = 9e-4 * 16 * (i == j ? 2 : 1);
+      obs_cov[(i+num_dds)*2*num_dds + j+num_dds] = 100 * 400 * (i == j ? 2 : 1);
+    }
+  }
+
+  ambiguity_test_t amb_test;
+  create_ambiguity_test(&amb_test);
+  fail_unless(ambiguity_test_set_max_hypotheses(&amb_test, n) == 0);
+  amb_test.sats.num_sats = num_dds + 1;
+  init_residual_matrices(&amb_test.res_mtxs, num_dds, DE, obs_cov);
+
+  double b[3] = {1.2, -3.4, 0.7};
+  s32 N_true[num_dds];
+  double dd_meas[2 * num_dds];
+  for (u8 i = 0; i < num_dds; i++) {
+    N_true[i] = 100 * i - 250;
+    double range = DE[3*i]*b[0] + DE[3*i+1]*b[1] + DE[3*i+2]*b[2];
+    dd_meas[i] = range / GPS_L1_LAMBDA_NO_VAC + N_true[i] + frand(-0.05, 0.05);
+    dd_meas[i+num_dds] = range + frand(-2, 2);
+  }
+
+  /* The first ambiguity is the same for every hypothesis, some hypotheses are
+   * far enough off to be rejected by the single observation test and some
+   * have log likelihoods low enough to be filtered. */
+  s32 *N_in = malloc(n * num_dds * sizeof(s32));
+  float *ll_in = malloc(n * sizeof(float));
+  for (u32 h = 0; h < n; h++) {
+    for (u8 k = 0; k < num_dds; k++) {
+      N_in[h*num_dds + k] = N_true[k] + (h == 0 || k == 0 ? 0 : rand() % 3 - 1);
+    }
+    ll_in[h] = frand(-100, 0);
+  }
+
+  u32 n_out[2];
+  s32 *N_out[2];
+  float *ll_out[2];
+  unanimous_amb_check_t check_out[2];
+  u8 threads[2] = {1, 4};
+  for (u8 t = 0; t < 2; t++) {
+    fail_unless(parallel_init(threads[t]) == 0);
+    hypothesis_store_clear(&amb_test.hyps);
+    for (u32 h = 0; h < n; h++) {
+      hypothesis_store_add(&amb_test.hyps, num_dds, &N_in[h*num_dds], ll_in[h]);
+    }
+    test_ambiguities(&amb_test, dd_meas);
+
+    /* Unanimous ambiguities found while testing match a separate check. */
+    unanimous_amb_check_t fused = amb_test.amb_check;
+    update_unanimous_ambiguities(&amb_test);
+    fail_unless(fused.initialized && amb_test.amb_check.initialized);
+    fail_unless(fused.num_matching_ndxs == amb_test.amb_check.num_matching_ndxs);
+    for (u8 k = 0; k < fused.num_matching_ndxs; k++) {
+      fail_unless(fused.matching_ndxs[k] == amb_test.amb_check.matching_ndxs[k]);
+      fail_unless(fused.ambs[k] == amb_test.amb_check.ambs[k]);
+    }
+
+    /* The hash index and MLE are up to date after filtering. */
+    fail_unless(amb_test.hyps.indexed && amb_test.hyps.index_dds == num_dds);
+    u32 mle = 0;
+    for (u32 h = 0; h < amb_test.hyps.n; h++) {
+      if (amb_test.hyps.ll[h] > amb_test.hyps.ll[mle]) {
+        mle = h;
+      }
+      s32 N[num_dds];
+      double ambs[num_dds];
+      hypothesis_store_get(&amb_test.hyps, h, num_dds, N);
+      for (u8 k = 0; k < num_dds; k++) {
+        ambs[k] = N[k];
+      }
+      fail_unless(ambiguity_test_pool_contains(&amb_test, ambs));
+    }
+    s32 N_mle[num_dds], N_mle_ref[num_dds];
+    ambiguity_test_MLE_ambs(&amb_test, N_mle);
+    hypothesis_store_get(&amb_test.hyps, mle, num_dds, N_mle_ref);
+    fail_unless(memcmp(N_mle, N_mle_ref, sizeof(N_mle)) == 0);
+    double far_ambs[num_dds];
+    for (u8 k = 0; k < num_dds; k++) {
+      far_ambs[k] = N_true[k] + 10;
+    }
+    fail_unless(!ambiguity_test_pool_contains(&amb_test, far_ambs));
+
+    n_out[t] = amb_test.hyps.n;
+    N_out[t] = malloc(n_out[t] * num_dds * sizeof(s32));
+    ll_out[t] = malloc(n_out[t] * sizeof(float));
+    for (u32 h = 0; h < n_out[t]; h++) {
+      hypothesis_store_get(&amb_test.hyps, h, num_dds, &N_out[t][h*num_dds]);
+      ll_out[t][h] = amb_test.hyps.ll[h];
+    }
+    check_out[t] = amb_test.amb_check;
+  }
+  parallel_deinit();
+
+  fail_unless(n_out[0] > 0 && n_out[0] < n,
+              "Expected some but not all hypotheses to be filtered, %u left",
+              n_out[0]);
+  /* Reference: update every hypothesis, then filter, then renormalize. */
+  double r_vec[amb_test.res_mtxs.res_dim];
+  assign_r_vec(&amb_test.res_mtxs, num_dds, dd_meas, r_vec);
+  s32 N0[num_dds];
+  memcpy(N0, N_in, sizeof(N0));
+  quadratic_expansion_t qe;
+  expand_quadratic_term(&amb_test.res_mtxs, num_dds, N0, r_vec, &qe);
+  u32 n_ref = 0;
+  double max_ll = -1e20;
+  float ll_ref[n];
+  for (u32 h = 0; h < n; h++) {
+    float q;
+    get_quadratic_terms(&qe, 1, &N_in[h*num_dds], 1, &q);
+    float ll = ll_in[h] + q;
+    max_ll = MAX(max_ll, ll);
+    ll_ref[h] = (fabsf(q) < 20 && ll > -90) ? ll : NAN;
+  }
+  for (u32 h = 0; h < n; h++) {
+    if (isnan(ll_ref[h])) {
+      continue;
+    }
+    fail_unless(n_ref < n_out[0] &&
+                memcmp(&N_out[0][n_ref*num_dds], &N_in[h*num_dds],
+                       num_dds * sizeof(s32)) == 0,
+                "Hypothesis %u missing or out of order", h);
+    fail_unless(ll_out[0][n_ref] == (float)(ll_ref[h] - max_ll),
+                "Hypothesis %u log likelihood %f, expected %f",
+                h, ll_out[0][n_ref], (float)(ll_ref[h] - max_ll));
+    n_ref++;
+  }
+  fail_unless(n_ref == n_out[0]);
+
+  fail_unless(n_out[0] == n_out[1],
+              "Number of hypotheses differs: %u vs %u", n_out[0], n_out[1]);
+  fail_unless(memcmp(N_out[0], N_out[1], n_out[0] * num_dds * sizeof(s32)) == 0,
+              "Hypotheses differ");
+  fail_unless(memcmp(ll_out[0], ll_out[1], n_out[0] * sizeof(float)) == 0,
+              "Log likelihoods differ");
+  fail_unless(check_out[0].num_matching_ndxs == check_out[1].num_matching_ndxs);
+  fail_unless(check_out[1].num_matching_ndxs >= 1 &&
+              check_out[1].matching_ndxs[0] == 0 &&
+              check_out[1].ambs[0] == N_true[0]);
+
+  for (u8 t = 0; t < 2; t++) {
+    free(N_out[t]);
+    free(ll_out[t]);
+  }
+  free(N_in);
+  free(ll_in);
+  destroy_ambiguity_test(&amb_test);
+}
+END_TEST
+
+/* Unanimous ambiguities are combined correctly across chunks. */
+START_TEST(test_unanimous_ambs_parallel)
+{
+  ambiguity_test_t amb_test;
+  create_ambiguity_test(&amb_test);
+  u32 n = 3000;
+  fail_unless(ambiguity_test_set_max_hypotheses(&amb_test, n) == 0);
+  amb_test.sats.num_sats = 4;
+  hypothesis_store_clear(&amb_test.hyps);
+
+  /* Ambiguity 0 is unanimous, ambiguity 1 is unanimous within each half but
+   * not overall and ambiguity 2 only differs in the last hypothesis. */
+  for (u32 h = 0; h < n; h++) {
+    s32 N[3] = {7, h < n / 2 ? 1 : 2, h == n - 1 ? 4 : 3};
+    hypothesis_store_add(&amb_test.hyps, 3, N, 0);
+  }
+
+  fail_unless(parallel_init(4) == 0);
+  update_unanimous_ambiguities(&amb_test);
+  parallel_deinit();
+
+  fail_unless(amb_test.amb_check.initialized);
+  fail_unless(amb_test.amb_check.num_matching_ndxs == 1,
+              "Expected one unanimous ambiguity, got %u",
+              amb_test.amb_check.num_matching_ndxs);
+  fail_unless(amb_test.amb_check.matching_ndxs[0] == 0);
+  fail_unless(amb_test.amb_check.ambs[0] == 7);
+  destroy_ambiguity_test(&amb_test);
+}
+END_TEST
+
+
+/* The pruned intersection count agrees with testing every point. */
+START_TEST(test_count_intersection)
+{
+  srand(3);
+  ambiguity_test_t amb_test;
+  create_ambiguity_test(&amb_test);
+
+  for (u32 trial = 0; trial < 50; trial++) {
+    u8 old_dim = rand() % 3;
+    u8 new_dim = 1 + rand() % 3;
+    u8 full_dim = old_dim + new_dim;
+
+    z_t Z1[full_dim * full_dim];
+    z_t Z2_inv[new_dim * new_dim];
+    for (u8 i = 0; i < full_dim * full_dim; i++) {
+      Z1[i] = rand() % 5 - 2;
+    }
+    for (u8 i = 0; i < new_dim * new_dim; i++) {
+      Z2_inv[i] = rand() % 5 - 2;
+    }
+    /* Z maps the new counter into V1, i.e. the new columns of Z1 * Z2_inv. */
+    z_t Z[full_dim * new_dim];
+    for (u8 i = 0; i < full_dim; i++) {
+      for (u8 j = 0; j < new_dim; j++) {
+        Z[i*new_dim + j] = 0;
+        for (u8 k = 0; k < new_dim; k++) {
+          Z[i*new_dim + j] += Z1[i*full_dim + old_dim + k] * Z2_inv[k*new_dim + j];
+        }
+      }
+    }
+
+    s32 itr_lo[new_dim], itr_hi[new_dim];
+    for (u8 i = 0; i < new_dim; i++) {
+      itr_lo[i] = rand() % 7 - 5;
+      itr_hi[i] = itr_lo[i] + rand() % 6;
+    }
+    s32 box_lo[full_dim], box_hi[full_dim];
+    for (u8 i = 0; i < full_dim; i++) {
+      box_lo[i] = rand() % 11 - 8;
+      box_hi[i] = box_lo[i] + rand() % 10;
+    }
+
+    hypothesis_store_clear(&amb_test.hyps);
+    u32 n_hyps = 1 + rand() % 20;
+    for (u32 h = 0; h < n_hyps; h++) {
+      s32 N[3] = {rand() % 7 - 3, rand() % 7 - 3, rand() % 7 - 3};
+      hypothesis_store_add(&amb_test.hyps, old_dim, N, 0);
+    }
+
+    /* Brute force: map every point of every hypothesis and test it. */
+    u32 expected = 0;
+    for (u32 h = 0; h < n_hyps; h++) {
+      s32 c[new_dim];
+      memcpy(c, itr_lo, sizeof(c));
+      while (1) {
+        s32 v[full_dim];
+        hypothesis_store_get(&amb_test.hyps, h, old_dim, v);
+        for (u8 i = 0; i < new_dim; i++) {
+          v[old_dim + i] = 0;
+          for (u8 j = 0; j < new_dim; j++) {
+            v[old_dim + i] += Z2_inv[i*new_dim + j] * c[j];
+          }
+        }
+        u8 in = 1;
+        for (u8 i = 0; i < full_dim; i++) {
+          s32 z = 0;
+          for (u8 j = 0; j < full_dim; j++) {
+            z += Z1[i*full_dim + j] * v[j];
+          }
+          in &= (z >= box_lo[i] && z <= box_hi[i]);
+        }
+        expected += in;
+        u8 k = 0;
+        while (k < new_dim && c[k] == itr_hi[k]) {
+          c[k] = itr_lo[k];
+          k++;
+        }
+        if (k == new_dim) {
+          break;
+        }
+        c[k]++;
+      }
+    }
+
+    s32 counter[new_dim];
+    z_t zimage[full_dim];
+    intersection_count_t x = {
+      .Z = Z, .Z1 = Z1, .Z2_inv = Z2_inv,
+      .counter = counter, .zimage = zimage,
+      .new_dim = new_dim, .old_dim = old_dim,
+      .itr_lower_bounds = itr_lo, .itr_upper_bounds = itr_hi,
+      .box_lower_bounds = box_lo, .box_upper_bounds = box_hi,
+    };
+    fail_unless(count_intersection(&x, &amb_test.hyps, 1000000, 1000000) == 1);
+    fail_unless(x.intersection_size == expected,
+                "Trial %u: counted %u, expected %u",
+                trial, x.intersection_size, expected);
+    if (expected > 0) {
+      /* Stops once the limit is reached. */
+      fail_unless(count_intersection(&x, &amb_test.hyps, expected, 1000000) == 0);
+      fail_unless(count_intersection(&x, &amb_test.hyps, expected + 1, 1000000) == 1);
+    }
+  }
+
+  /* A box of 64^6 = 2^36 rows must hit the iteration limit rather than wrap
+   * around it and then visit every row. */
+  {
+    const u8 new_dim = 7;
+    z_t I[new_dim * new_dim];
+    for (u8 i = 0; i < new_dim * new_dim; i++) {
+      I[i] = (i % (new_dim + 1)) == 0;
+    }
+    s32 itr_lo[new_dim], itr_hi[new_dim], box_lo[new_dim], box_hi[new_dim];
+    for (u8 i = 0; i < new_dim; i++) {
+      itr_lo[i] = 0;
+      itr_hi[i] = 63;
+      box_lo[i] = -1000;
+      box_hi[i] = 1000;
+    }
+    hypothesis_store_clear(&amb_test.hyps);
+    hypothesis_store_add(&amb_test.hyps, 0, NULL, 0);
+    s32 counter[new_dim];
+    z_t zimage[new_dim];
+    intersection_count_t x = {
+      .Z = I, .Z1 = I, .Z2_inv = I,
+      .counter = counter, .zimage = zimage,
+      .new_dim = new_dim, .old_dim = 0,
+      .itr_lower_bounds = itr_lo, .itr_upper_bounds = itr_hi,
+      .box_lower_bounds = box_lo, .box_upper_bounds = box_hi,
+    };
+    fail_unless(count_intersection(&x, &amb_test.hyps, UINT32_MAX, 10000) == 0);
+    fail_unless(x.intersection_size == 0);
+  }
+  destroy_ambiguity_test(&amb_test);
+}
+END_TEST
+
+/* The structured residual matrices agree with the general ones, and are
+ * only rebuilt when something changes. */
+START_TEST(test_residual_matrices_dd)
+{
+  srand(17);
+  /* IAR needs at least four DDs. */
+  for (u8 num_dds = 4; num_dds < MAX_CHANNELS; num_dds++) {
+    double DE[num_dds * 3];
+    for (u8 i = 0; i < num_dds * 3; i++) {
+      DE[i] = frand(-1, 1);
+    }
+    double phase_var = frand(1e-4, 1e-2);
+    double code_var = frand(1, 1e3);
+    double obs_cov[4 * num_dds * num_dds];
+    memset(obs_cov, 0, sizeof(obs_cov));
+    for (u8 i = 0; i < num_dds; i++) {
+      for (u8 j = 0; j < num_dds; j++) {
+        obs_cov[i*2*num_dds + j] = phase_var * (i == j ? 2 : 1);
+        obs_cov[(i+num_dds)*2*num_dds + j+num_dds] = code_var * (i == j ? 2 : 1);
+      }
+    }
+
+    residual_mtxs_t general, dd;
+    double b[3] = {1, -2, 0.5};
+    init_residual_matrices(&general, num_dds, DE, obs_cov);
+    dd.dd_num_dds = 0;
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, code_var, 0) == 1);
+
+    u32 res_dim = general.res_dim;
+    fail_unless(dd.res_dim == res_dim);
+    double max_abs = 0;
+    for (u32 i = 0; i < res_dim * res_dim; i++) {
+      max_abs = MAX(max_abs, fabs(general.half_res_cov_inv[i]));
+    }
+    for (u32 i = 0; i < res_dim * res_dim; i++) {
+      fail_unless(fabs(general.half_res_cov_inv[i] - dd.half_res_cov_inv[i])
+                    <= 1e-9 * max_abs,
+                  "Inverse covariance differs (dim %u, elem %u): %g vs %g",
+                  num_dds, i, general.half_res_cov_inv[i], dd.half_res_cov_inv[i]);
+    }
+    for (u32 i = 0; i < num_dds * num_dds; i++) {
+      fail_unless(fabs(general.amb_quad[i] - dd.amb_quad[i])
+                    <= 1e-9 * fabs(general.amb_quad[i]) + 1e-9 * max_abs);
+    }
+
+    /* Nothing changed, or the geometry moved too little to matter. */
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, code_var, 0) == 0);
+    DE[0] += 1e-9;
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, code_var, 0) == 0);
+    /* But it is rebuilt when the geometry, variances or satellites change.
+     * This moves the first phase residual by 1 mm. */
+    DE[0] += 1e-3;
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, code_var, 0) == 1);
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, 2 * code_var, 0) == 1);
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, 2 * code_var, 1) == 1);
+    /* Using the general version invalidates the cache. */
+    init_residual_matrices(&dd, num_dds, DE, obs_cov);
+    fail_unless(update_residual_matrices(&dd, num_dds, DE, b, phase_var, 2 * code_var, 0) == 1);
+  }
+}
+END_TEST
+
+/* With line of sight vectors drifting at a realistic rate the cached
+ * residual matrices are reused for many epochs on a short baseline, and the
+ * log likelihood ratios they give stay within the tolerance of those from
+ * freshly built matrices. */
+START_TEST(test_residual_matrices_drift)
+{
+  srand(23);
+  const u8 num_dds = 7;
+  const double phase_var = 9e-4 * 16;
+  const double code_var = 100 * 400;
+  const double b[3] = {0.6, -0.5, 0.4};
+  const double dt = 0.1;
+
+  /* Line of sight rates of around 1e-4 per second. */
+  double DE[num_dds * 3], DE_rate[num_dds * 3];
+  for (u8 i = 0; i < num_dds * 3; i++) {
+    DE[i] = frand(-1, 1);
+    DE_rate[i] = frand(-1e-4, 1e-4);
+  }
+  double N[num_dds];
+  for (u8 i = 0; i < num_dds; i++) {
+    N[i] = round(frand(-1e3, 1e3));
+  }
+
+  residual_mtxs_t cached, fresh;
+  cached.dd_num_dds = 0;
+  u32 n_epochs = 100, n_rebuilds = 0;
+  double max_err = 0;
+  for (u32 epoch = 0; epoch < n_epochs; epoch++) {
+    for (u8 i = 0; i < num_dds * 3; i++) {
+      DE[i] += DE_rate[i] * dt;
+    }
+    n_rebuilds += update_residual_matrices(&cached, num_dds, DE, b,
+                                           phase_var, code_var, 0);
+    init_residual_matrices_dd(&fresh, num_dds, DE, phase_var, code_var);
+
+    double dd_meas[2 * num_dds];
+    for (u8 i = 0; i < num_dds; i++) {
+      double range = DE[3*i]*b[0] + DE[3*i+1]*b[1] + DE[3*i+2]*b[2];
+      dd_meas[i] = range / GPS_L1_LAMBDA_NO_VAC + N[i];
+      dd_meas[i + num_dds] = range;
+    }
+
+    /* Log likelihood ratio of the true hypothesis against each one a cycle
+     * away on a single DD. */
+    for (u8 k = 0; k < num_dds; k++) {
+      double N_k[num_dds];
+      memcpy(N_k, N, sizeof(N));
+      N_k[k] += 1;
+      double r_c[cached.res_dim], r_f[fresh.res_dim];
+      assign_r_vec(&cached, num_dds, dd_meas, r_c);
+      assign_r_vec(&fresh, num_dds, dd_meas, r_f);
+      double ratio_c = get_quadratic_term(&cached, num_dds, N, r_c) -
+                       get_quadratic_term(&cached, num_dds, N_k, r_c);
+      double ratio_f = get_quadratic_term(&fresh, num_dds, N, r_f) -
+                       get_quadratic_term(&fresh, num_dds, N_k, r_f);
+      max_err = MAX(max_err, fabs(ratio_c - ratio_f));
+    }
+  }
+
+  fail_unless(n_rebuilds >= 2 && n_rebuilds <= n_epochs / 5,
+              "%u rebuilds in %u epochs", n_rebuilds, n_epochs);
+  fail_unless(max_err <= 0.1, "Log likelihood ratio error %g", max_err);
+}
+END_TEST
 
 Suite* ambiguity_test_suite(void)
 {
@@ -237,6 +979,14 @@ Suite* ambiguity_test_suite(void)
   //tcase_add_test(tc_core, test_update_sats_rebase);
   (void) test_update_sats_rebase;
   tcase_add_test(tc_core, test_amb_sat_inclusion);
+  tcase_add_test(tc_core, test_count_intersection);
+  tcase_add_test(tc_core, test_quadratic_terms_batch);
+  tcase_add_test(tc_core, test_quadratic_terms_accuracy);
+  tcase_add_test(tc_core, test_residual_matrices_dd);
+  tcase_add_test(tc_core, test_residual_matrices_drift);
+  tcase_add_test(tc_core, test_ambiguity_test_max_hypotheses);
+  tcase_add_test(tc_core, test_test_ambiguities_parallel);
+  tcase_add_test(tc_core, test_unanimous_ambs_parallel);
   suite_add_tcase(s, tc_core);
 
   return s;
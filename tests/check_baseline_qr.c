@@ -0,0 +1,149 @@
+#include <math.h>
+#include <string.h>
+
+#include <check.h>
+#include "check_utils.h"
+
+#include <baseline_qr.h>
+#include <linear_algebra.h>
+
+#define BASELINE_TOL 1e-9
+
+/* Random geometry rows, a difference of two unit vectors like assign_de_mtx()
+ * would produce. */
+static void random_de(u8 num_dds, double *DE)
+{
+  for (u8 i=0; i<num_dds*3; i++) {
+    DE[i] = frand(-1, 1);
+  }
+}
+
+static void reference_solve(u8 num_dds, const double *DE, const double *y,
+                            double b[3])
+{
+  double pinv[3 * num_dds];
+  fail_unless(matrix_pseudoinverse(num_dds, 3, DE, pinv) == 0);
+  matrix_multiply(3, num_dds, 1, pinv, y, b);
+}
+
+static void check_solution(u8 num_dds, const double *DE, const double *y,
+                           const double b[3])
+{
+  double b_ref[3];
+  reference_solve(num_dds, DE, y, b_ref);
+  for (u8 k=0; k<3; k++) {
+    fail_unless(fabs(b[k] - b_ref[k]) < BASELINE_TOL,
+                "Baseline differs from batch solution: %g vs %g",
+                b[k], b_ref[k]);
+  }
+}
+
+START_TEST(test_baseline_qr_solve)
+{
+  seed_rng();
+  for (u8 num_dds = 3; num_dds < MAX_CHANNELS; num_dds++) {
+    double DE[num_dds * 3], y[num_dds], b[3];
+    u8 prns[num_dds];
+    random_de(num_dds, DE);
+    for (u8 i=0; i<num_dds; i++) {
+      y[i] = frand(-10, 10);
+      prns[i] = i + 1;
+    }
+    baseline_qr_t qr;
+    baseline_qr_init(&qr);
+    fail_unless(baseline_qr_solve_de(&qr, num_dds, 0, prns, DE, y, b) == 0);
+    check_solution(num_dds, DE, y, b);
+  }
+
+  /* Too few double differences. */
+  baseline_qr_t qr;
+  baseline_qr_init(&qr);
+  double DE[6] = {1, 0, 0, 0, 1, 0}, y[2] = {1, 1}, b[3];
+  u8 prns[2] = {1, 2};
+  fail_unless(baseline_qr_solve_de(&qr, 2, 0, prns, DE, y, b) < 0);
+}
+END_TEST
+
+START_TEST(test_baseline_qr_incremental)
+{
+  seed_rng();
+  const u8 n = 8;
+  double DE[n * 3], y[n], b[3];
+  u8 prns[n];
+  random_de(n, DE);
+  for (u8 i=0; i<n; i++) {
+    y[i] = frand(-10, 10);
+    prns[i] = 10 + i;
+  }
+
+  baseline_qr_t qr;
+  baseline_qr_init(&qr);
+  fail_unless(baseline_qr_solve_de(&qr, n, 1, prns, DE, y, b) == 0);
+  fail_unless(qr.n_factorizations == 1);
+
+  /* Same satellites, slightly moved: R is reused and the refinement gives
+   * the solution for the new geometry. */
+  for (u8 i=0; i<n*3; i++) {
+    DE[i] += frand(-1, 1) * 0.5 * BASELINE_QR_REFRESH_TOL;
+  }
+  fail_unless(baseline_qr_solve_de(&qr, n, 1, prns, DE, y, b) == 0);
+  fail_unless(qr.n_factorizations == 1, "R was rebuilt");
+  check_solution(n, DE, y, b);
+
+  /* Drop a satellite from the middle. */
+  double DE_drop[(n-1) * 3], y_drop[n-1];
+  u8 prns_drop[n-1];
+  for (u8 i=0, j=0; i<n; i++) {
+    if (i == 3) {
+      continue;
+    }
+    memcpy(&DE_drop[3*j], &DE[3*i], 3 * sizeof(double));
+    y_drop[j] = y[i];
+    prns_drop[j] = prns[i];
+    j++;
+  }
+  fail_unless(baseline_qr_solve_de(&qr, n-1, 1, prns_drop, DE_drop, y_drop,
+                                   b) == 0);
+  fail_unless(qr.n_factorizations == 1, "R was rebuilt");
+  fail_unless(qr.num_dds == n-1);
+  check_solution(n-1, DE_drop, y_drop, b);
+
+  /* Add it back along with a new one, in a different order, with larger
+   * geometry changes. */
+  double DE_add[(n+1) * 3], y_add[n+1];
+  u8 prns_add[n+1];
+  for (u8 i=0; i<n; i++) {
+    memcpy(&DE_add[3*(n-1-i)], &DE[3*i], 3 * sizeof(double));
+    y_add[n-1-i] = y[i];
+    prns_add[n-1-i] = prns[i];
+  }
+  random_de(1, &DE_add[3*n]);
+  y_add[n] = 3;
+  prns_add[n] = 30;
+  for (u8 i=0; i<(n+1)*3; i++) {
+    DE_add[i] += frand(-1, 1) * 10 * BASELINE_QR_REFRESH_TOL;
+  }
+  fail_unless(baseline_qr_solve_de(&qr, n+1, 1, prns_add, DE_add, y_add,
+                                   b) == 0);
+  fail_unless(qr.n_factorizations == 1, "R was rebuilt");
+  check_solution(n+1, DE_add, y_add, b);
+
+  /* A new reference satellite changes every row. */
+  fail_unless(baseline_qr_solve_de(&qr, n+1, 2, prns_add, DE_add, y_add,
+                                   b) == 0);
+  fail_unless(qr.n_factorizations == 2);
+  check_solution(n+1, DE_add, y_add, b);
+}
+END_TEST
+
+Suite* baseline_qr_suite(void)
+{
+  Suite *s = suite_create("Baseline QR");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_baseline_qr_solve);
+  tcase_add_test(tc_core, test_baseline_qr_incremental);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -336,6 +336,199 @@ START_TEST(test_random_wgsecef2ned_d_0) {
 }
 END_TEST
 
+START_TEST(test_wgsecef2llh_vermeille)
+{
+  double llh[3];
+
+  wgsecef2llh_vermeille(ecefs[_i], llh);
+
+  for (int n=0; n<3; n++) {
+    fail_unless(!isnan(llh[n]), "NaN in output from wgsecef2llh_vermeille.");
+  }
+
+  double lat_err = fabs(llh[0] - llhs[_i][0]);
+  double lon_err = fabs(llh[1] - llhs[_i][1]);
+  double hgt_err = fabs(llh[2] - llhs[_i][2]);
+  fail_unless((lat_err < MAX_ANGLE_ERROR_RAD) &&
+              (lon_err < MAX_ANGLE_ERROR_RAD) &&
+              (hgt_err < MAX_DIST_ERROR_M),
+    "Closed form conversion from WGS84 ECEF to LLH has >1e-6 {rad, m} error:\n"
+    "ECEF: %f, %f, %f\n"
+    "Lat error (arc sec): %g\nLon error (arc sec): %g\nH error (mm): %g",
+    ecefs[_i][0], ecefs[_i][1], ecefs[_i][2],
+    (llh[0] - llhs[_i][0])*(R2D*3600),
+    (llh[1] - llhs[_i][1])*(R2D*3600),
+    (llh[2] - llhs[_i][2])*1e3
+  );
+}
+END_TEST
+
+START_TEST(test_random_wgsecef2llh_vermeille)
+{
+  double llh_init[3];
+  double ecef[3];
+  double llh[3], llh_iter[3];
+
+  seed_rng();
+
+  llh_init[0] = D2R*frand(-90, 90);
+  llh_init[1] = D2R*frand(-180, 180);
+  llh_init[2] = frand(-1e6, 4e7);
+
+  wgsllh2ecef(llh_init, ecef);
+  wgsecef2llh_vermeille(ecef, llh);
+  wgsecef2llh(ecef, llh_iter);
+
+  fail_unless((fabs(llh[0] - llh_iter[0]) < MAX_ANGLE_ERROR_RAD) &&
+              (fabs(llh[1] - llh_iter[1]) < MAX_ANGLE_ERROR_RAD) &&
+              (fabs(llh[2] - llh_iter[2]) < MAX_DIST_ERROR_M),
+    "Closed form and iterative ECEF to LLH disagree.\n"
+    "Initial LLH: %f, %f, %f\n"
+    "Lat diff (arc sec): %g\nLon diff (arc sec): %g\nH diff (mm): %g",
+    R2D*llh_init[0], R2D*llh_init[1], llh_init[2],
+    (llh[0] - llh_iter[0])*(R2D*3600),
+    (llh[1] - llh_iter[1])*(R2D*3600),
+    (llh[2] - llh_iter[2])*1e3
+  );
+}
+END_TEST
+
+START_TEST(test_coord_system_arrays)
+{
+  #define N_POINTS 100
+  double llh[N_POINTS][3], ecef[N_POINTS][3], llh_out[N_POINTS][3];
+  double lat[N_POINTS], lon[N_POINTS], hgt[N_POINTS];
+  double x[N_POINTS], y[N_POINTS], z[N_POINTS];
+  double ned[N_POINTS][3], az[N_POINTS], el[N_POINTS];
+
+  seed_rng();
+  for (u32 i=0; i<N_POINTS; i++) {
+    llh[i][0] = lat[i] = D2R*frand(-90, 90);
+    llh[i][1] = lon[i] = D2R*frand(-180, 180);
+    llh[i][2] = hgt[i] = frand(-1e3, 1e5);
+  }
+
+  wgsllh2ecef_array(N_POINTS, (const double (*)[3])llh, ecef);
+  wgsllh2ecef_soa(N_POINTS, lat, lon, hgt, x, y, z);
+  for (u32 i=0; i<N_POINTS; i++) {
+    double ecef_ref[3];
+    wgsllh2ecef(llh[i], ecef_ref);
+    for (u8 j=0; j<3; j++) {
+      fail_unless(fabs(ecef[i][j] - ecef_ref[j]) < MAX_DIST_ERROR_M);
+    }
+    fail_unless(fabs(x[i] - ecef_ref[0]) < MAX_DIST_ERROR_M);
+    fail_unless(fabs(y[i] - ecef_ref[1]) < MAX_DIST_ERROR_M);
+    fail_unless(fabs(z[i] - ecef_ref[2]) < MAX_DIST_ERROR_M);
+  }
+
+  wgsecef2llh_array(N_POINTS, (const double (*)[3])ecef, llh_out);
+  wgsecef2llh_soa(N_POINTS, x, y, z, lat, lon, hgt);
+  for (u32 i=0; i<N_POINTS; i++) {
+    fail_unless(fabs(llh_out[i][0] - llh[i][0]) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(llh_out[i][1] - llh[i][1]) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(llh_out[i][2] - llh[i][2]) < MAX_DIST_ERROR_M);
+    fail_unless(fabs(lat[i] - llh[i][0]) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(lon[i] - llh[i][1]) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(hgt[i] - llh[i][2]) < MAX_DIST_ERROR_M);
+  }
+
+  const double ref_ecef[3] = {EARTH_A, 0, 0};
+  wgsecef2ned_d_array(N_POINTS, (const double (*)[3])ecef, ref_ecef, ned);
+  wgsecef2azel_array(N_POINTS, (const double (*)[3])ecef, ref_ecef, az, el);
+  for (u32 i=0; i<N_POINTS; i++) {
+    double ned_ref[3], az_ref, el_ref;
+    wgsecef2ned_d(ecef[i], ref_ecef, ned_ref);
+    wgsecef2azel(ecef[i], ref_ecef, &az_ref, &el_ref);
+    for (u8 j=0; j<3; j++) {
+      fail_unless(fabs(ned[i][j] - ned_ref[j]) < MAX_DIST_ERROR_M);
+    }
+    fail_unless(fabs(az[i] - az_ref) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(el[i] - el_ref) < MAX_ANGLE_ERROR_RAD);
+  }
+  #undef N_POINTS
+}
+END_TEST
+
+START_TEST(test_random_ltp_frame)
+{
+  #define N_POINTS 20
+  double ref_llh[3], ref_ecef[3];
+  double ecef[N_POINTS][3], ned[N_POINTS][3], ecef_out[N_POINTS][3];
+  double az[N_POINTS], el[N_POINTS];
+
+  seed_rng();
+
+  ref_llh[0] = D2R*frand(-90, 90);
+  ref_llh[1] = D2R*frand(-180, 180);
+  ref_llh[2] = frand(-1e3, 1e4);
+  wgsllh2ecef(ref_llh, ref_ecef);
+
+  ltp_frame_t frame;
+  ltp_frame_init(&frame, ref_ecef);
+  for (u8 j=0; j<3; j++) {
+    fail_unless(frame.ref_ecef[j] == ref_ecef[j]);
+  }
+  fail_unless(fabs(frame.ref_llh[0] - ref_llh[0]) < MAX_ANGLE_ERROR_RAD);
+  fail_unless(fabs(frame.ref_llh[1] - ref_llh[1]) < MAX_ANGLE_ERROR_RAD);
+  fail_unless(fabs(frame.ref_llh[2] - ref_llh[2]) < MAX_DIST_ERROR_M);
+
+  /* Down is along the normal to the ellipsoid. */
+  double up_llh[3] = {ref_llh[0], ref_llh[1], ref_llh[2] + 100};
+  double up_ecef[3], up_ned[3];
+  wgsllh2ecef(up_llh, up_ecef);
+  ltp_ecef2ned_d(&frame, up_ecef, up_ned);
+  fail_unless(fabs(up_ned[0]) < MAX_DIST_ERROR_M);
+  fail_unless(fabs(up_ned[1]) < MAX_DIST_ERROR_M);
+  fail_unless(fabs(up_ned[2] + 100) < MAX_DIST_ERROR_M);
+
+  for (u32 i=0; i<N_POINTS; i++) {
+    for (u8 j=0; j<3; j++) {
+      ecef[i][j] = ref_ecef[j] + frand(-2e7, 2e7);
+    }
+
+    double ned_ref[3], v_ref[3], v[3], az_ref, el_ref;
+    wgsecef2ned_d(ecef[i], ref_ecef, ned_ref);
+    ltp_ecef2ned_d(&frame, ecef[i], ned[i]);
+    wgsecef2ned(ecef[i], ref_ecef, v_ref);
+    ltp_ecef2ned(&frame, ecef[i], v);
+    for (u8 j=0; j<3; j++) {
+      fail_unless(fabs(ned[i][j] - ned_ref[j]) < MAX_DIST_ERROR_M);
+      fail_unless(fabs(v[j] - v_ref[j]) < MAX_DIST_ERROR_M);
+    }
+
+    wgsned2ecef(ned[i], ref_ecef, v_ref);
+    ltp_ned2ecef(&frame, ned[i], v);
+    ltp_ned2ecef_d(&frame, ned[i], ecef_out[i]);
+    for (u8 j=0; j<3; j++) {
+      fail_unless(fabs(v[j] - v_ref[j]) < MAX_DIST_ERROR_M);
+      fail_unless(fabs(ecef_out[i][j] - ecef[i][j]) < MAX_DIST_ERROR_M);
+    }
+
+    wgsecef2azel(ecef[i], ref_ecef, &az_ref, &el_ref);
+    ltp_ecef2azel(&frame, ecef[i], &az[i], &el[i]);
+    fail_unless(fabs(az[i] - az_ref) < MAX_ANGLE_ERROR_RAD);
+    fail_unless(fabs(el[i] - el_ref) < MAX_ANGLE_ERROR_RAD);
+  }
+
+  double ned_arr[N_POINTS][3], ecef_arr[N_POINTS][3];
+  double az_arr[N_POINTS], el_arr[N_POINTS];
+  ltp_ecef2ned_d_array(&frame, N_POINTS, (const double (*)[3])ecef, ned_arr);
+  ltp_ned2ecef_d_array(&frame, N_POINTS, (const double (*)[3])ned_arr,
+                       ecef_arr);
+  ltp_ecef2azel_array(&frame, N_POINTS, (const double (*)[3])ecef,
+                      az_arr, el_arr);
+  for (u32 i=0; i<N_POINTS; i++) {
+    for (u8 j=0; j<3; j++) {
+      fail_unless(ned_arr[i][j] == ned[i][j]);
+      fail_unless(ecef_arr[i][j] == ecef_out[i][j]);
+    }
+    fail_unless(az_arr[i] == az[i]);
+    fail_unless(el_arr[i] == el[i]);
+  }
+  #undef N_POINTS
+}
+END_TEST
+
 Suite* coord_system_suite(void)
 {
   Suite *s = suite_create("Coordinate systems");
@@ -347,12 +540,16 @@ Suite* coord_system_suite(void)
   tcase_add_loop_test(tc_core, test_wgsecef2llh, 0, NUM_COORDS);
   tcase_add_loop_test(tc_core, test_wgsllh2ecef2llh, 0, NUM_COORDS);
   tcase_add_loop_test(tc_core, test_wgsecef2llh2ecef, 0, NUM_COORDS);
+  tcase_add_loop_test(tc_core, test_wgsecef2llh_vermeille, 0, NUM_COORDS);
+  tcase_add_test(tc_core, test_coord_system_arrays);
   suite_add_tcase(s, tc_core);
 
   TCase *tc_random = tcase_create("Random");
   tcase_add_loop_test(tc_random, test_random_wgsllh2ecef2llh, 0, 22);
   tcase_add_loop_test(tc_random, test_random_wgsecef2llh2ecef, 0, 22);
   tcase_add_loop_test(tc_random, test_random_wgsecef2ned_d_0, 0, 22);
+  tcase_add_loop_test(tc_random, test_random_wgsecef2llh_vermeille, 0, 22);
+  tcase_add_loop_test(tc_random, test_random_ltp_frame, 0, 22);
   suite_add_tcase(s, tc_random);
 
   return s;
@@ -0,0 +1,147 @@
+#include <math.h>
+#include <string.h>
+#include <check.h>
+
+#include "check_utils.h"
+
+#include <linear_algebra.h>
+#include <dd_cov.h>
+
+#define DD_COV_TOL 1e-10
+#define DD_COV_MAX_N 15
+#define DD_COV_VAR 3.7
+
+START_TEST(test_dd_cov_inverse) {
+  for (u8 n = 1; n <= DD_COV_MAX_N; n++) {
+    double C[n*n], C_inv[n*n], C_inv_dense[n*n];
+    dd_cov_assign(n, DD_COV_VAR, C);
+    dd_cov_inverse(n, DD_COV_VAR, C_inv);
+    fail_unless(matrix_inverse(n, C, C_inv_dense) == 0);
+    for (u32 i = 0; i < n*n; i++) {
+      fail_unless(fabs(C_inv[i] - C_inv_dense[i]) < DD_COV_TOL,
+                  "n = %u, element %u: %f vs %f",
+                  n, i, C_inv[i], C_inv_dense[i]);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_dd_cov_multiply_solve) {
+  seed_rng();
+  for (u8 n = 1; n <= DD_COV_MAX_N; n++) {
+    double C[n*n], B[n*2], CB[n*2], CB_dense[n*2];
+    for (u32 i = 0; i < n*2; i++) {
+      B[i] = frand(-10, 10);
+    }
+    dd_cov_assign(n, DD_COV_VAR, C);
+    matrix_multiply(n, n, 2, C, B, CB_dense);
+    dd_cov_multiply(n, DD_COV_VAR, 2, B, CB);
+    for (u32 i = 0; i < n*2; i++) {
+      fail_unless(fabs(CB[i] - CB_dense[i]) < DD_COV_TOL,
+                  "n = %u, element %u: %f vs %f", n, i, CB[i], CB_dense[i]);
+    }
+
+    /* Solve with the first column of CB, in place. */
+    double x[n];
+    for (u8 i = 0; i < n; i++) {
+      x[i] = CB[i*2];
+    }
+    dd_cov_solve(n, DD_COV_VAR, x, x);
+    for (u8 i = 0; i < n; i++) {
+      fail_unless(fabs(x[i] - B[i*2]) < DD_COV_TOL,
+                  "n = %u, element %u: %f vs %f", n, i, x[i], B[i*2]);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_dd_cov_cholesky) {
+  for (u8 n = 1; n <= DD_COV_MAX_N; n++) {
+    double C[n*n], L[n*n], L_dense[n*n];
+    dd_cov_assign(n, DD_COV_VAR, C);
+    dd_cov_cholesky(n, DD_COV_VAR, L);
+    fail_unless(matrix_cholesky(n, C, L_dense) == 0);
+    for (u32 i = 0; i < n*n; i++) {
+      fail_unless(fabs(L[i] - L_dense[i]) < DD_COV_TOL,
+                  "n = %u, element %u: %f vs %f", n, i, L[i], L_dense[i]);
+    }
+
+    /* The log determinant is twice the sum of the logs of L's diagonal. */
+    double log_det = 0;
+    for (u8 i = 0; i < n; i++) {
+      log_det += 2 * log(L_dense[i*n + i]);
+    }
+    fail_unless(fabs(dd_cov_log_det(n, DD_COV_VAR) - log_det) < DD_COV_TOL,
+                "n = %u: %f vs %f", n, dd_cov_log_det(n, DD_COV_VAR), log_det);
+  }
+}
+END_TEST
+
+START_TEST(test_dd_cov_udu) {
+  for (u8 n = 1; n <= DD_COV_MAX_N; n++) {
+    double C[n*n], U[n*n], D[n], U_dense[n*n], D_dense[n];
+    double U_inv[n*n], D_inv[n], U_inv_dense[n*n];
+    dd_cov_assign(n, DD_COV_VAR, C);
+    matrix_udu(n, C, U_dense, D_dense);
+    dd_cov_udu(n, DD_COV_VAR, U, D);
+    dd_cov_udu_inverse(n, DD_COV_VAR, U_inv, D_inv);
+    fail_unless(matrix_inverse(n, U_dense, U_inv_dense) == 0);
+    for (u32 i = 0; i < n*n; i++) {
+      fail_unless(fabs(U[i] - U_dense[i]) < DD_COV_TOL,
+                  "n = %u, U element %u: %f vs %f", n, i, U[i], U_dense[i]);
+      fail_unless(fabs(U_inv[i] - U_inv_dense[i]) < DD_COV_TOL,
+                  "n = %u, U_inv element %u: %f vs %f",
+                  n, i, U_inv[i], U_inv_dense[i]);
+    }
+    for (u8 i = 0; i < n; i++) {
+      fail_unless(fabs(D[i] - D_dense[i]) < DD_COV_TOL,
+                  "n = %u, D element %u: %f vs %f", n, i, D[i], D_dense[i]);
+      fail_unless(D_inv[i] == D[i]);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_dd_cov_rank_one_udu_inverse) {
+  seed_rng();
+  for (u8 n = 1; n <= DD_COV_MAX_N; n++) {
+    double u[n], M[n*n], U_dense[n*n], D_dense[n], U_inv_dense[n*n];
+    double U_inv[n*n], D[n];
+    for (u8 i = 0; i < n; i++) {
+      u[i] = frand(-2, 2);
+    }
+    for (u8 i = 0; i < n; i++) {
+      for (u8 j = 0; j < n; j++) {
+        M[i*n + j] = DD_COV_VAR * ((i == j) + u[i] * u[j]);
+      }
+    }
+    matrix_udu(n, M, U_dense, D_dense);
+    fail_unless(matrix_inverse(n, U_dense, U_inv_dense) == 0);
+    dd_cov_rank_one_udu_inverse(n, DD_COV_VAR, u, U_inv, D);
+    for (u32 i = 0; i < n*n; i++) {
+      fail_unless(fabs(U_inv[i] - U_inv_dense[i]) < DD_COV_TOL,
+                  "n = %u, U_inv element %u: %f vs %f",
+                  n, i, U_inv[i], U_inv_dense[i]);
+    }
+    for (u8 i = 0; i < n; i++) {
+      fail_unless(fabs(D[i] - D_dense[i]) < DD_COV_TOL,
+                  "n = %u, D element %u: %f vs %f", n, i, D[i], D_dense[i]);
+    }
+  }
+}
+END_TEST
+
+Suite* dd_cov_suite(void)
+{
+  Suite *s = suite_create("Double Difference Covariance");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_dd_cov_inverse);
+  tcase_add_test(tc_core, test_dd_cov_multiply_solve);
+  tcase_add_test(tc_core, test_dd_cov_cholesky);
+  tcase_add_test(tc_core, test_dd_cov_udu);
+  tcase_add_test(tc_core, test_dd_cov_rank_one_udu_inverse);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -1,10 +1,65 @@
 
 #include <check.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "linear_algebra.h"
 #include "check_utils.h"
 #include "dgnss_management.h"
 #include "ambiguity_test.h"
+#include "coord_system.h"
+#include "constants.h"
+
+#ifdef __GLIBC__
+/* Count heap allocations made while the code under test runs, including
+ * those inside LAPACK and libc, by interposing the glibc allocator entry
+ * points. Outside of a count_allocs_begin() / count_allocs_end() window the
+ * wrappers only forward to glibc. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile u8 counting_allocs = 0;
+static u32 n_allocs = 0;
+
+static void count_alloc(void)
+{
+  if (counting_allocs) {
+    __sync_fetch_and_add(&n_allocs, 1);
+  }
+}
+
+static void count_allocs_begin(void)
+{
+  n_allocs = 0;
+  counting_allocs = 1;
+}
+
+static u32 count_allocs_end(void)
+{
+  counting_allocs = 0;
+  return n_allocs;
+}
+
+void *malloc(size_t size)
+{
+  count_alloc();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+  count_alloc();
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  count_alloc();
+  return __libc_realloc(ptr, size);
+}
+#endif
 
 extern sats_management_t sats_management;
 extern nkf_t nkf;
@@ -483,6 +538,65 @@ START_TEST(test_dgnss_low_latency_baseline_uninitialized) {
 }
 END_TEST
 
+#ifdef __GLIBC__
+/* Single differences for a baseline `b` between two receivers near
+ * `rx_ecef`, with integer ambiguity `i` on satellite `i`. */
+static void simulate_sdiffs(u8 num_sats, const double rx_ecef[3],
+                            const double b[3], sdiff_t *sds)
+{
+  double rx_llh[3];
+  wgsecef2llh(rx_ecef, rx_llh);
+  for (u8 i=0; i<num_sats; i++) {
+    /* Satellites spread in azimuth, 20 to 70 degrees elevation. */
+    double az = 2 * M_PI * i / num_sats;
+    double el = (20 + 50.0 * (i % 3) / 2) * D2R;
+    double ned[3] = {cos(el) * cos(az), cos(el) * sin(az), -sin(el)};
+    for (u8 j=0; j<3; j++) {
+      ned[j] *= 2.02e7;
+    }
+    memset(&sds[i], 0, sizeof(sdiff_t));
+    wgsned2ecef_d(ned, rx_ecef, sds[i].sat_pos);
+    double los[3];
+    for (u8 j=0; j<3; j++) {
+      los[j] = (sds[i].sat_pos[j] - rx_ecef[j]) / 2.02e7;
+    }
+    double range_diff = -(los[0]*b[0] + los[1]*b[1] + los[2]*b[2]);
+    sds[i].pseudorange = range_diff;
+    sds[i].carrier_phase = -range_diff / GPS_L1_LAMBDA_NO_VAC + i;
+    sds[i].snr = 100;
+    sds[i].prn = i + 1;
+  }
+}
+
+START_TEST(test_dgnss_epoch_no_allocations) {
+  double rx_llh[3] = {37.77 * D2R, -122.42 * D2R, 10};
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llh, rx_ecef);
+  double b_true[3] = {1.5, -2.0, 0.5};
+
+  const u8 num_sats = 8;
+  sdiff_t sds[num_sats];
+  simulate_sdiffs(num_sats, rx_ecef, b_true, sds);
+  dgnss_init_known_baseline(num_sats, sds, rx_ecef, b_true);
+  dgnss_update(num_sats, sds, rx_ecef);
+
+  count_allocs_begin();
+  for (u32 epoch = 0; epoch < 10; epoch++) {
+    double b[3];
+    u8 num_used;
+    dgnss_update(num_sats, sds, rx_ecef);
+    dgnss_new_float_baseline(num_sats, sds, rx_ecef, &num_used, b);
+    dgnss_low_latency_baseline(num_sats, sds, rx_ecef, &num_used, b);
+    dgnss_fixed_baseline(num_sats, sds, rx_ecef, &num_used, b);
+  }
+  u32 allocs = count_allocs_end();
+
+  fail_unless(dgnss_iar_resolved(), "IAR did not resolve");
+  fail_unless(allocs == 0, "%u heap allocations in 10 epochs", allocs);
+}
+END_TEST
+#endif
+
 Suite* dgnss_management_test_suite(void)
 {
   Suite *s = suite_create("DGNSS Management");
@@ -503,6 +617,9 @@ Suite* dgnss_management_test_suite(void)
   tcase_add_test(tc_core, test_dgnss_low_latency_IAR_baseline_few_sats);
   tcase_add_test(tc_core, test_dgnss_low_latency_IAR_baseline_uninitialized);
   tcase_add_test(tc_core, test_dgnss_low_latency_baseline_uninitialized);
+#ifdef __GLIBC__
+  tcase_add_test(tc_core, test_dgnss_epoch_no_allocations);
+#endif
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -0,0 +1,116 @@
+#include <math.h>
+
+#include <check.h>
+
+#include <gpstime.h>
+
+#define WEEK_SECS (7*24*3600)
+
+START_TEST(test_normalize_gps_time)
+{
+  gps_time_t t = {.wn = 1000, .tow = -10};
+  t = normalize_gps_time(t);
+  fail_unless(t.wn == 999 && fabs(t.tow - (WEEK_SECS - 10)) < 1e-9,
+              "Negative tow not normalized, wn %u tow %f", t.wn, t.tow);
+
+  t = (gps_time_t){.wn = 1000, .tow = 3.5 * WEEK_SECS};
+  t = normalize_gps_time(t);
+  fail_unless(t.wn == 1003 && fabs(t.tow - 0.5 * WEEK_SECS) < 1e-9,
+              "Large tow not normalized, wn %u tow %f", t.wn, t.tow);
+
+  t = (gps_time_t){.wn = 1000, .tow = 1234.5};
+  t = normalize_gps_time(t);
+  fail_unless(t.wn == 1000 && t.tow == 1234.5,
+              "Normal time changed, wn %u tow %f", t.wn, t.tow);
+
+  t = (gps_time_t){.wn = 1000, .tow = NAN};
+  t = normalize_gps_time(t);
+  fail_unless(t.wn == 1000 && isnan(t.tow), "NaN tow not passed through");
+  fail_unless(gps2time(t) == (time_t)-1);
+  fail_unless(isnan(gps_day_of_year(t)));
+}
+END_TEST
+
+START_TEST(test_gps_time_ns_conversion)
+{
+  gps_time_t t = {.wn = 1787, .tow = 345600.123456789};
+  gps_time_ns_t t_ns = gps_time_to_ns(t);
+
+  fail_unless(gps_ns_wn(t_ns) == 1787);
+  fail_unless(gps_ns_tow(t_ns) == 345600123456789LL,
+              "Time of week %lld ns", (long long)gps_ns_tow(t_ns));
+
+  gps_time_t t2 = gps_time_from_ns(t_ns);
+  fail_unless(t2.wn == t.wn && fabs(t2.tow - t.tow) < 1e-9,
+              "Round trip wn %u tow %f", t2.wn, t2.tow);
+
+  /* Times of week outside of the week are normalized. */
+  gps_time_ns_t t3 = gps_ns_from_wn_tow(1787, -GPS_NS_PER_S);
+  fail_unless(gps_ns_wn(t3) == 1786);
+  fail_unless(gps_ns_tow(t3) == GPS_NS_PER_WEEK - GPS_NS_PER_S);
+}
+END_TEST
+
+START_TEST(test_gps_time_ns_arithmetic)
+{
+  gps_time_ns_t t = gps_ns_from_wn_tow(1787, GPS_NS_PER_WEEK - 1);
+
+  /* Crossing the end of the week. */
+  gps_time_ns_t t2 = gps_ns_add(t, 2);
+  fail_unless(gps_ns_wn(t2) == 1788 && gps_ns_tow(t2) == 1);
+  fail_unless(gps_ns_diff(t2, t) == 2);
+  fail_unless(gps_ns_diff(t, t2) == -2);
+
+  /* A nanosecond is still resolved at a large epoch, which a double time of
+   * week of seconds can not do exactly. */
+  fail_unless(gps_ns_diff_s(t2, t) == 2e-9,
+              "Difference %g s", gps_ns_diff_s(t2, t));
+
+  t2 = gps_ns_add(t, -10 * GPS_NS_PER_WEEK);
+  fail_unless(gps_ns_wn(t2) == 1777);
+  fail_unless(gps_ns_diff_s(t, t2) == 10.0 * WEEK_SECS);
+}
+END_TEST
+
+START_TEST(test_gps_utc_offset)
+{
+  /* 2014-01-01 00:00:00 UTC. */
+  gps_time_ns_t t = unix_ns_to_gps_ns(1388534400LL * GPS_NS_PER_S);
+  fail_unless(gps_utc_offset(t) == 16, "Offset %d", gps_utc_offset(t));
+  fail_unless(gps_ns_to_unix_ns(t) == 1388534400LL * GPS_NS_PER_S);
+
+  /* 2018-01-01 00:00:00 UTC. */
+  t = unix_ns_to_gps_ns(1514764800LL * GPS_NS_PER_S);
+  fail_unless(gps_utc_offset(t) == 18, "Offset %d", gps_utc_offset(t));
+  fail_unless(gps_ns_to_unix_ns(t) == 1514764800LL * GPS_NS_PER_S);
+
+  /* The GPS epoch. */
+  t.ns = 0;
+  fail_unless(gps_utc_offset(t) == 0);
+  fail_unless(gps_ns_to_unix_ns(t) == GPS_EPOCH * GPS_NS_PER_S);
+
+  /* Either side of the 2017-01-01 leap second. */
+  t = unix_ns_to_gps_ns(1483228800LL * GPS_NS_PER_S);
+  fail_unless(gps_utc_offset(t) == 18);
+  fail_unless(gps_utc_offset(gps_ns_add(t, -1)) == 17);
+
+  /* gps2time() follows the table. */
+  gps_time_t gt = gps_time_from_ns(t);
+  fail_unless(gps2time(gt) == 1483228800,
+              "gps2time %ld", (long)gps2time(gt));
+}
+END_TEST
+
+Suite* gpstime_suite(void)
+{
+  Suite *s = suite_create("GPS time");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_normalize_gps_time);
+  tcase_add_test(tc_core, test_gps_time_ns_conversion);
+  tcase_add_test(tc_core, test_gps_time_ns_arithmetic);
+  tcase_add_test(tc_core, test_gps_utc_offset);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
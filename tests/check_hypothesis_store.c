@@ -0,0 +1,219 @@
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hypothesis_store.h>
+
+#include "check_utils.h"
+
+#define TEST_CAPACITY 37
+#define TEST_DDS 6
+
+static u8 test_buff[HYPOTHESIS_STORE_BUFF_SIZE(TEST_CAPACITY)]
+  __attribute__((aligned(32)));
+
+START_TEST(test_hypothesis_store_add_get)
+{
+  hypothesis_store_t store;
+  fail_unless(hypothesis_store_init(&store, TEST_CAPACITY, test_buff) == 0);
+  fail_unless(store.n == 0);
+  fail_unless(store.stride % HYPOTHESIS_STORE_ALIGN == 0);
+  fail_unless(store.stride >= TEST_CAPACITY);
+
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    s32 N[TEST_DDS];
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      N[k] = 100*i + k;
+    }
+    fail_unless(hypothesis_store_add(&store, TEST_DDS, N, -(float)i) == (s32)i,
+                "Hypothesis added at the wrong index");
+  }
+  s32 N[TEST_DDS] = {0};
+  fail_unless(hypothesis_store_add(&store, TEST_DDS, N, 0) == -1,
+              "Add should fail when the store is full");
+  fail_unless(store.n == TEST_CAPACITY);
+
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    hypothesis_store_get(&store, i, TEST_DDS, N);
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      fail_unless(N[k] == (s32)(100*i + k),
+                  "Wrong ambiguity %u of hypothesis %u", k, i);
+    }
+    fail_unless(store.ll[i] == -(float)i);
+  }
+
+  N[2] = -7;
+  hypothesis_store_set(&store, 3, TEST_DDS, N);
+  hypothesis_store_get(&store, 3, TEST_DDS, N);
+  fail_unless(N[2] == -7);
+
+  hypothesis_store_clear(&store);
+  fail_unless(store.n == 0);
+}
+END_TEST
+
+START_TEST(test_hypothesis_store_compact)
+{
+  hypothesis_store_t store;
+  hypothesis_store_init(&store, TEST_CAPACITY, test_buff);
+
+  seed_rng();
+  u8 keep[TEST_CAPACITY];
+  u32 n_keep = 0;
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    s32 N[TEST_DDS];
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      N[k] = 100*i + k;
+    }
+    hypothesis_store_add(&store, TEST_DDS, N, i);
+    keep[i] = rand() % 2;
+    store.keep[i] = keep[i];
+    n_keep += keep[i];
+  }
+
+  fail_unless(hypothesis_store_compact(&store, TEST_DDS) == n_keep);
+  fail_unless(store.n == n_keep);
+
+  /* Survivors are still in order, with their ambiguities intact. */
+  u32 j = 0;
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    if (!keep[i]) {
+      continue;
+    }
+    s32 N[TEST_DDS];
+    hypothesis_store_get(&store, j, TEST_DDS, N);
+    fail_unless(store.ll[j] == i, "Hypothesis %u out of order", i);
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      fail_unless(N[k] == (s32)(100*i + k));
+    }
+    j++;
+  }
+
+  /* Dropping everything leaves an empty store. */
+  for (u32 i = 0; i < store.n; i++) {
+    store.keep[i] = 0;
+  }
+  fail_unless(hypothesis_store_compact(&store, TEST_DDS) == 0);
+}
+END_TEST
+
+START_TEST(test_hypothesis_store_compact_range)
+{
+  hypothesis_store_t store;
+  hypothesis_store_init(&store, TEST_CAPACITY, test_buff);
+
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    s32 N[TEST_DDS];
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      N[k] = 100*i + k;
+    }
+    hypothesis_store_add(&store, TEST_DDS, N, i);
+    store.keep[i] = (i % 3 != 0);
+  }
+
+  /* Compact two halves separately, then join them up. */
+  u32 mid = TEST_CAPACITY / 2;
+  u32 n0 = hypothesis_store_compact_range(&store, TEST_DDS, 0, mid);
+  u32 n1 = hypothesis_store_compact_range(&store, TEST_DDS, mid, TEST_CAPACITY);
+  fail_unless(store.n == TEST_CAPACITY, "Compacting a range changed n");
+  /* Hypotheses past the kept part of the first range are untouched. */
+  fail_unless(store.ll[mid - 1] == mid - 1);
+  hypothesis_store_move(&store, TEST_DDS, n0, mid, n1);
+  store.n = n0 + n1;
+
+  u32 j = 0;
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    if (i % 3 == 0) {
+      continue;
+    }
+    s32 N[TEST_DDS];
+    hypothesis_store_get(&store, j, TEST_DDS, N);
+    fail_unless(store.ll[j] == i, "Hypothesis %u out of order", i);
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      fail_unless(N[k] == (s32)(100*i + k));
+    }
+    j++;
+  }
+  fail_unless(j == store.n);
+}
+END_TEST
+
+START_TEST(test_hypothesis_store_index)
+{
+  hypothesis_store_t store;
+  hypothesis_store_init(&store, TEST_CAPACITY, test_buff);
+  hypothesis_store_reindex(&store, TEST_DDS);
+  fail_unless(hypothesis_store_mle(&store) == -1);
+
+  /* Hypotheses close together, as in an ambiguity test, some repeated. */
+  seed_rng();
+  s32 N_all[TEST_CAPACITY][TEST_DDS];
+  for (u32 i = 0; i < TEST_CAPACITY; i++) {
+    for (u8 k = 0; k < TEST_DDS; k++) {
+      N_all[i][k] = (i % 5 == 4) ? N_all[i-1][k] : rand() % 5 - 2;
+    }
+    hypothesis_store_add(&store, TEST_DDS, N_all[i], frand(-10, 0));
+  }
+  fail_unless(store.indexed);
+
+  for (u8 pass = 0; pass < 3; pass++) {
+    /* Each hypothesis is found, repeats at any index with its ambiguities. */
+    for (u32 i = 0; i < store.n; i++) {
+      s32 N[TEST_DDS];
+      hypothesis_store_get(&store, i, TEST_DDS, N);
+      s32 found = hypothesis_store_find(&store, TEST_DDS, N);
+      fail_unless(found >= 0, "Hypothesis %u not found, pass %u", i, pass);
+      s32 N_found[TEST_DDS];
+      hypothesis_store_get(&store, found, TEST_DDS, N_found);
+      fail_unless(memcmp(N_found, N, sizeof(N)) == 0);
+    }
+    s32 N_absent[TEST_DDS] = {3, 3, 3, 3, 3, 3};
+    fail_unless(hypothesis_store_find(&store, TEST_DDS, N_absent) == -1);
+
+    u32 mle = 0;
+    for (u32 i = 1; i < store.n; i++) {
+      if (store.ll[i] > store.ll[mle]) {
+        mle = i;
+      }
+    }
+    fail_unless(hypothesis_store_mle(&store) == (s32)mle,
+                "MLE %d, expected %u, pass %u",
+                hypothesis_store_mle(&store), mle, pass);
+
+    if (pass == 0) {
+      /* Changing ambiguities makes the index stale, lookups still work. */
+      s32 N[TEST_DDS] = {-3, -3, -3, -3, -3, -3};
+      hypothesis_store_set(&store, 7, TEST_DDS, N);
+      memcpy(N_all[7], N, sizeof(N));
+      fail_unless(!store.indexed);
+      fail_unless(hypothesis_store_find(&store, TEST_DDS, N) == 7);
+      hypothesis_store_reindex(&store, TEST_DDS);
+      fail_unless(hypothesis_store_find(&store, TEST_DDS, N) == 7);
+    } else if (pass == 1) {
+      /* Filtering keeps the index up to date. */
+      for (u32 i = 0; i < store.n; i++) {
+        store.keep[i] = (i % 3 != 1);
+      }
+      hypothesis_store_compact(&store, TEST_DDS);
+      fail_unless(store.indexed);
+      fail_unless(hypothesis_store_find(&store, TEST_DDS, N_all[7]) == -1,
+                  "Removed hypothesis still found");
+    }
+  }
+}
+END_TEST
+
+Suite* hypothesis_store_suite(void)
+{
+  Suite *s = suite_create("Hypothesis Store");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_hypothesis_store_add_get);
+  tcase_add_test(tc_core, test_hypothesis_store_compact);
+  tcase_add_test(tc_core, test_hypothesis_store_compact_range);
+  tcase_add_test(tc_core, test_hypothesis_store_index);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
@@ -0,0 +1,247 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "check_utils.h"
+
+#include <linear_algebra.h>
+#include <lambda.h>
+
+#define LAMBDA_TEST_N 5
+#define LAMBDA_TEST_K 8
+
+/* Random, strongly correlated covariance Q = A A^T + 1e-3 I. */
+static void random_cov(u8 n, double *Q)
+{
+  double A[n*n];
+  for (u32 i = 0; i < (u32)n*n; i++) {
+    A[i] = frand(-0.5, 0.5);
+  }
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      Q[i*n + j] = (i == j) ? 1e-3 : 0;
+      for (u8 l = 0; l < n; l++) {
+        Q[i*n + j] += A[i*n + l] * A[j*n + l];
+      }
+    }
+  }
+}
+
+static double distance(u8 n, const double *Q_inv, const double *a,
+                       const double *N)
+{
+  double d = 0;
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      d += (a[i] - N[i]) * Q_inv[i*n + j] * (a[j] - N[j]);
+    }
+  }
+  return d;
+}
+
+/* Keep the k smallest distances seen, ascending. */
+static void keep_best(u32 k, double *best, double d)
+{
+  for (u32 j = 0; j < k; j++) {
+    if (d < best[j]) {
+      memmove(&best[j+1], &best[j], (k - 1 - j) * sizeof(double));
+      best[j] = d;
+      return;
+    }
+  }
+}
+
+/* Distances of the k closest integer vectors to a, by exhaustive search of
+ * the reduced parameters z = Z^T a. Any z within distance R of the float
+ * solution has |z_i - zs_i| <= sqrt(R Qz_ii), Qz = Z^T Q Z = L^T D L, so
+ * searching that box for R at least the kth best distance is exact. R is
+ * taken as the kth best distance in the unit box about the rounded
+ * solution. */
+static void brute_force(const lambda_workspace_t *ws, const double *Q_inv,
+                        const double *a, u32 k, double *best)
+{
+  u8 n = ws->n;
+  double zs[n];
+  for (u8 i = 0; i < n; i++) {
+    zs[i] = 0;
+    for (u8 j = 0; j < n; j++) {
+      zs[i] += ws->Z[j + i*n] * a[j];
+    }
+  }
+
+  double lo[n], hi[n];
+  for (u8 i = 0; i < n; i++) {
+    lo[i] = round(zs[i]) - 1;
+    hi[i] = round(zs[i]) + 1;
+  }
+  for (u8 pass = 0; pass < 2; pass++) {
+    for (u32 j = 0; j < k; j++) {
+      best[j] = INFINITY;
+    }
+    double z[n], N[n];
+    memcpy(z, lo, sizeof(z));
+    u32 n_points = 0;
+    while (1) {
+      for (u8 i = 0; i < n; i++) {
+        N[i] = 0;
+        for (u8 m = 0; m < n; m++) {
+          N[i] += ws->Z_inv[m + i*n] * z[m];
+        }
+      }
+      keep_best(k, best, distance(n, Q_inv, a, N));
+      n_points++;
+      u8 i = 0;
+      while (i < n && z[i] == hi[i]) {
+        z[i] = lo[i];
+        i++;
+      }
+      if (i == n) {
+        break;
+      }
+      z[i]++;
+    }
+    fail_unless(n_points >= k && n_points <= 1000000,
+                "Brute force box has %u points", n_points);
+
+    /* Widen the box to hold everything within the kth best distance. */
+    for (u8 i = 0; i < n; i++) {
+      double Qz_ii = 0;
+      for (u8 l = 0; l < n; l++) {
+        Qz_ii += ws->L[l + i*n] * ws->L[l + i*n] * ws->D[l];
+      }
+      double w = sqrt(best[k - 1] * Qz_ii) * (1 + 1e-9);
+      lo[i] = ceil(zs[i] - w);
+      hi[i] = floor(zs[i] + w);
+    }
+  }
+}
+
+/* The search finds the same best candidates as brute force, for several
+ * float solutions with one workspace. */
+START_TEST(test_lambda_search)
+{
+  u8 n = LAMBDA_TEST_N;
+  double Q[n*n], Q_inv[n*n];
+  srand(5);
+  random_cov(n, Q);
+  fail_unless(matrix_inverse(n, Q, Q_inv) == 0);
+
+  u8 buff[LAMBDA_WORKSPACE_SIZE(LAMBDA_TEST_N)]
+    __attribute__((aligned(sizeof(double))));
+  lambda_workspace_t ws;
+  fail_unless(lambda_init(&ws, n, Q, buff) == 0);
+
+  /* Asking for no candidates is rejected without touching the outputs. */
+  double a0[n], F0[n], s0 = 1;
+  memset(a0, 0, sizeof(a0));
+  lambda_stats_t stats0 = {.n_candidates = 7};
+  fail_unless(lambda_search(&ws, a0, 0, 0, F0, &s0, &stats0) == -1);
+  fail_unless(s0 == 1 && stats0.n_candidates == 7);
+
+  for (u8 t = 0; t < 20; t++) {
+    double a[n];
+    for (u8 i = 0; i < n; i++) {
+      a[i] = frand(-100, 100);
+    }
+
+    double best[LAMBDA_TEST_K];
+    brute_force(&ws, Q_inv, a, LAMBDA_TEST_K, best);
+
+    double F[n * LAMBDA_TEST_K], s[LAMBDA_TEST_K];
+    lambda_stats_t stats;
+    fail_unless(lambda_search(&ws, a, LAMBDA_TEST_K, 0, F, s, &stats) == 0);
+    fail_unless(stats.n_candidates == LAMBDA_TEST_K);
+    for (u8 j = 0; j < LAMBDA_TEST_K; j++) {
+      fail_unless(fabs(s[j] - best[j]) < 1e-6 * best[j],
+                  "Candidate %u distance %f, expected %f", j, s[j], best[j]);
+      fail_unless(fabs(distance(n, Q_inv, a, &F[j*n]) - s[j]) < 1e-6 * s[j],
+                  "Candidate %u doesn't match its distance", j);
+      for (u8 i = 0; i < n; i++) {
+        fail_unless(F[j*n + i] == round(F[j*n + i]));
+      }
+    }
+    fail_unless(stats.ratio == s[1] / s[0]);
+    fail_unless(stats.success_rate > 0 && stats.success_rate <= 1);
+
+    /* A distance bound between the second and third candidates leaves two. */
+    double F2[n * LAMBDA_TEST_K], s2[LAMBDA_TEST_K];
+    lambda_stats_t stats2;
+    fail_unless(lambda_search(&ws, a, LAMBDA_TEST_K, (s[1] + s[2]) / 2,
+                              F2, s2, &stats2) == 0);
+    fail_unless(stats2.n_candidates == 2);
+    fail_unless(stats2.iterations <= stats.iterations);
+    fail_unless(memcmp(F2, F, 2 * n * sizeof(double)) == 0);
+
+    /* The original interface gives the same result. */
+    double F3[n * 2], s3[2];
+    fail_unless(lambda_solution(n, 2, a, Q, F3, s3) == 0);
+    fail_unless(memcmp(F3, F, 2 * n * sizeof(double)) == 0);
+    fail_unless(s3[0] == s[0] && s3[1] == s[1]);
+  }
+}
+END_TEST
+
+/* The reduction is unimodular and decorrelates. */
+START_TEST(test_lambda_reduction)
+{
+  u8 n = LAMBDA_TEST_N;
+  double Q[n*n];
+  seed_rng();
+  random_cov(n, Q);
+
+  u8 buff[LAMBDA_WORKSPACE_SIZE(LAMBDA_TEST_N)]
+    __attribute__((aligned(sizeof(double))));
+  lambda_workspace_t ws;
+  fail_unless(lambda_init(&ws, n, Q, buff) == 0);
+
+  double Z[n*n];
+  fail_unless(lambda_reduction(n, Q, Z) == 0);
+  fail_unless(memcmp(Z, ws.Z, sizeof(Z)) == 0);
+
+  /* Z_inv is the integer inverse of Z. */
+  double ZZ_inv[n*n];
+  matrix_multiply(n, n, n, ws.Z, ws.Z_inv, ZZ_inv);
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      fail_unless(ws.Z_inv[i*n + j] == round(ws.Z_inv[i*n + j]));
+      fail_unless(ZZ_inv[i*n + j] == (i == j));
+    }
+  }
+
+  /* Z^T Q Z = L^T D L, L unit lower triangular (column major). */
+  double QZ[n*n], Qz[n*n];
+  double Z_t[n*n];
+  matrix_transpose(n, n, ws.Z, Z_t); /* Z_t is Z in row major. */
+  matrix_multiply(n, n, n, Q, Z_t, QZ);
+  double Z_t_t[n*n];
+  matrix_transpose(n, n, Z_t, Z_t_t);
+  matrix_multiply(n, n, n, Z_t_t, QZ, Qz);
+  for (u8 i = 0; i < n; i++) {
+    for (u8 j = 0; j < n; j++) {
+      double x = 0;
+      for (u8 l = 0; l < n; l++) {
+        x += ws.L[l + i*n] * ws.D[l] * ws.L[l + j*n];
+      }
+      fail_unless(fabs(Qz[i*n + j] - x) < 1e-9,
+                  "Element (%u, %u): %f vs %f", i, j, Qz[i*n + j], x);
+    }
+  }
+
+  /* A covariance that isn't positive definite is rejected. */
+  Q[0] = -1;
+  fail_unless(lambda_init(&ws, n, Q, buff) == -1);
+}
+END_TEST
+
+Suite* lambda_suite(void)
+{
+  Suite *s = suite_create("LAMBDA");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_lambda_search);
+  tcase_add_test(tc_core, test_lambda_reduction);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
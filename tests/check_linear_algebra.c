@@ -1,11 +1,13 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 
 #include <stdio.h>
 #include "check_utils.h"
 
 #include <linear_algebra.h>
+#include <blas_check.h>
 
 #define LINALG_TOL 1e-10
 #define LINALG_NUM 22
@@ -152,6 +154,186 @@ START_TEST(test_matrix_inverse_5x5) {
 }
 END_TEST
 
+START_TEST(test_matrix_fixed_sizes) {
+  /* Sizes either side of the fixed size kernels, checked against naive
+   * reference implementations. */
+  seed_rng();
+  for (u32 n = 1; n <= 12; n++) {
+    double A[n*n], B[n*n], C[n*n], Ct[n*n], I[n*n];
+
+    for (u32 i = 0; i < n*n; i++) {
+      A[i] = mrand;
+      B[i] = mrand;
+    }
+    matrix_multiply(n, n, n, A, B, C);
+    for (u32 i = 0; i < n; i++)
+      for (u32 j = 0; j < n; j++) {
+        double c = 0;
+        for (u32 k = 0; k < n; k++)
+          c += A[n*i + k] * B[n*k + j];
+        fail_unless(fabs(C[n*i + j] - c) < LINALG_TOL * fabs(c) + LINALG_TOL,
+                    "n = %u: product differs at (%u, %u)", n, i, j);
+      }
+
+    matrix_transpose(n, n, C, Ct);
+    for (u32 i = 0; i < n; i++)
+      for (u32 j = 0; j < n; j++)
+        fail_unless(Ct[n*j + i] == C[n*i + j],
+                    "n = %u: transpose differs at (%u, %u)", n, i, j);
+
+    /* Diagonally dominant so the inverse is well conditioned. */
+    for (u32 i = 0; i < n; i++)
+      A[n*i + i] += n * MATRIX_MAX;
+    fail_unless(matrix_inverse(n, A, B) == 0, "n = %u: inverse failed", n);
+    matrix_multiply(n, n, n, A, B, I);
+    for (u32 i = 0; i < n; i++)
+      for (u32 j = 0; j < n; j++)
+        fail_unless(fabs(I[n*i + j] - (i == j)) < LINALG_TOL,
+                    "n = %u: A * inv(A) differs from identity at (%u, %u)",
+                    n, i, j);
+
+    /* Symmetric positive definite matrix A^T A for UDU. */
+    double M[n*n], M_orig[n*n], U[n*n], D[n], M_rec[n*n];
+    matrix_transpose(n, n, A, Ct);
+    matrix_multiply(n, n, n, Ct, A, M);
+    memcpy(M_orig, M, sizeof(M));
+    matrix_udu(n, M, U, D);
+    matrix_reconstruct_udu(n, U, D, M_rec);
+    for (u32 i = 0; i < n*n; i++)
+      fail_unless(fabs(M_rec[i] - M_orig[i]) < 1e-9 * fabs(M_orig[i]) + 1e-6,
+                  "n = %u: UDU reconstruction differs at %u", n, i);
+  }
+}
+END_TEST
+
+/* Random well conditioned symmetric positive definite matrix. */
+static void random_spd(u32 n, double *M) {
+  double A[n*n];
+  for (u32 i = 0; i < n*n; i++)
+    A[i] = frand(-1, 1);
+  for (u32 i = 0; i < n; i++)
+    for (u32 j = 0; j < n; j++) {
+      M[n*i + j] = (i == j) ? n : 0;
+      for (u32 k = 0; k < n; k++)
+        M[n*i + j] += A[n*k + i] * A[n*k + j];
+    }
+}
+
+START_TEST(test_matrix_cholesky) {
+  seed_rng();
+  for (u32 n = 1; n <= 12; n++) {
+    double M[n*n], L[n*n], LD[n*n], D[n], Minv[n*n], Minv_gj[n*n];
+    double b[n], x[n], x_ldl[n], x_gj[n];
+
+    random_spd(n, M);
+    for (u32 i = 0; i < n; i++)
+      b[i] = frand(-10, 10);
+
+    fail_unless(matrix_cholesky(n, M, L) == 0, "n = %u: factor failed", n);
+    for (u32 i = 0; i < n; i++)
+      for (u32 j = 0; j < n; j++) {
+        if (j > i)
+          fail_unless(L[n*i + j] == 0, "n = %u: L not lower triangular", n);
+        double m = 0;
+        for (u32 k = 0; k < n; k++)
+          m += L[n*i + k] * L[n*j + k];
+        fail_unless(fabs(m - M[n*i + j]) < LINALG_TOL,
+                    "n = %u: L L^T differs at (%u, %u)", n, i, j);
+      }
+
+    /* Solve and inverse agree with the Gauss-Jordan path. */
+    fail_unless(matrix_inverse(n, M, Minv_gj) == 0);
+    matrix_multiply(n, n, 1, Minv_gj, b, x_gj);
+    matrix_cholesky_solve(n, L, b, x);
+    matrix_cholesky_inverse(n, L, Minv);
+    fail_unless(matrix_ldl(n, M, LD, D) == 0, "n = %u: LDL failed", n);
+    matrix_ldl_solve(n, LD, D, b, x_ldl);
+    for (u32 i = 0; i < n; i++) {
+      fail_unless(fabs(x[i] - x_gj[i]) < LINALG_TOL,
+                  "n = %u: Cholesky solve differs at %u", n, i);
+      fail_unless(fabs(x_ldl[i] - x_gj[i]) < LINALG_TOL,
+                  "n = %u: LDL solve differs at %u", n, i);
+    }
+    for (u32 i = 0; i < n*n; i++)
+      fail_unless(fabs(Minv[i] - Minv_gj[i]) < LINALG_TOL,
+                  "n = %u: Cholesky inverse differs at %u", n, i);
+
+    /* In place factoring and solving. */
+    double Mc[n*n];
+    memcpy(Mc, M, sizeof(Mc));
+    matrix_cholesky(n, Mc, Mc);
+    memcpy(x, b, sizeof(x));
+    matrix_cholesky_solve(n, Mc, x, x);
+    for (u32 i = 0; i < n; i++)
+      fail_unless(fabs(x[i] - x_gj[i]) < LINALG_TOL);
+
+    /* Rank-one update and downdate match refactoring. */
+    double v[n], u[n], M2[n*n], L2[n*n];
+    for (u32 i = 0; i < n; i++)
+      v[i] = frand(-1, 1);
+    for (u32 i = 0; i < n; i++)
+      for (u32 j = 0; j < n; j++)
+        M2[n*i + j] = M[n*i + j] + v[i] * v[j];
+    matrix_cholesky(n, M2, L2);
+    memcpy(u, v, sizeof(u));
+    matrix_cholesky_update(n, L, u);
+    for (u32 i = 0; i < n*n; i++)
+      fail_unless(fabs(L[i] - L2[i]) < LINALG_TOL,
+                  "n = %u: update differs at %u", n, i);
+    memcpy(u, v, sizeof(u));
+    fail_unless(matrix_cholesky_downdate(n, L, u) == 0);
+    matrix_cholesky(n, M, L2);
+    for (u32 i = 0; i < n*n; i++)
+      fail_unless(fabs(L[i] - L2[i]) < LINALG_TOL,
+                  "n = %u: downdate differs at %u", n, i);
+  }
+
+  /* Indefinite and singular matrices are rejected. */
+  double I[9] = {1, 0, 0, 0, -1, 0, 0, 0, 1};
+  double L[9], D[3];
+  fail_unless(matrix_cholesky(3, I, L) < 0);
+  fail_unless(matrix_ldl(3, I, L, D) < 0);
+  double S[4] = {1, 1, 1, 1};
+  fail_unless(matrix_cholesky(2, S, L) < 0);
+  double x[2] = {1, 1};
+  double L1[4] = {1, 0, 0, 1};
+  fail_unless(matrix_cholesky_downdate(2, L1, x) < 0);
+}
+END_TEST
+
+START_TEST(test_matrix_pseudoinverse) {
+  seed_rng();
+  for (u32 t = 0; t < LINALG_NUM; t++) {
+    /* Overdetermined: B A = I. */
+    double A[8*4], B[4*8], I[4*4];
+    for (u32 i = 0; i < 8*4; i++)
+      A[i] = frand(-1, 1);
+    fail_unless(matrix_pseudoinverse(8, 4, A, B) == 0);
+    matrix_multiply(4, 8, 4, B, A, I);
+    for (u32 i = 0; i < 4; i++)
+      for (u32 j = 0; j < 4; j++)
+        fail_unless(fabs(I[4*i + j] - (i == j)) < LINALG_TOL,
+                    "B A differs from identity at (%u, %u)", i, j);
+
+    /* Underdetermined: A B = I. */
+    double At[4*8], Bt[8*4];
+    matrix_transpose(8, 4, A, At);
+    fail_unless(matrix_pseudoinverse(4, 8, At, Bt) == 0);
+    matrix_multiply(4, 8, 4, At, Bt, I);
+    for (u32 i = 0; i < 4; i++)
+      for (u32 j = 0; j < 4; j++)
+        fail_unless(fabs(I[4*i + j] - (i == j)) < LINALG_TOL,
+                    "A B differs from identity at (%u, %u)", i, j);
+  }
+}
+END_TEST
+
+START_TEST(test_blas_self_check) {
+  s8 ret = blas_self_check();
+  fail_unless(ret == 0, "BLAS/LAPACK self check failed (%d)", ret);
+}
+END_TEST
+
 START_TEST(test_matrix_eye)
 {
   double M[10][10];
@@ -703,6 +885,10 @@ Suite* linear_algebra_suite(void) {
   tcase_add_test(tc_core, test_matrix_inverse_3x3);
   tcase_add_test(tc_core, test_matrix_inverse_4x4);
   tcase_add_test(tc_core, test_matrix_inverse_5x5);
+  tcase_add_test(tc_core, test_matrix_fixed_sizes);
+  tcase_add_test(tc_core, test_matrix_cholesky);
+  tcase_add_test(tc_core, test_matrix_pseudoinverse);
+  tcase_add_test(tc_core, test_blas_self_check);
 
   tcase_add_test(tc_core, test_vector_dot);
   tcase_add_test(tc_core, test_vector_mean);
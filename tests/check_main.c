@@ -18,9 +18,17 @@ int main(void)
   srunner_add_suite(sr, rtcm3_suite());
   srunner_add_suite(sr, bits_suite());
   srunner_add_suite(sr, memory_pool_suite());
+  srunner_add_suite(sr, hypothesis_store_suite());
+  srunner_add_suite(sr, parallel_suite());
   srunner_add_suite(sr, sbp_suite());
   srunner_add_suite(sr, coord_system_suite());
   srunner_add_suite(sr, linear_algebra_suite());
+  srunner_add_suite(sr, dd_cov_suite());
+  srunner_add_suite(sr, lambda_suite());
+  srunner_add_suite(sr, pvt_suite());
+  srunner_add_suite(sr, tropo_suite());
+  srunner_add_suite(sr, gpstime_suite());
+  srunner_add_suite(sr, baseline_qr_suite());
 
   srunner_set_fork_status(sr, CK_NOFORK);
   srunner_run_all(sr, CK_NORMAL);
@@ -0,0 +1,57 @@
+#include <check.h>
+#include <string.h>
+
+#include <parallel.h>
+
+#define TEST_TASKS 1000
+
+static void count_task(void *arg, u32 task)
+{
+  u32 *counts = (u32 *)arg;
+  counts[task]++;
+}
+
+START_TEST(test_parallel_for)
+{
+  u8 n_threads[] = {1, 2, 4, PARALLEL_MAX_THREADS};
+  for (u8 t = 0; t < sizeof(n_threads); t++) {
+    fail_unless(parallel_init(n_threads[t]) == 0);
+    fail_unless(parallel_n_threads() == n_threads[t]);
+
+    /* Run a few times to check the pool can be reused. */
+    for (u32 n_tasks = 0; n_tasks < TEST_TASKS; n_tasks = 3*n_tasks + 1) {
+      u32 counts[TEST_TASKS];
+      memset(counts, 0, sizeof(counts));
+      parallel_for(n_tasks, count_task, counts);
+      for (u32 i = 0; i < TEST_TASKS; i++) {
+        fail_unless(counts[i] == (i < n_tasks),
+                    "Task %u of %u ran %u times with %u threads",
+                    i, n_tasks, counts[i], n_threads[t]);
+      }
+    }
+  }
+
+  parallel_deinit();
+  fail_unless(parallel_n_threads() == 1);
+}
+END_TEST
+
+START_TEST(test_parallel_init_range)
+{
+  fail_unless(parallel_init(0) == -1);
+  fail_unless(parallel_init(PARALLEL_MAX_THREADS + 1) == -1);
+  fail_unless(parallel_n_threads() == 1);
+}
+END_TEST
+
+Suite* parallel_suite(void)
+{
+  Suite *s = suite_create("Parallel");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_parallel_for);
+  tcase_add_test(tc_core, test_parallel_init_range);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
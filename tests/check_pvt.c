@@ -0,0 +1,636 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <check.h>
+#include "check_utils.h"
+
+#include <pvt.h>
+#include <pvt_kf.h>
+#include <constants.h>
+#include <coord_system.h>
+#include <linear_algebra.h>
+#include <tropo.h>
+
+#define NUM_TEST_SATS 8
+
+/* Maximum allowable error in the solved position (in meters). */
+#define MAX_POS_ERROR_M 1e-4
+
+/* Elevation and azimuth of the simulated satellites [deg]. */
+static const double sat_azel[NUM_TEST_SATS][2] = {
+  {0, 75}, {45, 30}, {100, 55}, {160, 20},
+  {210, 40}, {270, 15}, {315, 60}, {20, 10},
+};
+
+/* Simulate navigation measurements as seen by a stationary receiver at
+ * `rx_ecef` with a receiver clock error of `clock_m` meters. Pseudoranges are
+ * generated with the same Earth rotation model used by the solver so that a
+ * converged solution should recover `rx_ecef` exactly. */
+static void simulate_nav_meas(const double rx_ecef[3], double clock_m,
+                              u8 n, navigation_measurement_t *nav_meas)
+{
+  memset(nav_meas, 0, n * sizeof(navigation_measurement_t));
+
+  for (u8 i=0; i<n; i++) {
+    double az = sat_azel[i][0] * D2R;
+    double el = sat_azel[i][1] * D2R;
+    double ned[3] = {
+      20200e3 * cos(el) * cos(az),
+      20200e3 * cos(el) * sin(az),
+      -20200e3 * sin(el),
+    };
+    wgsned2ecef_d(ned, rx_ecef, nav_meas[i].sat_pos);
+
+    double tempv[3];
+    vector_subtract(3, rx_ecef, nav_meas[i].sat_pos, tempv);
+    double wEtau = GPS_OMEGAE_DOT * vector_norm(3, tempv) / GPS_C;
+    double sat_rot[3] = {
+      nav_meas[i].sat_pos[0] + wEtau * nav_meas[i].sat_pos[1],
+      nav_meas[i].sat_pos[1] - wEtau * nav_meas[i].sat_pos[0],
+      nav_meas[i].sat_pos[2],
+    };
+    vector_subtract(3, sat_rot, rx_ecef, tempv);
+
+    nav_meas[i].pseudorange = vector_norm(3, tempv) + clock_m;
+    nav_meas[i].raw_pseudorange = nav_meas[i].pseudorange;
+    nav_meas[i].snr = 1e4;
+    nav_meas[i].prn = i;
+    nav_meas[i].tot.wn = 1800;
+    nav_meas[i].tot.tow = 100000;
+  }
+}
+
+/* Error of a solution's position and velocity. gnss_solution is packed, so
+ * its members are read element by element rather than passed by pointer. */
+static void pos_error(const gnss_solution *soln, const double ecef[3],
+                      double err[3])
+{
+  for (u8 i=0; i<3; i++) {
+    err[i] = soln->pos_ecef[i] - ecef[i];
+  }
+}
+
+static void vel_error(const gnss_solution *soln, const double vel[3],
+                      double err[3])
+{
+  for (u8 i=0; i<3; i++) {
+    err[i] = soln->vel_ecef[i] - vel[i];
+  }
+}
+
+static const double rx_llhs[][3] = {
+  {37.779804*D2R, -122.391751*D2R, 60.0},
+  {-33.8688*D2R, 151.2093*D2R, 20.0},
+  {51.5074*D2R, -0.1278*D2R, 35.0},
+  {64.1466*D2R, -21.9426*D2R, 500.0},
+};
+#define NUM_RX (sizeof(rx_llhs) / sizeof(rx_llhs[0]))
+
+START_TEST(test_calc_pvt_solver)
+{
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llhs[0], rx_ecef);
+
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx_ecef, 1234.5, NUM_TEST_SATS, nav_meas);
+
+  pvt_solver_t solver;
+  pvt_solver_init(&solver);
+  gnss_solution soln;
+  dops_t dops;
+
+  s8 ret = calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas, &soln, &dops);
+  fail_unless(ret == 0, "calc_PVT_solver returned %d", ret);
+  fail_unless(soln.valid == 1);
+  fail_unless(soln.n_used == NUM_TEST_SATS);
+
+  for (u8 i=0; i<3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - rx_ecef[i]) < MAX_POS_ERROR_M,
+                "Position error %g m in axis %u",
+                soln.pos_ecef[i] - rx_ecef[i], i);
+    fail_unless(fabs(soln.vel_ecef[i]) < 1e-6);
+  }
+  fail_unless(fabs(soln.clock_offset * GPS_C - 1234.5) < MAX_POS_ERROR_M);
+  fail_unless(dops.pdop > 0 && dops.pdop < 10);
+}
+END_TEST
+
+START_TEST(test_calc_pvt_wrapper)
+{
+  /* calc_PVT() should give the same answer as a fresh solver instance. */
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llhs[1], rx_ecef);
+
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx_ecef, -50.0, NUM_TEST_SATS, nav_meas);
+
+  pvt_solver_t solver;
+  pvt_solver_init(&solver);
+  gnss_solution soln, soln_wrapper;
+  dops_t dops, dops_wrapper;
+
+  fail_unless(calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas,
+                              &soln, &dops) == 0);
+  fail_unless(calc_PVT(NUM_TEST_SATS, nav_meas,
+                       &soln_wrapper, &dops_wrapper) == 0);
+
+  for (u8 i=0; i<3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - soln_wrapper.pos_ecef[i])
+                < MAX_POS_ERROR_M);
+  }
+}
+END_TEST
+
+START_TEST(test_calc_pvt_solver_independent)
+{
+  /* Solving for one receiver must not disturb the warm start of another. */
+  pvt_solver_t solvers[2];
+  navigation_measurement_t nav_meas[2][NUM_TEST_SATS];
+  double rx_ecef[2][3];
+
+  for (u8 r=0; r<2; r++) {
+    pvt_solver_init(&solvers[r]);
+    wgsllh2ecef(rx_llhs[r+2], rx_ecef[r]);
+    simulate_nav_meas(rx_ecef[r], 10.0*r, NUM_TEST_SATS, nav_meas[r]);
+  }
+
+  gnss_solution soln;
+  dops_t dops;
+  fail_unless(calc_PVT_solver(&solvers[0], NUM_TEST_SATS, nav_meas[0],
+                              &soln, &dops) == 0);
+  double warm_start[8];
+  memcpy(warm_start, solvers[0].rx_state, sizeof(warm_start));
+
+  fail_unless(calc_PVT_solver(&solvers[1], NUM_TEST_SATS, nav_meas[1],
+                              &soln, &dops) == 0);
+  fail_unless(memcmp(warm_start, solvers[0].rx_state,
+                     sizeof(warm_start)) == 0,
+              "Solver state was modified by another instance");
+
+  for (u8 i=0; i<3; i++) {
+    fail_unless(fabs(solvers[0].rx_state[i] - rx_ecef[0][i])
+                < MAX_POS_ERROR_M);
+    fail_unless(fabs(solvers[1].rx_state[i] - rx_ecef[1][i])
+                < MAX_POS_ERROR_M);
+  }
+}
+END_TEST
+
+typedef struct {
+  u8 rx;
+  u32 n_failed;
+} pvt_thread_arg_t;
+
+static void *pvt_thread(void *arg_)
+{
+  pvt_thread_arg_t *arg = (pvt_thread_arg_t *)arg_;
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llhs[arg->rx], rx_ecef);
+
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx_ecef, 100.0*arg->rx, NUM_TEST_SATS, nav_meas);
+
+  pvt_solver_t solver;
+  pvt_solver_init(&solver);
+  gnss_solution soln;
+  dops_t dops;
+
+  arg->n_failed = 0;
+  for (u32 k=0; k<200; k++) {
+    if (calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas, &soln, &dops) != 0 ||
+        fabs(soln.pos_ecef[0] - rx_ecef[0]) > MAX_POS_ERROR_M ||
+        fabs(soln.pos_ecef[1] - rx_ecef[1]) > MAX_POS_ERROR_M ||
+        fabs(soln.pos_ecef[2] - rx_ecef[2]) > MAX_POS_ERROR_M) {
+      arg->n_failed++;
+    }
+  }
+  return NULL;
+}
+
+START_TEST(test_calc_pvt_solver_threads)
+{
+  pthread_t threads[NUM_RX];
+  pvt_thread_arg_t args[NUM_RX];
+
+  for (u8 r=0; r<NUM_RX; r++) {
+    args[r].rx = r;
+    fail_unless(pthread_create(&threads[r], NULL, pvt_thread, &args[r]) == 0);
+  }
+  for (u8 r=0; r<NUM_RX; r++) {
+    pthread_join(threads[r], NULL);
+    fail_unless(args[r].n_failed == 0,
+                "Receiver %u had %u bad solutions", r, args[r].n_failed);
+  }
+}
+END_TEST
+
+START_TEST(test_calc_pvt_batch)
+{
+  /* Not a multiple of PVT_BATCH_LANES to exercise a partial block. */
+  #define N_EPOCHS (2*PVT_BATCH_LANES + 3)
+  navigation_measurement_t nav_meas[N_EPOCHS][NUM_TEST_SATS];
+  const navigation_measurement_t *nav_meas_ptrs[N_EPOCHS];
+  u8 n_used[N_EPOCHS];
+  gnss_solution solns[N_EPOCHS];
+  dops_t dops[N_EPOCHS];
+  s8 ret[N_EPOCHS];
+
+  seed_rng();
+  for (u32 k=0; k<N_EPOCHS; k++) {
+    double rx_ecef[3];
+    wgsllh2ecef(rx_llhs[k % NUM_RX], rx_ecef);
+    simulate_nav_meas(rx_ecef, 10.0*k, NUM_TEST_SATS, nav_meas[k]);
+    for (u8 i=0; i<NUM_TEST_SATS; i++) {
+      nav_meas[k][i].doppler = frand(-500, 500);
+    }
+    nav_meas_ptrs[k] = nav_meas[k];
+    n_used[k] = NUM_TEST_SATS - (k % 3);
+  }
+  /* Too few satellites to solve. */
+  n_used[5] = 3;
+
+  u32 n_valid = calc_PVT_batch(N_EPOCHS, n_used, nav_meas_ptrs, NULL,
+                               solns, dops, ret);
+  fail_unless(n_valid == N_EPOCHS - 1,
+              "Expected %u valid solutions, got %u", N_EPOCHS - 1, n_valid);
+  fail_unless(ret[5] == -4);
+  fail_unless(solns[5].valid == 0);
+
+  for (u32 k=0; k<N_EPOCHS; k++) {
+    if (k == 5) {
+      continue;
+    }
+    pvt_solver_t solver;
+    pvt_solver_init(&solver);
+    gnss_solution soln;
+    dops_t dop;
+    s8 r = calc_PVT_solver(&solver, n_used[k], nav_meas[k], &soln, &dop);
+
+    fail_unless(ret[k] == r, "Epoch %u: batch returned %d, expected %d",
+                k, ret[k], r);
+    fail_unless(solns[k].valid == 1);
+    fail_unless(solns[k].n_used == n_used[k]);
+    for (u8 i=0; i<3; i++) {
+      fail_unless(fabs(solns[k].pos_ecef[i] - soln.pos_ecef[i])
+                  < MAX_POS_ERROR_M);
+      fail_unless(fabs(solns[k].vel_ecef[i] - soln.vel_ecef[i]) < 1e-6,
+                  "Epoch %u: velocity mismatch %g", k,
+                  solns[k].vel_ecef[i] - soln.vel_ecef[i]);
+    }
+    fail_unless(within_epsilon(dops[k].gdop, dop.gdop));
+    fail_unless(within_epsilon(dops[k].hdop, dop.hdop));
+    fail_unless(fabs(solns[k].clock_offset - soln.clock_offset) < 1e-12);
+  }
+  #undef N_EPOCHS
+}
+END_TEST
+
+START_TEST(test_calc_pvt_batch_solvers)
+{
+  /* With solver instances supplied the batch should keep the warm start up
+   * to date as calc_PVT_solver() would. */
+  navigation_measurement_t nav_meas[NUM_RX][NUM_TEST_SATS];
+  const navigation_measurement_t *nav_meas_ptrs[NUM_RX];
+  u8 n_used[NUM_RX];
+  pvt_solver_t solvers[NUM_RX];
+  gnss_solution solns[NUM_RX];
+  dops_t dops[NUM_RX];
+  s8 ret[NUM_RX];
+  double rx_ecef[NUM_RX][3];
+
+  for (u8 r=0; r<NUM_RX; r++) {
+    wgsllh2ecef(rx_llhs[r], rx_ecef[r]);
+    simulate_nav_meas(rx_ecef[r], 0, NUM_TEST_SATS, nav_meas[r]);
+    nav_meas_ptrs[r] = nav_meas[r];
+    n_used[r] = NUM_TEST_SATS;
+    pvt_solver_init(&solvers[r]);
+  }
+
+  for (u8 n=0; n<2; n++) {
+    fail_unless(calc_PVT_batch(NUM_RX, n_used, nav_meas_ptrs, solvers,
+                               solns, dops, ret) == NUM_RX);
+    for (u8 r=0; r<NUM_RX; r++) {
+      for (u8 i=0; i<3; i++) {
+        fail_unless(fabs(solvers[r].rx_state[i] - rx_ecef[r][i])
+                    < MAX_POS_ERROR_M);
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_pvt_bancroft)
+{
+  for (u8 r=0; r<NUM_RX; r++) {
+    double rx_ecef[3];
+    wgsllh2ecef(rx_llhs[r], rx_ecef);
+
+    navigation_measurement_t nav_meas[NUM_TEST_SATS];
+    simulate_nav_meas(rx_ecef, 3e5, NUM_TEST_SATS, nav_meas);
+
+    double init[4];
+    fail_unless(pvt_bancroft(NUM_TEST_SATS, nav_meas, init) == 0);
+    /* Earth rotation is not modelled so only expect to be close. */
+    double err[3];
+    vector_subtract(3, init, rx_ecef, err);
+    fail_unless(vector_norm(3, err) < 100,
+                "Bancroft position error %g m", vector_norm(3, err));
+    fail_unless(fabs(init[3] - 3e5) < 100,
+                "Bancroft clock error %g m", init[3] - 3e5);
+
+    /* Minimum number of measurements. */
+    fail_unless(pvt_bancroft(4, nav_meas, init) == 0);
+    vector_subtract(3, init, rx_ecef, err);
+    fail_unless(vector_norm(3, err) < 100);
+    fail_unless(pvt_bancroft(3, nav_meas, init) == -1);
+  }
+}
+END_TEST
+
+START_TEST(test_pvt_init_policy)
+{
+  double rx_ecef[2][3];
+  navigation_measurement_t nav_meas[2][NUM_TEST_SATS];
+  for (u8 r=0; r<2; r++) {
+    wgsllh2ecef(rx_llhs[r], rx_ecef[r]);
+    simulate_nav_meas(rx_ecef[r], 0, NUM_TEST_SATS, nav_meas[r]);
+  }
+
+  gnss_solution soln;
+  dops_t dops;
+  pvt_solver_t warm, bancroft, automatic;
+  pvt_solver_init(&warm);
+  pvt_solver_init(&bancroft);
+  pvt_solver_init(&automatic);
+  warm.init_policy = PVT_INIT_WARM;
+  bancroft.init_policy = PVT_INIT_BANCROFT;
+
+  /* Cold start, then a static re-solve, then a jump to the other side of
+   * the world. */
+  const u8 sequence[3] = {0, 0, 1};
+  for (u8 n=0; n<3; n++) {
+    const navigation_measurement_t *m = nav_meas[sequence[n]];
+    fail_unless(calc_PVT_solver(&warm, NUM_TEST_SATS, m, &soln, &dops) == 0);
+    fail_unless(calc_PVT_solver(&bancroft, NUM_TEST_SATS, m,
+                                &soln, &dops) == 0);
+    fail_unless(calc_PVT_solver(&automatic, NUM_TEST_SATS, m,
+                                &soln, &dops) == 0);
+    for (u8 i=0; i<3; i++) {
+      fail_unless(fabs(soln.pos_ecef[i] - rx_ecef[sequence[n]][i])
+                  < MAX_POS_ERROR_M);
+    }
+
+    if (n != 1) {
+      /* Bancroft should save iterations over starting far away. */
+      fail_unless(bancroft.stats.last_iterations
+                  < warm.stats.last_iterations,
+                  "Bancroft took %u iterations, warm start took %u",
+                  bancroft.stats.last_iterations,
+                  warm.stats.last_iterations);
+      fail_unless(automatic.stats.last_iterations
+                  == bancroft.stats.last_iterations);
+    } else {
+      /* A good warm start should need no more than the Bancroft start. */
+      fail_unless(automatic.stats.last_iterations
+                  <= bancroft.stats.last_iterations);
+    }
+  }
+
+  fail_unless(warm.stats.n_solves == 3);
+  fail_unless(warm.stats.n_failed == 0);
+  fail_unless(warm.stats.n_bancroft == 0);
+  fail_unless(bancroft.stats.n_bancroft == 3);
+  fail_unless(automatic.stats.n_bancroft == 2,
+              "Auto policy used Bancroft %u times",
+              automatic.stats.n_bancroft);
+  fail_unless(warm.stats.max_iterations >= warm.stats.last_iterations);
+  fail_unless(automatic.stats.total_iterations
+              < warm.stats.total_iterations);
+
+  /* Failed solves are counted. */
+  fail_unless(calc_PVT_solver(&automatic, 3, nav_meas[0], &soln, &dops) < 0);
+  fail_unless(automatic.stats.n_solves == 4);
+  fail_unless(automatic.stats.n_failed == 1);
+}
+END_TEST
+
+START_TEST(test_calc_pvt_wls_tropo)
+{
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llhs[0], rx_ecef);
+
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx_ecef, 0, NUM_TEST_SATS, nav_meas);
+  tropo_model_t tropo;
+  tropo_model_init(&tropo, rx_llhs[0][0], rx_llhs[0][2],
+                   gps_day_of_year(nav_meas[0].tot));
+  for (u8 i=0; i<NUM_TEST_SATS; i++) {
+    double az, el;
+    wgsecef2azel(nav_meas[i].sat_pos, rx_ecef, &az, &el);
+    nav_meas[i].pseudorange += tropo_model_correction(&tropo, el);
+    nav_meas[i].snr = 1e3 * (i + 1);
+  }
+
+  const pvt_weighting_t weightings[3] = {
+    PVT_WEIGHT_NONE, PVT_WEIGHT_ELEVATION, PVT_WEIGHT_SNR
+  };
+
+  for (u8 k=0; k<3; k++) {
+    pvt_solver_t solver;
+    gnss_solution soln;
+    dops_t dops;
+    double err[3];
+
+    /* Without the correction the troposphere biases the solution. */
+    pvt_solver_init(&solver);
+    solver.weighting = weightings[k];
+    fail_unless(calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas,
+                                &soln, &dops) == 0);
+    pos_error(&soln, rx_ecef, err);
+    fail_unless(vector_norm(3, err) > 1,
+                "Weighting %u: expected tropo error, got %g m",
+                k, vector_norm(3, err));
+
+    pvt_solver_init(&solver);
+    solver.weighting = weightings[k];
+    solver.tropo = 1;
+    fail_unless(calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas,
+                                &soln, &dops) == 0);
+    pos_error(&soln, rx_ecef, err);
+    fail_unless(vector_norm(3, err) < 1e-3,
+                "Weighting %u: position error %g m",
+                k, vector_norm(3, err));
+  }
+}
+END_TEST
+
+START_TEST(test_calc_pvt_raim)
+{
+  double rx_ecef[3];
+  wgsllh2ecef(rx_llhs[1], rx_ecef);
+
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx_ecef, 20, NUM_TEST_SATS, nav_meas);
+
+  /* Noise within pr_sigma should not raise an alarm. */
+  seed_rng();
+  for (u8 i=0; i<NUM_TEST_SATS; i++) {
+    nav_meas[i].pseudorange += frand(-1, 1);
+  }
+
+  pvt_solver_t solver;
+  gnss_solution soln;
+  dops_t dops;
+  double err[3];
+
+  pvt_solver_init(&solver);
+  solver.raim = 1;
+  fail_unless(calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas,
+                              &soln, &dops) == 0);
+  fail_unless(solver.excluded_prn == -1);
+  fail_unless(soln.n_used == NUM_TEST_SATS);
+
+  /* A large error on one satellite should be found and excluded. */
+  for (u8 bad=0; bad<NUM_TEST_SATS; bad++) {
+    simulate_nav_meas(rx_ecef, 20, NUM_TEST_SATS, nav_meas);
+    nav_meas[bad].pseudorange += 300;
+
+    pvt_solver_init(&solver);
+    fail_unless(calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas,
+                                &soln, &dops) == 0);
+    pos_error(&soln, rx_ecef, err);
+    fail_unless(vector_norm(3, err) > 10);
+
+    pvt_solver_init(&solver);
+    solver.raim = 1;
+    s8 ret = calc_PVT_solver(&solver, NUM_TEST_SATS, nav_meas, &soln, &dops);
+    fail_unless(ret == 0, "calc_PVT_solver returned %d", ret);
+    fail_unless(solver.excluded_prn == nav_meas[bad].prn,
+                "Excluded PRN %d, expected %u",
+                solver.excluded_prn, nav_meas[bad].prn);
+    fail_unless(soln.n_used == NUM_TEST_SATS - 1);
+    fail_unless(solver.stats.n_exclusions == 1);
+    pos_error(&soln, rx_ecef, err);
+    fail_unless(vector_norm(3, err) < 1e-3,
+                "Position error after exclusion %g m", vector_norm(3, err));
+  }
+
+  /* With five satellites a fault can be detected but not excluded. */
+  simulate_nav_meas(rx_ecef, 20, NUM_TEST_SATS, nav_meas);
+  nav_meas[2].pseudorange += 300;
+  pvt_solver_init(&solver);
+  solver.raim = 1;
+  fail_unless(calc_PVT_solver(&solver, 5, nav_meas, &soln, &dops)
+              == PVT_RAIM_ALARM);
+  fail_unless(soln.valid == 0);
+  fail_unless(solver.stats.n_raim_alarms == 1);
+}
+END_TEST
+
+START_TEST(test_pvt_kf)
+{
+  /* Receiver moving at constant velocity with a drifting clock, 10 Hz. */
+  double rx0_ecef[3], rx_ecef[3];
+  wgsllh2ecef(rx_llhs[0], rx0_ecef);
+  const double vel_ned[3] = {20, -10, 0.5};
+  double vel_ecef[3];
+  wgsned2ecef(vel_ned, rx0_ecef, vel_ecef);
+  const double clock0 = 1e4, drift = 50;
+
+  pvt_kf_t kf;
+  pvt_kf_init(&kf, 1.0, 25.0, 0.01);
+
+  seed_rng();
+  gnss_solution soln;
+  dops_t dops;
+  double max_late_err = 0;
+
+  for (u32 k=0; k<200; k++) {
+    double t = 0.1 * k;
+    for (u8 i=0; i<3; i++) {
+      rx_ecef[i] = rx0_ecef[i] + vel_ecef[i] * t;
+    }
+    double clock = clock0 + drift * t;
+
+    navigation_measurement_t nav_meas[NUM_TEST_SATS];
+    simulate_nav_meas(rx_ecef, clock, NUM_TEST_SATS, nav_meas);
+    for (u8 i=0; i<NUM_TEST_SATS; i++) {
+      double los[3];
+      vector_subtract(3, nav_meas[i].sat_pos, rx_ecef, los);
+      vector_normalize(3, los);
+      double rr = -vector_dot(3, los, vel_ecef) + drift;
+      nav_meas[i].doppler = -rr * GPS_L1_HZ / GPS_C;
+      nav_meas[i].pseudorange += frand(-3, 3);
+      /* Transmit time such that the receiver time is 100000 + t. */
+      nav_meas[i].tot.tow = 100000 + t
+                            - (nav_meas[i].pseudorange - clock) / GPS_C;
+    }
+
+    s8 ret = pvt_kf_update(&kf, NUM_TEST_SATS, nav_meas, &soln, &dops);
+    fail_unless(ret == 0, "Epoch %u: pvt_kf_update returned %d", k, ret);
+    fail_unless(soln.valid == 1);
+    fail_unless(fabs(soln.time.tow - (100000 + t)) < 1e-6);
+
+    if (k >= 100) {
+      double err[3];
+      pos_error(&soln, rx_ecef, err);
+      max_late_err = fmax(max_late_err, vector_norm(3, err));
+      vel_error(&soln, vel_ecef, err);
+      fail_unless(vector_norm(3, err) < 0.1,
+                  "Epoch %u: velocity error %g m/s", k, vector_norm(3, err));
+    }
+  }
+
+  /* Filtering should do much better than the 3 m snapshot noise. */
+  fail_unless(max_late_err < 1.0, "Position error %g m", max_late_err);
+  fail_unless(soln.err_cov[0] > 0 && soln.err_cov[0] < 1.0);
+  fail_unless(fabs(soln.clock_bias * GPS_C - drift) < 0.1);
+
+  /* An epoch without measurements leaves the filter as it was. */
+  pvt_kf_t kf_prior = kf;
+  gnss_solution soln_prior = soln;
+  fail_unless(pvt_kf_update(&kf, 0, NULL, &soln, &dops)
+              == PVT_KF_NO_MEASUREMENTS);
+  fail_unless(memcmp(&kf, &kf_prior, sizeof(kf)) == 0);
+  fail_unless(soln.valid == 0);
+  fail_unless(memcmp(soln.pos_ecef, soln_prior.pos_ecef,
+                     sizeof(soln.pos_ecef)) == 0);
+  fail_unless(gpsdifftime(soln.time, soln_prior.time) == 0);
+
+  /* A large gap in the data restarts the filter. */
+  navigation_measurement_t nav_meas[NUM_TEST_SATS];
+  simulate_nav_meas(rx0_ecef, clock0, NUM_TEST_SATS, nav_meas);
+  for (u8 i=0; i<NUM_TEST_SATS; i++) {
+    nav_meas[i].tot.tow = 101000;
+  }
+  fail_unless(pvt_kf_update(&kf, NUM_TEST_SATS, nav_meas, &soln, &dops) == 0);
+  for (u8 i=0; i<3; i++) {
+    fail_unless(fabs(soln.pos_ecef[i] - rx0_ecef[i]) < MAX_POS_ERROR_M);
+  }
+}
+END_TEST
+
+Suite* pvt_suite(void)
+{
+  Suite *s = suite_create("PVT");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_calc_pvt_solver);
+  tcase_add_test(tc_core, test_calc_pvt_wrapper);
+  tcase_add_test(tc_core, test_calc_pvt_solver_independent);
+  tcase_add_test(tc_core, test_calc_pvt_solver_threads);
+  tcase_add_test(tc_core, test_calc_pvt_batch);
+  tcase_add_test(tc_core, test_calc_pvt_batch_solvers);
+  tcase_add_test(tc_core, test_pvt_bancroft);
+  tcase_add_test(tc_core, test_pvt_init_policy);
+  tcase_add_test(tc_core, test_calc_pvt_wls_tropo);
+  tcase_add_test(tc_core, test_calc_pvt_raim);
+  suite_add_tcase(s, tc_core);
+
+  TCase *tc_kf = tcase_create("Kalman filter");
+  tcase_add_test(tc_kf, test_pvt_kf);
+  suite_add_tcase(s, tc_kf);
+
+  return s;
+}
@@ -8,10 +8,18 @@ Suite* coord_system_suite(void);
 Suite* rtcm3_suite(void);
 Suite* bits_suite(void);
 Suite* memory_pool_suite(void);
+Suite* hypothesis_store_suite(void);
+Suite* parallel_suite(void);
 Suite* sbp_suite(void);
 Suite* edc_suite(void);
 Suite* linear_algebra_suite(void);
+Suite* dd_cov_suite(void);
+Suite* lambda_suite(void);
 Suite* ambiguity_test_suite(void);
+Suite* pvt_suite(void);
+Suite* tropo_suite(void);
+Suite* gpstime_suite(void);
+Suite* baseline_qr_suite(void);
 
 #endif /* CHECK_SUITES_H */
 
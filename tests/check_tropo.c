@@ -0,0 +1,118 @@
+#include <math.h>
+
+#include <check.h>
+#include "check_utils.h"
+
+#include <tropo.h>
+#include <gpstime.h>
+#include <constants.h>
+
+START_TEST(test_tropo_model_zenith)
+{
+  tropo_model_t model;
+
+  /* Mid latitude, sea level. */
+  tropo_model_init(&model, 45*D2R, 0, 180);
+  fail_unless(model.zenith_dry > 2.25 && model.zenith_dry < 2.35,
+              "Zenith hydrostatic delay %g m", model.zenith_dry);
+  fail_unless(model.zenith_wet > 0.05 && model.zenith_wet < 0.3,
+              "Zenith wet delay %g m", model.zenith_wet);
+
+  /* Delays decrease with height. */
+  tropo_model_t high;
+  tropo_model_init(&high, 45*D2R, 2000, 180);
+  fail_unless(high.zenith_dry < 0.85 * model.zenith_dry);
+  fail_unless(high.zenith_wet < model.zenith_wet);
+
+  /* The tropics are wetter than the poles. */
+  tropo_model_t tropics, polar;
+  tropo_model_init(&tropics, 5*D2R, 0, 180);
+  tropo_model_init(&polar, -80*D2R, 0, 180);
+  fail_unless(tropics.zenith_wet > 2 * polar.zenith_wet);
+
+  /* Northern summer is wetter than northern winter. */
+  tropo_model_t winter;
+  tropo_model_init(&winter, 45*D2R, 0, 28);
+  fail_unless(model.zenith_wet > winter.zenith_wet);
+
+  /* Above the troposphere the delays stay finite. */
+  tropo_model_init(&high, 45*D2R, 1e6, 180);
+  fail_unless(isfinite(high.zenith_dry) && high.zenith_dry >= 0);
+  fail_unless(isfinite(high.zenith_wet) && high.zenith_wet >= 0);
+}
+END_TEST
+
+START_TEST(test_tropo_model_mapping)
+{
+  tropo_model_t model;
+  tropo_model_init(&model, 45*D2R, 0, 180);
+
+  /* Make the model reproduce the fixed zenith delays of tropo_correction()
+   * so the tabulated mapping functions can be compared directly. */
+  model.zenith_dry = 2.235486646978727;
+  model.zenith_wet = 0.122382715318184;
+
+  for (u32 i=0; i<=9000; i++) {
+    double el = i * 0.01 * D2R;
+    double err = fabs(tropo_model_correction(&model, el)
+                      - tropo_correction(el));
+    double max_err = el < 5*D2R ? 0.05 : 1e-3;
+    fail_unless(err < max_err, "Mapping error %g m at %g deg",
+                err, el * R2D);
+  }
+
+  fail_unless(tropo_model_correction(&model, -0.1) == 0);
+
+  double els[4] = {-0.1, 0.2, 0.7, M_PI_2};
+  double corr[4];
+  tropo_model_correction_array(&model, 4, els, corr);
+  for (u8 i=0; i<4; i++) {
+    fail_unless(corr[i] == tropo_model_correction(&model, els[i]));
+  }
+}
+END_TEST
+
+START_TEST(test_tropo_model_update)
+{
+  tropo_model_t model;
+  tropo_model_init(&model, 30*D2R, 100, 100);
+
+  fail_unless(tropo_model_update(&model, 30*D2R, 100.5, 100.5) == 0);
+  fail_unless(model.height == 100);
+  fail_unless(tropo_model_update(&model, 30*D2R, 150, 100) == 1);
+  fail_unless(model.height == 150);
+  fail_unless(tropo_model_update(&model, 31*D2R, 150, 100) == 1);
+  fail_unless(tropo_model_update(&model, 31*D2R, 150, 110) == 1);
+}
+END_TEST
+
+START_TEST(test_gps_day_of_year)
+{
+  /* GPS week 1773 started on Sunday 2013-12-29. */
+  gps_time_t t = {.wn = 1773, .tow = 3*24*3600};
+  fail_unless(within_epsilon(gps_day_of_year(t), 1.0));
+  t.tow += 12*3600;
+  fail_unless(within_epsilon(gps_day_of_year(t), 1.5));
+  t.tow = 2*24*3600;
+  fail_unless(within_epsilon(gps_day_of_year(t), 365.0));
+
+  /* 2012 was a leap year, GPS week 1682 started on Sunday 2012-04-01. */
+  t.wn = 1682;
+  t.tow = 0;
+  fail_unless(within_epsilon(gps_day_of_year(t), 92.0));
+}
+END_TEST
+
+Suite* tropo_suite(void)
+{
+  Suite *s = suite_create("Troposphere");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_tropo_model_zenith);
+  tcase_add_test(tc_core, test_tropo_model_mapping);
+  tcase_add_test(tc_core, test_tropo_model_update);
+  tcase_add_test(tc_core, test_gps_day_of_year);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}